@@ -0,0 +1,170 @@
+/* bot_shm.c - Many local players driven through the server's shared memory
+ *
+ * Attaches to a server started with --shm NAME, claims BOTS client slots
+ * and plays them all from one thread: each bot follows its room's state
+ * ring and moves its paddle toward the ball. With nothing new to read the
+ * thread sleeps on the region's futex until the server's next pass.
+ *
+ * Reports what the bots saw and the host cost per bot and pass.
+ */
+#include "../server/shm_link.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#define DEFAULT_BOTS    64
+#define DEFAULT_SECONDS 10
+#define KEEPALIVE_MS    1000   /* an unchanged input is repeated this often */
+#define WAIT_MS         100    /* longest sleep on the futex */
+
+typedef struct {
+    int      slot;       /* client slot, -1 = none */
+    uint32_t room;       /* room handle followed, 0 = none */
+    uint64_t cursor;     /* position in that room's ring */
+    uint8_t  input;      /* last input sent */
+    uint64_t sent_ms;
+} Bot;
+
+static uint64_t now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + (uint64_t)ts.tv_nsec / 1000000;
+}
+
+static double cpu_s(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Follow the ball with the bot's paddle */
+static uint8_t choose_input(const RoomView *v, unsigned player) {
+    const GameState *g = &v->game;
+    float paddle = player == 0 ? g->paddle_left_y : g->paddle_right_y;
+    float margin = g->paddle_h / 4;
+
+    if (g->ball_y < paddle - margin) return INPUT_UP;
+    if (g->ball_y > paddle + margin) return INPUT_DOWN;
+    return INPUT_NONE;
+}
+
+int main(int argc, char **argv) {
+    if (argc < 2 || argc > 4) {
+        fprintf(stderr, "Usage: %s NAME [BOTS] [SECONDS]\n", argv[0]);
+        return 1;
+    }
+    int nbots = argc > 2 ? atoi(argv[2]) : DEFAULT_BOTS;
+    int seconds = argc > 3 ? atoi(argv[3]) : DEFAULT_SECONDS;
+    if (nbots <= 0 || seconds <= 0) {
+        fprintf(stderr, "Usage: %s NAME [BOTS] [SECONDS]\n", argv[0]);
+        return 1;
+    }
+
+    ShmLink l;
+    if (shm_link_attach(&l, argv[1]) < 0) {
+        perror(argv[1]);
+        return 1;
+    }
+
+    Bot *bots = calloc((size_t)nbots, sizeof(Bot));
+    if (!bots) {
+        fprintf(stderr, "out of memory\n");
+        return 1;
+    }
+    int claimed = 0;
+    for (int i = 0; i < nbots; i++) {
+        bots[i].slot = shm_client_claim(&l, 0, 0);
+        claimed += bots[i].slot >= 0;
+    }
+    printf("%d bots on %s (%d slots claimed of %u)\n", nbots, argv[1], claimed,
+           l.hdr->max_clients);
+
+    unsigned long long states = 0, inputs = 0, full = 0;
+    uint64_t overruns = 0;
+    unsigned long long passes = 0, sleeps = 0, closed = 0;
+    double cpu0 = cpu_s();
+    uint64_t start = now_ms();
+    uint64_t end = start + (uint64_t)seconds * 1000;
+
+    for (uint64_t now = start; now < end; now = now_ms()) {
+        unsigned seen = shm_passes(&l);
+        int busy = 0;
+
+        for (int i = 0; i < nbots; i++) {
+            Bot *b = &bots[i];
+            if (b->slot < 0) continue;
+            ShmClient *c = &l.clients[b->slot];
+
+            unsigned state = atomic_load_explicit(&c->state, memory_order_acquire);
+            if (state == SHM_CLOSED) {
+                /* Dropped by the server: free the slot, join again */
+                closed++;
+                shm_client_leave(&l, (uint32_t)b->slot);
+                b->slot = shm_client_claim(&l, 0, 0);
+                b->room = 0;
+                continue;
+            }
+            if (state != SHM_ACTIVE) continue;
+
+            uint32_t room = atomic_load_explicit(&c->room, memory_order_relaxed);
+            if (room != b->room) {
+                b->room = room;
+                if (room) b->cursor = shm_room_head(&l, pool_handle_index(room));
+            }
+
+            uint8_t input = b->input;
+            if (room) {
+                RoomView v;
+                unsigned player = atomic_load_explicit(&c->player, memory_order_relaxed);
+                while (shm_state_next(&l, pool_handle_index(room), &b->cursor, &v, &overruns)) {
+                    states++;
+                    busy = 1;
+                    if (v.room == room) input = choose_input(&v, player);
+                }
+            }
+
+            /* Queued players send too: the server times out silent sessions */
+            if (input != b->input || now - b->sent_ms >= KEEPALIVE_MS) {
+                if (shm_client_input(&l, (uint32_t)b->slot, input)) {
+                    b->input = input;
+                    b->sent_ms = now;
+                    inputs++;
+                } else {
+                    full++;
+                }
+            }
+        }
+
+        passes++;
+        if (!busy) {
+            shm_wait(&l, seen, WAIT_MS);
+            sleeps++;
+        }
+    }
+
+    double cpu = cpu_s() - cpu0;
+    double elapsed = (double)(now_ms() - start) / 1000.0;
+
+    unsigned active = 0, matched = 0;
+    for (int i = 0; i < nbots; i++) {
+        if (bots[i].slot < 0) continue;
+        ShmClient *c = &l.clients[bots[i].slot];
+        if (atomic_load(&c->state) != SHM_ACTIVE) continue;
+        active++;
+        matched += atomic_load(&c->status) == SHM_MATCHED;
+    }
+    for (int i = 0; i < nbots; i++) {
+        if (bots[i].slot >= 0) shm_client_leave(&l, (uint32_t)bots[i].slot);
+    }
+
+    printf("active=%u matched=%u closed=%llu\n", active, matched, closed);
+    printf("states read=%llu (%.1f per bot and s) overruns=%llu\n", states,
+           (double)states / (double)nbots / elapsed, (unsigned long long)overruns);
+    printf("inputs sent=%llu ring_full=%llu\n", inputs, full);
+    printf("cpu %.2fs of %.2fs: %.0f ns per bot and pass (%llu passes, %llu sleeps)\n",
+           cpu, elapsed, passes ? cpu * 1e9 / (double)passes / nbots : 0.0, passes, sleeps);
+
+    free(bots);
+    shm_link_close(&l);
+    return 0;
+}
@@ -0,0 +1,281 @@
+/* bot_tcp.c - Many players over TCP from one process (load test)
+ *
+ * Opens BOTS connections to server_tcp (or server_udp --tcp) and plays them
+ * all from one epoll loop: each bot waits for its HELLO, then moves its
+ * paddle toward the ball of every state it reads, sending an input only
+ * when its direction changes. Connections are opened a batch at a time so
+ * the server's accept backlog is not overrun.
+ *
+ * Reports how many connections were made and matched, what they read, and
+ * how many the server closed.
+ */
+#include <arpa/inet.h>
+#include <errno.h>
+#include <netinet/in.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#define DEFAULT_BOTS    1000
+#define DEFAULT_SECONDS 10
+#define CONNECT_BATCH   256    /* connections opened per loop pass */
+#define EPOLL_BATCH     256
+#define RX_BUF_SIZE     256    /* longest message read: header and body */
+
+/* Wire format, as in server_tcp.c */
+enum { MSG_HELLO = 1, MSG_INPUT = 2, MSG_STATE = 3 };
+
+typedef struct __attribute__((packed)) {
+    uint8_t type;
+    uint8_t player_id;
+    uint8_t dir;        // 0 none, 1 up, 2 down
+    uint8_t _pad;
+} MsgInput;
+
+/* Every server message: this header, then `size` bytes */
+typedef struct __attribute__((packed)) {
+    uint8_t type;
+    uint8_t player_id;  // MSG_HELLO only
+    uint16_t size;      // network order
+} MsgHeader;
+
+typedef struct __attribute__((packed)) {
+    uint16_t tick;
+    int16_t ball_x;
+    int16_t ball_y;
+    int16_t paddle_left_y;
+    int16_t paddle_right_y;
+    uint16_t score_left;
+    uint16_t score_right;
+    uint16_t field_w;
+    uint16_t field_h;
+    uint16_t paddle_h;
+    uint16_t ball_size;
+} NetState;
+
+typedef enum {
+    BOT_CONNECTING = 0,
+    BOT_WAITING    = 1,   /* connected, no HELLO yet */
+    BOT_PLAYING    = 2,
+    BOT_CLOSED     = 3
+} BotState;
+
+typedef struct {
+    int      fd;
+    uint8_t  state;       /* BotState */
+    uint8_t  player;      /* 1 or 2 */
+    uint8_t  dir;         /* last direction sent */
+    uint16_t rx_len;
+    uint8_t  rx[RX_BUF_SIZE];
+} Bot;
+
+static struct {
+    unsigned long long connected, failed, matched, closed;
+    unsigned long long states, inputs, bytes;
+} stats;
+
+static uint64_t now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + (uint64_t)ts.tv_nsec / 1000000;
+}
+
+static double cpu_s(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void bot_close(Bot *b, int by_server) {
+    if (b->fd >= 0) close(b->fd);
+    b->fd = -1;
+    if (b->state == BOT_CONNECTING) stats.failed++;
+    else if (by_server) stats.closed++;
+    b->state = BOT_CLOSED;
+}
+
+/* Follow the ball with the bot's paddle */
+static uint8_t choose_dir(const Bot *b, const NetState *st) {
+    int paddle = (int16_t)ntohs(b->player == 1 ? st->paddle_left_y : st->paddle_right_y);
+    int ball = (int16_t)ntohs(st->ball_y);
+    int margin = ntohs(st->paddle_h) / 4;
+
+    if (ball < paddle - margin) return 1;
+    if (ball > paddle + margin) return 2;
+    return 0;
+}
+
+static void handle_message(Bot *b, const MsgHeader *h, const uint8_t *body, size_t size) {
+    if (h->type == MSG_HELLO) {
+        b->state = BOT_PLAYING;
+        b->player = h->player_id;
+        stats.matched++;
+        return;
+    }
+    if (h->type != MSG_STATE || b->state != BOT_PLAYING || size < sizeof(NetState)) return;
+
+    NetState st;
+    memcpy(&st, body, sizeof(st));
+    stats.states++;
+
+    uint8_t dir = choose_dir(b, &st);
+    if (dir == b->dir) return;
+
+    MsgInput in;
+    memset(&in, 0, sizeof(in));
+    in.type = MSG_INPUT;
+    in.player_id = b->player;
+    in.dir = dir;
+    /* Four bytes into an almost empty socket buffer: a short write would
+       mean the server stopped reading, so it is left at that */
+    if (send(b->fd, &in, sizeof(in), MSG_NOSIGNAL | MSG_DONTWAIT) == (ssize_t)sizeof(in)) {
+        b->dir = dir;
+        stats.inputs++;
+    }
+}
+
+/* Read what is there and handle every complete message. Returns -1 if the
+   connection is gone. */
+static int bot_read(Bot *b) {
+    ssize_t n = recv(b->fd, b->rx + b->rx_len, sizeof(b->rx) - b->rx_len, MSG_DONTWAIT);
+    if (n == 0) return -1;
+    if (n < 0) return (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) ? 0 : -1;
+    stats.bytes += (unsigned long long)n;
+    b->rx_len = (uint16_t)(b->rx_len + n);
+
+    size_t pos = 0;
+    while (b->rx_len - pos >= sizeof(MsgHeader)) {
+        MsgHeader h;
+        memcpy(&h, b->rx + pos, sizeof(h));
+        size_t size = ntohs(h.size);
+        if (sizeof(h) + size > sizeof(b->rx)) return -1;  /* not this protocol */
+        if (b->rx_len - pos < sizeof(h) + size) break;
+
+        handle_message(b, &h, b->rx + pos + sizeof(h), size);
+        pos += sizeof(h) + size;
+    }
+    memmove(b->rx, b->rx + pos, b->rx_len - pos);
+    b->rx_len = (uint16_t)(b->rx_len - pos);
+    return 0;
+}
+
+static int bot_connect(Bot *b, int epfd, uint32_t index, const struct sockaddr_in *addr) {
+    b->fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    if (b->fd < 0) return -1;
+    if (connect(b->fd, (const struct sockaddr *)addr, sizeof(*addr)) < 0 &&
+        errno != EINPROGRESS) {
+        return -1;
+    }
+
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLOUT;  /* writable once connected */
+    ev.data.u32 = index;
+    return epoll_ctl(epfd, EPOLL_CTL_ADD, b->fd, &ev);
+}
+
+int main(int argc, char **argv) {
+    if (argc < 3 || argc > 5) {
+        fprintf(stderr, "Usage: %s <server_ip> <port> [BOTS] [SECONDS]\n", argv[0]);
+        return 1;
+    }
+    int nbots = argc > 3 ? atoi(argv[3]) : DEFAULT_BOTS;
+    int seconds = argc > 4 ? atoi(argv[4]) : DEFAULT_SECONDS;
+    if (nbots <= 0 || seconds <= 0) {
+        fprintf(stderr, "Usage: %s <server_ip> <port> [BOTS] [SECONDS]\n", argv[0]);
+        return 1;
+    }
+
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons((uint16_t)atoi(argv[2]));
+    if (inet_pton(AF_INET, argv[1], &addr.sin_addr) != 1) {
+        fprintf(stderr, "Invalid IP\n");
+        return 1;
+    }
+
+    /* One descriptor per bot */
+    struct rlimit rl;
+    if (getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur < (rlim_t)nbots + 16) {
+        rl.rlim_cur = rl.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &rl);
+    }
+
+    Bot *bots = calloc((size_t)nbots, sizeof(Bot));
+    int epfd = epoll_create1(0);
+    if (!bots || epfd < 0) {
+        fprintf(stderr, "out of memory\n");
+        return 1;
+    }
+
+    int opened = 0;
+    double cpu0 = cpu_s();
+    uint64_t start = now_ms();
+    uint64_t end = start + (uint64_t)seconds * 1000;
+    struct epoll_event events[EPOLL_BATCH];
+
+    for (uint64_t now = start; now < end; now = now_ms()) {
+        for (int k = 0; k < CONNECT_BATCH && opened < nbots; k++, opened++) {
+            Bot *b = &bots[opened];
+            if (bot_connect(b, epfd, (uint32_t)opened, &addr) < 0) bot_close(b, 0);
+        }
+
+        int n = epoll_wait(epfd, events, EPOLL_BATCH, 100);
+        for (int i = 0; i < n; i++) {
+            Bot *b = &bots[events[i].data.u32];
+            if (b->state == BOT_CLOSED) continue;
+
+            if (b->state == BOT_CONNECTING) {
+                int err = 0;
+                socklen_t len = sizeof(err);
+                getsockopt(b->fd, SOL_SOCKET, SO_ERROR, &err, &len);
+                if (err != 0 || (events[i].events & (EPOLLERR | EPOLLHUP))) {
+                    bot_close(b, 0);
+                    continue;
+                }
+                b->state = BOT_WAITING;
+                stats.connected++;
+
+                struct epoll_event ev;
+                memset(&ev, 0, sizeof(ev));
+                ev.events = EPOLLIN | EPOLLRDHUP;
+                ev.data.u32 = events[i].data.u32;
+                epoll_ctl(epfd, EPOLL_CTL_MOD, b->fd, &ev);
+                continue;
+            }
+
+            if (bot_read(b) < 0 || (events[i].events & (EPOLLERR | EPOLLHUP))) {
+                bot_close(b, 1);
+            }
+        }
+    }
+
+    double cpu = cpu_s() - cpu0;
+    double elapsed = (double)(now_ms() - start) / 1000.0;
+
+    unsigned waiting = 0, playing = 0;
+    for (int i = 0; i < opened; i++) {
+        waiting += bots[i].state == BOT_WAITING;
+        playing += bots[i].state == BOT_PLAYING;
+        if (bots[i].fd >= 0) close(bots[i].fd);
+    }
+
+    printf("%d bots: connected=%llu failed=%llu matched=%llu closed by server=%llu\n",
+           nbots, stats.connected, stats.failed, stats.matched, stats.closed);
+    printf("at the end: playing=%u waiting=%u\n", playing, waiting);
+    printf("states read=%llu (%.1f per player and s, %.0f KB/s) inputs sent=%llu\n",
+           stats.states, playing ? (double)stats.states / playing / elapsed : 0.0,
+           (double)stats.bytes / 1024.0 / elapsed, stats.inputs);
+    printf("cpu %.2fs of %.2fs\n", cpu, elapsed);
+
+    free(bots);
+    close(epfd);
+    return 0;
+}
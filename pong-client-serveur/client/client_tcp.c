@@ -25,10 +25,28 @@ typedef struct __attribute__((packed)) {
     uint8_t _pad;
 } MsgInput;
 
+/* Ruleset of the match, sent with HELLO (network order, lengths and
+   speeds * 100) */
+typedef struct __attribute__((packed)) {
+    uint16_t tick_hz;
+    uint16_t serve_pause_ticks;
+    uint16_t field_w;
+    uint16_t field_h;
+    uint16_t paddle_h;
+    uint16_t paddle_w;
+    uint16_t paddle_margin;
+    uint16_t paddle_speed;
+    uint16_t ball_size;
+    uint16_t ball_speed_base;
+    uint16_t ball_speed_max;
+    uint16_t ball_speed_gain;
+    uint16_t min_vy_abs;
+} NetRules;
+
 typedef struct __attribute__((packed)) {
     uint8_t type;
     uint8_t player_id;  // 1 or 2
-    uint16_t _pad;
+    uint16_t size;      // sizeof(NetRules) on the server: the rules follow
 } MsgHello;
 
 typedef struct __attribute__((packed)) {
@@ -187,12 +205,7 @@ static void draw_state(const NetState *ns) {
 
 /* ================= Prediction params ================= */
 
-// MUST match server tick and paddle speed (from game.c)
-#define TICK_HZ 60
-#define DT (1.0f / (float)TICK_HZ)
-
-// If you changed g->paddle_speed in game.c, update this too
-#define PADDLE_SPEED 55.0f
+// Tick rate and paddle speed come from the server's rules (HELLO)
 
 // If no key repeat arrives after this time, consider key released -> stop
 #define RELEASE_TIMEOUT_S 0.12
@@ -247,8 +260,29 @@ int main(int argc, char **argv) {
         return 1;
     }
 
+    /* The rules follow; a newer server may send more than we know */
+    NetRules rules;
+    memset(&rules, 0, sizeof(rules));
+    size_t rules_size = ntohs(hello.size);
+    size_t known = rules_size < sizeof(rules) ? rules_size : sizeof(rules);
+    uint8_t skip[64];
+    int ok = recv_all(fd, &rules, known) > 0;
+    for (size_t left = rules_size - known; ok && left > 0; ) {
+        size_t n = left < sizeof(skip) ? left : sizeof(skip);
+        ok = recv_all(fd, skip, n) > 0;
+        left -= n;
+    }
+    unsigned tick_hz = ntohs(rules.tick_hz);
+    if (!ok || tick_hz == 0) {
+        fprintf(stderr, "Failed to receive the rules\n");
+        close(fd);
+        return 1;
+    }
+    const float dt = 1.0f / (float)tick_hz;
+    const float paddle_speed = u16_to_f(rules.paddle_speed);
+
     uint8_t my_id = hello.player_id;
-    printf("Connected as player %d (%s)\n", my_id, (my_id == 1) ? "LEFT" : "RIGHT");
+    printf("Connected as player %d (%s), %u Hz\n", my_id, (my_id == 1) ? "LEFT" : "RIGHT", tick_hz);
     printf("Controls: W=UP, S=DOWN, Q=quit\n");
     usleep(600000);
 
@@ -310,8 +344,8 @@ int main(int argc, char **argv) {
         }
 
         /* ---- Prediction (move immediately) ---- */
-        if (dir_state == 1) predicted_y -= PADDLE_SPEED * DT;
-        else if (dir_state == 2) predicted_y += PADDLE_SPEED * DT;
+        if (dir_state == 1) predicted_y -= paddle_speed * dt;
+        else if (dir_state == 2) predicted_y += paddle_speed * dt;
 
         /* clamp prediction inside field */
         float fh = u16_to_f(st.st.field_h);
@@ -346,7 +380,7 @@ int main(int argc, char **argv) {
 
         draw_state(&st.st);
 
-        usleep(1000000 / TICK_HZ);
+        usleep(1000000 / tick_hz);
     }
 
     close(fd);
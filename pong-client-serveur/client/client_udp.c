@@ -1,5 +1,8 @@
 /* client_udp.c - Pong UDP Client with ASCII rendering */
+#include "../server/frame.h"
 #include "../server/game.h"
+#include "../server/reliable.h"
+#include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -16,31 +19,115 @@
 #define SERVER_PORT 12345
 #define BUFFER_SIZE 1024
 #define KEEPALIVE_INTERVAL_MS 1000
+#define LEAVE_TIMEOUT_MS 1000      /* how long quitting waits for the leave to be acked */
 #define RENDER_WIDTH 80
 #define RENDER_HEIGHT 24
+#define LOCKSTEP_PREDICT_MAX 8     /* ticks shown ahead of the confirmed game */
+#define LOCKSTEP_RESYNC_MS 200     /* between two keyframe requests */
 
 /* Protocol message types */
 typedef enum {
     MSG_CLIENT_CONNECT = 1,
-    MSG_CLIENT_INPUT = 2,
-    MSG_SERVER_STATE = 3,
-    MSG_CLIENT_DISCONNECT = 4
+    MSG_CLIENT_JOIN_QUEUE = 5,
+    MSG_SERVER_JOINED = 6,
+    MSG_SERVER_COOKIE = 7,
+    MSG_FRAME = 10
 } MessageType;
 
-/* Message structures */
+/* Chunk types inside a MSG_FRAME */
+enum {
+    CHUNK_INPUT = 1,
+    CHUNK_ACK = 2,
+    CHUNK_RELIABLE = 3,
+    CHUNK_STATE = 4,
+    CHUNK_PING = 5,
+    CHUNK_PONG = 6,
+    CHUNK_DISCONNECT = 7,
+    CHUNK_INPUTS = 8,
+    CHUNK_KEYFRAME = 9,
+    CHUNK_RESYNC = 10
+};
+
+/* Reliable message kinds (RelChunk.kind) */
+enum {
+    REL_EV_MATCHED = 1,
+    REL_EV_OPPONENT_LEFT = 2,
+    REL_EV_POINT = 3,
+    REL_EV_REKEY = 4,
+    REL_CTL_LEAVE = 16
+};
+
+/* MSG_SERVER_JOINED status */
+enum { JOIN_QUEUED = 0, JOIN_MATCHED = 1 };
+
+/* JoinQueueMsg.flags / JoinedMsg.flags */
+enum { JOIN_LOCKSTEP = 1 };
+
+/* Message structures. Cookie and token are opaque: echoed back as received.
+   The session key that comes with the token MACs every frame, both ways. */
+typedef struct {
+    uint8_t input;
+    uint32_t seen_tick;   /* tick of the state on screen: the server checks
+                             close misses against the paddle we saw there */
+} __attribute__((packed)) InputChunk;
+
+typedef struct {
+    uint32_t stamp;
+} __attribute__((packed)) PingChunk;
+
+typedef struct {
+    uint32_t stamp;
+    uint16_t hold_ms;   /* time the server kept the pong back */
+} __attribute__((packed)) PongChunk;
+
+typedef struct {
+    uint8_t slot;
+    uint8_t _pad[3];
+    uint32_t room_id;
+} __attribute__((packed)) MatchedEvent;
+
+typedef struct {
+    uint16_t score_left;
+    uint16_t score_right;
+} __attribute__((packed)) PointEvent;
+
+/* The match moved to another server: our session there. It comes in a
+   frame under the current key, so nobody else can hand us one. */
+typedef struct {
+    uint64_t token;
+    uint8_t key[FRAME_KEY_SIZE];
+    uint32_t room_id;
+    uint8_t flags;      /* JOIN_LOCKSTEP */
+} __attribute__((packed)) RekeyEvent;
+
 typedef struct {
     uint8_t type;
-    uint8_t player_id;
-} __attribute__((packed)) ConnectMsg;
+    uint8_t region;
+    uint8_t rtt_bucket;
+    uint8_t flags;      /* JOIN_LOCKSTEP: we can replay inputs */
+    uint64_t cookie;
+} __attribute__((packed)) JoinQueueMsg;
 
 typedef struct {
     uint8_t type;
-    uint8_t player_id;
-    uint8_t input;
-} __attribute__((packed)) InputMsg;
+    uint8_t _pad[3];
+    uint64_t cookie;
+} __attribute__((packed)) CookieMsg;
 
 typedef struct {
     uint8_t type;
+    uint8_t status;
+    uint8_t player_id;
+    uint8_t flags;      /* JOIN_LOCKSTEP: inputs and keyframes instead of states */
+    uint32_t room_id;
+    uint64_t token;
+    uint8_t key[FRAME_KEY_SIZE];
+    GameRules rules;    /* of our room once matched (older servers stop before it) */
+} __attribute__((packed)) JoinedMsg;
+
+#define JOINED_MIN_SIZE offsetof(JoinedMsg, rules)
+
+typedef struct {
     float ball_x;
     float ball_y;
     float paddle_left_y;
@@ -50,17 +137,57 @@ typedef struct {
     uint32_t tick;
     uint8_t player0_connected;
     uint8_t player1_connected;
-} __attribute__((packed)) StateMsg;
+} __attribute__((packed)) StateChunk;
+
+/* Lockstep: both players' steps up to a tick (each batch repeats the one
+   before) and the server's checksum there */
+typedef struct {
+    uint32_t tick;
+    uint32_t checksum;
+    uint8_t count;
+    uint8_t steps[];    /* oldest first: left | right << 2 | (stride - 1) << 4 */
+} __attribute__((packed)) InputsChunk;
+
+typedef struct {
+    GameState game;
+    uint8_t player0_connected;
+    uint8_t player1_connected;
+} __attribute__((packed)) KeyframeChunk;
 
 /* Client state */
 typedef struct {
     int sockfd;
     struct sockaddr_in server_addr;
-    int player_id;
+    int player_id;          /* assigned by the server when matched */
+    int region;             /* matchmaking region tag */
     PlayerInput current_input;
-    StateMsg last_state;
+    StateChunk last_state;
     int connected;
+    int matched;
+    uint32_t room_id;
+    uint64_t cookie;        /* handshake cookie, 0 until the server sent one */
+    uint64_t token;         /* session token, 0 until joined */
+    uint8_t key[FRAME_KEY_SIZE];  /* session key, from the same JOINED */
+    uint64_t prev_token;    /* before a rekey: the server frames with it (and
+                               prev_key) until it hears the new one; 0 = none */
+    uint8_t prev_key[FRAME_KEY_SIZE];
+    GameRules rules;        /* field, paddles, ball: what we draw from */
+    uint32_t rules_room;    /* room the rules came with, UINT32_MAX = server defaults */
+    FrameReplay rx_replay;  /* server frame seqs taken under this token */
     uint64_t last_keepalive_ms;
+    uint32_t rtt_ms;        /* from the last pong */
+    RelChannel rel;         /* reliable control messages with the server */
+    FrameWriter out;        /* chunks for the next datagram to the server */
+    char event[64];         /* last reliable event, shown under the score */
+
+    /* Lockstep: the game as far as the server's inputs confirm it */
+    int lockstep;
+    int have_confirmed;     /* 0 until a keyframe, and after losing track */
+    GameState confirmed;
+    uint64_t confirmed_ms;  /* when it last moved on */
+    uint8_t last_step;      /* newest step: the next ones are predicted alike */
+    uint64_t resync_ms;     /* last keyframe request */
+    unsigned resyncs;
 } ClientState;
 
 /* Terminal settings for raw input */
@@ -113,36 +240,163 @@ static void configure_terminal(void) {
     fcntl(STDIN_FILENO, F_SETFL, flags | O_NONBLOCK);
 }
 
-/* Send connect message */
-static void send_connect(ClientState *client) {
-    ConnectMsg msg;
-    msg.type = MSG_CLIENT_CONNECT;
-    msg.player_id = client->player_id;
+/* Send join-queue message (also repeated until we are matched) */
+static void send_join(ClientState *client) {
+    JoinQueueMsg msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.type = MSG_CLIENT_JOIN_QUEUE;
+    msg.region = (uint8_t)client->region;
+    msg.rtt_bucket = 0;
+    msg.flags = JOIN_LOCKSTEP;
+    msg.cookie = client->cookie;
     
     sendto(client->sockfd, &msg, sizeof(msg), 0,
            (struct sockaddr *)&client->server_addr,
            sizeof(client->server_addr));
 }
 
-/* Send input message */
-static void send_input(ClientState *client) {
-    InputMsg msg;
-    msg.type = MSG_CLIENT_INPUT;
-    msg.player_id = client->player_id;
-    msg.input = client->current_input;
-    
-    sendto(client->sockfd, &msg, sizeof(msg), 0,
+/* Close the pending frame and send it */
+static void send_frame(ClientState *client) {
+    uint16_t len = frame_finish(&client->out, client->key);
+    if (len == 0) return;
+
+    sendto(client->sockfd, client->out.buf, len, 0,
            (struct sockaddr *)&client->server_addr,
            sizeof(client->server_addr));
 }
 
-/* Send disconnect message */
-static void send_disconnect(ClientState *client) {
-    uint8_t msg = MSG_CLIENT_DISCONNECT;
-    
-    sendto(client->sockfd, &msg, sizeof(msg), 0,
-           (struct sockaddr *)&client->server_addr,
-           sizeof(client->server_addr));
+/* Append a chunk to the next datagram (needs a token: frames carry it) */
+static void queue_chunk(ClientState *client, uint8_t type, const void *data, uint8_t len) {
+    if (client->token == 0) return;
+
+    if (frame_add(&client->out, MSG_FRAME, client->token, type, data, len) < 0) {
+        send_frame(client);  /* full: send what we have */
+        frame_add(&client->out, MSG_FRAME, client->token, type, data, len);
+    }
+}
+
+/* Send everything queued since the last call as one datagram, with the ack
+   block (alone if it is all we owe) */
+static void flush_frame(ClientState *client) {
+    if (client->rel.received_any &&
+        (frame_pending(&client->out) || client->rel.ack_pending)) {
+        RelAck ack;
+        rel_take_ack(&client->rel, &ack);
+        queue_chunk(client, CHUNK_ACK, &ack, sizeof(ack));
+    }
+    send_frame(client);
+}
+
+/* Queue the current input */
+static void send_input(ClientState *client) {
+    InputChunk msg;
+    msg.input = client->current_input;
+    msg.seen_tick = client->connected ? client->last_state.tick : 0;
+    queue_chunk(client, CHUNK_INPUT, &msg, sizeof(msg));
+}
+
+/* Queue a ping; the server echoes it in a pong */
+static void send_ping(ClientState *client, uint64_t now) {
+    PingChunk msg;
+    msg.stamp = (uint32_t)now;
+    queue_chunk(client, CHUNK_PING, &msg, sizeof(msg));
+}
+
+/* Lockstep: we lost track of the game, ask for a keyframe (not too often:
+   the answer is on its way) */
+static void request_keyframe(ClientState *client, uint64_t now) {
+    if (client->resync_ms && now - client->resync_ms < LOCKSTEP_RESYNC_MS) return;
+    client->resync_ms = now;
+    client->resyncs++;
+    queue_chunk(client, CHUNK_RESYNC, NULL, 0);
+}
+
+/* Replay one step as the server ran it */
+static void lockstep_apply(GameState *g, uint8_t step) {
+    float dt = g->dt;
+    g->dt = dt * (float)((step >> 4) + 1);
+    game_step(g, (PlayerInput)(step & 3), (PlayerInput)((step >> 2) & 3));
+    g->dt = dt;
+}
+
+/* Apply the steps of a batch we do not have yet. A gap, or a state that
+   no longer checksums like the server's, means a keyframe is needed. */
+static void lockstep_follow(ClientState *client, const InputsChunk *b,
+                            const uint8_t *steps, uint64_t now) {
+    GameState *g = &client->confirmed;
+    if (!client->have_confirmed) {
+        request_keyframe(client, now);
+        return;
+    }
+    if ((int32_t)(b->tick - g->tick) <= 0) return;  /* nothing new (late or repeated) */
+
+    uint32_t first = b->tick - b->count + 1;
+    if ((int32_t)(first - g->tick) > 1) {
+        request_keyframe(client, now);
+        return;
+    }
+    while (g->tick != b->tick) lockstep_apply(g, steps[g->tick + 1 - first]);
+    client->last_step = steps[b->count - 1];
+    client->confirmed_ms = now;
+
+    if (game_checksum(g) != b->checksum) request_keyframe(client, now);
+}
+
+/* What to draw: the confirmed game run ahead by the time since, with the
+   newest steps (our own input as we press it) */
+static void lockstep_show(ClientState *client, uint64_t now) {
+    GameState g = client->confirmed;
+    uint64_t ahead = (now - client->confirmed_ms) * client->rules.tick_hz / 1000;
+    if (ahead > LOCKSTEP_PREDICT_MAX) ahead = LOCKSTEP_PREDICT_MAX;
+
+    uint8_t step = client->last_step & 0x0F;
+    int shift = client->player_id ? 2 : 0;
+    step = (uint8_t)((step & ~(3 << shift)) | (client->current_input << shift));
+    for (uint64_t i = 0; i < ahead; i++) lockstep_apply(&g, step);
+
+    StateChunk *st = &client->last_state;
+    st->ball_x = g.ball_x;
+    st->ball_y = g.ball_y;
+    st->paddle_left_y = g.paddle_left_y;
+    st->paddle_right_y = g.paddle_right_y;
+    st->score_left = g.score_left;
+    st->score_right = g.score_right;
+    st->tick = g.tick;
+}
+
+/* Queue what the reliable channel owes: due (re)transmissions */
+static void service_reliable(ClientState *client, uint64_t now) {
+    RelSlot *due[REL_WINDOW];
+    int n = rel_poll(&client->rel, now, due, REL_WINDOW);
+
+    for (int i = 0; i < n; i++) {
+        RelChunk msg;
+        msg.kind = due[i]->kind;
+        msg.seq = htons(due[i]->seq);
+        memcpy(msg.data, due[i]->data, due[i]->len);
+        queue_chunk(client, CHUNK_RELIABLE, &msg, (uint8_t)(REL_CHUNK_HEADER + due[i]->len));
+    }
+}
+
+static int handle_datagram(ClientState *client, uint8_t *buffer, int recv_len, uint64_t now);
+
+/* Leave reliably: queue the leave and wait (bounded) for its ack */
+static void send_leave(ClientState *client) {
+    if (client->token == 0) return;  /* never joined: nothing to release */
+
+    rel_queue(&client->rel, REL_CTL_LEAVE, NULL, 0);
+
+    uint8_t buffer[BUFFER_SIZE];
+    uint64_t start = get_time_ms();
+    while (client->rel.base != client->rel.next_seq &&
+           get_time_ms() - start < LEAVE_TIMEOUT_MS) {
+        service_reliable(client, get_time_ms());
+        flush_frame(client);
+
+        /* Any frame from the server may carry the ack */
+        int len = recv(client->sockfd, buffer, BUFFER_SIZE, 0);
+        if (len > 0) handle_datagram(client, buffer, len, get_time_ms());
+    }
 }
 
 /* Read keyboard input (non-blocking) */
@@ -193,16 +447,17 @@ static void render_state(ClientState *client) {
         screen[y][RENDER_WIDTH] = '\0';
     }
     
-    StateMsg *state = &client->last_state;
+    StateChunk *state = &client->last_state;
     
-    /* Assume field dimensions from game.c defaults */
-    float field_w = 100.0f;
-    float field_h = 60.0f;
-    float paddle_h = 14.0f;
+    /* Dimensions from the rules the server sent */
+    float field_w = client->rules.field_w;
+    float field_h = client->rules.field_h;
+    float paddle_h = client->rules.paddle_h;
+    float margin = client->rules.paddle_margin;
     
     /* Draw left paddle */
     int px, py;
-    map_to_screen(3.5f, state->paddle_left_y, field_w, field_h, &px, &py);
+    map_to_screen(margin, state->paddle_left_y, field_w, field_h, &px, &py);
     int paddle_screen_h = (int)((paddle_h / field_h) * (RENDER_HEIGHT - 2));
     if (paddle_screen_h < 3) paddle_screen_h = 3;
     
@@ -214,7 +469,7 @@ static void render_state(ClientState *client) {
     }
     
     /* Draw right paddle */
-    map_to_screen(field_w - 3.5f, state->paddle_right_y, field_w, field_h, &px, &py);
+    map_to_screen(field_w - margin, state->paddle_right_y, field_w, field_h, &px, &py);
     for (int i = -paddle_screen_h/2; i <= paddle_screen_h/2; i++) {
         int draw_y = py + i;
         if (draw_y > 0 && draw_y < RENDER_HEIGHT - 1) {
@@ -232,8 +487,12 @@ static void render_state(ClientState *client) {
     /* Clear screen and render */
     printf("\033[2J\033[H"); /* ANSI: clear screen and move cursor to top-left */
     
-    printf("PONG - Player %d\n", client->player_id + 1);
-    printf("Score: %d - %d\n", state->score_left, state->score_right);
+    printf("PONG - Player %d (room %u, %u Hz)\n", client->player_id + 1, client->room_id,
+           client->rules.tick_hz);
+    printf("Score: %d - %d   rtt %u ms   %s", state->score_left, state->score_right,
+           client->rtt_ms, client->event);
+    if (client->lockstep) printf("   [lockstep, %u resyncs]", client->resyncs);
+    printf("\n");
     
     /* Show connection status */
     if (!state->player0_connected || !state->player1_connected) {
@@ -260,12 +519,25 @@ static void render_state(ClientState *client) {
     fflush(stdout);
 }
 
+/* Render the lobby screen while waiting for an opponent */
+static void render_waiting(ClientState *client) {
+    printf("\033[2J\033[H");
+    printf("PONG - Region %d\n\n", client->region);
+    printf("Waiting for an opponent...\n");
+    printf("\nControls: Q to quit\n");
+    fflush(stdout);
+}
+
 /* Initialize client */
-static int client_init(ClientState *client, const char *server_ip, int player_id) {
+static int client_init(ClientState *client, const char *server_ip, int region) {
     memset(client, 0, sizeof(ClientState));
-    client->player_id = player_id;
+    client->region = region;
     client->current_input = INPUT_NONE;
     client->connected = 0;
+    game_rules_default(&client->rules, GAME_TICK_HZ);  /* until the server says otherwise */
+    client->rules_room = UINT32_MAX;
+    rel_init(&client->rel);
+    frame_writer_init(&client->out);
     
     /* Create UDP socket */
     client->sockfd = socket(AF_INET, SOCK_DGRAM, 0);
@@ -290,40 +562,223 @@ static int client_init(ClientState *client, const char *server_ip, int player_id
         close(client->sockfd);
         return -1;
     }
+
+    /* The kernel drops datagrams from anyone but the server (or router) */
+    if (connect(client->sockfd, (struct sockaddr *)&client->server_addr,
+                sizeof(client->server_addr)) < 0) {
+        perror("connect failed");
+        close(client->sockfd);
+        return -1;
+    }
     
     return 0;
 }
 
+/* Deliver the server's reliable events in order */
+static void handle_events(ClientState *client) {
+    RelSlot m;
+    while (rel_deliver(&client->rel, &m)) {
+        switch (m.kind) {
+            case REL_EV_MATCHED: {
+                MatchedEvent ev;
+                memcpy(&ev, m.data, sizeof(ev));
+                client->matched = 1;
+                client->player_id = ev.slot;
+                client->room_id = ntohl(ev.room_id);
+                snprintf(client->event, sizeof(client->event), "[opponent found]");
+                /* Its JOINED (and the room's rules) may have been lost: ask again */
+                if (client->rules_room != client->room_id) send_join(client);
+                break;
+            }
+            case REL_EV_OPPONENT_LEFT:
+                snprintf(client->event, sizeof(client->event), "[opponent left]");
+                break;
+            case REL_EV_POINT: {
+                PointEvent ev;
+                memcpy(&ev, m.data, sizeof(ev));
+                snprintf(client->event, sizeof(client->event), "[point! %u - %u]",
+                         ntohs(ev.score_left), ntohs(ev.score_right));
+                break;
+            }
+            case REL_EV_REKEY: {
+                RekeyEvent ev;
+                memcpy(&ev, m.data, sizeof(ev));
+                /* What is queued goes under the old token; the rest under the new */
+                send_frame(client);
+                client->prev_token = client->token;
+                memcpy(client->prev_key, client->key, sizeof(client->key));
+                client->token = ev.token;
+                memcpy(client->key, ev.key, sizeof(client->key));
+                /* Same game and rules, and the frame seqs carry on */
+                client->room_id = ntohl(ev.room_id);
+                client->rules_room = client->room_id;
+                client->lockstep = (ev.flags & JOIN_LOCKSTEP) != 0;
+                client->have_confirmed = 0;  /* lockstep: resync with the new server */
+                snprintf(client->event, sizeof(client->event), "[moved to another server]");
+                break;
+            }
+        }
+    }
+}
+
+/* Handle the chunks of one frame. Returns 1 if it carried a snapshot. */
+static int handle_frame(ClientState *client, const uint8_t *buffer, int recv_len, uint64_t now) {
+    FrameReader fr;
+    FrameHeader hdr;
+    if (frame_open(&fr, buffer, recv_len, MSG_FRAME, &hdr) < 0) return 0;
+
+    /* Only frames of our session, authentic and not seen before. After a
+       rekey, the old token until the server uses the new one. */
+    const uint8_t *key = NULL;
+    if (client->token != 0 && hdr.conn_id == client->token) {
+        key = client->key;
+    } else if (client->prev_token != 0 && hdr.conn_id == client->prev_token) {
+        key = client->prev_key;
+    }
+    if (!key || !frame_verify(key, buffer, recv_len) ||
+        !frame_replay_accept(&client->rx_replay, hdr.seq)) {
+        return 0;
+    }
+    if (key == client->key) client->prev_token = 0;
+
+    int state_updated = 0;
+    uint8_t type, len;
+    const uint8_t *data;
+    while (frame_next(&fr, &type, &data, &len) == 1) {
+        switch (type) {
+            case CHUNK_STATE:
+                if (len < sizeof(StateChunk)) break;
+                memcpy(&client->last_state, data, sizeof(StateChunk));
+                client->connected = 1;
+                state_updated = 1;
+                break;
+
+            case CHUNK_KEYFRAME: {
+                if (len < sizeof(KeyframeChunk)) break;
+                KeyframeChunk kf;
+                memcpy(&kf, data, sizeof(kf));
+                client->confirmed = kf.game;
+                client->confirmed_ms = now;
+                client->last_step = 0;
+                client->have_confirmed = 1;
+                client->last_state.player0_connected = kf.player0_connected;
+                client->last_state.player1_connected = kf.player1_connected;
+                client->connected = 1;
+                state_updated = 1;
+                break;
+            }
+
+            case CHUNK_INPUTS: {
+                InputsChunk b;
+                if (len < sizeof(b)) break;
+                memcpy(&b, data, sizeof(b));
+                if (b.count == 0 || len < sizeof(b) + b.count) break;
+                lockstep_follow(client, &b, data + sizeof(b), now);
+                state_updated = 1;
+                break;
+            }
+
+            case CHUNK_ACK:
+                if (len < sizeof(RelAck)) break;
+                rel_on_ack(&client->rel, (const RelAck *)data, now);
+                break;
+
+            case CHUNK_RELIABLE: {
+                if (len < REL_CHUNK_HEADER || len > sizeof(RelChunk)) break;
+                const RelChunk *msg = (const RelChunk *)data;
+                rel_on_message(&client->rel, ntohs(msg->seq), msg->kind, msg->data,
+                               (uint8_t)(len - REL_CHUNK_HEADER));
+                break;
+            }
+
+            case CHUNK_PONG: {
+                if (len < sizeof(PongChunk)) break;
+                PongChunk pong;
+                memcpy(&pong, data, sizeof(pong));
+                uint32_t rtt = (uint32_t)now - pong.stamp;
+                uint32_t hold = ntohs(pong.hold_ms);
+                client->rtt_ms = (rtt > hold) ? rtt - hold : 0;
+                break;
+            }
+        }
+    }
+
+    handle_events(client);
+    return state_updated;
+}
+
+/* Rules we can draw with (the server is trusted, but not a garbled field) */
+static int rules_valid(const GameRules *r) {
+    return r->tick_hz >= GAME_TICK_HZ_MIN && r->tick_hz <= GAME_TICK_HZ_MAX &&
+           r->field_w > 0.0f && r->field_h > 0.0f && r->paddle_h > 0.0f;
+}
+
+/* Handle one datagram from the server. Returns 1 if it was a new snapshot. */
+static int handle_datagram(ClientState *client, uint8_t *buffer, int recv_len, uint64_t now) {
+    if (recv_len >= (int)sizeof(CookieMsg) && buffer[0] == MSG_SERVER_COOKIE) {
+        /* Handshake: repeat the join with the cookie right away */
+        client->cookie = ((CookieMsg *)buffer)->cookie;
+        send_join(client);
+    } else if (recv_len >= (int)JOINED_MIN_SIZE && buffer[0] == MSG_SERVER_JOINED) {
+        JoinedMsg *msg = (JoinedMsg *)buffer;
+        /* It carries no MAC: it may open our session, never replace it
+           (a moved match rekeys through a reliable event) */
+        if (client->token == 0) {
+            client->token = msg->token;
+            memcpy(client->key, msg->key, sizeof(client->key));
+        } else if (msg->token != client->token) {
+            return 0;
+        }
+        client->lockstep = (msg->flags & JOIN_LOCKSTEP) != 0;
+        GameRules rules;
+        memcpy(&rules, &msg->rules, sizeof(rules));
+        if (recv_len >= (int)sizeof(JoinedMsg) && rules_valid(&rules)) {
+            client->rules = rules;
+            client->rules_room = (msg->status == JOIN_MATCHED) ? ntohl(msg->room_id) : UINT32_MAX;
+        }
+        if (msg->status == JOIN_MATCHED) {
+            client->matched = 1;
+            client->player_id = msg->player_id;
+            client->room_id = ntohl(msg->room_id);
+        } else if (!client->matched) {
+            render_waiting(client);
+        }
+    } else if (buffer[0] == MSG_FRAME) {
+        return handle_frame(client, buffer, recv_len, now);
+    }
+    return 0;
+}
+
 int main(int argc, char *argv[]) {
     ClientState client;
     const char *server_ip = "127.0.0.1";
-    int player_id = 0;
+    int region = 0;
     
     /* Parse command line arguments */
     if (argc >= 2) {
         server_ip = argv[1];
     }
     if (argc >= 3) {
-        player_id = atoi(argv[2]);
-        if (player_id < 0 || player_id > 1) {
-            printf("Player ID must be 0 or 1\n");
+        region = atoi(argv[2]);
+        if (region < 0 || region > 255) {
+            printf("Region must be between 0 and 255\n");
             return 1;
         }
     }
     
     /* Initialize client */
-    if (client_init(&client, server_ip, player_id) < 0) {
+    if (client_init(&client, server_ip, region) < 0) {
         return 1;
     }
     
     /* Configure terminal */
     configure_terminal();
     
-    printf("Connecting to server %s:%d as Player %d...\n",
-           server_ip, SERVER_PORT, player_id + 1);
+    printf("Connecting to server %s:%d (region %d)...\n",
+           server_ip, SERVER_PORT, region);
     
-    /* Send initial connect message */
-    send_connect(&client);
+    /* Ask the server to match us with an opponent */
+    send_join(&client);
     client.last_keepalive_ms = get_time_ms();
     
     uint8_t buffer[BUFFER_SIZE];
@@ -349,34 +804,40 @@ int main(int argc, char *argv[]) {
             send_input(&client);
         }
         
-        /* Send keepalive/input periodically */
+        /* Send keepalive/input and a ping periodically (join again until matched) */
         if (now - client.last_keepalive_ms >= KEEPALIVE_INTERVAL_MS) {
-            send_input(&client);
+            if (client.matched) {
+                send_input(&client);
+                send_ping(&client, now);
+            } else {
+                send_join(&client);
+            }
             client.last_keepalive_ms = now;
         }
         
-        /* Receive state updates from server */
-        struct sockaddr_in from_addr;
-        socklen_t from_len = sizeof(from_addr);
-        int recv_len = recvfrom(client.sockfd, buffer, BUFFER_SIZE, 0,
-                               (struct sockaddr *)&from_addr, &from_len);
-        
-        if (recv_len >= sizeof(StateMsg)) {
-            StateMsg *msg = (StateMsg *)buffer;
-            if (msg->type == MSG_SERVER_STATE) {
-                client.last_state = *msg;
-                client.connected = 1;
-                
-                /* Render the game */
-                render_state(&client);
-            }
+        /* Receive everything that arrived since the last frame */
+        int state_updated = 0;
+        int recv_len;
+        while ((recv_len = recv(client.sockfd, buffer, BUFFER_SIZE, MSG_DONTWAIT)) > 0) {
+            state_updated |= handle_datagram(&client, buffer, recv_len, now);
+        }
+        if (client.lockstep && client.have_confirmed) {
+            /* Between batches the game runs on here */
+            lockstep_show(&client, now);
+            render_state(&client);
+        } else if (state_updated) {
+            render_state(&client);
         }
+
+        /* Whatever this iteration produced leaves in one datagram */
+        service_reliable(&client, now);
+        flush_frame(&client);
         
         usleep(16000); /* ~60 FPS rendering */
     }
     
     /* Cleanup */
-    send_disconnect(&client);
+    send_leave(&client);
     close(client.sockfd);
     restore_terminal();
     
@@ -0,0 +1,111 @@
+/* auth.c - Stateless join cookies and per-session tokens */
+#include "auth.h"
+#include <string.h>
+#include <sys/random.h>
+
+/* Single writer: a plain load/store pair is enough and avoids a locked add */
+static void count(atomic_uint_fast64_t *c) {
+    atomic_store_explicit(c, atomic_load_explicit(c, memory_order_relaxed) + 1,
+                          memory_order_relaxed);
+}
+
+static int random_bytes(uint8_t *buf, size_t len) {
+    while (len > 0) {
+        ssize_t n = getrandom(buf, len, 0);
+        if (n < 0) return -1;
+        buf += n;
+        len -= (size_t)n;
+    }
+    return 0;
+}
+
+/* Hash input: ip and port exactly as they appear on the wire */
+static uint64_t addr_hash(const uint8_t key[SIPHASH_KEY_SIZE], uint32_t prefix,
+                          const struct sockaddr_in *addr) {
+    uint8_t in[10];
+    memcpy(in, &prefix, 4);
+    memcpy(in + 4, &addr->sin_addr.s_addr, 4);
+    memcpy(in + 8, &addr->sin_port, 2);
+    return siphash24(key, in, sizeof(in));
+}
+
+int auth_init(Auth *a, uint64_t now_ms, uint8_t node) {
+    memset(a, 0, sizeof(*a));
+    if (random_bytes(a->cookie_key[0], SIPHASH_KEY_SIZE) < 0 ||
+        random_bytes(a->cookie_key[1], SIPHASH_KEY_SIZE) < 0 ||
+        random_bytes(a->token_key, SIPHASH_KEY_SIZE) < 0 ||
+        random_bytes(a->mac_key, SIPHASH_KEY_SIZE) < 0) {
+        return -1;
+    }
+    a->rotated_ms = now_ms;
+    a->node = node;
+
+    atomic_init(&a->epoch, 0);
+    atomic_init(&a->challenges, 0);
+    atomic_init(&a->bad_cookies, 0);
+    atomic_init(&a->bad_tokens, 0);
+    atomic_init(&a->bad_macs, 0);
+    atomic_init(&a->replays, 0);
+    return 0;
+}
+
+void auth_maybe_rotate(Auth *a, uint64_t now_ms) {
+    if (now_ms - a->rotated_ms < AUTH_ROTATE_MS) return;
+
+    /* The new epoch takes over the key of the epoch before last. Published
+       once its key is in place: the stats may read it from another thread. */
+    uint32_t next = atomic_load_explicit(&a->epoch, memory_order_relaxed) + 1;
+    if (random_bytes(a->cookie_key[next & 1], SIPHASH_KEY_SIZE) < 0) {
+        return;  /* keep the current keys, retry on the next call */
+    }
+    atomic_store_explicit(&a->epoch, next, memory_order_relaxed);
+    a->rotated_ms = now_ms;
+}
+
+uint64_t auth_cookie(Auth *a, const struct sockaddr_in *addr) {
+    uint32_t parity = atomic_load_explicit(&a->epoch, memory_order_relaxed) & 1;
+    count(&a->challenges);
+    return (addr_hash(a->cookie_key[parity], 0, addr) & ~1ull) | parity;
+}
+
+int auth_cookie_valid(Auth *a, const struct sockaddr_in *addr, uint64_t cookie) {
+    if (cookie == 0) return 0;  /* first contact, not an error */
+
+    uint32_t parity = (uint32_t)(cookie & 1);
+    if (((addr_hash(a->cookie_key[parity], 0, addr) & ~1ull) | parity) == cookie) {
+        return 1;
+    }
+    count(&a->bad_cookies);
+    return 0;
+}
+
+uint64_t auth_token(const Auth *a, PoolHandle sh, const struct sockaddr_in *addr) {
+    uint32_t tag = (uint32_t)addr_hash(a->token_key, sh, addr) & 0x00FFFFFFu;
+    return ((uint64_t)sh << 32) | ((uint32_t)a->node << 24) | tag;
+}
+
+PoolHandle auth_token_check(Auth *a, uint64_t token, const struct sockaddr_in *addr) {
+    PoolHandle sh = (PoolHandle)(token >> 32);
+    if (sh != POOL_INVALID_HANDLE && auth_token(a, sh, addr) == token) return sh;
+
+    count(&a->bad_tokens);
+    return POOL_INVALID_HANDLE;
+}
+
+void auth_session_key(const Auth *a, uint64_t token, uint8_t key[SIPHASH_KEY_SIZE]) {
+    uint8_t in[9];
+    memcpy(in, &token, 8);
+    for (uint8_t half = 0; half < 2; half++) {
+        in[8] = half;
+        uint64_t h = siphash24(a->mac_key, in, sizeof(in));
+        memcpy(key + 8 * half, &h, 8);
+    }
+}
+
+void auth_count_bad_mac(Auth *a) {
+    count(&a->bad_macs);
+}
+
+void auth_count_replay(Auth *a) {
+    count(&a->replays);
+}
@@ -0,0 +1,80 @@
+/* auth.h - Stateless join cookies and per-session tokens */
+#ifndef AUTH_H
+#define AUTH_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdatomic.h>
+#include <stdint.h>
+#include <netinet/in.h>
+
+#include "pool.h"
+#include "siphash.h"
+
+/* Cookie secrets are replaced every AUTH_ROTATE_MS; a cookie stays valid
+   for one more period after its secret was retired. */
+#define AUTH_ROTATE_MS 30000
+
+/* Both values are opaque to the client: it echoes the 8 bytes it was given.
+   cookie = SipHash(secret[epoch], ip, port) with the epoch parity in bit 0,
+            so checking one costs exactly one hash.
+   token  = session handle << 32 | node << 24 | 24 bits of
+            SipHash(token_key, handle, ip, port): the handle indexes the
+            session pool directly, the tag proves the sender was given it,
+            and the node id lets a router find the server that issued it
+            (see cluster.h). 24 bits still take ~2^23 tries per session,
+            far beyond what the per-source rate limit lets through.
+   session key = SipHash(mac_key, token) twice: the MAC key of the session's
+            frames (see frame.h), handed to the client with its token.
+            Derived, not stored: any thread can recompute it. */
+typedef struct {
+    uint8_t cookie_key[2][SIPHASH_KEY_SIZE];  /* indexed by epoch parity */
+    uint8_t token_key[SIPHASH_KEY_SIZE];      /* fixed for the process lifetime */
+    uint8_t mac_key[SIPHASH_KEY_SIZE];        /* likewise */
+    atomic_uint epoch;                        /* rotating thread writes, stats read */
+    uint64_t rotated_ms;
+    uint8_t node;                             /* cluster node id, 0 when alone */
+
+    /* Written by the receiving thread only, readable from anywhere */
+    atomic_uint_fast64_t challenges;   /* cookies handed out */
+    atomic_uint_fast64_t bad_cookies;
+    atomic_uint_fast64_t bad_tokens;
+    atomic_uint_fast64_t bad_macs;     /* valid token, forged or corrupt frame */
+    atomic_uint_fast64_t replays;      /* authentic frame seen already */
+} Auth;
+
+/* Draw fresh secrets from the kernel. Returns 0 on success, -1 on error. */
+int auth_init(Auth *a, uint64_t now_ms, uint8_t node);
+
+/* Retire the older cookie secret if AUTH_ROTATE_MS elapsed. Same thread as
+   auth_cookie / auth_cookie_valid. */
+void auth_maybe_rotate(Auth *a, uint64_t now_ms);
+
+uint64_t auth_cookie(Auth *a, const struct sockaddr_in *addr);
+int      auth_cookie_valid(Auth *a, const struct sockaddr_in *addr, uint64_t cookie);
+
+/* Tokens only read token_key, so any thread may call these */
+uint64_t auth_token(const Auth *a, PoolHandle sh, const struct sockaddr_in *addr);
+
+/* Session handle carried by a token whose tag matches addr, or POOL_INVALID_HANDLE */
+PoolHandle auth_token_check(Auth *a, uint64_t token, const struct sockaddr_in *addr);
+
+/* MAC key of the session a token belongs to */
+void auth_session_key(const Auth *a, uint64_t token, uint8_t key[SIPHASH_KEY_SIZE]);
+
+/* Count a frame refused for its MAC, or as a replay (receiving thread) */
+void auth_count_bad_mac(Auth *a);
+void auth_count_replay(Auth *a);
+
+/* Node that issued a token: all a router needs to read */
+static inline uint8_t auth_token_node(uint64_t token) {
+    return (uint8_t)(token >> 24);
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* AUTH_H */
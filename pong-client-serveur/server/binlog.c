@@ -0,0 +1,305 @@
+/* binlog.c - Asynchronous binary event log: per-thread rings, one drain thread */
+#include "binlog.h"
+#include "overload.h"
+#include "spsc_ring.h"
+#include <arpa/inet.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define HAVE_TSC 1
+#endif
+
+#define DRAIN_IDLE_NS   1000000     /* drain thread sleep when every ring is empty */
+#define CALIBRATE_NS    10000000    /* first TSC rate measurement, at start */
+#define RECALIBRATE_NS  1000000000  /* drain thread refines the rate this often */
+
+static const char *messages[LOG_EVENTS] = {
+    [LOG_DROPPED]             = "Log: thread %u lost %u records (ring full)",
+    [LOG_MATCH_STARTED]       = "Room %u: both players connected! Game starting...",
+    [LOG_PLAYER_LEFT]         = "Player %d disconnected from room %u",
+    [LOG_QUEUED_LEFT]         = "Queued player left: %a",
+    [LOG_SERVER_FULL]         = "Server full, rejecting connection from %a",
+    [LOG_PLAYER_QUEUED]       = "Player queued (bucket %u): %a",
+    [LOG_PLAYER_TIMEOUT]      = "Player %d timed out in room %u",
+    [LOG_OVERLOAD]            = "Overload: %o (tick %u us, avg %u us, budget %u us)",
+    [LOG_PLAYER_UNREACHABLE]  = "Player unreachable (no ack after %d tries): %a",
+    [LOG_CLUSTER_NOT_MOVABLE] = "Cluster: room %u is not a match that can move to node %u",
+    [LOG_CLUSTER_MOVED]       = "Cluster: room %u moved to node %u",
+    [LOG_CLUSTER_REFUSED]     = "Cluster: refused room %u from node %u (different build)",
+    [LOG_CLUSTER_LOST]        = "Cluster: server full, room %u from node %u lost",
+    [LOG_CLUSTER_ADOPTED]     = "Cluster: adopted room %u from node %u as room %u",
+    [LOG_TCP_CLIENT_LEFT]     = "[server] client %d disconnected",
+    [LOG_TCP_SEND_FAILED]     = "[server] send failed, client %d",
+    [LOG_TCP_CONNECTED]       = "[server] client %u connected from %a",
+    [LOG_TCP_ROOM_ENDED]      = "[server] room %u ended: client %u left",
+    [LOG_TCP_STATS]           = "[server] %u connections, %u rooms, %u queued, tick max %u us, %u ticks late",
+    [LOG_TCP_INPUTS]          = "[server] inputs: %u received, %u coalesced (latest kept), at most %u from one player in a tick",
+    [LOG_TCP_SLOW_DROPPED]    = "[server] client %u dropped: send queue full, nothing taken for %u ms (%u conflated)",
+    [LOG_TCP_CONN_QUEUE]      = "[server]   client %u: queue %u bytes, kernel unsent %u, conflated %u (%u in all)",
+    [LOG_TCP_OUT_STATS]       = "[server] out: %u connections behind, %u states conflated (latest kept), %u slow drops",
+};
+
+static struct {
+    SpscRing rings[BINLOG_MAX_THREADS];
+    atomic_uint threads;             /* rings claimed, may exceed the max */
+    atomic_uint_fast64_t overflow;   /* records from threads without a ring */
+    atomic_int running;
+
+    /* TSC -> CLOCK_REALTIME: ns = anchor_ns + (tsc - anchor_tsc) * ns_per_tick.
+       Set at start, then only touched by the drain thread. */
+    uint64_t start_tsc, start_ns;
+    uint64_t anchor_tsc, anchor_ns;
+    double ns_per_tick;
+
+    /* Drain thread only */
+    pthread_t drain;
+    FILE *out;
+    int text;
+    uint64_t reported[BINLOG_MAX_THREADS];   /* drops already noted */
+} g_log;
+
+/* 0: not logging yet, n: ring n - 1, -1: no ring left for this thread */
+static _Thread_local int t_slot;
+
+static uint64_t realtime_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+/* Record timestamp: the TSC where there is one (a few ns, where
+   clock_gettime costs tens); converted to ns by the drain thread */
+static inline uint64_t stamp(void) {
+#ifdef HAVE_TSC
+    return __rdtsc();
+#else
+    return realtime_ns();
+#endif
+}
+
+static void calibrate(void) {
+#ifdef HAVE_TSC
+    uint64_t tsc = __rdtsc();
+    uint64_t ns = realtime_ns();
+    if (tsc > g_log.start_tsc) {
+        g_log.ns_per_tick = (double)(ns - g_log.start_ns) / (double)(tsc - g_log.start_tsc);
+    }
+    g_log.anchor_tsc = tsc;
+    g_log.anchor_ns = ns;
+#endif
+}
+
+static uint64_t stamp_to_ns(uint64_t ts) {
+#ifdef HAVE_TSC
+    /* Signed: a record may be stamped just before the latest anchor */
+    int64_t ticks = (int64_t)(ts - g_log.anchor_tsc);
+    return g_log.anchor_ns + (uint64_t)(int64_t)((double)ticks * g_log.ns_per_tick);
+#else
+    return ts;
+#endif
+}
+
+void binlog_write(uint16_t event, const uint32_t args[BINLOG_ARGS]) {
+    if (!atomic_load_explicit(&g_log.running, memory_order_relaxed)) return;
+
+    if (t_slot == 0) {
+        unsigned n = atomic_fetch_add(&g_log.threads, 1);
+        t_slot = (n < BINLOG_MAX_THREADS) ? (int)n + 1 : -1;
+    }
+    if (t_slot < 0) {
+        atomic_fetch_add_explicit(&g_log.overflow, 1, memory_order_relaxed);
+        return;
+    }
+
+    BinlogRecord rec;
+    rec.ts_ns = stamp();
+    rec.event = event;
+    rec.thread = (uint8_t)(t_slot - 1);
+    rec._pad = 0;
+    memcpy(rec.arg, args, sizeof(rec.arg));
+    spsc_push(&g_log.rings[t_slot - 1], &rec);
+}
+
+int binlog_format(const BinlogRecord *rec, char *out, size_t cap) {
+    const char *fmt = (rec->event < LOG_EVENTS) ? messages[rec->event] : NULL;
+    if (!fmt) {
+        return snprintf(out, cap, "event %u (%u %u %u %u %u)", rec->event,
+                        rec->arg[0], rec->arg[1], rec->arg[2], rec->arg[3], rec->arg[4]);
+    }
+
+    size_t len = 0;
+    int a = 0;
+    out[0] = '\0';
+    for (const char *p = fmt; *p && len + 1 < cap; p++) {
+        char piece[INET_ADDRSTRLEN + 8];
+        if (p[0] != '%' || !p[1]) {
+            out[len++] = *p;
+            out[len] = '\0';
+            continue;
+        }
+
+        p++;
+        uint32_t v = (a < BINLOG_ARGS) ? rec->arg[a++] : 0;
+        switch (*p) {
+        case 'd':
+            snprintf(piece, sizeof(piece), "%d", (int32_t)v);
+            break;
+        case 'a': {
+            struct in_addr ip = { .s_addr = v };
+            char host[INET_ADDRSTRLEN];
+            uint32_t port = (a < BINLOG_ARGS) ? rec->arg[a++] : 0;
+            inet_ntop(AF_INET, &ip, host, sizeof(host));
+            snprintf(piece, sizeof(piece), "%s:%u", host, port);
+            break;
+        }
+        case 'o':
+            snprintf(piece, sizeof(piece), "%s", overload_level_name((OverloadLevel)v));
+            break;
+        default:
+            snprintf(piece, sizeof(piece), "%u", v);
+            break;
+        }
+        len += (size_t)snprintf(out + len, cap - len, "%s", piece);
+        if (len >= cap) len = cap - 1;
+    }
+    return (int)len;
+}
+
+static void emit(BinlogRecord *rec) {
+    rec->ts_ns = stamp_to_ns(rec->ts_ns);
+    if (g_log.text) {
+        char line[BINLOG_TEXT_MAX];
+        binlog_format(rec, line, sizeof(line));
+        fputs(line, g_log.out);
+        fputc('\n', g_log.out);
+    } else {
+        fwrite(rec, sizeof(*rec), 1, g_log.out);
+    }
+}
+
+/* Empty every ring once, then note new drops. Returns the records written. */
+static int drain_pass(void) {
+    unsigned n = atomic_load(&g_log.threads);
+    if (n > BINLOG_MAX_THREADS) n = BINLOG_MAX_THREADS;
+
+    int written = 0;
+    BinlogRecord rec;
+    for (unsigned i = 0; i < n; i++) {
+        while (spsc_pop(&g_log.rings[i], &rec)) {
+            emit(&rec);
+            written++;
+        }
+
+        SpscStats st;
+        spsc_stats(&g_log.rings[i], &st);
+        if (st.dropped > g_log.reported[i]) {
+            memset(&rec, 0, sizeof(rec));
+            rec.ts_ns = stamp();
+            rec.event = LOG_DROPPED;
+            rec.thread = (uint8_t)i;
+            rec.arg[0] = i;
+            rec.arg[1] = (uint32_t)(st.dropped - g_log.reported[i]);
+            emit(&rec);
+            written++;
+            g_log.reported[i] = st.dropped;
+        }
+    }
+    return written;
+}
+
+static void *drain_main(void *arg) {
+    (void)arg;
+    const struct timespec idle = { 0, DRAIN_IDLE_NS };
+    uint64_t calibrated_ns = realtime_ns();
+
+    while (atomic_load(&g_log.running)) {
+        if (realtime_ns() - calibrated_ns >= RECALIBRATE_NS) {
+            calibrate();
+            calibrated_ns = realtime_ns();
+        }
+        if (drain_pass() == 0) {
+            /* Output may block here; no producer ever waits on it */
+            fflush(g_log.out);
+            nanosleep(&idle, NULL);
+        }
+    }
+    drain_pass();
+    fflush(g_log.out);
+    return NULL;
+}
+
+int binlog_start(const char *path) {
+    memset(&g_log, 0, sizeof(g_log));
+
+    for (int i = 0; i < BINLOG_MAX_THREADS; i++) {
+        if (spsc_init(&g_log.rings[i], sizeof(BinlogRecord), BINLOG_RING_CAPACITY) < 0) {
+            while (--i >= 0) spsc_destroy(&g_log.rings[i]);
+            return -1;
+        }
+    }
+
+#ifdef HAVE_TSC
+    /* Rough rate before the first record; the drain thread refines it */
+    const struct timespec wait = { 0, CALIBRATE_NS };
+    g_log.start_tsc = __rdtsc();
+    g_log.start_ns = realtime_ns();
+    nanosleep(&wait, NULL);
+    calibrate();
+#endif
+
+    if (path) {
+        g_log.out = fopen(path, "wb");
+        if (!g_log.out) goto fail;
+
+        BinlogFileHeader hdr;
+        memset(&hdr, 0, sizeof(hdr));
+        memcpy(hdr.magic, BINLOG_MAGIC, sizeof(BINLOG_MAGIC));
+        hdr.version = BINLOG_VERSION;
+        hdr.record_size = sizeof(BinlogRecord);
+        if (fwrite(&hdr, sizeof(hdr), 1, g_log.out) != 1) goto fail;
+    } else {
+        g_log.out = stdout;
+        g_log.text = 1;
+    }
+
+    atomic_store(&g_log.running, 1);
+    if (pthread_create(&g_log.drain, NULL, drain_main, NULL) != 0) {
+        atomic_store(&g_log.running, 0);
+        goto fail;
+    }
+    return 0;
+
+fail:
+    if (g_log.out && g_log.out != stdout) fclose(g_log.out);
+    g_log.out = NULL;
+    for (int i = 0; i < BINLOG_MAX_THREADS; i++) spsc_destroy(&g_log.rings[i]);
+    return -1;
+}
+
+void binlog_stop(void) {
+    if (!atomic_exchange(&g_log.running, 0)) return;
+    pthread_join(g_log.drain, NULL);
+
+    if (g_log.out != stdout) fclose(g_log.out);
+    g_log.out = NULL;
+    /* The rings stay allocated: a thread still logging finds running == 0 */
+}
+
+void binlog_stats(BinlogStats *out) {
+    memset(out, 0, sizeof(*out));
+    unsigned n = atomic_load(&g_log.threads);
+    out->threads = n;
+    if (n > BINLOG_MAX_THREADS) n = BINLOG_MAX_THREADS;
+
+    for (unsigned i = 0; i < n; i++) {
+        SpscStats st;
+        spsc_stats(&g_log.rings[i], &st);
+        out->records += st.pushed;
+        out->dropped += st.dropped;
+    }
+    out->dropped += atomic_load(&g_log.overflow);
+}
@@ -0,0 +1,104 @@
+/* binlog.h - Asynchronous binary event log for the packet and tick paths
+ *
+ * A log call copies a fixed-size record (timestamp, event id, a few integer
+ * arguments) into a lock-free ring owned by the calling thread. A background
+ * thread drains all rings: it formats the records as text on stdout, or
+ * writes them unformatted to a file for logdump to format offline. The
+ * caller never formats, never takes a lock and never blocks; when its ring
+ * is full the record is dropped and counted, and the drain thread notes the
+ * gap in the output (LOG_DROPPED).
+ */
+#ifndef BINLOG_H
+#define BINLOG_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define BINLOG_MAX_THREADS   8
+#define BINLOG_RING_CAPACITY 4096   /* records per thread */
+#define BINLOG_ARGS          5
+#define BINLOG_TEXT_MAX      160    /* longest formatted message */
+
+#define BINLOG_MAGIC   "PONGLOG"    /* file header, NUL included */
+#define BINLOG_VERSION 1
+
+/* Events. The message of each is in binlog.c: %u and %d take one argument,
+   %a two (IPv4 address in network order, then the port), %o one (an
+   overload level, printed by name). */
+enum {
+    LOG_DROPPED = 1,         /* written by the drain thread: thread, records lost */
+    LOG_MATCH_STARTED,       /* room */
+    LOG_PLAYER_LEFT,         /* slot, room */
+    LOG_QUEUED_LEFT,         /* address */
+    LOG_SERVER_FULL,         /* address */
+    LOG_PLAYER_QUEUED,       /* bucket, address */
+    LOG_PLAYER_TIMEOUT,      /* slot, room */
+    LOG_OVERLOAD,            /* level, tick us, ewma us, budget us */
+    LOG_PLAYER_UNREACHABLE,  /* tries, address */
+    LOG_CLUSTER_NOT_MOVABLE, /* room, to node */
+    LOG_CLUSTER_MOVED,       /* room, to node */
+    LOG_CLUSTER_REFUSED,     /* room, from node */
+    LOG_CLUSTER_LOST,        /* room, from node */
+    LOG_CLUSTER_ADOPTED,     /* room, from node, new room */
+    LOG_TCP_CLIENT_LEFT,     /* client */
+    LOG_TCP_SEND_FAILED,     /* client */
+    LOG_TCP_CONNECTED,       /* client, address */
+    LOG_TCP_ROOM_ENDED,      /* room, client that left */
+    LOG_TCP_STATS,           /* connections, rooms, queued, tick max us, late ticks */
+    LOG_TCP_INPUTS,          /* received, coalesced, most from one player in a tick */
+    LOG_TCP_SLOW_DROPPED,    /* client, ms full without taking a byte, states conflated */
+    LOG_TCP_CONN_QUEUE,      /* client, bytes queued, unsent in the kernel, conflated now / in all */
+    LOG_TCP_OUT_STATS,       /* connections behind, states conflated, slow drops in all */
+    LOG_EVENTS
+};
+
+typedef struct {
+    uint64_t ts_ns;          /* CLOCK_REALTIME */
+    uint16_t event;
+    uint8_t  thread;         /* order in which threads first logged */
+    uint8_t  _pad;
+    uint32_t arg[BINLOG_ARGS];
+} BinlogRecord;              /* 32 bytes */
+
+/* Log file: this header, then BinlogRecords in host byte order */
+typedef struct {
+    char     magic[8];
+    uint32_t version;
+    uint32_t record_size;
+} BinlogFileHeader;
+
+/* Allocate the rings and start the drain thread. path NULL: text on
+   stdout, otherwise binary records to that file (truncated).
+   Returns 0, or -1 on error (logging then stays off). */
+int binlog_start(const char *path);
+
+/* Drain what is left, stop the thread and close the output */
+void binlog_stop(void);
+
+/* Hot path: queue one record. Missing arguments are 0. Does nothing
+   before binlog_start(). */
+#define binlog(event, ...) \
+    binlog_write((event), (const uint32_t[BINLOG_ARGS]){ __VA_ARGS__ })
+
+void binlog_write(uint16_t event, const uint32_t args[BINLOG_ARGS]);
+
+/* Message of a record, without timestamp or thread. Returns its length. */
+int binlog_format(const BinlogRecord *rec, char *out, size_t cap);
+
+typedef struct {
+    uint64_t records;        /* queued by all threads */
+    uint64_t dropped;        /* lost to full rings, or past BINLOG_MAX_THREADS */
+    uint32_t threads;
+} BinlogStats;
+
+void binlog_stats(BinlogStats *out);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* BINLOG_H */
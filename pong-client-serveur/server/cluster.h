@@ -0,0 +1,56 @@
+/* cluster.h - Wire formats between router_udp and the servers behind it
+ *
+ * The router owns the public port and relays every datagram:
+ *
+ *   client -> router -> node   RouteHeader (the client's address) + datagram
+ *   node -> router -> client   RouteHeader (the destination) + datagram
+ *
+ * A RouteHeader with ip 0 carries a cluster message (ClusterHeader first)
+ * instead: from the router's control port to a node, or from one node to
+ * another through the router. Nodes only accept datagrams from the router.
+ *
+ * Frames are routed without any table: every session token carries the id
+ * of the node that issued it (see auth.h). Joins carry no token yet; the
+ * router places them by matchmaking bucket, so players who may be paired
+ * always reach the same node.
+ */
+#ifndef CLUSTER_H
+#define CLUSTER_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+
+#define ROUTER_INTERNAL_PORT 12400  /* router side of the router <-> node traffic */
+#define ROUTER_CONTROL_PORT  12401  /* operator commands, loopback only */
+#define CLUSTER_MAX_NODES    16
+#define CLUSTER_MSG_MAX      4096   /* largest cluster message (a room snapshot) */
+
+typedef struct {
+    uint32_t ip;      /* client address, network order; 0 = cluster message */
+    uint16_t port;    /* network order */
+    uint8_t  node;    /* cluster message to a node: its id */
+    uint8_t  _pad;
+} __attribute__((packed)) RouteHeader;
+
+/* Cluster message operations */
+enum {
+    CLUSTER_MOVE_ROOM = 1,      /* router -> node: send room_id to to_node */
+    CLUSTER_ROOM_SNAPSHOT = 2   /* node -> node: the room, to be adopted */
+};
+
+typedef struct {
+    uint8_t  op;
+    uint8_t  from_node;
+    uint8_t  to_node;
+    uint8_t  _pad;
+    uint32_t room_id;           /* network order, room index on from_node */
+} __attribute__((packed)) ClusterHeader;
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* CLUSTER_H */
@@ -0,0 +1,101 @@
+/* frame.c - Framed datagrams: one header, then type-length-value chunks */
+#include "frame.h"
+#include <stddef.h>
+#include <string.h>
+#include <arpa/inet.h>
+
+void frame_writer_init(FrameWriter *w) {
+    memset(w, 0, sizeof(*w));
+}
+
+int frame_add(FrameWriter *w, uint8_t msg_type, uint64_t conn_id,
+              uint8_t chunk_type, const void *data, uint8_t len) {
+    size_t need = sizeof(ChunkHeader) + len;
+
+    if (w->len == 0) {
+        FrameHeader hdr;
+        memset(&hdr, 0, sizeof(hdr));
+        hdr.type = msg_type;
+        hdr.conn_id = conn_id;
+        memcpy(w->buf, &hdr, sizeof(hdr));
+        w->len = sizeof(hdr);
+        w->chunks = 0;
+    }
+    if (w->len + need + FRAME_MAC_SIZE > FRAME_MAX) return -1;
+
+    ChunkHeader ch = { chunk_type, len };
+    memcpy(w->buf + w->len, &ch, sizeof(ch));
+    if (len) memcpy(w->buf + w->len + sizeof(ch), data, len);
+    w->len += (uint16_t)need;
+    w->chunks++;
+    return 0;
+}
+
+uint16_t frame_finish(FrameWriter *w, const uint8_t key[FRAME_KEY_SIZE]) {
+    uint16_t len = w->len;
+    if (len == 0) return 0;
+
+    uint32_t seq = htonl(w->next_seq++);
+    memcpy(w->buf + offsetof(FrameHeader, seq), &seq, sizeof(seq));
+
+    uint64_t mac = siphash24(key, w->buf, len);
+    memcpy(w->buf + len, &mac, FRAME_MAC_SIZE);
+    w->len = 0;
+    return (uint16_t)(len + FRAME_MAC_SIZE);
+}
+
+int frame_open(FrameReader *r, const uint8_t *buf, int len, uint8_t msg_type,
+               FrameHeader *hdr) {
+    if (len < (int)(sizeof(FrameHeader) + FRAME_MAC_SIZE) || buf[0] != msg_type) return -1;
+
+    memcpy(hdr, buf, sizeof(*hdr));
+    hdr->seq = ntohl(hdr->seq);
+    r->p = buf + sizeof(FrameHeader);
+    r->end = buf + len - FRAME_MAC_SIZE;
+    return 0;
+}
+
+int frame_verify(const uint8_t key[FRAME_KEY_SIZE], const uint8_t *buf, int len) {
+    uint64_t mac;
+    memcpy(&mac, buf + len - FRAME_MAC_SIZE, FRAME_MAC_SIZE);
+    return siphash24(key, buf, (size_t)len - FRAME_MAC_SIZE) == mac;
+}
+
+int frame_replay_accept(FrameReplay *w, uint32_t seq) {
+    if (!w->any) {
+        w->any = 1;
+        w->top = seq;
+        w->seen = 1;
+        return 1;
+    }
+
+    int32_t ahead = (int32_t)(seq - w->top);
+    if (ahead > 0) {
+        w->seen = (ahead >= FRAME_REPLAY_WINDOW) ? 0 : w->seen << ahead;
+        w->seen |= 1;
+        w->top = seq;
+        return 1;
+    }
+
+    uint32_t behind = (uint32_t)-ahead;
+    if (behind >= FRAME_REPLAY_WINDOW) return 0;
+    uint64_t bit = 1ull << behind;
+    if (w->seen & bit) return 0;
+    w->seen |= bit;
+    return 1;
+}
+
+int frame_next(FrameReader *r, uint8_t *type, const uint8_t **data, uint8_t *len) {
+    if (r->p == r->end) return 0;
+    if (r->end - r->p < (long)sizeof(ChunkHeader)) return -1;
+
+    ChunkHeader ch;
+    memcpy(&ch, r->p, sizeof(ch));
+    if (r->end - r->p - (long)sizeof(ch) < ch.len) return -1;
+
+    *type = ch.type;
+    *len = ch.len;
+    *data = r->p + sizeof(ch);
+    r->p += sizeof(ch) + ch.len;
+    return 1;
+}
@@ -0,0 +1,103 @@
+/* frame.h - Framed datagrams: one header, then type-length-value chunks
+ *
+ * Everything a peer has pending for a session (input, acks, pings, reliable
+ * messages, state) is packed into one datagram per send instead of one
+ * datagram per message:
+ *
+ *   FrameHeader | ChunkHeader + payload | ChunkHeader + payload | ... | MAC
+ *
+ * The MAC is SipHash-2-4 of everything before it under the session key
+ * (handed out with the session token), so a frame cannot be forged without
+ * the key. The receiver also keeps a window of the sequence numbers it took,
+ * so a captured frame cannot be replayed either.
+ *
+ * Shared by the server and the UDP client; chunk types are the protocol's.
+ */
+#ifndef FRAME_H
+#define FRAME_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+
+#include "siphash.h"
+
+#define FRAME_MAX      512   /* bytes per datagram, well below the path MTU */
+#define FRAME_MAC_SIZE 8     /* trailer */
+#define FRAME_KEY_SIZE SIPHASH_KEY_SIZE
+#define FRAME_REPLAY_WINDOW 64   /* older seqs than this behind the newest are refused */
+
+typedef struct {
+    uint8_t  type;      /* the protocol's MSG_FRAME */
+    uint8_t  _pad;
+    uint32_t seq;       /* per-direction datagram counter, network order
+                           (32 bits: never wraps within a session) */
+    uint64_t conn_id;   /* session token (opaque to the client) */
+} __attribute__((packed)) FrameHeader;
+
+typedef struct {
+    uint8_t type;
+    uint8_t len;        /* payload bytes that follow */
+} __attribute__((packed)) ChunkHeader;
+
+/* Outbound frame being filled */
+typedef struct {
+    uint16_t len;       /* 0 = empty, no header written yet */
+    uint16_t chunks;
+    uint32_t next_seq;
+    uint8_t  buf[FRAME_MAX];
+} FrameWriter;
+
+/* Sequence numbers taken from one peer: the newest, and a bit per seq
+   behind it */
+typedef struct {
+    uint32_t top;
+    uint8_t  any;
+    uint64_t seen;      /* bit i: top - i was taken */
+} FrameReplay;
+
+typedef struct {
+    const uint8_t *p;
+    const uint8_t *end;
+} FrameReader;
+
+void frame_writer_init(FrameWriter *w);
+
+static inline int frame_pending(const FrameWriter *w) {
+    return w->len != 0;
+}
+
+/* Append a chunk, writing the header first if the frame is empty (room is
+   kept for the MAC). Returns 0, or -1 if it does not fit (send the frame
+   and retry). */
+int frame_add(FrameWriter *w, uint8_t msg_type, uint64_t conn_id,
+              uint8_t chunk_type, const void *data, uint8_t len);
+
+/* Stamp the sequence number, append the MAC under `key` and close the
+   frame. Returns its length; the bytes in w->buf stay valid until the next
+   frame_add(). */
+uint16_t frame_finish(FrameWriter *w, const uint8_t key[FRAME_KEY_SIZE]);
+
+/* Check the header (msg_type must match). Returns 0, or -1 if malformed.
+   The MAC is not checked yet: the key depends on hdr->conn_id. */
+int frame_open(FrameReader *r, const uint8_t *buf, int len, uint8_t msg_type,
+               FrameHeader *hdr);
+
+/* 1 if the trailer of a frame frame_open() accepted is its MAC under `key` */
+int frame_verify(const uint8_t key[FRAME_KEY_SIZE], const uint8_t *buf, int len);
+
+/* Take an authenticated frame's seq: 1 if it is new (it is recorded),
+   0 if it was seen already or is too old to tell */
+int frame_replay_accept(FrameReplay *w, uint32_t seq);
+
+/* Next chunk. Returns 1 with type/data/len set, 0 at the end of the frame,
+   -1 if a chunk overruns the datagram (the rest is ignored). */
+int frame_next(FrameReader *r, uint8_t *type, const uint8_t **data, uint8_t *len);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* FRAME_H */
@@ -1,6 +1,7 @@
 /* game.c - Pong core (no networking), server-authoritative style */
 #include "game.h"
 #include <math.h>
+#include <stddef.h>
 
 #ifndef M_PI
 #define M_PI 3.14159265358979323846
@@ -100,6 +101,27 @@ static int collide_paddle(const GameState *g,
     return 1;
 }
 
+/* Lag compensation for a ball that just missed the paddle of `side`:
+   if it is level with the paddle's x (a borderline miss, not a ball
+   nowhere near) and the player saw their paddle elsewhere, check that
+   position too. Returns 1 on a hit there. */
+static int collide_rewound(const GameState *g, const GameRewind *rw, int side,
+                           float paddle_x_center, float paddle_y_now,
+                           float *out_rel, GameRewindResult *result)
+{
+    if (!rw || !rw->valid[side] || rw->paddle_y[side] == paddle_y_now) return 0;
+
+    float reach = g->paddle_w * 0.5f + g->ball_size;
+    if (fabsf(g->ball_x - paddle_x_center) > reach) return 0;
+
+    if (!collide_paddle(g, paddle_x_center, rw->paddle_y[side], out_rel)) {
+        *result = GAME_REWIND_MISSED;
+        return 0;
+    }
+    *result = GAME_REWIND_HIT;
+    return 1;
+}
+
 /* ---------- Public API ---------- */
 
 void game_reset_round(GameState *g, int serve_dir) {
@@ -126,23 +148,76 @@ void game_reset_round(GameState *g, int serve_dir) {
     g->serve_wait = g->serve_pause_ticks;
 }
 
-void game_init(GameState *g) {
-    if (!g) return;
+void game_rules_default(GameRules *r, uint32_t tick_hz) {
+    if (!r) return;
+    if (tick_hz < GAME_TICK_HZ_MIN) tick_hz = GAME_TICK_HZ_MIN;
+    if (tick_hz > GAME_TICK_HZ_MAX) tick_hz = GAME_TICK_HZ_MAX;
+
+    r->tick_hz = tick_hz;
 
     /* Logical field (can be mapped later to ASCII) */
-    g->field_w = 100.0f;
-    g->field_h = 60.0f;
+    r->field_w = 100.0f;
+    r->field_h = 60.0f;
 
     /* Paddles */
-    g->paddle_h = 14.0f;
-    g->paddle_w = 2.5f;
-    g->paddle_speed = 55.0f; /* units/sec */
+    r->paddle_h = 14.0f;
+    r->paddle_w = 2.5f;
+    r->paddle_margin = GAME_PADDLE_MARGIN;
+    r->paddle_speed = 55.0f; /* units/sec */
+
+    /* Ball */
+    r->ball_size = 1.2f;
+
+    /* Atari feeling */
+    r->ball_speed_base = 45.0f;
+    r->ball_speed_max  = 95.0f;
+    r->ball_speed_gain = 1.05f;
+    r->min_vy_abs      = 6.0f;
+
+    /* Serve */
+    r->serve_pause_ticks = tick_hz; /* ~1 second */
+}
+
+void game_rules_of(const GameState *g, GameRules *r) {
+    if (!g || !r) return;
+
+    r->tick_hz = (uint32_t)lroundf(1.0f / g->dt);
+    r->field_w = g->field_w;
+    r->field_h = g->field_h;
+    r->paddle_h = g->paddle_h;
+    r->paddle_w = g->paddle_w;
+    r->paddle_margin = GAME_PADDLE_MARGIN;
+    r->paddle_speed = g->paddle_speed;
+    r->ball_size = g->ball_size;
+    r->ball_speed_base = g->ball_speed_base;
+    r->ball_speed_max = g->ball_speed_max;
+    r->ball_speed_gain = g->ball_speed_gain;
+    r->min_vy_abs = g->min_vy_abs;
+    r->serve_pause_ticks = g->serve_pause_ticks;
+}
+
+void game_init(GameState *g) {
+    GameRules r;
+    game_rules_default(&r, GAME_TICK_HZ);
+    game_init_rules(g, &r);
+}
+
+void game_init_rules(GameState *g, const GameRules *r) {
+    if (!g || !r) return;
+
+    g->field_w = r->field_w;
+    g->field_h = r->field_h;
+
+    /* Paddles */
+    g->paddle_h = r->paddle_h;
+    g->paddle_w = r->paddle_w;
+    g->paddle_speed = r->paddle_speed;
 
     g->paddle_left_y  = g->field_h * 0.5f;
     g->paddle_right_y = g->field_h * 0.5f;
 
     /* Ball */
-    g->ball_size = 1.2f;
+    g->ball_size = r->ball_size;
 
     /* Score */
     g->score_left = 0;
@@ -150,24 +225,39 @@ void game_init(GameState *g) {
 
     /* Time */
     g->tick = 0;
-    g->dt = 1.0f / 60.0f; /* 60 Hz */
+    g->dt = 1.0f / (float)r->tick_hz;
 
     /* Serve */
-    g->serve_pause_ticks = 60; /* ~1 second */
+    g->serve_pause_ticks = r->serve_pause_ticks;
     g->serve_wait = 0;
 
-    /* Atari feeling */
-    g->ball_speed_base = 45.0f;
-    g->ball_speed_max  = 95.0f;
-    g->ball_speed_gain = 1.05f;
-    g->min_vy_abs      = 6.0f;
+    g->ball_speed_base = r->ball_speed_base;
+    g->ball_speed_max  = r->ball_speed_max;
+    g->ball_speed_gain = r->ball_speed_gain;
+    g->min_vy_abs      = r->min_vy_abs;
 
     /* Start serving to the right */
     game_reset_round(g, +1);
 }
 
+uint32_t game_checksum(const GameState *g) {
+    const uint8_t *p = (const uint8_t *)g;
+    uint32_t h = 2166136261u;
+    for (size_t i = 0; i < sizeof(*g); i++) {
+        h ^= p[i];
+        h *= 16777619u;
+    }
+    return h;
+}
+
 void game_step(GameState *g, PlayerInput left_in, PlayerInput right_in) {
-    if (!g) return;
+    game_step_rewind(g, left_in, right_in, NULL);
+}
+
+GameRewindResult game_step_rewind(GameState *g, PlayerInput left_in, PlayerInput right_in,
+                                  const GameRewind *rw) {
+    GameRewindResult result = GAME_REWIND_NONE;
+    if (!g) return result;
 
     g->tick++;
 
@@ -195,7 +285,7 @@ void game_step(GameState *g, PlayerInput left_in, PlayerInput right_in) {
     g->paddle_right_y = clampf(g->paddle_right_y, half_ph, g->field_h - half_ph);
 
     /* 2) If still in pause, do not move the ball */
-    if (g->serve_wait > 0) return;
+    if (g->serve_wait > 0) return result;
 
     /* 3) Move ball */
     g->ball_x += g->ball_vx * g->dt;
@@ -211,20 +301,22 @@ void game_step(GameState *g, PlayerInput left_in, PlayerInput right_in) {
     }
 
     /* 5) Collision with paddles (fixed x near borders) */
-    float paddle_left_x  = 3.5f;                 /* margin */
-    float paddle_right_x = g->field_w - 3.5f;
+    float paddle_left_x  = GAME_PADDLE_MARGIN;
+    float paddle_right_x = g->field_w - GAME_PADDLE_MARGIN;
 
     /* Only check collision with the paddle the ball is moving towards */
     if (g->ball_vx < 0) {
         float rel = 0.0f;
-        if (collide_paddle(g, paddle_left_x, g->paddle_left_y, &rel)) {
+        if (collide_paddle(g, paddle_left_x, g->paddle_left_y, &rel) ||
+            collide_rewound(g, rw, 0, paddle_left_x, g->paddle_left_y, &rel, &result)) {
             /* push ball out of paddle to avoid sticking */
             g->ball_x = paddle_left_x + (g->paddle_w * 0.5f) + g->ball_size + 0.01f;
             reflect_on_paddle(g, 1, rel);
         }
     } else if (g->ball_vx > 0) {
         float rel = 0.0f;
-        if (collide_paddle(g, paddle_right_x, g->paddle_right_y, &rel)) {
+        if (collide_paddle(g, paddle_right_x, g->paddle_right_y, &rel) ||
+            collide_rewound(g, rw, 1, paddle_right_x, g->paddle_right_y, &rel, &result)) {
             g->ball_x = paddle_right_x - (g->paddle_w * 0.5f) - g->ball_size - 0.01f;
             reflect_on_paddle(g, 0, rel);
         }
@@ -235,12 +327,13 @@ void game_step(GameState *g, PlayerInput left_in, PlayerInput right_in) {
         /* point for right player */
         g->score_right++;
         game_reset_round(g, -1);
-        return;
+        return result;
     }
     if (g->ball_x - g->ball_size > g->field_w) {
         /* point for left player */
         g->score_left++;
         game_reset_round(g, +1);
-        return;
+        return result;
     }
+    return result;
 }
@@ -56,9 +56,43 @@ typedef struct {
 
 } GameState;
 
+#define GAME_TICK_HZ        60     /* default simulation rate */
+#define GAME_TICK_HZ_MIN    10
+#define GAME_TICK_HZ_MAX    250
+#define GAME_PADDLE_MARGIN  3.5f   /* paddle center to its side wall */
+
+/* Ruleset of a match: everything a client needs to predict and draw it.
+   Speeds are per second and the serve pause is a whole second by default,
+   so the same play runs at any tick rate. Only 32-bit fields: servers send
+   it as is in their handshake. */
+typedef struct {
+    uint32_t tick_hz;
+    float    field_w;
+    float    field_h;
+    float    paddle_h;
+    float    paddle_w;
+    float    paddle_margin;
+    float    paddle_speed;
+    float    ball_size;
+    float    ball_speed_base;
+    float    ball_speed_max;
+    float    ball_speed_gain;
+    float    min_vy_abs;
+    uint32_t serve_pause_ticks;
+} GameRules;
+
+/* The default ruleset at tick_hz (clamped to GAME_TICK_HZ_MIN..MAX) */
+void game_rules_default(GameRules *r, uint32_t tick_hz);
+
+/* The ruleset a game was started with */
+void game_rules_of(const GameState *g, GameRules *r);
+
 /* Initialize with default parameters and reset the round */
 void game_init(GameState *g);
 
+/* Same, with the given ruleset */
+void game_init_rules(GameState *g, const GameRules *r);
+
 /* Reset the ball to the center and apply serve pause.
    serve_dir: -1 (to the left), +1 (to the right). */
 void game_reset_round(GameState *g, int serve_dir);
@@ -66,6 +100,29 @@ void game_reset_round(GameState *g, int serve_dir);
 /* Advance the game by one tick, applying the inputs of the current tick */
 void game_step(GameState *g, PlayerInput left_in, PlayerInput right_in);
 
+/* FNV-1a of the whole state: equal on two machines that stepped the same
+   game with the same inputs (same build and float behaviour) */
+uint32_t game_checksum(const GameState *g);
+
+/* Lag compensation: where each player saw their own paddle, i.e. its y at
+   the latest tick their client had shown when the server stepped. */
+typedef struct {
+    float   paddle_y[2];   /* 0 = left, 1 = right */
+    uint8_t valid[2];      /* 0 = no rewind for that player */
+} GameRewind;
+
+typedef enum {
+    GAME_REWIND_NONE   = 0,  /* no borderline miss this step */
+    GAME_REWIND_MISSED = 1,  /* a borderline miss, a miss at the rewound paddle too */
+    GAME_REWIND_HIT    = 2   /* a borderline miss that hit the rewound paddle: bounced */
+} GameRewindResult;
+
+/* game_step(), where a ball level with a paddle but missing it is checked
+   again against the player's rewound paddle (rw may be NULL). The caller
+   bounds how far back a rewind may go. */
+GameRewindResult game_step_rewind(GameState *g, PlayerInput left_in, PlayerInput right_in,
+                                  const GameRewind *rw);
+
 #ifdef __cplusplus
 }
 #endif
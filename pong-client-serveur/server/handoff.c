@@ -0,0 +1,178 @@
+/* handoff.c - Hot restart transport over a UNIX socket */
+#include "handoff.h"
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+
+static int make_addr(const char *path, struct sockaddr_un *addr) {
+    memset(addr, 0, sizeof(*addr));
+    addr->sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(addr->sun_path)) return -1;
+    strcpy(addr->sun_path, path);
+    return 0;
+}
+
+/* Blocking I/O on the connection, bounded so a stuck peer cannot hang the
+   old server's loop */
+static void set_timeouts(int sock) {
+    struct timeval tv;
+    tv.tv_sec = HANDOFF_TIMEOUT_MS / 1000;
+    tv.tv_usec = (HANDOFF_TIMEOUT_MS % 1000) * 1000;
+    setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    setsockopt(sock, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+}
+
+int handoff_listen(const char *path) {
+    struct sockaddr_un addr;
+    if (make_addr(path, &addr) < 0) return -1;
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0) return -1;
+
+    unlink(path);
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(fd, 1) < 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+int handoff_accept(int listen_fd) {
+    int fd = accept4(listen_fd, NULL, NULL, SOCK_CLOEXEC);
+    if (fd < 0) return -1;
+
+    /* accept4 does not inherit O_NONBLOCK: the connection blocks (bounded) */
+    set_timeouts(fd);
+    return fd;
+}
+
+int handoff_connect(const char *path) {
+    struct sockaddr_un addr;
+    if (make_addr(path, &addr) < 0) return -1;
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) return -1;
+
+    if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        close(fd);
+        return -1;
+    }
+    set_timeouts(fd);
+    return fd;
+}
+
+int handoff_send(int sock, const void *buf, size_t len, int fd) {
+    return handoff_send_fds(sock, buf, len, &fd, fd >= 0 ? 1 : 0);
+}
+
+int handoff_send_fds(int sock, const void *buf, size_t len, const int *fds, int nfds) {
+    const uint8_t *p = buf;
+
+    if (nfds < 0 || nfds > HANDOFF_FDS_MAX) return -1;
+    if (nfds > 0) {
+        /* The descriptors travel with the first byte(s) */
+        union {
+            struct cmsghdr hdr;
+            char buf[CMSG_SPACE(HANDOFF_FDS_MAX * sizeof(int))];
+        } ctl;
+        struct iovec iov = { (void *)p, len };
+        struct msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        memset(&ctl, 0, sizeof(ctl));
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = ctl.buf;
+        msg.msg_controllen = CMSG_SPACE((size_t)nfds * sizeof(int));
+
+        struct cmsghdr *c = CMSG_FIRSTHDR(&msg);
+        c->cmsg_level = SOL_SOCKET;
+        c->cmsg_type = SCM_RIGHTS;
+        c->cmsg_len = CMSG_LEN((size_t)nfds * sizeof(int));
+        memcpy(CMSG_DATA(c), fds, (size_t)nfds * sizeof(int));
+
+        ssize_t n;
+        do {
+            n = sendmsg(sock, &msg, MSG_NOSIGNAL);
+        } while (n < 0 && errno == EINTR);
+        if (n <= 0) return -1;
+        p += n;
+        len -= (size_t)n;
+    }
+
+    while (len > 0) {
+        ssize_t n = send(sock, p, len, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return -1;
+        p += n;
+        len -= (size_t)n;
+    }
+    return 0;
+}
+
+int handoff_try_recv(int sock, uint8_t *byte) {
+    ssize_t n = recv(sock, byte, 1, MSG_DONTWAIT);
+    if (n == 1) return 1;
+    if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)) return 0;
+    return -1;
+}
+
+int handoff_recv(int sock, void *buf, size_t len, int *fd) {
+    if (!fd) return handoff_recv_fds(sock, buf, len, NULL, 0, NULL);
+
+    int nfds;
+    if (handoff_recv_fds(sock, buf, len, fd, 1, &nfds) < 0) return -1;
+    if (nfds == 0) *fd = -1;
+    return 0;
+}
+
+int handoff_recv_fds(int sock, void *buf, size_t len, int *fds, int max_fds, int *nfds) {
+    uint8_t *p = buf;
+
+    if (max_fds < 0 || max_fds > HANDOFF_FDS_MAX) return -1;
+    if (nfds) {
+        union {
+            struct cmsghdr hdr;
+            char buf[CMSG_SPACE(HANDOFF_FDS_MAX * sizeof(int))];
+        } ctl;
+        struct iovec iov = { p, len };
+        struct msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = ctl.buf;
+        msg.msg_controllen = sizeof(ctl.buf);
+
+        *nfds = 0;
+        ssize_t n;
+        do {
+            n = recvmsg(sock, &msg, MSG_CMSG_CLOEXEC);
+        } while (n < 0 && errno == EINTR);
+        if (n <= 0) return -1;
+
+        for (struct cmsghdr *c = CMSG_FIRSTHDR(&msg); c; c = CMSG_NXTHDR(&msg, c)) {
+            if (c->cmsg_level != SOL_SOCKET || c->cmsg_type != SCM_RIGHTS) continue;
+            int got = (int)((c->cmsg_len - CMSG_LEN(0)) / sizeof(int));
+            const uint8_t *data = CMSG_DATA(c);
+            for (int i = 0; i < got; i++) {
+                int fd;
+                memcpy(&fd, data + (size_t)i * sizeof(int), sizeof(int));
+                if (*nfds < max_fds) fds[(*nfds)++] = fd;
+                else close(fd);  /* more than the caller takes */
+            }
+        }
+        p += n;
+        len -= (size_t)n;
+    }
+
+    while (len > 0) {
+        ssize_t n = recv(sock, p, len, 0);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return -1;
+        p += n;
+        len -= (size_t)n;
+    }
+    return 0;
+}
@@ -0,0 +1,71 @@
+/* handoff.h - Hot restart transport: a UNIX socket between the running
+ * server and its replacement
+ *
+ * The new process connects to the old one; the message formats belong to
+ * the server:
+ *
+ *   old -> new  layout          sizes to check and allocate for (at once)
+ *   new -> old  HANDOFF_READY   allocated, waiting
+ *   old -> new  state           at the old's next tick boundary: the bound
+ *                               UDP socket (SCM_RIGHTS) and a snapshot;
+ *                               with --tcp, the TCP listener and the open
+ *                               connections follow, HANDOFF_FDS_MAX
+ *                               descriptors per message
+ *   new -> old  HANDOFF_TAKEN   state loaded, about to serve
+ *   old -> new  HANDOFF_BYE     old stops for good (sent before it exits)
+ *
+ * The old process only stops serving from the state message to BYE. If
+ * anything fails before BYE it resumes serving and the new one gives up.
+ */
+#ifndef HANDOFF_H
+#define HANDOFF_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define HANDOFF_TIMEOUT_MS 2000  /* per read/write on the connection */
+#define HANDOFF_FDS_MAX    64    /* descriptors per message (the kernel takes 253) */
+
+#define HANDOFF_READY 'R'
+#define HANDOFF_TAKEN 'T'
+#define HANDOFF_BYE   'B'
+
+/* Listen on `path` (an old socket file is replaced). Nonblocking.
+   Returns the fd, or -1. */
+int handoff_listen(const char *path);
+
+/* A pending connection from a new process, or -1 if there is none */
+int handoff_accept(int listen_fd);
+
+/* Connect to the running server. Returns the fd, or -1. */
+int handoff_connect(const char *path);
+
+/* Send exactly len bytes; fd >= 0 is passed along with them.
+   Returns 0, or -1 on error or timeout. */
+int handoff_send(int sock, const void *buf, size_t len, int fd);
+
+/* Same, with up to HANDOFF_FDS_MAX descriptors */
+int handoff_send_fds(int sock, const void *buf, size_t len, const int *fds, int nfds);
+
+/* Nonblocking: one byte if the peer sent it. Returns 1 with *byte set,
+   0 if nothing arrived yet, -1 if the peer is gone. */
+int handoff_try_recv(int sock, uint8_t *byte);
+
+/* Receive exactly len bytes. If fd is not NULL it gets the descriptor
+   passed along with them (-1 if none). Returns 0, or -1 on error,
+   timeout or end of stream. */
+int handoff_recv(int sock, void *buf, size_t len, int *fd);
+
+/* Same, taking up to max_fds descriptors (any beyond are closed); *nfds
+   gets how many came. With nfds NULL no descriptor is expected. */
+int handoff_recv_fds(int sock, void *buf, size_t len, int *fds, int max_fds, int *nfds);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* HANDOFF_H */
@@ -0,0 +1,51 @@
+/* hist.c - Fixed-size latency histogram, log-linear buckets */
+#include "hist.h"
+#include <string.h>
+
+#define SUB (1u << HIST_SUB_BITS)
+
+static uint32_t bucket_of(uint32_t v) {
+    if (v < 2 * SUB) return v;
+    uint32_t shift = (31 - (uint32_t)__builtin_clz(v)) - HIST_SUB_BITS;
+    return (shift + 1) * SUB + ((v >> shift) - SUB);
+}
+
+/* Largest value that falls in bucket b */
+static uint32_t bucket_top(uint32_t b) {
+    if (b < 2 * SUB) return b;
+    uint32_t shift = b / SUB - 1;
+    uint64_t low = (uint64_t)((b % SUB) + SUB) << shift;
+    uint64_t top = low + ((uint64_t)1 << shift) - 1;
+    return top > UINT32_MAX ? UINT32_MAX : (uint32_t)top;
+}
+
+void hist_reset(Hist *h) {
+    memset(h, 0, sizeof(*h));
+}
+
+void hist_add(Hist *h, uint32_t value) {
+    h->counts[bucket_of(value)]++;
+    h->count++;
+    if (value > h->max) h->max = value;
+}
+
+void hist_add_span_ns(Hist *h, uint64_t from_ns, uint64_t to_ns) {
+    if (from_ns == 0 || to_ns < from_ns) return;
+    uint64_t us = (to_ns - from_ns) / 1000;
+    hist_add(h, us > UINT32_MAX ? UINT32_MAX : (uint32_t)us);
+}
+
+uint32_t hist_percentile(const Hist *h, uint32_t permille) {
+    if (h->count == 0) return 0;
+
+    uint64_t want = (h->count * permille + 999) / 1000;
+    uint64_t seen = 0;
+    for (uint32_t b = 0; b < HIST_BUCKETS; b++) {
+        seen += h->counts[b];
+        if (seen >= want) {
+            uint32_t top = bucket_top(b);
+            return top < h->max ? top : h->max;
+        }
+    }
+    return h->max;
+}
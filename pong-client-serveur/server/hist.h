@@ -0,0 +1,40 @@
+/* hist.h - Fixed-size latency histogram, log-linear buckets
+ *
+ * Values below 64 get a bucket each; above, every power of two is split in
+ * 32 buckets, so a reported percentile is within ~3% of the true value.
+ * Adding a sample is a few instructions and never allocates.
+ */
+#ifndef HIST_H
+#define HIST_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+
+#define HIST_SUB_BITS 5
+#define HIST_BUCKETS  ((32 - HIST_SUB_BITS) * (1 << HIST_SUB_BITS))  /* covers uint32_t */
+
+typedef struct {
+    uint32_t counts[HIST_BUCKETS];
+    uint64_t count;
+    uint32_t max;
+} Hist;
+
+void hist_reset(Hist *h);
+void hist_add(Hist *h, uint32_t value);
+
+/* Add the span between two nanosecond stamps, in microseconds. Skipped if
+   `from_ns` is 0 (no stamp) or after `to_ns` (the clock stepped). */
+void hist_add_span_ns(Hist *h, uint64_t from_ns, uint64_t to_ns);
+
+/* Smallest bucket bound with at least `permille` of the samples at or
+   below it (999 = p99.9). 0 when empty. */
+uint32_t hist_percentile(const Hist *h, uint32_t permille);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* HIST_H */
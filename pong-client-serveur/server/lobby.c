@@ -0,0 +1,155 @@
+/* lobby.c - Matchmaking queue: pairs waiting players into rooms in O(1) */
+#include "lobby.h"
+#include <string.h>
+
+/* ---------- Intrusive FIFO ---------- */
+
+static void queue_push_back(LobbyQueue *q, RoomTable *t, PoolHandle sh, Session *s) {
+    s->q_prev = q->tail;
+    s->q_next = POOL_INVALID_HANDLE;
+    if (q->tail != POOL_INVALID_HANDLE) session_get(t, q->tail)->q_next = sh;
+    else q->head = sh;
+    q->tail = sh;
+    q->len++;
+}
+
+static void queue_push_front(LobbyQueue *q, RoomTable *t, PoolHandle sh, Session *s) {
+    s->q_prev = POOL_INVALID_HANDLE;
+    s->q_next = q->head;
+    if (q->head != POOL_INVALID_HANDLE) session_get(t, q->head)->q_prev = sh;
+    else q->tail = sh;
+    q->head = sh;
+    q->len++;
+}
+
+static void queue_unlink(LobbyQueue *q, RoomTable *t, Session *s) {
+    if (s->q_prev != POOL_INVALID_HANDLE) session_get(t, s->q_prev)->q_next = s->q_next;
+    else q->head = s->q_next;
+    if (s->q_next != POOL_INVALID_HANDLE) session_get(t, s->q_next)->q_prev = s->q_prev;
+    else q->tail = s->q_prev;
+    s->q_prev = s->q_next = POOL_INVALID_HANDLE;
+    q->len--;
+}
+
+static void mark_queued(Lobby *l, Session *s, uint8_t bucket) {
+    s->queued = 1;
+    s->bucket = bucket;
+    l->waiting++;
+    if (l->waiting > l->waiting_hwm) l->waiting_hwm = l->waiting;
+}
+
+/* Oldest live waiter of a bucket (silent ones are released), or INVALID */
+static PoolHandle pop_live(Lobby *l, RoomTable *t, uint8_t bucket,
+                           uint64_t now, uint64_t timeout_ms) {
+    LobbyQueue *q = &l->queues[bucket];
+
+    while (q->head != POOL_INVALID_HANDLE) {
+        PoolHandle sh = q->head;
+        Session *s = session_get(t, sh);
+
+        queue_unlink(q, t, s);
+        s->queued = 0;
+        l->waiting--;
+
+        if (s->last_seen_ms + timeout_ms >= now) return sh;
+
+        l->expired++;
+        session_leave(t, sh);
+    }
+    return POOL_INVALID_HANDLE;
+}
+
+/* ---------- Public API ---------- */
+
+void lobby_init(Lobby *l) {
+    memset(l, 0, sizeof(*l));
+}
+
+PoolHandle lobby_join(Lobby *l, RoomTable *t, PoolHandle sh, uint8_t bucket,
+                      uint64_t now, uint64_t timeout_ms) {
+    Session *s = session_get(t, sh);
+    if (!s) return POOL_INVALID_HANDLE;
+    bucket %= LOBBY_BUCKETS;
+    l->joins++;
+
+    PoolHandle opp = pop_live(l, t, bucket, now, timeout_ms);
+    if (opp == POOL_INVALID_HANDLE) {
+        lobby_enqueue(l, t, sh, bucket);
+        return POOL_INVALID_HANDLE;
+    }
+
+    /* Reuse a room one of them sits in while its other player is gone */
+    Session *o = session_get(t, opp);
+    PoolHandle rh = s->room;
+    if (rh == POOL_INVALID_HANDLE) rh = o->room;
+    else if (o->room != POOL_INVALID_HANDLE) room_unseat(t, opp);
+
+    if (rh == POOL_INVALID_HANDLE) {
+        rh = room_create(t, now);
+        if (rh == POOL_INVALID_HANDLE) {
+            /* No room left: keep the opponent first in line, queue the newcomer */
+            l->no_room++;
+            queue_push_front(&l->queues[bucket], t, opp, o);
+            mark_queued(l, o, bucket);
+            lobby_enqueue(l, t, sh, bucket);
+            return POOL_INVALID_HANDLE;
+        }
+    }
+    if (o->room != rh) room_seat(t, rh, opp);
+    if (s->room != rh) room_seat(t, rh, sh);
+    s->bucket = bucket;
+
+    l->matches++;
+    return rh;
+}
+
+PoolHandle lobby_match_next(Lobby *l, RoomTable *t, uint64_t now, uint64_t timeout_ms) {
+    for (uint8_t b = 0; b < LOBBY_BUCKETS; b++) {
+        if (l->queues[b].len < 2) continue;
+
+        PoolHandle sh = pop_live(l, t, b, now, timeout_ms);
+        if (sh == POOL_INVALID_HANDLE) continue;
+
+        l->joins--;  /* a re-pairing, not a new join */
+        PoolHandle rh = lobby_join(l, t, sh, b, now, timeout_ms);
+        if (rh != POOL_INVALID_HANDLE) return rh;
+        if (l->queues[b].len >= 2) return POOL_INVALID_HANDLE;  /* room pool full */
+    }
+    return POOL_INVALID_HANDLE;
+}
+
+void lobby_enqueue(Lobby *l, RoomTable *t, PoolHandle sh, uint8_t bucket) {
+    Session *s = session_get(t, sh);
+    if (!s || s->queued) return;
+    bucket %= LOBBY_BUCKETS;
+
+    queue_push_back(&l->queues[bucket], t, sh, s);
+    mark_queued(l, s, bucket);
+}
+
+void lobby_remove(Lobby *l, RoomTable *t, PoolHandle sh) {
+    Session *s = session_get(t, sh);
+    if (!s || !s->queued) return;
+
+    queue_unlink(&l->queues[s->bucket], t, s);
+    s->queued = 0;
+    l->waiting--;
+}
+
+void lobby_expire(Lobby *l, RoomTable *t, uint64_t now, uint64_t timeout_ms) {
+    for (uint8_t b = 0; b < LOBBY_BUCKETS; b++) {
+        LobbyQueue *q = &l->queues[b];
+
+        while (q->head != POOL_INVALID_HANDLE) {
+            Session *s = session_get(t, q->head);
+            if (s->last_seen_ms + timeout_ms >= now) break;
+
+            PoolHandle sh = q->head;
+            queue_unlink(q, t, s);
+            s->queued = 0;
+            l->waiting--;
+            l->expired++;
+            session_leave(t, sh);
+        }
+    }
+}
@@ -0,0 +1,71 @@
+/* lobby.h - Matchmaking queue: pairs waiting players into rooms in O(1) */
+#ifndef LOBBY_H
+#define LOBBY_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+
+#include "room.h"
+
+/* Players are only paired with players of the same bucket.
+   bucket = region tag x RTT bucket, both supplied by the client. */
+#define LOBBY_REGIONS      8
+#define LOBBY_RTT_BUCKETS  4
+#define LOBBY_BUCKETS      (LOBBY_REGIONS * LOBBY_RTT_BUCKETS)
+
+/* FIFO of sessions, linked through Session.q_prev / q_next (no extra memory) */
+typedef struct {
+    PoolHandle head;
+    PoolHandle tail;
+    uint32_t   len;
+} LobbyQueue;
+
+typedef struct {
+    LobbyQueue queues[LOBBY_BUCKETS];
+
+    uint32_t waiting;        /* sessions currently queued */
+    uint32_t waiting_hwm;
+    uint64_t joins;
+    uint64_t matches;
+    uint64_t expired;        /* waiters dropped for silence */
+    uint64_t no_room;        /* pairings deferred because the room pool was full */
+} Lobby;
+
+void lobby_init(Lobby *l);
+
+static inline uint8_t lobby_bucket(uint8_t region, uint8_t rtt_bucket) {
+    return (uint8_t)((region % LOBBY_REGIONS) * LOBBY_RTT_BUCKETS +
+                     (rtt_bucket % LOBBY_RTT_BUCKETS));
+}
+
+/* O(1). Pair sh with the oldest waiter of its bucket and seat both in a room
+   (a room one of them already sits in while waiting for an opponent, a new
+   room otherwise). Waiters silent for more than timeout_ms
+   are released on the way (amortized O(1): each is dropped once).
+   Returns the room handle, or POOL_INVALID_HANDLE if sh was queued instead. */
+PoolHandle lobby_join(Lobby *l, RoomTable *t, PoolHandle sh, uint8_t bucket,
+                      uint64_t now, uint64_t timeout_ms);
+
+/* Pair two waiters of any bucket that has several (players put back in the
+   queue by lobby_enqueue). Returns the room they were seated in, or
+   POOL_INVALID_HANDLE when there is nothing to pair. O(LOBBY_BUCKETS). */
+PoolHandle lobby_match_next(Lobby *l, RoomTable *t, uint64_t now, uint64_t timeout_ms);
+
+/* O(1). Put sh at the back of its bucket's queue (no-op if already queued) */
+void lobby_enqueue(Lobby *l, RoomTable *t, PoolHandle sh, uint8_t bucket);
+
+/* O(1). Take sh out of the queue (no-op if not queued) */
+void lobby_remove(Lobby *l, RoomTable *t, PoolHandle sh);
+
+/* Release silent waiters at the head of every bucket.
+   O(LOBBY_BUCKETS) plus one step per released session. */
+void lobby_expire(Lobby *l, RoomTable *t, uint64_t now, uint64_t timeout_ms);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* LOBBY_H */
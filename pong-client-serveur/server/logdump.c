@@ -0,0 +1,57 @@
+/* logdump.c - Format a binary event log written by server_udp --log FILE
+ *
+ * One line per record: local time with microseconds, the logging thread,
+ * then the message as the server would have printed it.
+ */
+#include "binlog.h"
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+int main(int argc, char **argv) {
+    if (argc != 2) {
+        fprintf(stderr, "Usage: %s LOGFILE\n", argv[0]);
+        return 1;
+    }
+
+    FILE *f = fopen(argv[1], "rb");
+    if (!f) {
+        perror(argv[1]);
+        return 1;
+    }
+
+    BinlogFileHeader hdr;
+    if (fread(&hdr, sizeof(hdr), 1, f) != 1 ||
+        memcmp(hdr.magic, BINLOG_MAGIC, sizeof(BINLOG_MAGIC)) != 0) {
+        fprintf(stderr, "%s: not a server event log\n", argv[1]);
+        fclose(f);
+        return 1;
+    }
+    if (hdr.version != BINLOG_VERSION || hdr.record_size != sizeof(BinlogRecord)) {
+        fprintf(stderr, "%s: log version %u (record %u bytes), this tool reads "
+                "version %d (%zu bytes)\n", argv[1], hdr.version, hdr.record_size,
+                BINLOG_VERSION, sizeof(BinlogRecord));
+        fclose(f);
+        return 1;
+    }
+
+    BinlogRecord rec;
+    unsigned long long count = 0;
+    while (fread(&rec, sizeof(rec), 1, f) == 1) {
+        char msg[BINLOG_TEXT_MAX];
+        char when[32];
+        time_t sec = (time_t)(rec.ts_ns / 1000000000ull);
+        struct tm tm;
+        localtime_r(&sec, &tm);
+        strftime(when, sizeof(when), "%Y-%m-%d %H:%M:%S", &tm);
+
+        binlog_format(&rec, msg, sizeof(msg));
+        printf("%s.%06u t%u %s\n", when, (unsigned)(rec.ts_ns % 1000000000ull / 1000),
+               rec.thread, msg);
+        count++;
+    }
+
+    fclose(f);
+    fprintf(stderr, "%llu records\n", count);
+    return 0;
+}
@@ -0,0 +1,56 @@
+/* lowlat.c - Low-latency host profile (Linux) */
+#include "lowlat.h"
+#include <string.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+
+#ifndef SO_BUSY_POLL
+#define SO_BUSY_POLL 46
+#endif
+#ifndef SO_PREFER_BUSY_POLL
+#define SO_PREFER_BUSY_POLL 69
+#endif
+
+int lowlat_busy_poll(int fd, int usec) {
+    int one = 1;
+    if (setsockopt(fd, SOL_SOCKET, SO_BUSY_POLL, &usec, sizeof(usec)) < 0) return -1;
+    setsockopt(fd, SOL_SOCKET, SO_PREFER_BUSY_POLL, &one, sizeof(one));
+    return 0;
+}
+
+int lowlat_pin_thread(int cpu) {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    return sched_setaffinity(0, sizeof(set), &set);  /* 0 = calling thread */
+}
+
+int lowlat_fifo(int priority) {
+    struct sched_param param;
+    memset(&param, 0, sizeof(param));
+    param.sched_priority = priority;
+    return sched_setscheduler(0, SCHED_FIFO, &param);
+}
+
+/* Touch every page of a stack buffer; noinline so the frame is really there */
+static __attribute__((noinline)) void prefault_stack(size_t bytes) {
+    volatile char buf[LOWLAT_STACK_PREFAULT];
+    size_t n = bytes < sizeof(buf) ? bytes : sizeof(buf);
+    for (size_t i = 0; i < n; i += 4096) buf[i] = 0;
+}
+
+int lowlat_lock_memory(size_t stack_bytes) {
+    prefault_stack(stack_bytes);
+    /* MCL_CURRENT faults in everything already mapped, MCL_FUTURE whatever
+       is mapped later (thread stacks, late allocations) */
+    return mlockall(MCL_CURRENT | MCL_FUTURE);
+}
+
+long lowlat_thread_faults(void) {
+    struct rusage ru;
+    if (getrusage(RUSAGE_THREAD, &ru) < 0) return 0;
+    return ru.ru_minflt + ru.ru_majflt;
+}
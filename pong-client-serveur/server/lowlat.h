@@ -0,0 +1,42 @@
+/* lowlat.h - Low-latency host profile: busy-polled sockets, pinned threads,
+ * real-time scheduling and memory locked in RAM
+ *
+ * Every call is best effort: it returns -1 with errno set when the kernel or
+ * the process's limits refuse, and the server keeps running without it.
+ */
+#ifndef LOWLAT_H
+#define LOWLAT_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stddef.h>
+
+#define LOWLAT_BUSY_POLL_US   50          /* spin on the device queue before sleeping */
+#define LOWLAT_STACK_PREFAULT (256 * 1024)
+
+/* SO_BUSY_POLL and SO_PREFER_BUSY_POLL (the latter from Linux 5.11; older
+   kernels keep the former) */
+int lowlat_busy_poll(int fd, int usec);
+
+/* Pin the calling thread to one CPU */
+int lowlat_pin_thread(int cpu);
+
+/* SCHED_FIFO at `priority` for the calling thread. A FIFO thread that spins
+   owns its core: give it an isolated one. */
+int lowlat_fifo(int priority);
+
+/* Fault in `stack_bytes` of the calling thread's stack, then lock every
+   current and future mapping (pools, rings, thread stacks) so no tick waits
+   on a page fault */
+int lowlat_lock_memory(size_t stack_bytes);
+
+/* Page faults taken by the calling thread so far (minor + major) */
+long lowlat_thread_faults(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* LOWLAT_H */
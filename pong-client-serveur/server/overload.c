@@ -0,0 +1,60 @@
+/* overload.c - Tick budget controller: degrade in steps instead of running late */
+#include "overload.h"
+#include <string.h>
+
+/* Hysteresis: escalate quickly, recover slowly (at 60 Hz, 4 ticks ~ 67 ms
+   and 120 ticks = 2 s), so a level is not dropped on a single quiet tick. */
+#define HOT_PERCENT   80   /* ewma above this share of the budget is "hot" */
+#define COOL_PERCENT  40   /* ewma below this share is "cool" */
+#define UP_TICKS       4
+#define DOWN_TICKS   120
+
+static const char *level_names[OVERLOAD_LEVELS] = {
+    "normal", "slow-serving", "slow-sends", "slow-sim"
+};
+
+void overload_init(OverloadCtl *c, uint32_t budget_us) {
+    memset(c, 0, sizeof(*c));
+    c->budget_us = budget_us ? budget_us : 1;
+    c->level = OVERLOAD_NORMAL;
+}
+
+int overload_tick(OverloadCtl *c, uint32_t tick_us) {
+    c->ticks++;
+    c->ticks_at[c->level]++;
+    c->last_us = tick_us;
+    if (tick_us > c->max_us) c->max_us = tick_us;
+    if (tick_us > c->budget_us) c->ticks_over_budget++;
+
+    /* ewma += (x - ewma) / 8, in integers */
+    c->ewma_us = (uint32_t)(((uint64_t)c->ewma_us * 7 + tick_us) / 8);
+
+    uint64_t hot  = (uint64_t)c->budget_us * HOT_PERCENT / 100;
+    uint64_t cool = (uint64_t)c->budget_us * COOL_PERCENT / 100;
+
+    if (c->ewma_us > hot || tick_us > c->budget_us) {
+        c->down_streak = 0;
+        if (++c->up_streak >= UP_TICKS && c->level + 1 < OVERLOAD_LEVELS) {
+            c->level++;
+            c->escalations++;
+            c->up_streak = 0;
+            return 1;
+        }
+    } else if (c->ewma_us < cool) {
+        c->up_streak = 0;
+        if (++c->down_streak >= DOWN_TICKS && c->level > OVERLOAD_NORMAL) {
+            c->level--;
+            c->recoveries++;
+            c->down_streak = 0;
+            return -1;
+        }
+    } else {
+        c->up_streak = 0;
+        c->down_streak = 0;
+    }
+    return 0;
+}
+
+const char *overload_level_name(OverloadLevel level) {
+    return (level < OVERLOAD_LEVELS) ? level_names[level] : "?";
+}
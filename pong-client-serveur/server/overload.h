@@ -0,0 +1,58 @@
+/* overload.h - Tick budget controller: degrade in steps instead of running late */
+#ifndef OVERLOAD_H
+#define OVERLOAD_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+
+/* Degradation steps, cheapest first. Each level includes the previous ones. */
+typedef enum {
+    OVERLOAD_NORMAL       = 0,
+    OVERLOAD_SLOW_SERVING = 1,  /* paddle updates during serve pauses: every 4th tick */
+    OVERLOAD_SLOW_SENDS   = 2,  /* players get every 2nd snapshot; no new rooms */
+    OVERLOAD_SLOW_SIM     = 3,  /* low-priority rooms step every 2nd tick (dt x2) */
+    OVERLOAD_LEVELS
+} OverloadLevel;
+
+/* Admission closes at this level, before the simulation itself is degraded */
+#define OVERLOAD_CLOSE_ADMISSION OVERLOAD_SLOW_SENDS
+
+typedef struct {
+    uint32_t budget_us;        /* target processing time per tick */
+    OverloadLevel level;
+
+    uint32_t ewma_us;          /* smoothed tick time (1/8 weight) */
+    uint32_t last_us;
+    uint32_t max_us;           /* worst tick; the caller resets it per stats window */
+    uint32_t up_streak;        /* consecutive hot ticks */
+    uint32_t down_streak;      /* consecutive cool ticks */
+
+    uint64_t ticks;
+    uint64_t ticks_over_budget;
+    uint64_t ticks_at[OVERLOAD_LEVELS];
+    uint64_t escalations;
+    uint64_t recoveries;
+    uint64_t refused;          /* room admissions deferred while closed */
+} OverloadCtl;
+
+void overload_init(OverloadCtl *c, uint32_t budget_us);
+
+/* Feed the processing time of one tick. Returns the level change
+   (+1, -1 or 0) so the caller can log transitions. */
+int overload_tick(OverloadCtl *c, uint32_t tick_us);
+
+/* 1 if new rooms may be created */
+static inline int overload_admit(const OverloadCtl *c) {
+    return c->level < OVERLOAD_CLOSE_ADMISSION;
+}
+
+const char *overload_level_name(OverloadLevel level);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* OVERLOAD_H */
@@ -0,0 +1,120 @@
+/* pool.c - Fixed-capacity object pool (slab) with generation-checked handles */
+#include "pool.h"
+#include <stdlib.h>
+#include <string.h>
+
+static size_t round_up(size_t x, size_t a) {
+    return (x + a - 1) & ~(a - 1);
+}
+
+static PoolHandle make_handle(uint16_t gen, uint32_t index) {
+    return ((PoolHandle)gen << 16) | (index & 0xFFFFu);
+}
+
+int pool_init(Pool *p, const char *name, size_t elem_size, uint32_t capacity) {
+    if (!p || elem_size == 0 || capacity == 0 || capacity > POOL_MAX_CAPACITY)
+        return -1;
+
+    memset(p, 0, sizeof(*p));
+    p->name = name;
+    p->capacity = capacity;
+    p->stride = round_up(elem_size, POOL_CACHE_LINE);
+
+    p->base = aligned_alloc(POOL_CACHE_LINE, p->stride * capacity);
+    p->generation = calloc(capacity, sizeof(uint16_t));
+    p->free_list = malloc(capacity * sizeof(uint32_t));
+    if (!p->base || !p->generation || !p->free_list) {
+        pool_destroy(p);
+        return -1;
+    }
+
+    /* Touch every page now so no page fault happens on first use */
+    memset(p->base, 0, p->stride * capacity);
+
+    /* Lowest indices on top of the stack: keeps live objects packed */
+    for (uint32_t i = 0; i < capacity; i++)
+        p->free_list[i] = capacity - 1 - i;
+    p->free_top = capacity;
+    return 0;
+}
+
+void pool_destroy(Pool *p) {
+    if (!p) return;
+    free(p->base);
+    free(p->generation);
+    free(p->free_list);
+    p->base = NULL;
+    p->generation = NULL;
+    p->free_list = NULL;
+    p->capacity = 0;
+    p->free_top = 0;
+}
+
+PoolHandle pool_alloc(Pool *p, void **out) {
+    if (p->free_top == 0) {
+        p->exhausted++;
+        return POOL_INVALID_HANDLE;
+    }
+
+    uint32_t index = p->free_list[--p->free_top];
+    uint16_t gen = (uint16_t)(p->generation[index] + 1);  /* even -> odd: live */
+    p->generation[index] = gen;
+
+    void *obj = p->base + (size_t)index * p->stride;
+    memset(obj, 0, p->stride);
+
+    p->in_use++;
+    if (p->in_use > p->high_water) p->high_water = p->in_use;
+
+    if (out) *out = obj;
+    return make_handle(gen, index);
+}
+
+void *pool_get(Pool *p, PoolHandle h) {
+    uint32_t index = pool_handle_index(h);
+    if (h == POOL_INVALID_HANDLE || index >= p->capacity) return NULL;
+
+    if (p->generation[index] != pool_handle_gen(h)) {
+        p->stale++;
+        return NULL;
+    }
+    return p->base + (size_t)index * p->stride;
+}
+
+int pool_free(Pool *p, PoolHandle h) {
+    uint32_t index = pool_handle_index(h);
+    if (h == POOL_INVALID_HANDLE || index >= p->capacity ||
+        p->generation[index] != pool_handle_gen(h)) {
+        p->stale++;
+        return -1;
+    }
+
+    p->generation[index]++;  /* odd -> even: free, and old handles now mismatch */
+    p->free_list[p->free_top++] = index;
+    p->in_use--;
+    return 0;
+}
+
+int pool_restore(Pool *p, const uint16_t *generation, uint32_t capacity) {
+    if (capacity != p->capacity) return -1;
+
+    memcpy(p->generation, generation, capacity * sizeof(uint16_t));
+    memset(p->base, 0, p->stride * capacity);
+
+    /* Same order as pool_init: lowest free index on top */
+    p->free_top = 0;
+    p->in_use = 0;
+    for (uint32_t i = capacity; i-- > 0; ) {
+        if (p->generation[i] & 1u) p->in_use++;
+        else p->free_list[p->free_top++] = i;
+    }
+    if (p->in_use > p->high_water) p->high_water = p->in_use;
+    return 0;
+}
+
+PoolHandle pool_handle_at(const Pool *p, uint32_t index) {
+    if (index >= p->capacity) return POOL_INVALID_HANDLE;
+    uint16_t gen = p->generation[index];
+    if ((gen & 1u) == 0) return POOL_INVALID_HANDLE;
+    return make_handle(gen, index);
+}
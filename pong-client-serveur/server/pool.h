@@ -0,0 +1,71 @@
+/* pool.h - Fixed-capacity object pool (slab) with generation-checked handles */
+#ifndef POOL_H
+#define POOL_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define POOL_CACHE_LINE 64
+
+/* Handle = (generation << 16) | slot index.
+   A slot's generation is odd while it is allocated and is bumped on every
+   alloc and free, so a handle kept after its object was released no longer
+   matches and is rejected instead of silently aliasing the next owner.
+   0 is never a valid handle. */
+typedef uint32_t PoolHandle;
+
+#define POOL_INVALID_HANDLE 0u
+#define POOL_MAX_CAPACITY   65535u
+
+static inline uint32_t pool_handle_index(PoolHandle h) { return h & 0xFFFFu; }
+static inline uint16_t pool_handle_gen(PoolHandle h)   { return (uint16_t)(h >> 16); }
+
+typedef struct {
+    const char *name;
+    uint8_t  *base;        /* capacity * stride bytes, cache-line aligned */
+    size_t    stride;      /* object size rounded up to a whole cache line */
+    uint32_t  capacity;
+
+    uint16_t *generation;  /* per slot */
+    uint32_t *free_list;   /* stack of free slot indices */
+    uint32_t  free_top;
+
+    uint32_t  in_use;
+    uint32_t  high_water;
+    uint64_t  exhausted;   /* allocations refused because the pool was full */
+    uint64_t  stale;       /* lookups/frees with an outdated handle */
+} Pool;
+
+/* All memory is allocated and touched here, once, at startup.
+   Returns 0 on success, -1 on error. */
+int  pool_init(Pool *p, const char *name, size_t elem_size, uint32_t capacity);
+void pool_destroy(Pool *p);
+
+/* O(1). Returns a handle to a zeroed object (and its address in *out),
+   or POOL_INVALID_HANDLE when the pool is exhausted. */
+PoolHandle pool_alloc(Pool *p, void **out);
+
+/* O(1). Returns NULL if the handle is stale or out of range. */
+void *pool_get(Pool *p, PoolHandle h);
+
+/* O(1). Returns 0 on success, -1 if the handle was stale. */
+int pool_free(Pool *p, PoolHandle h);
+
+/* Handle of the live object at a slot index, or POOL_INVALID_HANDLE */
+PoolHandle pool_handle_at(const Pool *p, uint32_t index);
+
+/* Hot restart: take over the slot generations of another process's pool of
+   the same capacity. Slots with an odd generation become allocated (zeroed,
+   filled in by the caller through pool_get), so handles held by clients stay
+   valid. Returns 0, or -1 if the capacities differ. */
+int pool_restore(Pool *p, const uint16_t *generation, uint32_t capacity);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* POOL_H */
@@ -0,0 +1,84 @@
+/* ratelimit.c - Per-source token buckets, checked before a datagram is parsed */
+#include "ratelimit.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define RATE_CACHE_LINE 64
+
+/* Single writer: a plain load/store pair is enough and avoids a locked add */
+static void count(atomic_uint_fast64_t *c) {
+    atomic_store_explicit(c, atomic_load_explicit(c, memory_order_relaxed) + 1,
+                          memory_order_relaxed);
+}
+
+int ratelimit_init(RateLimiter *rl, uint32_t entries, uint32_t rate_pps, uint32_t burst) {
+    memset(rl, 0, sizeof(*rl));
+    rl->rate_pps = rate_pps;
+    rl->burst = burst ? burst : 1;
+
+    uint32_t sets = 1;
+    while (sets * RATE_WAYS < entries) sets <<= 1;
+    rl->set_mask = sets - 1;
+
+    size_t bytes = (size_t)sets * RATE_WAYS * sizeof(RateEntry);
+    rl->entries = aligned_alloc(RATE_CACHE_LINE, bytes);
+    if (!rl->entries) return -1;
+    memset(rl->entries, 0, bytes);
+
+    atomic_init(&rl->allowed, 0);
+    atomic_init(&rl->dropped, 0);
+    atomic_init(&rl->evicted, 0);
+    return 0;
+}
+
+void ratelimit_destroy(RateLimiter *rl) {
+    free(rl->entries);
+    rl->entries = NULL;
+}
+
+int ratelimit_allow(RateLimiter *rl, const struct sockaddr_in *src, uint64_t now_ms) {
+    if (rl->rate_pps == 0) {
+        count(&rl->allowed);
+        return 1;
+    }
+
+    uint64_t key = ((uint64_t)src->sin_addr.s_addr << 16) | src->sin_port;
+    uint32_t set = (uint32_t)((key * 0x9E3779B97F4A7C15ull) >> 32) & rl->set_mask;
+    RateEntry *e = &rl->entries[(size_t)set * RATE_WAYS];
+    uint32_t now = (uint32_t)now_ms;
+    uint32_t full = rl->burst * 1000u;
+
+    /* Find the source in its set, remembering the stalest way */
+    RateEntry *hit = NULL;
+    RateEntry *victim = &e[0];
+    for (int w = 0; w < RATE_WAYS; w++) {
+        if (e[w].key == key) { hit = &e[w]; break; }
+        if (e[w].key == 0) { victim = &e[w]; continue; }
+        if (victim->key != 0 &&
+            (uint32_t)(now - e[w].last_ms) > (uint32_t)(now - victim->last_ms))
+            victim = &e[w];
+    }
+
+    if (!hit) {
+        /* New (or forgotten) source: starts with a full bucket */
+        if (victim->key != 0) count(&rl->evicted);
+        hit = victim;
+        hit->key = key;
+        hit->milli_tokens = full;
+        hit->last_ms = now;
+    } else {
+        /* Refill: rate_pps tokens per second = rate_pps milli-tokens per ms */
+        uint64_t refill = (uint64_t)(uint32_t)(now - hit->last_ms) * rl->rate_pps;
+        uint64_t tokens = hit->milli_tokens + refill;
+        hit->milli_tokens = (tokens > full) ? full : (uint32_t)tokens;
+        hit->last_ms = now;
+    }
+
+    if (hit->milli_tokens < 1000u) {
+        count(&rl->dropped);
+        return 0;
+    }
+    hit->milli_tokens -= 1000u;
+    count(&rl->allowed);
+    return 1;
+}
@@ -0,0 +1,49 @@
+/* ratelimit.h - Per-source token buckets, checked before a datagram is parsed */
+#ifndef RATELIMIT_H
+#define RATELIMIT_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdatomic.h>
+#include <stdint.h>
+#include <netinet/in.h>
+
+/* Entries are grouped in sets of RATE_WAYS (one cache line per set).
+   A new source replaces the least recently seen entry of its set, which is
+   an approximate LRU over the whole table at the cost of one line read. */
+#define RATE_WAYS 4
+
+typedef struct {
+    uint64_t key;           /* ip << 16 | port, 0 = empty */
+    uint32_t milli_tokens;  /* tokens * 1000 */
+    uint32_t last_ms;       /* last refill (truncated clock, wraps) */
+} RateEntry;
+
+typedef struct {
+    RateEntry *entries;     /* n_sets * RATE_WAYS */
+    uint32_t set_mask;
+    uint32_t rate_pps;      /* sustained datagrams per second per source */
+    uint32_t burst;         /* bucket depth, in datagrams */
+
+    /* Written by the receiving thread only, readable from anywhere */
+    atomic_uint_fast64_t allowed;
+    atomic_uint_fast64_t dropped;
+    atomic_uint_fast64_t evicted;
+} RateLimiter;
+
+/* Allocate a table of at least `entries` sources. rate_pps = 0 disables
+   limiting (every datagram is allowed). Returns 0 on success, -1 on error. */
+int  ratelimit_init(RateLimiter *rl, uint32_t entries, uint32_t rate_pps, uint32_t burst);
+void ratelimit_destroy(RateLimiter *rl);
+
+/* O(1), no syscalls. Returns 1 if the datagram may be processed, 0 if the
+   source is over its budget (the datagram should be dropped unparsed). */
+int ratelimit_allow(RateLimiter *rl, const struct sockaddr_in *src, uint64_t now_ms);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* RATELIMIT_H */
@@ -0,0 +1,146 @@
+/* reliable.c - Reliable, ordered control messages over the UDP socket */
+#include "reliable.h"
+#include <string.h>
+#include <arpa/inet.h>
+
+/* 16-bit sequence distance, positive if a is after b */
+static int16_t seq_diff(uint16_t a, uint16_t b) {
+    return (int16_t)(uint16_t)(a - b);
+}
+
+void rel_init(RelChannel *c) {
+    memset(c, 0, sizeof(*c));
+    c->rto_ms = REL_RTO_INIT_MS;
+    c->ack = 0xFFFF;  /* nothing received: "acks" the seq before 0 */
+}
+
+int rel_queue(RelChannel *c, uint8_t kind, const void *data, uint8_t len) {
+    if (len > REL_PAYLOAD_MAX || (uint16_t)(c->next_seq - c->base) >= REL_WINDOW) {
+        c->window_full++;
+        return -1;
+    }
+
+    RelSlot *s = &c->out[c->next_seq % REL_WINDOW];
+    s->seq = c->next_seq++;
+    s->kind = kind;
+    s->len = len;
+    s->tries = 0;
+    s->busy = 1;
+    if (len) memcpy(s->data, data, len);
+    return 0;
+}
+
+int rel_poll(RelChannel *c, uint64_t now, RelSlot **due, int max) {
+    int n = 0;
+
+    for (uint16_t seq = c->base; seq != c->next_seq && n < max; seq++) {
+        RelSlot *s = &c->out[seq % REL_WINDOW];
+        if (!s->busy) continue;
+
+        if (s->tries > 0) {
+            /* Exponential backoff per message */
+            uint64_t rto = (uint64_t)c->rto_ms << (s->tries - 1);
+            if (rto > REL_RTO_MAX_MS) rto = REL_RTO_MAX_MS;
+            if (now - s->sent_ms < rto) continue;
+            if (s->tries >= REL_MAX_TRIES) return -1;
+            c->retransmits++;
+        }
+
+        s->tries++;
+        s->sent_ms = now;
+        c->sent++;
+        due[n++] = s;
+    }
+    return n;
+}
+
+/* RFC 6298 estimator, in milliseconds */
+static void rtt_sample(RelChannel *c, uint32_t rtt) {
+    if (c->srtt_ms == 0) {
+        c->srtt_ms = rtt ? rtt : 1;
+        c->rttvar_ms = rtt / 2;
+    } else {
+        uint32_t err = (rtt > c->srtt_ms) ? rtt - c->srtt_ms : c->srtt_ms - rtt;
+        c->rttvar_ms = (3 * c->rttvar_ms + err) / 4;
+        c->srtt_ms = (7 * c->srtt_ms + rtt) / 8;
+    }
+
+    uint32_t rto = c->srtt_ms + 4 * c->rttvar_ms;
+    if (rto < REL_RTO_MIN_MS) rto = REL_RTO_MIN_MS;
+    if (rto > REL_RTO_MAX_MS) rto = REL_RTO_MAX_MS;
+    c->rto_ms = rto;
+}
+
+void rel_on_ack(RelChannel *c, const RelAck *wire, uint64_t now) {
+    uint16_t ack = ntohs(wire->ack);
+    uint16_t bits = ntohs(wire->ack_bits);
+
+    for (uint16_t seq = c->base; seq != c->next_seq; seq++) {
+        RelSlot *s = &c->out[seq % REL_WINDOW];
+        if (!s->busy) continue;
+
+        int16_t d = seq_diff(ack, seq);
+        int acked = (d == 0) || (d > 0 && d <= 16 && (bits & (1u << (d - 1))));
+        if (!acked) continue;
+
+        /* Karn: only sample messages that were sent once */
+        if (s->tries == 1) rtt_sample(c, (uint32_t)(now - s->sent_ms));
+        s->busy = 0;
+    }
+
+    while (c->base != c->next_seq && !c->out[c->base % REL_WINDOW].busy) c->base++;
+}
+
+int rel_on_message(RelChannel *c, uint16_t seq, uint8_t kind,
+                   const uint8_t *data, uint8_t len) {
+    c->ack_pending = 1;  /* ack duplicates too: our previous ack may be lost */
+
+    int16_t d = seq_diff(seq, c->recv_next);
+    if (d < 0 || d >= REL_WINDOW || len > REL_PAYLOAD_MAX) {
+        c->duplicates++;
+        return 0;
+    }
+
+    RelSlot *s = &c->in[seq % REL_WINDOW];
+    if (s->busy) {
+        c->duplicates++;
+        return 0;
+    }
+
+    /* Ack state: latest seq seen plus the 16 before it */
+    int16_t ahead = seq_diff(seq, c->ack);
+    if (!c->received_any) {
+        c->received_any = 1;
+        c->ack = seq;
+        c->ack_bits = 0;
+    } else if (ahead > 0) {
+        c->ack_bits = (ahead > 16) ? 0 : (uint16_t)((c->ack_bits << ahead) | (1u << (ahead - 1)));
+        c->ack = seq;
+    } else if (ahead < 0 && ahead >= -16) {
+        c->ack_bits |= (uint16_t)(1u << (-ahead - 1));
+    }
+
+    s->seq = seq;
+    s->kind = kind;
+    s->len = len;
+    s->busy = 1;
+    if (len) memcpy(s->data, data, len);
+    return 1;
+}
+
+int rel_deliver(RelChannel *c, RelSlot *out) {
+    RelSlot *s = &c->in[c->recv_next % REL_WINDOW];
+    if (!s->busy || s->seq != c->recv_next) return 0;
+
+    *out = *s;
+    s->busy = 0;
+    c->recv_next++;
+    c->delivered++;
+    return 1;
+}
+
+void rel_take_ack(RelChannel *c, RelAck *wire) {
+    wire->ack = htons(c->ack);
+    wire->ack_bits = htons(c->ack_bits);
+    c->ack_pending = 0;
+}
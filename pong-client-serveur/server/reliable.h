@@ -0,0 +1,111 @@
+/* reliable.h - Reliable, ordered control messages over the UDP socket
+ *
+ * Each direction of a session numbers its control messages (16-bit seq).
+ * The receiver acks with the latest seq it got plus a bitfield of the 16
+ * before it; acks travel as a chunk in whatever frame goes out next (see
+ * frame.h), and a frame is sent for them alone only when nothing else is due.
+ * Unacked messages are resent after an RTO estimated from the acks.
+ * Messages are delivered in order; the unreliable state stream is separate.
+ * Shared by the server and the UDP client.
+ */
+#ifndef RELIABLE_H
+#define RELIABLE_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+
+#define REL_WINDOW        16    /* messages in flight per direction (= ack_bits width) */
+#define REL_PAYLOAD_MAX   32    /* fits a rekey: token, key, room, flags */
+#define REL_RTO_INIT_MS  200
+#define REL_RTO_MIN_MS    50
+#define REL_RTO_MAX_MS  2000
+#define REL_MAX_TRIES      8    /* then the peer is considered gone */
+
+/* Wire: ack block, network order (an ack chunk) */
+typedef struct {
+    uint16_t ack;       /* latest seq received (0xFFFF before the first) */
+    uint16_t ack_bits;  /* bit i set: seq ack-1-i received too */
+} __attribute__((packed)) RelAck;
+
+/* Wire: one reliable message (a reliable chunk); the payload length is
+   the chunk length minus the header */
+typedef struct {
+    uint8_t  kind;      /* application message kind */
+    uint16_t seq;       /* network order */
+    uint8_t  data[REL_PAYLOAD_MAX];
+} __attribute__((packed)) RelChunk;
+
+#define REL_CHUNK_HEADER (sizeof(RelChunk) - REL_PAYLOAD_MAX)
+
+typedef struct {
+    uint64_t sent_ms;
+    uint16_t seq;
+    uint8_t  kind;
+    uint8_t  len;
+    uint8_t  tries;     /* transmissions so far (0 = not sent yet) */
+    uint8_t  busy;
+    uint8_t  data[REL_PAYLOAD_MAX];
+} RelSlot;
+
+typedef struct {
+    /* Send side */
+    RelSlot  out[REL_WINDOW];      /* indexed by seq % REL_WINDOW */
+    uint16_t next_seq;
+    uint16_t base;                 /* oldest unacked seq */
+    uint32_t srtt_ms;              /* 0 until the first sample */
+    uint32_t rttvar_ms;
+    uint32_t rto_ms;
+
+    /* Receive side */
+    RelSlot  in[REL_WINDOW];       /* received, not yet delivered */
+    uint16_t recv_next;            /* next seq to deliver */
+    uint16_t ack;
+    uint16_t ack_bits;
+    uint8_t  ack_pending;          /* something arrived since our last ack */
+    uint8_t  received_any;         /* ack/ack_bits are meaningful */
+
+    /* Counters */
+    uint32_t sent;
+    uint32_t retransmits;
+    uint32_t delivered;
+    uint32_t duplicates;
+    uint32_t window_full;
+} RelChannel;
+
+void rel_init(RelChannel *c);
+
+/* Queue a message (sent by the next rel_poll). Returns 0, or -1 if the
+   window is full or the payload too long (counted, message dropped). */
+int rel_queue(RelChannel *c, uint8_t kind, const void *data, uint8_t len);
+
+/* Collect messages due for (re)transmission at `now`, at most `max`.
+   Returns the count, or -1 if a message ran out of tries (peer gone). */
+int rel_poll(RelChannel *c, uint64_t now, RelSlot **due, int max);
+
+/* Process an ack block received from the peer */
+void rel_on_ack(RelChannel *c, const RelAck *wire, uint64_t now);
+
+/* Store an incoming message. Returns 1 if new, 0 if duplicate/out of window.
+   Either way an ack is now pending. */
+int rel_on_message(RelChannel *c, uint16_t seq, uint8_t kind,
+                   const uint8_t *data, uint8_t len);
+
+/* Next message in order, copied to *out. Returns 0 when none is ready. */
+int rel_deliver(RelChannel *c, RelSlot *out);
+
+/* Fill an ack block for the peer and clear ack_pending */
+void rel_take_ack(RelChannel *c, RelAck *wire);
+
+/* 1 if nothing is in flight and no ack is owed */
+static inline int rel_idle(const RelChannel *c) {
+    return c->base == c->next_seq && !c->ack_pending;
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* RELIABLE_H */
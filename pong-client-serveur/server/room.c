@@ -0,0 +1,239 @@
+/* room.c - Rooms (one match each) and player sessions, backed by fixed pools */
+#include "room.h"
+#include <stdlib.h>
+#include <string.h>
+
+/* ---------- Address index ---------- */
+
+#define ADDR_NOT_FOUND 0xFFFFFFFFu
+
+static uint64_t addr_key(const struct sockaddr_in *a) {
+    /* never 0 for a real peer (port 0 cannot send) */
+    return ((uint64_t)a->sin_addr.s_addr << 16) | a->sin_port;
+}
+
+static uint32_t addr_hash(const RoomTable *t, uint64_t key) {
+    return (uint32_t)((key * 0x9E3779B97F4A7C15ull) >> 32) & t->addr_mask;
+}
+
+static void addr_insert(RoomTable *t, uint64_t key, PoolHandle h) {
+    uint32_t i = addr_hash(t, key);
+    while (t->addr_vals[i] != POOL_INVALID_HANDLE)
+        i = (i + 1) & t->addr_mask;
+    t->addr_keys[i] = key;
+    t->addr_vals[i] = h;
+}
+
+static uint32_t addr_lookup(const RoomTable *t, uint64_t key) {
+    uint32_t i = addr_hash(t, key);
+    while (t->addr_vals[i] != POOL_INVALID_HANDLE) {
+        if (t->addr_keys[i] == key) return i;
+        i = (i + 1) & t->addr_mask;
+    }
+    return ADDR_NOT_FOUND;
+}
+
+/* Backward-shift deletion: keeps probe chains intact without tombstones */
+static void addr_remove(RoomTable *t, uint64_t key) {
+    uint32_t i = addr_lookup(t, key);
+    if (i == ADDR_NOT_FOUND) return;
+
+    uint32_t j = i;
+    while (1) {
+        j = (j + 1) & t->addr_mask;
+        if (t->addr_vals[j] == POOL_INVALID_HANDLE) break;
+
+        uint32_t home = addr_hash(t, t->addr_keys[j]);
+        /* move j back into the hole at i if its home is not in (i, j] */
+        int in_range = (i <= j) ? (home > i && home <= j)
+                                : (home > i || home <= j);
+        if (!in_range) {
+            t->addr_keys[i] = t->addr_keys[j];
+            t->addr_vals[i] = t->addr_vals[j];
+            i = j;
+        }
+    }
+    t->addr_keys[i] = 0;
+    t->addr_vals[i] = POOL_INVALID_HANDLE;
+}
+
+/* ---------- Live room list ---------- */
+
+static void live_add(RoomTable *t, PoolHandle rh, Room *r) {
+    r->live_pos = t->live_count;
+    t->live[t->live_count++] = rh;
+}
+
+static void live_remove(RoomTable *t, Room *r) {
+    PoolHandle last = t->live[--t->live_count];
+    if (r->live_pos < t->live_count) {
+        t->live[r->live_pos] = last;
+        room_get(t, last)->live_pos = r->live_pos;
+    }
+}
+
+static void room_release(RoomTable *t, PoolHandle rh, Room *r) {
+    r->state = ROOM_FINISHED;
+    pool_free(&t->rooms, rh);
+
+    RoomView empty;
+    memset(&empty, 0, sizeof(empty));
+    empty.state = ROOM_FINISHED;
+    room_view_publish(&t->views[pool_handle_index(rh)], &empty);
+}
+
+/* ---------- Public API ---------- */
+
+int room_table_init(RoomTable *t, uint32_t max_rooms) {
+    uint32_t max_sessions = max_rooms * ROOM_PLAYERS;
+
+    memset(t, 0, sizeof(*t));
+    if (max_rooms == 0 || max_sessions > POOL_MAX_CAPACITY) return -1;
+    game_rules_default(&t->rules, GAME_TICK_HZ);
+
+    if (pool_init(&t->rooms, "rooms", sizeof(Room), max_rooms) < 0 ||
+        pool_init(&t->sessions, "sessions", sizeof(Session), max_sessions) < 0) {
+        room_table_destroy(t);
+        return -1;
+    }
+
+    /* Load factor <= 0.5 */
+    uint32_t slots = 1;
+    while (slots < max_sessions * 2) slots <<= 1;
+    t->addr_mask = slots - 1;
+    t->addr_keys = calloc(slots, sizeof(uint64_t));
+    t->addr_vals = calloc(slots, sizeof(PoolHandle));
+
+    t->live = calloc(max_rooms, sizeof(PoolHandle));
+
+    /* Sequence 0 and a zero room handle: every view starts even and empty */
+    t->views = aligned_alloc(POOL_CACHE_LINE, max_rooms * sizeof(RoomViewSlot));
+    if (t->views) memset(t->views, 0, max_rooms * sizeof(RoomViewSlot));
+
+    if (!t->addr_keys || !t->addr_vals || !t->live || !t->views) {
+        room_table_destroy(t);
+        return -1;
+    }
+    return 0;
+}
+
+void room_table_destroy(RoomTable *t) {
+    pool_destroy(&t->rooms);
+    pool_destroy(&t->sessions);
+    free(t->addr_keys);
+    free(t->addr_vals);
+    free(t->live);
+    free(t->views);
+    memset(t, 0, sizeof(*t));
+}
+
+void room_table_rebuild(RoomTable *t, const PoolHandle *live, uint32_t live_count) {
+    memset(t->addr_keys, 0, (t->addr_mask + 1) * sizeof(uint64_t));
+    memset(t->addr_vals, 0, (t->addr_mask + 1) * sizeof(PoolHandle));
+    for (uint32_t i = 0; i < t->sessions.capacity; i++) {
+        PoolHandle sh = pool_handle_at(&t->sessions, i);
+        if (sh != POOL_INVALID_HANDLE)
+            addr_insert(t, addr_key(&session_get(t, sh)->addr), sh);
+    }
+
+    t->live_count = 0;
+    for (uint32_t i = 0; i < live_count; i++) {
+        Room *r = room_get(t, live[i]);
+        if (r && room_playing(r)) live_add(t, live[i], r);
+    }
+
+    for (uint32_t i = 0; i < t->rooms.capacity; i++) {
+        PoolHandle rh = pool_handle_at(&t->rooms, i);
+        if (rh != POOL_INVALID_HANDLE) room_publish(t, rh, room_get(t, rh));
+    }
+}
+
+PoolHandle session_find(RoomTable *t, const struct sockaddr_in *addr) {
+    uint32_t i = addr_lookup(t, addr_key(addr));
+    return (i == ADDR_NOT_FOUND) ? POOL_INVALID_HANDLE : t->addr_vals[i];
+}
+
+PoolHandle session_create(RoomTable *t, const struct sockaddr_in *addr, uint64_t now) {
+    Session *s;
+    PoolHandle sh = pool_alloc(&t->sessions, (void **)&s);
+    if (sh == POOL_INVALID_HANDLE) return sh;
+
+    s->addr = *addr;
+    s->last_seen_ms = now;
+    s->room = POOL_INVALID_HANDLE;
+    s->input = INPUT_NONE;
+    addr_insert(t, addr_key(addr), sh);
+    return sh;
+}
+
+PoolHandle room_create(RoomTable *t, uint64_t now) {
+    Room *r;
+    PoolHandle rh = pool_alloc(&t->rooms, (void **)&r);
+    if (rh == POOL_INVALID_HANDLE) return rh;
+
+    game_init_rules(&r->game, &t->rules);
+    r->state = ROOM_WAITING;
+    r->created_ms = now;
+    room_publish(t, rh, r);
+    return rh;
+}
+
+int room_seat(RoomTable *t, PoolHandle rh, PoolHandle sh) {
+    Room *r = room_get(t, rh);
+    Session *s = session_get(t, sh);
+    if (!r || !s) return -1;
+
+    int slot;
+    if (r->players[0] == POOL_INVALID_HANDLE) slot = 0;
+    else if (r->players[1] == POOL_INVALID_HANDLE) slot = 1;
+    else return -1;
+
+    r->players[slot] = sh;
+    s->room = rh;
+    s->slot = (uint8_t)slot;
+    s->input = INPUT_NONE;
+
+    if (r->players[0] != POOL_INVALID_HANDLE && r->players[1] != POOL_INVALID_HANDLE) {
+        GameRules rules;
+        game_rules_of(&r->game, &rules);
+        game_init_rules(&r->game, &rules);  /* new opponent, new match (opens with a serve) */
+        memset(r->history, 0, sizeof(r->history));
+        r->state = ROOM_SERVING;
+        r->dirty = 1;  /* players have not seen this game yet */
+        live_add(t, rh, r);
+        room_publish(t, rh, r);
+    }
+    return slot;
+}
+
+PoolHandle room_unseat(RoomTable *t, PoolHandle sh) {
+    Session *s = session_get(t, sh);
+    if (!s) return POOL_INVALID_HANDLE;
+
+    PoolHandle rh = s->room;
+    Room *r = room_get(t, rh);
+    s->room = POOL_INVALID_HANDLE;
+
+    if (r) {
+        r->players[s->slot] = POOL_INVALID_HANDLE;
+        /* Stop the match and park the room until an opponent is back */
+        if (room_playing(r)) live_remove(t, r);
+        r->state = ROOM_WAITING;
+
+        if (r->players[0] == POOL_INVALID_HANDLE && r->players[1] == POOL_INVALID_HANDLE)
+            room_release(t, rh, r);
+        else
+            room_publish(t, rh, r);
+    }
+    return rh;
+}
+
+PoolHandle session_leave(RoomTable *t, PoolHandle sh) {
+    Session *s = session_get(t, sh);
+    if (!s) return POOL_INVALID_HANDLE;
+
+    PoolHandle rh = room_unseat(t, sh);
+    addr_remove(t, addr_key(&s->addr));
+    pool_free(&t->sessions, sh);
+    return rh;
+}
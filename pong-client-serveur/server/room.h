@@ -0,0 +1,194 @@
+/* room.h - Rooms (one match each) and player sessions, backed by fixed pools */
+#ifndef ROOM_H
+#define ROOM_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <netinet/in.h>
+
+#include "game.h"
+#include "pool.h"
+#include "room_view.h"
+
+#define ROOM_PLAYERS 2
+#define ROOM_REWIND_TICKS 12  /* ticks kept for lag compensation and lockstep batches */
+
+/* One connected player. Fields read on every packet come first. */
+typedef struct {
+    struct sockaddr_in addr;
+    uint64_t last_seen_ms;
+    PoolHandle room;         /* POOL_INVALID_HANDLE while only queued */
+    uint8_t slot;            /* 0 = left paddle, 1 = right paddle */
+    uint8_t input;           /* PlayerInput */
+
+    /* Lobby queue links (see lobby.h) */
+    uint8_t queued;
+    uint8_t bucket;          /* matchmaking bucket (region / RTT) */
+    PoolHandle q_prev;
+    PoolHandle q_next;
+
+    uint8_t lockstep;        /* sent inputs and keyframes instead of states */
+} Session;
+
+/* Room lifecycle. Only serving and live rooms are on the tick list;
+   a waiting room is parked and costs nothing until a packet arrives for it. */
+typedef enum {
+    ROOM_WAITING  = 0,  /* fewer than two players (a fresh pool object is waiting) */
+    ROOM_SERVING  = 1,  /* pause after a point: ball frozen, paddles may move */
+    ROOM_LIVE     = 2,  /* ball in play */
+    ROOM_FINISHED = 3   /* released; set just before the slot goes back to the pool */
+} RoomState;
+
+/* One step as a lockstep client replays it: both inputs (PlayerInput) and
+   how many ticks of game time it covered */
+#define ROOM_STEP(left, right, stride) \
+    ((uint8_t)((left) | ((right) << 2) | (((stride) - 1) << 4)))
+
+/* One tick: both paddles after it, and the step that led there */
+typedef struct {
+    uint32_t tick;                     /* 0 = empty */
+    float paddle_y[ROOM_PLAYERS];
+    uint8_t step;                      /* ROOM_STEP() */
+} TickSample;
+
+/* One match. Fields touched every tick come first; the pool places each
+   room on its own cache lines. */
+typedef struct {
+    GameState game;
+    PoolHandle players[ROOM_PLAYERS];  /* POOL_INVALID_HANDLE = empty slot */
+    uint8_t state;                     /* RoomState */
+    uint8_t dirty;                     /* snapshot owed: paddles moved, or new match */
+
+    /* The last ROOM_REWIND_TICKS ticks, at tick % ROOM_REWIND_TICKS
+       (emptied when a match starts) */
+    TickSample history[ROOM_REWIND_TICKS];
+
+    uint32_t live_pos;                 /* index in RoomTable.live */
+    uint64_t created_ms;
+} Room;
+
+/* All rooms and sessions of a server. Every array is sized by
+   room_table_init(); nothing is allocated afterwards. */
+typedef struct {
+    Pool rooms;
+    Pool sessions;
+
+    /* Session lookup by source address (open addressing, linear probing) */
+    uint64_t   *addr_keys;
+    PoolHandle *addr_vals;
+    uint32_t    addr_mask;
+
+    /* Dense list of serving/live rooms, for the tick loop */
+    PoolHandle *live;
+    uint32_t    live_count;
+
+    /* Published state, one slot per room index (see room_view.h): written
+       by the thread that owns the table, read by any thread */
+    RoomViewSlot *views;
+
+    /* Ruleset of the rooms created from now on (default: game_rules_default
+       at GAME_TICK_HZ). A room keeps its own across matches. */
+    GameRules rules;
+} RoomTable;
+
+int  room_table_init(RoomTable *t, uint32_t max_rooms);
+void room_table_destroy(RoomTable *t);
+
+/* Hot restart: once both pools are restored and their objects copied in,
+   rebuild the address index from the sessions and the tick list from
+   `live` (kept in the old process's order). */
+void room_table_rebuild(RoomTable *t, const PoolHandle *live, uint32_t live_count);
+
+static inline Room *room_get(RoomTable *t, PoolHandle h) {
+    return (Room *)pool_get(&t->rooms, h);
+}
+
+static inline int room_playing(const Room *r) {
+    return r->state == ROOM_SERVING || r->state == ROOM_LIVE;
+}
+
+/* Record a step and the paddles after it */
+static inline void room_record_tick(Room *r, uint8_t step) {
+    TickSample *p = &r->history[r->game.tick % ROOM_REWIND_TICKS];
+    p->tick = r->game.tick;
+    p->paddle_y[0] = r->game.paddle_left_y;
+    p->paddle_y[1] = r->game.paddle_right_y;
+    p->step = step;
+}
+
+/* Where a paddle was after `tick`. Returns 0 if that tick is no longer
+   (or was never) in the history. */
+static inline int room_paddle_at(const Room *r, uint32_t tick, int slot, float *y) {
+    const TickSample *p = &r->history[tick % ROOM_REWIND_TICKS];
+    if (tick == 0 || p->tick != tick) return 0;
+    *y = p->paddle_y[slot];
+    return 1;
+}
+
+/* The step that led to `tick`. Returns 0 if it is not in the history. */
+static inline int room_step_at(const Room *r, uint32_t tick, uint8_t *step) {
+    const TickSample *p = &r->history[tick % ROOM_REWIND_TICKS];
+    if (tick == 0 || p->tick != tick) return 0;
+    *step = p->step;
+    return 1;
+}
+
+/* The room as its view slot and the shared-memory rings carry it */
+static inline void room_view_of(PoolHandle rh, const Room *r, RoomView *v) {
+    v->room = rh;
+    v->state = r->state;
+    v->game = r->game;
+}
+
+/* Publish the room's current state to its view slot. The tick calls this
+   after every step; seating, unseating and release publish on their own. */
+static inline void room_publish(RoomTable *t, PoolHandle rh, const Room *r) {
+    RoomView v;
+    room_view_of(rh, r, &v);
+    room_view_publish(&t->views[pool_handle_index(rh)], &v);
+}
+
+/* Any thread: snapshot of the room in slot `index`. Returns 0 if the slot is free. */
+static inline int room_view_at(RoomTable *t, uint32_t index, RoomView *out, uint64_t *retries) {
+    return room_view_read(&t->views[index], out, retries);
+}
+
+static inline Session *session_get(RoomTable *t, PoolHandle h) {
+    return (Session *)pool_get(&t->sessions, h);
+}
+
+/* O(1). Session bound to this source address, or POOL_INVALID_HANDLE */
+PoolHandle session_find(RoomTable *t, const struct sockaddr_in *addr);
+
+/* O(1). Create a session (not seated yet) for addr.
+   Returns POOL_INVALID_HANDLE if the session pool is exhausted. */
+PoolHandle session_create(RoomTable *t, const struct sockaddr_in *addr, uint64_t now);
+
+/* O(1). Take the session out of its room (it stays alive). The room goes
+   back to waiting (off the tick list); it is released when its last player leaves.
+   Returns the room handle (possibly already released). */
+PoolHandle room_unseat(RoomTable *t, PoolHandle sh);
+
+/* O(1). Remove the session from its room and release it. The caller takes it
+   out of the lobby first. The room stops and waits for a new opponent; it is
+   released when its last player leaves. Returns the room handle (possibly
+   already released). */
+PoolHandle session_leave(RoomTable *t, PoolHandle sh);
+
+/* O(1). New empty (waiting) room under t->rules, or POOL_INVALID_HANDLE if
+   the room pool is exhausted */
+PoolHandle room_create(RoomTable *t, uint64_t now);
+
+/* O(1). Seat a session in the room's free slot. When the second player sits
+   down the match starts from a fresh game under the room's ruleset: the
+   room starts serving and joins the tick list. Returns the slot, or -1 if full. */
+int room_seat(RoomTable *t, PoolHandle rh, PoolHandle sh);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* ROOM_H */
@@ -0,0 +1,89 @@
+/* room_view.h - Post-tick room state published for other threads (seqlock)
+ *
+ * The tick thread publishes each room's state into a slot of its own after
+ * every step. Any other thread (stats, spectator encoders, admin tools)
+ * copies a consistent snapshot out of the slot without taking a lock; the
+ * writer never waits for readers, a reader that raced a write retries.
+ *
+ * Sequence protocol: the writer makes the sequence odd, stores the words,
+ * then makes it even again. A reader copies the words between two reads of
+ * the same even sequence. The payload is stored as relaxed atomic words, so
+ * a racing copy is well defined and only ever discarded.
+ */
+#ifndef ROOM_VIEW_H
+#define ROOM_VIEW_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "game.h"
+#include "pool.h"
+
+/* What readers get: the room as it was after one tick */
+typedef struct {
+    PoolHandle room;     /* POOL_INVALID_HANDLE = slot not in use */
+    uint32_t state;      /* RoomState */
+    GameState game;
+} RoomView;
+
+#define ROOM_VIEW_WORDS (sizeof(RoomView) / sizeof(uint32_t))
+#define ROOM_VIEW_SPINS 64   /* failed copies before a reader yields its CPU */
+_Static_assert(sizeof(RoomView) % sizeof(uint32_t) == 0, "RoomView is not whole words");
+
+/* One per room slot, on cache lines of its own (the tick thread writes
+   neighbouring rooms while a reader copies this one) */
+typedef struct {
+    _Alignas(POOL_CACHE_LINE) atomic_uint seq;  /* odd while a write is under way */
+    atomic_uint words[ROOM_VIEW_WORDS];
+} RoomViewSlot;
+
+/* Writer (one thread per slot). Wait-free: a few dozen plain stores. */
+static inline void room_view_publish(RoomViewSlot *v, const RoomView *src) {
+    uint32_t w[ROOM_VIEW_WORDS];
+    memcpy(w, src, sizeof(w));
+
+    unsigned seq = atomic_load_explicit(&v->seq, memory_order_relaxed);
+    atomic_store_explicit(&v->seq, seq + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);  /* odd before any word */
+    for (size_t i = 0; i < ROOM_VIEW_WORDS; i++) {
+        atomic_store_explicit(&v->words[i], w[i], memory_order_relaxed);
+    }
+    atomic_store_explicit(&v->seq, seq + 2, memory_order_release);
+}
+
+/* Reader (any thread, any number). Copies the latest complete view into
+   *out; *retries (may be NULL) counts copies thrown away because they
+   raced a write. A reader that keeps failing yields: the writer may have
+   been preempted mid-write on the reader's CPU. Returns 1 if the slot
+   holds a room, 0 if it is empty. */
+static inline int room_view_read(RoomViewSlot *v, RoomView *out, uint64_t *retries) {
+    uint32_t w[ROOM_VIEW_WORDS];
+
+    for (unsigned spins = 0;; spins++) {
+        unsigned seq = atomic_load_explicit(&v->seq, memory_order_acquire);
+        if (!(seq & 1)) {
+            for (size_t i = 0; i < ROOM_VIEW_WORDS; i++) {
+                w[i] = atomic_load_explicit(&v->words[i], memory_order_relaxed);
+            }
+            atomic_thread_fence(memory_order_acquire);  /* words before the re-check */
+            if (atomic_load_explicit(&v->seq, memory_order_relaxed) == seq) break;
+        }
+        if (retries) (*retries)++;
+        if (spins % ROOM_VIEW_SPINS == ROOM_VIEW_SPINS - 1) sched_yield();
+    }
+
+    memcpy(out, w, sizeof(w));
+    return out->room != POOL_INVALID_HANDLE;
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* ROOM_VIEW_H */
@@ -0,0 +1,483 @@
+/* router_udp.c - One public UDP port in front of several Pong servers
+ *
+ * Clients talk to the router exactly as to a single server. Each datagram
+ * goes to the node that owns it (see cluster.h): frames by the node id in
+ * their token, joins by the placement table (matchmaking bucket -> node).
+ * Replies come back from the nodes with the client's address in front and
+ * leave through the public port. Datagrams move in batches (recvmmsg /
+ * sendmmsg). The stats report the time each one spends in the router, in
+ * two parts: waiting (kernel receive timestamp -> read by the router, i.e.
+ * wakeup and scheduling) and work (read -> handed to sendmmsg).
+ *
+ * Operator commands, one per datagram on 127.0.0.1:ROUTER_CONTROL_PORT:
+ *   place BUCKET NODE       new joins of that bucket go to NODE
+ *   move NODE ROOM TO_NODE  move a match from NODE to TO_NODE
+ *   status                  placement table and counters
+ * e.g.  echo "move 0 3 1" | nc -u -w1 127.0.0.1 12401
+ */
+#include "auth.h"
+#include "cluster.h"
+#include "frame.h"
+#include "hist.h"
+#include "lobby.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <poll.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#define ROUTER_PORT 12345
+#define BATCH 64                  /* datagrams per recvmmsg / sendmmsg */
+#define DATAGRAM_MAX CLUSTER_MSG_MAX
+#define POLL_TIMEOUT_MS 100
+#define STATS_INTERVAL_MS 5000
+
+/* What the router reads of the protocol (see server_udp.c) */
+enum {
+    MSG_CLIENT_JOIN_QUEUE = 5,
+    MSG_FRAME = 10
+};
+
+typedef struct {
+    uint8_t type;
+    uint8_t region;
+    uint8_t rtt_bucket;
+    uint8_t _pad;
+    uint64_t cookie;
+} __attribute__((packed)) JoinQueueMsg;
+
+typedef struct {
+    struct sockaddr_in addr;
+    uint64_t to_node;       /* datagrams forwarded to it */
+    uint64_t from_node;     /* datagrams relayed for it */
+} Node;
+
+/* A batch of datagrams on their way in or out. Incoming datagrams from the
+   nodes land with their RouteHeader split off into route[]. */
+typedef struct {
+    struct mmsghdr msgs[BATCH];
+    struct iovec iov[BATCH][2];
+    struct sockaddr_in addrs[BATCH];
+    RouteHeader route[BATCH];
+    uint64_t stamp_ns[BATCH];  /* kernel receive time of each datagram */
+    uint64_t read_ns[BATCH];   /* when the router read it */
+    union {
+        struct cmsghdr align;
+        char buf[CMSG_SPACE(sizeof(struct timespec))];
+    } ctl[BATCH];
+    uint8_t bufs[BATCH][DATAGRAM_MAX];
+    int count;
+} Batch;
+
+typedef struct {
+    int pub_fd;             /* clients */
+    int node_fd;            /* ROUTER_INTERNAL_PORT: the nodes */
+    int ctl_fd;             /* ROUTER_CONTROL_PORT */
+    int spin;               /* busy-poll instead of sleeping in poll() */
+
+    Node nodes[CLUSTER_MAX_NODES];
+    int node_count;
+    uint8_t placement[LOBBY_BUCKETS];
+
+    uint64_t unroutable;    /* unknown message, or a node id we do not have */
+    uint64_t foreign;       /* reached the node port from outside the cluster */
+    uint64_t send_failed;
+    uint64_t cluster_msgs;
+    uint64_t last_stats_ms;
+
+    /* Time in the router, per datagram, since the last stats line */
+    Hist wait;
+    Hist work;
+} Router;
+
+static uint64_t get_time_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + (uint64_t)ts.tv_nsec / 1000000;
+}
+
+/* Same clock as SO_TIMESTAMPNS */
+static uint64_t get_realtime_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+static int parse_addr(const char *text, struct sockaddr_in *addr) {
+    char ip[INET_ADDRSTRLEN];
+    int port;
+
+    memset(addr, 0, sizeof(*addr));
+    if (sscanf(text, "%15[0-9.]:%d", ip, &port) != 2 ||
+        inet_pton(AF_INET, ip, &addr->sin_addr) != 1 || port <= 0 || port > 65535) {
+        return -1;
+    }
+    addr->sin_family = AF_INET;
+    addr->sin_port = htons((uint16_t)port);
+    return 0;
+}
+
+static int open_socket(uint32_t ip, int port) {
+    struct sockaddr_in addr;
+    int one = 1;
+
+    int fd = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK, 0);
+    if (fd < 0) return -1;
+    setsockopt(fd, SOL_SOCKET, SO_TIMESTAMPNS, &one, sizeof(one));
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = ip;
+    addr.sin_port = htons((uint16_t)port);
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+/* Read up to BATCH datagrams. With split_route, the first bytes of each go
+   to route[] (datagrams from the nodes). Returns the count. */
+static int recv_batch(int fd, Batch *b, int split_route) {
+    for (int i = 0; i < BATCH; i++) {
+        struct msghdr *m = &b->msgs[i].msg_hdr;
+        int k = 0;
+        if (split_route) {
+            b->iov[i][k].iov_base = &b->route[i];
+            b->iov[i][k++].iov_len = sizeof(RouteHeader);
+        }
+        b->iov[i][k].iov_base = b->bufs[i];
+        b->iov[i][k++].iov_len = DATAGRAM_MAX;
+
+        m->msg_name = &b->addrs[i];
+        m->msg_namelen = sizeof(b->addrs[i]);
+        m->msg_iov = b->iov[i];
+        m->msg_iovlen = (size_t)k;
+        m->msg_control = b->ctl[i].buf;
+        m->msg_controllen = sizeof(b->ctl[i].buf);
+        m->msg_flags = 0;
+    }
+
+    int n = recvmmsg(fd, b->msgs, BATCH, MSG_DONTWAIT, NULL);
+    if (n <= 0) return 0;
+
+    uint64_t now_ns = get_realtime_ns();
+    for (int i = 0; i < n; i++) {
+        struct msghdr *m = &b->msgs[i].msg_hdr;
+        b->read_ns[i] = now_ns;
+        b->stamp_ns[i] = 0;
+        for (struct cmsghdr *c = CMSG_FIRSTHDR(m); c; c = CMSG_NXTHDR(m, c)) {
+            if (c->cmsg_level == SOL_SOCKET && c->cmsg_type == SCM_TIMESTAMPNS) {
+                struct timespec ts;
+                memcpy(&ts, CMSG_DATA(c), sizeof(ts));
+                b->stamp_ns[i] = (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+            }
+        }
+    }
+    return n;
+}
+
+/* Queue one datagram in an outgoing batch; route != NULL goes in front */
+static void out_add(Batch *out, const struct sockaddr_in *to, const RouteHeader *route,
+                    const void *data, size_t len, const Batch *in, int from) {
+    int i = out->count++;
+    int k = 0;
+
+    if (route) {
+        out->route[i] = *route;
+        out->iov[i][k].iov_base = &out->route[i];
+        out->iov[i][k++].iov_len = sizeof(RouteHeader);
+    }
+    out->iov[i][k].iov_base = (void *)data;
+    out->iov[i][k++].iov_len = len;
+    out->addrs[i] = *to;
+    out->stamp_ns[i] = in->stamp_ns[from];
+    out->read_ns[i] = in->read_ns[from];
+
+    struct msghdr *m = &out->msgs[i].msg_hdr;
+    memset(m, 0, sizeof(*m));
+    m->msg_name = &out->addrs[i];
+    m->msg_namelen = sizeof(out->addrs[i]);
+    m->msg_iov = out->iov[i];
+    m->msg_iovlen = (size_t)k;
+}
+
+/* Send a batch and record how long each datagram spent in the router. The
+   clock stops before the send: on loopback, sendmmsg may run the receiver
+   before it returns. */
+static void send_batch(Router *rt, int fd, Batch *out) {
+    uint64_t now_ns = get_realtime_ns();
+    int sent = 0;
+    while (sent < out->count) {
+        int n = sendmmsg(fd, out->msgs + sent, (unsigned)(out->count - sent), 0);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            rt->send_failed += (uint64_t)(out->count - sent);  /* full buffer: dropped */
+            break;
+        }
+        sent += n;
+    }
+
+    for (int i = 0; i < sent; i++) {
+        hist_add_span_ns(&rt->wait, out->stamp_ns[i], out->read_ns[i]);
+        hist_add_span_ns(&rt->work, out->read_ns[i], now_ns);
+    }
+    out->count = 0;
+}
+
+/* Node owning a client datagram, or -1 */
+static int route_client(const Router *rt, const uint8_t *buf, unsigned len) {
+    if (len >= sizeof(JoinQueueMsg) && buf[0] == MSG_CLIENT_JOIN_QUEUE) {
+        const JoinQueueMsg *msg = (const JoinQueueMsg *)buf;
+        return rt->placement[lobby_bucket(msg->region, msg->rtt_bucket)];
+    }
+    if (len >= sizeof(FrameHeader) && buf[0] == MSG_FRAME) {
+        FrameHeader hdr;
+        memcpy(&hdr, buf, sizeof(hdr));
+        uint8_t node = auth_token_node(hdr.conn_id);
+        return node < rt->node_count ? node : -1;
+    }
+    return -1;
+}
+
+/* Node a datagram on the node port came from, or -1 */
+static int find_node(const Router *rt, const struct sockaddr_in *addr) {
+    for (int i = 0; i < rt->node_count; i++) {
+        if (rt->nodes[i].addr.sin_addr.s_addr == addr->sin_addr.s_addr &&
+            rt->nodes[i].addr.sin_port == addr->sin_port) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+/* Clients -> nodes */
+static void pump_clients(Router *rt) {
+    static Batch in, out;
+
+    int n = recv_batch(rt->pub_fd, &in, 0);
+    for (int i = 0; i < n; i++) {
+        int node = route_client(rt, in.bufs[i], in.msgs[i].msg_len);
+        if (node < 0) {
+            rt->unroutable++;
+            continue;
+        }
+
+        RouteHeader route;
+        memset(&route, 0, sizeof(route));
+        route.ip = in.addrs[i].sin_addr.s_addr;
+        route.port = in.addrs[i].sin_port;
+        out_add(&out, &rt->nodes[node].addr, &route, in.bufs[i], in.msgs[i].msg_len, &in, i);
+        rt->nodes[node].to_node++;
+    }
+    if (out.count) send_batch(rt, rt->node_fd, &out);
+}
+
+/* Nodes -> clients, and cluster messages from node to node */
+static void pump_nodes(Router *rt) {
+    static Batch in, to_clients, to_nodes;
+
+    int n = recv_batch(rt->node_fd, &in, 1);
+    for (int i = 0; i < n; i++) {
+        int from = find_node(rt, &in.addrs[i]);
+        if (from < 0 || in.msgs[i].msg_len < sizeof(RouteHeader)) {
+            rt->foreign++;
+            continue;
+        }
+        size_t len = in.msgs[i].msg_len - sizeof(RouteHeader);
+        const RouteHeader *route = &in.route[i];
+
+        if (route->ip != 0) {
+            struct sockaddr_in client;
+            memset(&client, 0, sizeof(client));
+            client.sin_family = AF_INET;
+            client.sin_addr.s_addr = route->ip;
+            client.sin_port = route->port;
+            out_add(&to_clients, &client, NULL, in.bufs[i], len, &in, i);
+            rt->nodes[from].from_node++;
+            continue;
+        }
+
+        if (route->node >= rt->node_count) {
+            rt->unroutable++;
+            continue;
+        }
+        RouteHeader fwd;
+        memset(&fwd, 0, sizeof(fwd));
+        fwd.node = (uint8_t)from;
+        out_add(&to_nodes, &rt->nodes[route->node].addr, &fwd, in.bufs[i], len, &in, i);
+        rt->cluster_msgs++;
+    }
+    if (to_clients.count) send_batch(rt, rt->pub_fd, &to_clients);
+    if (to_nodes.count) send_batch(rt, rt->node_fd, &to_nodes);
+}
+
+/* Ask a node to move one of its matches */
+static void send_move(Router *rt, int node, uint32_t room, int to_node) {
+    RouteHeader route;
+    memset(&route, 0, sizeof(route));
+    route.node = (uint8_t)node;
+
+    ClusterHeader hdr;
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.op = CLUSTER_MOVE_ROOM;
+    hdr.from_node = (uint8_t)node;
+    hdr.to_node = (uint8_t)to_node;
+    hdr.room_id = htonl(room);
+
+    struct iovec iov[2] = { { &route, sizeof(route) }, { &hdr, sizeof(hdr) } };
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_name = &rt->nodes[node].addr;
+    msg.msg_namelen = sizeof(rt->nodes[node].addr);
+    msg.msg_iov = iov;
+    msg.msg_iovlen = 2;
+    if (sendmsg(rt->node_fd, &msg, 0) < 0) rt->send_failed++;
+}
+
+/* One operator command; the reply goes back to the sender */
+static void serve_control(Router *rt) {
+    char cmd[256], reply[1024];
+    struct sockaddr_in from;
+    socklen_t from_len = sizeof(from);
+
+    ssize_t n = recvfrom(rt->ctl_fd, cmd, sizeof(cmd) - 1, MSG_DONTWAIT,
+                         (struct sockaddr *)&from, &from_len);
+    if (n <= 0) return;
+    cmd[n] = '\0';
+
+    int a, b, c;
+    if (sscanf(cmd, "place %d %d", &a, &b) == 2) {
+        if (a < 0 || a >= LOBBY_BUCKETS || b < 0 || b >= rt->node_count) {
+            snprintf(reply, sizeof(reply), "error: bucket 0-%d, node 0-%d\n",
+                     LOBBY_BUCKETS - 1, rt->node_count - 1);
+        } else {
+            rt->placement[a] = (uint8_t)b;
+            snprintf(reply, sizeof(reply), "ok: bucket %d -> node %d\n", a, b);
+            printf("Placement: bucket %d -> node %d\n", a, b);
+        }
+    } else if (sscanf(cmd, "move %d %d %d", &a, &b, &c) == 3) {
+        if (a < 0 || a >= rt->node_count || c < 0 || c >= rt->node_count || a == c || b < 0) {
+            snprintf(reply, sizeof(reply), "error: nodes 0-%d, distinct\n", rt->node_count - 1);
+        } else {
+            send_move(rt, a, (uint32_t)b, c);
+            snprintf(reply, sizeof(reply), "ok: asked node %d to move room %d to node %d\n",
+                     a, b, c);
+            printf("Move: room %d of node %d -> node %d\n", b, a, c);
+        }
+    } else if (strncmp(cmd, "status", 6) == 0) {
+        int len = snprintf(reply, sizeof(reply), "placement:");
+        for (int i = 0; i < LOBBY_BUCKETS && len < (int)sizeof(reply) - 8; i++) {
+            len += snprintf(reply + len, sizeof(reply) - (size_t)len, " %u", rt->placement[i]);
+        }
+        for (int i = 0; i < rt->node_count && len < (int)sizeof(reply) - 64; i++) {
+            len += snprintf(reply + len, sizeof(reply) - (size_t)len,
+                            "\nnode %d: to=%llu from=%llu", i,
+                            (unsigned long long)rt->nodes[i].to_node,
+                            (unsigned long long)rt->nodes[i].from_node);
+        }
+        snprintf(reply + len, sizeof(reply) - (size_t)len, "\n");
+    } else {
+        snprintf(reply, sizeof(reply), "error: place BUCKET NODE | move NODE ROOM TO_NODE | status\n");
+    }
+    sendto(rt->ctl_fd, reply, strlen(reply), 0, (struct sockaddr *)&from, from_len);
+}
+
+static void lat_print(const char *name, const Hist *h) {
+    if (h->count == 0) return;
+    printf("[stats] time in router (%s): n=%llu p50=%uus p99=%uus p99.9=%uus max=%uus\n",
+           name, (unsigned long long)h->count, hist_percentile(h, 500),
+           hist_percentile(h, 990), hist_percentile(h, 999), h->max);
+}
+
+static void print_stats(Router *rt) {
+    printf("[stats] router: unroutable=%llu foreign=%llu send_failed=%llu cluster_msgs=%llu\n",
+           (unsigned long long)rt->unroutable, (unsigned long long)rt->foreign,
+           (unsigned long long)rt->send_failed, (unsigned long long)rt->cluster_msgs);
+    for (int i = 0; i < rt->node_count; i++) {
+        printf("[stats] node %d (%s:%d): to=%llu from=%llu\n", i,
+               inet_ntoa(rt->nodes[i].addr.sin_addr), ntohs(rt->nodes[i].addr.sin_port),
+               (unsigned long long)rt->nodes[i].to_node,
+               (unsigned long long)rt->nodes[i].from_node);
+    }
+    lat_print("wait", &rt->wait);
+    lat_print("work", &rt->work);
+    hist_reset(&rt->wait);
+    hist_reset(&rt->work);
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr, "Usage: %s [--port PORT] [--spin] --node IP:PORT [--node IP:PORT ...]\n", prog);
+    fprintf(stderr, "  --port PORT     public UDP port (default %d)\n", ROUTER_PORT);
+    fprintf(stderr, "  --spin          busy-poll the sockets (one core, lowest latency)\n");
+    fprintf(stderr, "  --node IP:PORT  a server started with --node-id <its position, from 0>\n"
+                    "                  --router <this host>:%d\n", ROUTER_INTERNAL_PORT);
+}
+
+int main(int argc, char *argv[]) {
+    static Router rt;
+    int port = ROUTER_PORT;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--port") == 0 && i + 1 < argc) {
+            port = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--spin") == 0) {
+            rt.spin = 1;
+        } else if (strcmp(argv[i], "--node") == 0 && i + 1 < argc &&
+                   rt.node_count < CLUSTER_MAX_NODES) {
+            if (parse_addr(argv[++i], &rt.nodes[rt.node_count].addr) < 0) {
+                usage(argv[0]);
+                return 1;
+            }
+            rt.node_count++;
+        } else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (rt.node_count == 0) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    /* Buckets spread over the nodes until the operator says otherwise */
+    for (int i = 0; i < LOBBY_BUCKETS; i++) {
+        rt.placement[i] = (uint8_t)(i % rt.node_count);
+    }
+
+    rt.pub_fd = open_socket(INADDR_ANY, port);
+    rt.node_fd = open_socket(INADDR_ANY, ROUTER_INTERNAL_PORT);
+    rt.ctl_fd = open_socket(htonl(INADDR_LOOPBACK), ROUTER_CONTROL_PORT);
+    if (rt.pub_fd < 0 || rt.node_fd < 0 || rt.ctl_fd < 0) {
+        perror("router: bind failed");
+        exit(EXIT_FAILURE);
+    }
+
+    printf("Pong router on port %d, %d nodes, control on 127.0.0.1:%d%s\n",
+           port, rt.node_count, ROUTER_CONTROL_PORT, rt.spin ? " (spinning)" : "");
+    rt.last_stats_ms = get_time_ms();
+
+    struct pollfd fds[3] = {
+        { rt.pub_fd, POLLIN, 0 }, { rt.node_fd, POLLIN, 0 }, { rt.ctl_fd, POLLIN, 0 }
+    };
+
+    while (1) {
+        if (!rt.spin) poll(fds, 3, POLL_TIMEOUT_MS);
+
+        pump_clients(&rt);
+        pump_nodes(&rt);
+        serve_control(&rt);
+
+        uint64_t now = get_time_ms();
+        if (now - rt.last_stats_ms >= STATS_INTERVAL_MS) {
+            print_stats(&rt);
+            rt.last_stats_ms = now;
+        }
+    }
+    return 0;
+}
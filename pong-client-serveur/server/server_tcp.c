@@ -1,293 +1,326 @@
 // server_tcp.c - Pong TCP server (authoritative)
-// Build: gcc server_tcp.c game.c -o server_tcp -lm
-// Run : ./server_tcp 5555
+// Build: make server_tcp
+// Run : ./server_tcp 5555 [tick_hz] [max_rooms]
+//
+// One epoll loop serves every connection through the TCP frontend
+// (tcp_front.c), which server_udp --tcp shares. Rooms, sessions and
+// matchmaking come from the same pools and lobby as the UDP server. A
+// timerfd ticks every live room at once, and a disconnect ends only the
+// room it happened in.
 
-#include <arpa/inet.h>
 #include <errno.h>
-#include <fcntl.h>
-#include <netinet/in.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <sys/select.h>
-#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
 #include <sys/time.h>
+#include <sys/timerfd.h>
+#include <time.h>
 #include <unistd.h>
 
+#include "binlog.h"
 #include "game.h"
+#include "lobby.h"
+#include "room.h"
+#include "tcp_front.h"
+
+#define DEFAULT_MAX_ROOMS 8192     /* 16384 connections; pools are sized once at startup */
+#define EPOLL_BATCH       256      /* events taken per epoll_wait() and per frontend poll */
+#define STATS_INTERVAL_MS 5000
+#define FD_RESERVE        16       /* descriptors besides the connections */
+#define LOBBY_NO_TIMEOUT  (UINT64_MAX / 2)  /* waiters leave by closing, not by silence */
+
+/* epoll_event.data.u64 of the two fds in the loop */
+#define EV_FRONT 1
+#define EV_TIMER 2
+
+typedef struct {
+    int epoll_fd;
+    int timer_fd;
+
+    RoomTable rooms;
+    Lobby lobby;
+    TcpFront tcp;             /* connection i plays as session tcp_client_addr(i) */
+
+    uint64_t ticks;
+    uint64_t ticks_missed;    /* timer expirations folded into one tick */
+    uint32_t tick_max_us;     /* per stats window */
+    uint64_t last_stats_ms;
+
+    uint64_t rooms_ended;     /* by a disconnect */
+} Server;
+
+static uint64_t get_time_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + (uint64_t)ts.tv_nsec / 1000000;
+}
 
-#define MAX_CLIENTS 2
-#define TICK_HZ 60
-#define TICK_US (1000000 / TICK_HZ)
-
-static int send_all(int fd, const void *buf, size_t len) {
-    const uint8_t *p = (const uint8_t *)buf;
-    size_t sent = 0;
-    while (sent < len) {
-        ssize_t n = send(fd, p + sent, len - sent, 0);
-        if (n <= 0) return -1;
-        sent += (size_t)n;
-    }
-    return 0;
+static uint64_t get_time_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + (uint64_t)ts.tv_nsec / 1000;
 }
 
-static int recv_all(int fd, void *buf, size_t len) {
-    uint8_t *p = (uint8_t *)buf;
-    size_t recvd = 0;
-    while (recvd < len) {
-        ssize_t n = recv(fd, p + recvd, len - recvd, 0);
-        if (n == 0) return 0;      // disconnect
-        if (n < 0) return -1;      // error
-        recvd += (size_t)n;
+/* Raise the descriptor limit as far as the hard limit allows. Returns the
+   descriptors available. */
+static rlim_t raise_fd_limit(rlim_t want) {
+    struct rlimit rl;
+    if (getrlimit(RLIMIT_NOFILE, &rl) < 0) return 0;
+    if (rl.rlim_cur < want) {
+        rl.rlim_cur = (rl.rlim_max == RLIM_INFINITY || rl.rlim_max >= want) ? want : rl.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &rl);
+        getrlimit(RLIMIT_NOFILE, &rl);
     }
-    return 1; // success
+    return rl.rlim_cur;
+}
+
+static PoolHandle conn_session(Server *srv, uint32_t conn) {
+    struct sockaddr_in addr = tcp_client_addr(conn);
+    return session_find(&srv->rooms, &addr);
 }
 
-/* ---------- Simple binary protocol (fixed-size messages) ---------- */
-
-enum { MSG_HELLO = 1, MSG_INPUT = 2, MSG_STATE = 3 };
-
-/* Client -> Server */
-typedef struct __attribute__((packed)) {
-    uint8_t type;      // MSG_INPUT
-    uint8_t player_id; // 1 or 2
-    uint8_t dir;       // 0 none, 1 up, 2 down
-    uint8_t _pad;
-} MsgInput;
-
-/* Server -> Client */
-typedef struct __attribute__((packed)) {
-    uint8_t type;      // MSG_HELLO
-    uint8_t player_id; // 1 or 2
-    uint16_t _pad;
-} MsgHello;
-
-/* Quantized state (avoid float endianness issues) */
-typedef struct __attribute__((packed)) {
-    uint16_t tick;          // wraps (network order)
-    int16_t ball_x;         // x * 100
-    int16_t ball_y;         // y * 100
-    int16_t paddle_left_y;  // y * 100
-    int16_t paddle_right_y; // y * 100
-    uint16_t score_left;
-    uint16_t score_right;
-    uint16_t field_w;       // *100
-    uint16_t field_h;       // *100
-    uint16_t paddle_h;      // *100
-    uint16_t ball_size;     // *100
-} NetState;
-
-typedef struct __attribute__((packed)) {
-    uint8_t type; // MSG_STATE
-    uint8_t _pad;
-    uint16_t size; // sizeof(NetState) (network order)
-    NetState st;   // all fields network order
-} MsgState;
-
-static uint16_t u16_net(uint16_t x) { return htons(x); }
-static uint16_t u16_host(uint16_t x) { return ntohs(x); }
-
-static uint16_t s16_net(int16_t x) { return htons((uint16_t)x); }
-static int16_t  s16_host(uint16_t x) { return (int16_t)ntohs(x); }
-
-static int16_t q100(float v) {
-    int32_t t = (int32_t)(v * 100.0f);
-    if (t < -32768) t = -32768;
-    if (t >  32767) t =  32767;
-    return (int16_t)t;
+static uint32_t session_conn(Server *srv, PoolHandle sh) {
+    return (uint32_t)tcp_addr_client(&session_get(&srv->rooms, sh)->addr);
 }
 
-static uint16_t uq100(float v) {
-    int32_t t = (int32_t)(v * 100.0f);
-    if (t < 0) t = 0;
-    if (t > 65535) t = 65535;
-    return (uint16_t)t;
+/* Close the connection and release its session (out of the lobby and of
+   its room first). Its room is left to the caller. */
+static void drop_conn(Server *srv, PoolHandle sh) {
+    tcp_front_drop(&srv->tcp, session_conn(srv, sh));
+    lobby_remove(&srv->lobby, &srv->rooms, sh);
+    session_leave(&srv->rooms, sh);
 }
 
-static void fill_netstate(NetState *ns, const GameState *g) {
-    ns->tick = u16_net((uint16_t)g->tick);
+/* A connection is gone: a queued player just leaves; a player ends the
+   match, and the opponent's connection is closed with it (the protocol has
+   no way to tell it to wait for someone else). Other rooms carry on. */
+static void end_conn(Server *srv, PoolHandle sh) {
+    Session *s = session_get(&srv->rooms, sh);
+    if (!s) return;  /* already ended, with its room */
+
+    binlog(LOG_TCP_CLIENT_LEFT, session_conn(srv, sh));
+    Room *r = room_get(&srv->rooms, s->room);
+    if (!r) {
+        drop_conn(srv, sh);
+        return;
+    }
 
-    ns->ball_x = s16_net(q100(g->ball_x));
-    ns->ball_y = s16_net(q100(g->ball_y));
+    PoolHandle rh = s->room;
+    PoolHandle opp = r->players[s->slot ^ 1];
+    binlog(LOG_TCP_ROOM_ENDED, pool_handle_index(rh), session_conn(srv, sh));
+    drop_conn(srv, sh);
+    if (opp != POOL_INVALID_HANDLE) drop_conn(srv, opp);  /* releases the room */
+    srv->rooms_ended++;
+}
 
-    ns->paddle_left_y  = s16_net(q100(g->paddle_left_y));
-    ns->paddle_right_y = s16_net(q100(g->paddle_right_y));
+/* Both players are seated: each gets its HELLO (player id from its slot,
+   and the room's rules), and the match starts with the next tick */
+static void start_match(Server *srv, PoolHandle rh) {
+    Room *r = room_get(&srv->rooms, rh);
+    if (!r) return;
+
+    GameRules rules;
+    game_rules_of(&r->game, &rules);
+
+    binlog(LOG_MATCH_STARTED, pool_handle_index(rh));
+    for (int i = 0; i < ROOM_PLAYERS; i++) {
+        PoolHandle sh = r->players[i];
+        if (tcp_front_hello(&srv->tcp, session_conn(srv, sh), (uint8_t)i, &rules) < 0) {
+            end_conn(srv, sh);
+            return;
+        }
+    }
+}
 
-    ns->score_left  = u16_net((uint16_t)g->score_left);
-    ns->score_right = u16_net((uint16_t)g->score_right);
+/* A new connection gets a session, then joins the lobby */
+static void open_conn(Server *srv, uint32_t conn) {
+    struct sockaddr_in addr = tcp_client_addr(conn);
+    uint64_t now = get_time_ms();
+    PoolHandle sh = session_create(&srv->rooms, &addr, now);
+    if (sh == POOL_INVALID_HANDLE) {
+        tcp_front_drop(&srv->tcp, conn);
+        return;
+    }
 
-    ns->field_w   = u16_net(uq100(g->field_w));
-    ns->field_h   = u16_net(uq100(g->field_h));
-    ns->paddle_h  = u16_net(uq100(g->paddle_h));
-    ns->ball_size = u16_net(uq100(g->ball_size));
+    PoolHandle rh = lobby_join(&srv->lobby, &srv->rooms, sh, 0, now, LOBBY_NO_TIMEOUT);
+    if (rh != POOL_INVALID_HANDLE) start_match(srv, rh);
 }
 
-static PlayerInput dir_to_input(uint8_t dir) {
-    if (dir == 1) return INPUT_UP;
-    if (dir == 2) return INPUT_DOWN;
-    return INPUT_NONE;
+static void serve_conns(Server *srv) {
+    TcpEvent events[EPOLL_BATCH];
+    uint32_t n = tcp_front_poll(&srv->tcp, events, EPOLL_BATCH);
+
+    for (uint32_t i = 0; i < n; i++) {
+        TcpEvent *ev = &events[i];
+        if (ev->type == TCP_EV_OPEN) {
+            open_conn(srv, ev->conn);
+            continue;
+        }
+
+        PoolHandle sh = conn_session(srv, ev->conn);
+        if (sh == POOL_INVALID_HANDLE) continue;  /* ended earlier in this batch */
+        if (ev->type == TCP_EV_CLOSED) {
+            end_conn(srv, sh);
+            continue;
+        }
+        Session *s = session_get(&srv->rooms, sh);
+        s->input = (PlayerInput)ev->input;
+        s->last_seen_ms = get_time_ms();
+    }
 }
 
-static int make_server_socket(uint16_t port) {
-    int fd = socket(AF_INET, SOCK_STREAM, 0);
-    if (fd < 0) return -1;
+static void print_stats(Server *srv) {
+    binlog(LOG_TCP_STATS, srv->tcp.open_count, srv->rooms.live_count, srv->lobby.waiting,
+           srv->tick_max_us, (uint32_t)srv->ticks_missed);
+    tcp_front_log_stats(&srv->tcp);
+    srv->tick_max_us = 0;
+}
 
-    int yes = 1;
-    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
+/* One tick for every live room: step, then the state to both players.
+   Backwards: a room that ends during the pass is swapped with the last one. */
+static void tick(Server *srv) {
+    uint64_t expirations = 0;
+    if (read(srv->timer_fd, &expirations, sizeof(expirations)) != sizeof(expirations)) return;
+    if (expirations > 1) srv->ticks_missed += expirations - 1;  /* no catching up */
+    srv->ticks++;
+    uint64_t start_us = get_time_us();
+
+    RoomTable *t = &srv->rooms;
+    for (uint32_t i = t->live_count; i-- > 0; ) {
+        PoolHandle rh = t->live[i];
+        Room *r = room_get(t, rh);
+        Session *left = session_get(t, r->players[0]);
+        Session *right = session_get(t, r->players[1]);
+
+        game_step(&r->game, left->input, right->input);
+        r->state = (r->game.serve_wait > 0) ? ROOM_SERVING : ROOM_LIVE;
+
+        for (int p = 0; p < ROOM_PLAYERS; p++) {
+            PoolHandle sh = r->players[p];
+            if (tcp_front_state(&srv->tcp, session_conn(srv, sh), &r->game) < 0) {
+                end_conn(srv, sh);
+                break;
+            }
+        }
+    }
 
-    struct sockaddr_in addr;
-    memset(&addr, 0, sizeof(addr));
-    addr.sin_family = AF_INET;
-    addr.sin_addr.s_addr = htonl(INADDR_ANY);
-    addr.sin_port = htons(port);
+    uint32_t tick_us = (uint32_t)(get_time_us() - start_us);
+    if (tick_us > srv->tick_max_us) srv->tick_max_us = tick_us;
 
-    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
-        close(fd);
-        return -1;
+    uint64_t now = get_time_ms();
+    if (now - srv->last_stats_ms >= STATS_INTERVAL_MS) {
+        print_stats(srv);
+        srv->last_stats_ms = now;
     }
-    if (listen(fd, 8) < 0) {
+}
+
+static int start_timer(uint32_t tick_hz) {
+    int fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK);
+    if (fd < 0) return -1;
+
+    struct itimerspec its;
+    memset(&its, 0, sizeof(its));
+    its.it_interval.tv_nsec = 1000000000L / tick_hz;
+    its.it_value = its.it_interval;
+    if (timerfd_settime(fd, 0, &its, NULL) < 0) {
         close(fd);
         return -1;
     }
     return fd;
 }
 
-static void set_nonblocking(int fd) {
-    int flags = fcntl(fd, F_GETFL, 0);
-    if (flags >= 0) fcntl(fd, F_SETFL, flags | O_NONBLOCK);
-}
-
 int main(int argc, char **argv) {
-    if (argc != 2) {
-        fprintf(stderr, "Usage: %s <port>\n", argv[0]);
+    static Server srv;
+
+    if (argc < 2 || argc > 4) {
+        fprintf(stderr, "Usage: %s <port> [tick_hz (%d-%d, default %d)] [max_rooms (default %d)]\n",
+                argv[0], GAME_TICK_HZ_MIN, GAME_TICK_HZ_MAX, GAME_TICK_HZ, DEFAULT_MAX_ROOMS);
         return 1;
     }
     uint16_t port = (uint16_t)atoi(argv[1]);
-
-    int server_fd = make_server_socket(port);
-    if (server_fd < 0) {
-        perror("server socket");
+    int tick_hz = (argc >= 3) ? atoi(argv[2]) : GAME_TICK_HZ;
+    if (tick_hz < GAME_TICK_HZ_MIN || tick_hz > GAME_TICK_HZ_MAX) {
+        fprintf(stderr, "tick_hz must be between %d and %d\n", GAME_TICK_HZ_MIN, GAME_TICK_HZ_MAX);
         return 1;
     }
-
-    printf("[server] Listening on port %u...\n", port);
-
-    int client_fd[MAX_CLIENTS] = { -1, -1 };
-    uint8_t client_id[MAX_CLIENTS] = { 1, 2 };
-
-    // Accept exactly 2 clients
-    for (int i = 0; i < MAX_CLIENTS; i++) {
-        struct sockaddr_in caddr;
-        socklen_t clen = sizeof(caddr);
-        int cfd = accept(server_fd, (struct sockaddr *)&caddr, &clen);
-        if (cfd < 0) {
-            perror("accept");
-            close(server_fd);
-            return 1;
-        }
-        client_fd[i] = cfd;
-
-        char ip[64];
-        inet_ntop(AF_INET, &caddr.sin_addr, ip, sizeof(ip));
-        printf("[server] Client %d connected from %s:%u\n",
-               i + 1, ip, (unsigned)ntohs(caddr.sin_port));
-
-        // Send HELLO with assigned player_id (1 for first, 2 for second)
-        MsgHello hello;
-        memset(&hello, 0, sizeof(hello));
-        hello.type = MSG_HELLO;
-        hello.player_id = client_id[i];
-        if (send_all(cfd, &hello, sizeof(hello)) != 0) {
-            fprintf(stderr, "[server] failed to send HELLO\n");
-            close(cfd);
-            close(server_fd);
-            return 1;
-        }
-
-        // Non-blocking clients for input polling
-        // (fcntl needs <fcntl.h>; we avoid it by using select only on blocking fds,
-        // but nonblocking is still helpful. If you want: include <fcntl.h> and call set_nonblocking.)
+    int max_rooms = (argc == 4) ? atoi(argv[3]) : DEFAULT_MAX_ROOMS;
+    if (max_rooms <= 0 || (uint32_t)max_rooms * ROOM_PLAYERS > POOL_MAX_CAPACITY) {
+        fprintf(stderr, "max_rooms must be between 1 and %u\n", POOL_MAX_CAPACITY / ROOM_PLAYERS);
+        return 1;
     }
 
-    printf("[server] Two clients connected. Starting game loop @ %d Hz\n", TICK_HZ);
+    /* One descriptor per connection: fewer rooms if the limit is lower */
+    rlim_t fds = raise_fd_limit((rlim_t)max_rooms * ROOM_PLAYERS + FD_RESERVE);
+    if (fds < (rlim_t)max_rooms * ROOM_PLAYERS + FD_RESERVE) {
+        int fit = fds > FD_RESERVE + ROOM_PLAYERS ? (int)((fds - FD_RESERVE) / ROOM_PLAYERS) : 1;
+        fprintf(stderr, "[server] descriptor limit %llu: %d rooms instead of %d\n",
+                (unsigned long long)fds, fit, max_rooms);
+        max_rooms = fit;
+    }
 
-    GameState g;
-    game_init(&g);
+    /* Preallocate every room, session and connection */
+    if (room_table_init(&srv.rooms, (uint32_t)max_rooms) < 0) {
+        fprintf(stderr, "cannot allocate pools for %d rooms\n", max_rooms);
+        return 1;
+    }
+    /* Every client gets the rules in its HELLO: nothing to rebuild for
+       another tick rate */
+    game_rules_default(&srv.rooms.rules, (uint32_t)tick_hz);
+    lobby_init(&srv.lobby);
 
-    uint8_t last_dir_p1 = 0; // 0 none, 1 up, 2 down
-    uint8_t last_dir_p2 = 0;
+    uint32_t max_conns = srv.rooms.sessions.capacity;
+    if (tcp_front_open(&srv.tcp, port, max_conns) < 0) {
+        perror("server socket");
+        return 1;
+    }
+    srv.epoll_fd = epoll_create1(0);
+    srv.timer_fd = start_timer((uint32_t)tick_hz);
+    if (srv.epoll_fd < 0 || srv.timer_fd < 0) {
+        perror("epoll / timerfd");
+        return 1;
+    }
 
-    struct timeval last_tv;
-    gettimeofday(&last_tv, NULL);
+    /* The frontend's own epoll set is readable while it has work */
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN;
+    ev.data.u64 = EV_FRONT;
+    epoll_ctl(srv.epoll_fd, EPOLL_CTL_ADD, srv.tcp.epoll_fd, &ev);
+    ev.data.u64 = EV_TIMER;
+    epoll_ctl(srv.epoll_fd, EPOLL_CTL_ADD, srv.timer_fd, &ev);
+
+    printf("[server] Listening on port %u: up to %u connections, %d rooms @ %d Hz\n",
+           port, max_conns, max_rooms, tick_hz);
+
+    // From here on, log through the async event log: the loop never
+    // waits on stdout
+    if (binlog_start(NULL) < 0) {
+        fprintf(stderr, "[server] cannot start the event log\n");
+    }
+    srv.last_stats_ms = get_time_ms();
 
+    struct epoll_event events[2];
     while (1) {
-        // --- Poll inputs (non-blocking) ---
-        fd_set rfds;
-        FD_ZERO(&rfds);
-        int maxfd = -1;
-        for (int i = 0; i < MAX_CLIENTS; i++) {
-            FD_SET(client_fd[i], &rfds);
-            if (client_fd[i] > maxfd) maxfd = client_fd[i];
-        }
-
-        struct timeval tv;
-        tv.tv_sec = 0;
-        tv.tv_usec = 0; // pure polling
-        int ready = select(maxfd + 1, &rfds, NULL, NULL, &tv);
-        if (ready < 0) {
-            perror("select");
+        int n = epoll_wait(srv.epoll_fd, events, 2, -1);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            perror("epoll_wait");
             break;
         }
 
-        for (int i = 0; i < MAX_CLIENTS; i++) {
-            if (!FD_ISSET(client_fd[i], &rfds)) continue;
-
-            MsgInput in;
-            int r = recv_all(client_fd[i], &in, sizeof(in));
-            if (r == 0) {
-                printf("[server] client %d disconnected\n", i + 1);
-                goto shutdown;
-            }
-            if (r < 0) {
-                // if it's EAGAIN in real nonblocking, you'd ignore. Here recv_all blocks.
-                perror("recv");
-                goto shutdown;
-            }
-
-            if (in.type != MSG_INPUT) continue;
-            if (in.player_id == 1) last_dir_p1 = in.dir;
-            if (in.player_id == 2) last_dir_p2 = in.dir;
+        for (int i = 0; i < n; i++) {
+            if (events[i].data.u64 == EV_TIMER) tick(&srv);
+            else serve_conns(&srv);
         }
-
-        // --- Advance game @ fixed dt ---
-        PlayerInput p1 = dir_to_input(last_dir_p1);
-        PlayerInput p2 = dir_to_input(last_dir_p2);
-
-        game_step(&g, p1, p2);
-
-        // --- Broadcast state ---
-        MsgState out;
-        memset(&out, 0, sizeof(out));
-        out.type = MSG_STATE;
-        out.size = u16_net((uint16_t)sizeof(NetState));
-        fill_netstate(&out.st, &g);
-
-        for (int i = 0; i < MAX_CLIENTS; i++) {
-            if (send_all(client_fd[i], &out, sizeof(out)) != 0) {
-                printf("[server] send failed, client %d\n", i + 1);
-                goto shutdown;
-            }
-        }
-
-        // --- Sleep to maintain tick rate ---
-        usleep(TICK_US);
     }
 
-shutdown:
-    for (int i = 0; i < MAX_CLIENTS; i++) {
-        if (client_fd[i] >= 0) close(client_fd[i]);
-    }
-    close(server_fd);
+    binlog_stop();
+    tcp_front_close(&srv.tcp);
+    close(srv.timer_fd);
+    close(srv.epoll_fd);
+    room_table_destroy(&srv.rooms);
     return 0;
 }
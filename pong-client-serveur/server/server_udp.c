@@ -1,52 +1,191 @@
 /* server_udp.c - Pong UDP Server */
+#include "auth.h"
+#include "binlog.h"
+#include "cluster.h"
+#include "frame.h"
 #include "game.h"
+#include "handoff.h"
+#include "hist.h"
+#include "lobby.h"
+#include "lowlat.h"
+#include "overload.h"
+#include "ratelimit.h"
+#include "reliable.h"
+#include "room.h"
+#include "shm_link.h"
+#include "spsc_ring.h"
+#include "tcp_front.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/resource.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <sys/time.h>
+#include <time.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <linux/net_tstamp.h>
 
 #define SERVER_PORT 12345
-#define BUFFER_SIZE 1024
-#define TICK_INTERVAL_MS 16  /* ~60 Hz (16.67 ms) */
+#define BUFFER_SIZE CLUSTER_MSG_MAX  /* room snapshots from other nodes are the largest */
 #define CLIENT_TIMEOUT_MS 5000
-#define MAX_CLIENTS 2
+#define DEFAULT_MAX_ROOMS 1024   /* pools are sized once at startup */
 
-/* Protocol message types */
+/* Pipeline mode (I/O thread + simulation thread) */
+#define RING_CAPACITY 1024        /* records per ring, power of two */
+#define RX_BATCH 64               /* max datagrams read before flushing outbound */
+#define IO_WAIT_MS 10             /* I/O thread's longest sleep with nothing to do */
+#define OUT_RECORD_MAX FRAME_MAX  /* largest encoded datagram the sim thread emits */
+#define STATS_INTERVAL_MS 5000
+
+/* Per-source flood shedding, applied before a datagram is parsed */
+#define RATE_TABLE_ENTRIES 16384  /* sources tracked at once (LRU-ish beyond that) */
+#define DEFAULT_RATE_PPS 200      /* a client sends at most ~60 inputs/s + keepalives */
+#define RATE_BURST 100
+#define RX_BUDGET 256             /* single-thread mode: datagrams read per pass */
+#define RX_CHUNKS_MAX 16          /* chunks taken from one client frame, the rest ignored */
+#define CLUSTER_RING_CAPACITY 16  /* pipeline mode: cluster messages waiting for the sim thread */
+#define LOCKSTEP_BATCH 6          /* ticks per input batch to a lockstep session */
+#define LOCKSTEP_KEYFRAME_MS 5000 /* full state to a lockstep session at least this often */
+#define LAGCOMP_MAX_TICKS 6       /* furthest a paddle hit is rewound (100 ms at 60 Hz); < ROOM_REWIND_TICKS */
+#define PACE_SLOT_US 1000         /* pacing: rooms' send slots (and burst buckets) are 1 ms apart */
+#define BURST_BUCKETS (1000000 / GAME_TICK_HZ_MIN / PACE_SLOT_US)  /* buckets in the longest tick */
+#define TCP_EVENT_BATCH 256       /* --tcp: frontend events applied per pass */
+#define TCP_SWEEP_MS 1000         /* --tcp: open connections refresh their sessions this often */
+
+/* Hot restart snapshot (see handoff.h) */
+#define HANDOFF_MAGIC 0x504F4E47u /* "PONG" */
+#define HANDOFF_VERSION 6
+#define HANDOFF_BUF 65536         /* snapshot bytes batched per write */
+
+/* Protocol message types. The handshake travels in its own datagrams; once
+   joined, everything goes in frames (2-4, 8 and 9 were the single-message
+   types that chunks replaced). */
 typedef enum {
-    MSG_CLIENT_CONNECT = 1,
-    MSG_CLIENT_INPUT = 2,
-    MSG_SERVER_STATE = 3,
-    MSG_CLIENT_DISCONNECT = 4
+    MSG_CLIENT_CONNECT = 1,      /* legacy: cannot carry a cookie, ignored */
+    MSG_CLIENT_JOIN_QUEUE = 5,
+    MSG_SERVER_JOINED = 6,
+    MSG_SERVER_COOKIE = 7,
+    MSG_FRAME = 10               /* both directions, see frame.h */
 } MessageType;
 
-/* Client connection info */
+/* Chunk types inside a MSG_FRAME */
+enum {
+    CHUNK_INPUT = 1,             /* client -> server: InputChunk */
+    CHUNK_ACK = 2,               /* both: RelAck for the peer's reliable messages */
+    CHUNK_RELIABLE = 3,          /* both: RelChunk, see reliable.h */
+    CHUNK_STATE = 4,             /* server -> client: StateChunk */
+    CHUNK_PING = 5,              /* client -> server: PingChunk */
+    CHUNK_PONG = 6,              /* server -> client: PongChunk */
+    CHUNK_DISCONNECT = 7,        /* client -> server: no payload (unreliable leave) */
+    CHUNK_INPUTS = 8,            /* server -> client (lockstep): InputsChunk */
+    CHUNK_KEYFRAME = 9,          /* server -> client (lockstep): KeyframeChunk */
+    CHUNK_RESYNC = 10            /* client -> server (lockstep): no payload, send a keyframe */
+};
+
+/* Reliable message kinds (RelChunk.kind) */
+enum {
+    REL_EV_MATCHED = 1,          /* server -> client: MatchedEvent */
+    REL_EV_OPPONENT_LEFT = 2,    /* server -> client: no payload */
+    REL_EV_POINT = 3,            /* server -> client: PointEvent */
+    REL_EV_REKEY = 4,            /* server -> client: RekeyEvent */
+    REL_CTL_LEAVE = 16           /* client -> server: no payload */
+};
+
+/* MSG_SERVER_JOINED status */
+enum { JOIN_QUEUED = 0, JOIN_MATCHED = 1 };
+
+/* JoinQueueMsg.flags / JoinedMsg.flags */
+enum {
+    JOIN_LOCKSTEP = 1   /* join: the client can replay inputs; joined: it will get them */
+};
+
+/* Message structures. Cookies and tokens are opaque 8-byte values for the
+   client (see auth.h): it echoes them back unchanged (the token as the
+   frame's conn_id). The session key comes with the token; every frame
+   carries a MAC under it (see frame.h). */
 typedef struct {
-    struct sockaddr_in addr;
-    socklen_t addr_len;
-    int active;
-    uint64_t last_seen_ms;
-    PlayerInput current_input;
-} ClientInfo;
+    uint8_t input;        /* PlayerInput enum */
+    uint32_t seen_tick;   /* tick of the latest state the client showed, as sent
+                             in StateChunk (lag compensation). Optional: a
+                             1-byte chunk (older clients) carries only input. */
+} __attribute__((packed)) InputChunk;
+
+typedef struct {
+    uint32_t stamp;     /* client clock, echoed as is */
+} __attribute__((packed)) PingChunk;
+
+/* The pong may wait for the session's next frame: hold_ms says how long, so
+   the client can take it out of its RTT sample */
+typedef struct {
+    uint32_t stamp;
+    uint16_t hold_ms;   /* network order */
+} __attribute__((packed)) PongChunk;
+
+typedef struct {
+    uint8_t slot;
+    uint8_t _pad[3];
+    uint32_t room_id;    /* network order */
+} __attribute__((packed)) MatchedEvent;
+
+typedef struct {
+    uint16_t score_left;   /* network order */
+    uint16_t score_right;
+} __attribute__((packed)) PointEvent;
 
-/* Message structures */
+/* The match moved to this node: the session's token and key here. Sent
+   reliably in frames under the token and key the client already has, so
+   only the server that holds them can move it; from its next frame on,
+   both sides use the new ones. */
+typedef struct {
+    uint64_t token;
+    uint8_t  key[FRAME_KEY_SIZE];
+    uint32_t room_id;    /* network order */
+    uint8_t  flags;      /* JOIN_LOCKSTEP */
+} __attribute__((packed)) RekeyEvent;
+
+_Static_assert(sizeof(RekeyEvent) <= REL_PAYLOAD_MAX, "RekeyEvent does not fit a reliable message");
+
+/* Ask to be matched. Without a valid cookie the server only answers with a
+   MSG_SERVER_COOKIE; the join is resent with it. */
 typedef struct {
     uint8_t type;
-    uint8_t player_id;
-} __attribute__((packed)) ConnectMsg;
+    uint8_t region;      /* matchmaking region tag */
+    uint8_t rtt_bucket;  /* coarse RTT class measured by the client */
+    uint8_t flags;       /* JOIN_LOCKSTEP */
+    uint64_t cookie;     /* 0 on first contact */
+} __attribute__((packed)) JoinQueueMsg;
 
+/* Stateless challenge: no larger than the join it answers */
 typedef struct {
     uint8_t type;
-    uint8_t player_id;
-    uint8_t input;  /* PlayerInput enum */
-} __attribute__((packed)) InputMsg;
+    uint8_t _pad[3];
+    uint64_t cookie;
+} __attribute__((packed)) CookieMsg;
+
+_Static_assert(sizeof(CookieMsg) <= sizeof(JoinQueueMsg), "cookie reply must not amplify");
 
+/* Reply to a join: sent when queued, and again to both players once matched */
 typedef struct {
     uint8_t type;
+    uint8_t status;      /* JOIN_QUEUED / JOIN_MATCHED */
+    uint8_t player_id;   /* 0 = left paddle, 1 = right paddle (when matched) */
+    uint8_t flags;       /* JOIN_LOCKSTEP */
+    uint32_t room_id;    /* network order */
+    uint64_t token;      /* session token, the conn_id of every frame */
+    uint8_t key[FRAME_KEY_SIZE];  /* session key, MACs the frames both ways */
+    GameRules rules;     /* of the room when matched, else of the rooms this
+                            server opens: clients predict and draw from it */
+} __attribute__((packed)) JoinedMsg;
+
+typedef struct {
     float ball_x;
     float ball_y;
     float paddle_left_y;
@@ -56,7 +195,301 @@ typedef struct {
     uint32_t tick;
     uint8_t player0_connected;  /* 1 if player 0 is active, 0 otherwise */
     uint8_t player1_connected;  /* 1 if player 1 is active, 0 otherwise */
-} __attribute__((packed)) StateMsg;
+} __attribute__((packed)) StateChunk;
+
+/* Lockstep sessions get no StateChunk: they step the game themselves from
+   both players' inputs, LOCKSTEP_BATCH ticks at a time. Each batch repeats
+   the steps of the one before (a lost datagram costs nothing) and ends with
+   a checksum of the server's state; a client that cannot follow (a gap, a
+   mismatch) asks for a keyframe. */
+typedef struct {
+    uint32_t tick;       /* game tick after the last step listed */
+    uint32_t checksum;   /* game_checksum() at that tick */
+    uint8_t count;       /* steps listed, oldest first */
+    uint8_t steps[ROOM_REWIND_TICKS];   /* ROOM_STEP() each */
+} __attribute__((packed)) InputsChunk;
+
+#define INPUTS_CHUNK_HEADER (sizeof(InputsChunk) - ROOM_REWIND_TICKS)
+
+/* The whole game: sent when a match starts, every LOCKSTEP_KEYFRAME_MS,
+   when the server did something the inputs do not show (a lag-compensated
+   hit, a player gone) and on request */
+typedef struct {
+    GameState game;
+    uint8_t player0_connected;
+    uint8_t player1_connected;
+} __attribute__((packed)) KeyframeChunk;
+
+/* Where an input's latency goes, from the kernel to the state it produced.
+   Stamps are CLOCK_REALTIME ns, the clock of SO_TIMESTAMPNS. */
+enum {
+    LAT_RX_PARSE,     /* kernel receive -> parsed (time in the socket queue) */
+    LAT_PARSE_TICK,   /* parsed -> the tick that applied it */
+    LAT_TICK_SEND,    /* that tick -> the resulting snapshot handed to the socket */
+    LAT_STAGES
+};
+
+/* Parsed message (I/O side -> simulation side): a join, or one chunk of a
+   frame */
+typedef struct {
+    struct sockaddr_in addr;
+    uint64_t recv_ms;
+    uint64_t parse_ns;
+    uint8_t type;        /* MSG_CLIENT_JOIN_QUEUE or MSG_FRAME */
+    uint8_t chunk;       /* chunk type (frames) */
+    uint8_t frame_start; /* first chunk of its frame: frame_seq is new */
+    uint32_t frame_seq;
+    uint8_t input;
+    uint32_t seen_tick;  /* CHUNK_INPUT, 0 = not sent */
+    uint8_t region;
+    uint8_t rtt_bucket;
+    uint8_t join_flags;
+    PoolHandle session;  /* from the frame's checked token */
+    RelAck ack;          /* CHUNK_ACK */
+    uint32_t ping;       /* CHUNK_PING */
+    uint16_t rel_seq;    /* CHUNK_RELIABLE */
+    uint8_t rel_kind;
+    uint8_t rel_len;
+    uint8_t rel_data[REL_PAYLOAD_MAX];
+} InputRecord;
+
+/* Encoded datagram (simulation side -> I/O side) */
+typedef struct {
+    struct sockaddr_in addr;
+    uint64_t tick_ns;    /* tick whose inputs this snapshot shows, 0 = none */
+    uint64_t due_us;     /* departure for the kernel (--txtime), 0 = now */
+    uint16_t len;
+    uint8_t data[OUT_RECORD_MAX];
+} OutRecord;
+
+_Static_assert(sizeof(JoinedMsg) <= OUT_RECORD_MAX, "JoinedMsg does not fit in an OutRecord");
+_Static_assert(LAGCOMP_MAX_TICKS < ROOM_REWIND_TICKS, "rewind window longer than the paddle history");
+_Static_assert(LOCKSTEP_BATCH * 2 <= ROOM_REWIND_TICKS, "a batch must repeat the one before");
+_Static_assert(sizeof(KeyframeChunk) <= 255, "a keyframe must fit in one chunk");
+
+/* Per-session transport state, indexed by session pool index (cold: kept
+   out of Session) */
+typedef struct {
+    RelChannel rel;
+    FrameWriter out;       /* chunks for the session's next datagram */
+    uint16_t state_at;     /* offset of the StateChunk in `out`, 0 = none */
+    uint32_t rx_seq;       /* last frame seq received */
+    uint8_t  rx_any;
+    uint8_t  pong_owed;
+    uint32_t ping_stamp;
+    uint64_t ping_recv_ms;
+    uint32_t rel_pos;      /* index in rel_pending, UINT32_MAX = not listed */
+    uint32_t flush_pos;    /* index in flush_list, UINT32_MAX = not listed */
+    uint64_t input_ns;     /* parse time of the oldest input no tick has used yet */
+    uint64_t tick_ns;      /* tick that used an input, until a snapshot goes out */
+    uint32_t seen_tick;    /* latest game tick the client showed, 0 = unknown */
+    uint8_t  keyframe_owed;   /* lockstep: the next step sends a keyframe */
+    uint64_t keyframe_ms;     /* lockstep: when the last one was queued */
+    uint64_t due_us;       /* pacing: the frame carries room traffic, leaves then */
+    uint8_t  key[FRAME_KEY_SIZE];  /* session key, MACs outgoing frames */
+    uint64_t moved_token;  /* moved in: the old node's token, framed (with
+                              its key) until the client uses ours; 0 = none */
+} Link;
+
+/* Per-session receive check, indexed by session pool index and owned by the
+   receiving thread (the I/O thread in pipeline mode): the session key, kept
+   while its token is the one in use, and the seqs taken from it */
+typedef struct {
+    uint64_t token;        /* 0 = none yet */
+    uint8_t  key[FRAME_KEY_SIZE];
+    FrameReplay replay;
+} RxGuard;
+
+/* Whole server state. In pipeline mode the I/O thread owns what receiving
+   needs (sockfd reads, limiter, the cookie side of auth including its
+   rotation, rx_guards, io_lat) and touches in_ring and cluster_ring
+   (producer) and out_ring (consumer); everything else belongs to the
+   simulation thread, which also sends cluster messages on sockfd itself
+   (cluster_send: a snapshot does not fit an OutRecord). The simulation
+   thread reads the auth epoch for its stats, hence atomic. */
+typedef struct {
+    int sockfd;
+    int pipeline;
+
+    RoomTable rooms;   /* a room's game only runs while both players are in it */
+    Lobby lobby;       /* players waiting for an opponent */
+    RateLimiter limiter;  /* owned by whichever thread calls recvfrom */
+    Auth auth;            /* cookies: receiving thread; token key: read-only */
+    RxGuard *rx_guards;   /* one per session slot, receiving thread */
+    OverloadCtl overload; /* tick budget, owned by the simulation side */
+
+    uint64_t ticks;
+    uint64_t last_tick_ms;
+    uint64_t last_stats_ms;
+    uint32_t tick_ms;           /* 1000 / the rooms' tick rate (--tick-hz) */
+
+    /* Low-latency profile (see lowlat.h): spin instead of sleeping, and
+       where to pin the threads (-1 = anywhere) */
+    int      low_latency;
+    int      tick_cpu;
+    int      io_cpu;
+    int      fifo_priority;     /* 0 = default scheduler */
+
+    /* Tick jitter: how far each tick started from tick_ms after
+       the previous one, per stats window. Tick thread only. */
+    Hist     tick_jitter;
+    uint64_t prev_tick_us;
+    long     faults_at_stats;
+
+    /* Input latency by stage (LAT_*), each written by one thread only: the
+       tick thread's, and in pipeline mode the I/O thread's (which receives
+       and sends) */
+    Hist     lat[LAT_STAGES];
+    Hist     io_lat[LAT_STAGES];
+    uint64_t tick_ns;           /* start of the current tick */
+
+    SpscRing in_ring;   /* InputRecord, I/O -> sim */
+    SpscRing out_ring;  /* OutRecord, sim -> I/O */
+    int      out_wake;  /* eventfd: the sim thread queued records or paused rx */
+    int      out_queued; /* sim thread: records pushed since the last wake */
+
+    /* One Link per session slot, the dense list of sessions with reliable
+       messages in flight or an ack owed, and the sessions with something to
+       send at the end of the pass. */
+    Link       *links;
+    PoolHandle *rel_pending;
+    uint32_t    rel_pending_count;
+    PoolHandle *flush_list;
+    uint32_t    flush_count;
+    uint64_t    rel_sent;
+    uint64_t    rel_retransmits;
+    uint64_t    rel_delivered;
+    uint64_t    rel_window_full;
+    uint64_t    rel_dead;
+
+    uint64_t    frames_rx;
+    uint64_t    chunks_rx;
+    uint64_t    frames_lost;      /* gaps in the clients' frame seqs */
+    uint64_t    frames_tx;
+    uint64_t    chunks_tx;
+    uint64_t    states_merged;    /* snapshots replaced before they went out */
+
+    /* Lag compensation: borderline misses checked against a rewound
+       paddle, those that hit there, and rewinds cut to LAGCOMP_MAX_TICKS */
+    uint64_t    lagcomp_rewinds;
+    uint64_t    lagcomp_hits;
+    uint64_t    lagcomp_clamped;
+
+    /* Lockstep (--lockstep): who may get it, and what went to those who do */
+    int         lockstep;
+    uint64_t    lockstep_batches;
+    uint64_t    lockstep_keyframes;
+    uint64_t    lockstep_resyncs;
+    uint64_t    tx_state_bytes;     /* frames to sessions on states */
+    uint64_t    tx_lockstep_bytes;  /* frames to lockstep sessions */
+
+    /* Pacing (--pace): each room's traffic leaves in a slot of the tick
+       fixed by its index, held here until then, or with --txtime handed to
+       the kernel with its departure time (SO_TXTIME, fq paces it).
+       Bursts: frames per PACE_SLOT_US of departure, counted per tick. */
+    uint32_t    pace_slots;       /* 0 = off: everything leaves at the tick */
+    int         txtime;
+    uint64_t    flush_us;         /* departure of what the current flush sends */
+    uint32_t    burst_bucket[BURST_BUCKETS];
+    uint32_t    burst_max;
+    uint64_t    bursts;           /* non-empty buckets */
+    uint64_t    burst_frames;
+
+    /* Hot restart: listening for a replacement, and one waiting for the
+       next tick boundary. rx_pause/rx_paused stop the I/O thread reading
+       while the state is handed over (pipeline mode). */
+    int         handoff_listen;   /* -1 = disabled */
+    int         handoff_conn;
+    int         handoff_ready;    /* the new process has allocated its pools */
+    atomic_int  rx_pause;
+    atomic_int  rx_paused;
+
+    /* Cluster mode (behind router_udp, see cluster.h): every datagram goes
+       through the router. The node id lives in auth (tokens carry it). */
+    int         routed;
+    struct sockaddr_in router_addr;
+    SpscRing    cluster_ring;     /* ClusterRecord, I/O -> sim (pipeline mode) */
+    uint64_t    rooms_moved_out;
+    uint64_t    rooms_moved_in;
+
+    /* Local clients over shared memory (--shm, see shm_link.h); hdr NULL =
+       off. Simulation side only. */
+    ShmLink     shm;
+    uint32_t   *shm_dirty;        /* client slots taken by one shm_collect() */
+    uint64_t    shm_swept_ms;
+
+    /* Clients over TCP (--tcp, see tcp_front.h); conns NULL = off.
+       Simulation side only. */
+    TcpFront    tcp;
+    uint64_t    tcp_swept_ms;
+} Server;
+
+/* Sent as soon as a new process connects. Rooms, sessions and reliable
+   channels are copied as they sit in memory: the sizes pin that layout, and
+   a build that changed it refuses the handoff (the old process then keeps
+   serving). */
+typedef struct {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t tick_hz;         /* matches in progress go on at their rate */
+    uint32_t room_size;
+    uint32_t session_size;
+    uint32_t rel_size;
+    uint32_t lobby_size;
+    uint32_t max_rooms;
+    uint32_t tcp_conn_size;
+    uint16_t tcp_port;        /* --tcp: its listener and connections follow the snapshot */
+} HandoffLayout;
+
+/* Sent at the tick boundary with the UDP socket attached; the snapshot
+   follows */
+typedef struct {
+    uint32_t live_count;
+    uint64_t ticks;
+    uint64_t last_tick_ms;
+    uint8_t  cookie_key[2][SIPHASH_KEY_SIZE];
+    uint8_t  token_key[SIPHASH_KEY_SIZE];
+    uint8_t  mac_key[SIPHASH_KEY_SIZE];
+    uint32_t epoch;
+    uint64_t rotated_ms;
+    uint8_t  node;            /* tokens carry it: the new process keeps it */
+} HandoffState;
+
+/* A match moving to another node, sent through the router. The sessions
+   are rebuilt there under new tokens, which the players get in a REKEY
+   under their old ones; the game, the reliable channels and the frame
+   seqs carry on where they were. Both nodes must run the same build. */
+typedef struct {
+    ClusterHeader hdr;
+    uint32_t size;            /* sizeof(RoomSnapshot) on the sender */
+    GameState game;
+    uint8_t state;            /* ROOM_SERVING or ROOM_LIVE */
+    struct {
+        struct sockaddr_in addr;
+        uint8_t input;
+        uint8_t bucket;
+        RelChannel rel;
+        uint64_t token;       /* what the client frames with, and its key */
+        uint8_t key[FRAME_KEY_SIZE];
+        uint32_t out_seq;     /* next frame seq to it: its replay window carries on */
+    } players[ROOM_PLAYERS];
+} RoomSnapshot;
+
+_Static_assert(sizeof(RoomSnapshot) <= CLUSTER_MSG_MAX, "room snapshot does not fit a cluster message");
+
+/* Cluster message (I/O side -> simulation side) */
+typedef struct {
+    uint16_t len;
+    uint8_t data[CLUSTER_MSG_MAX];
+} ClusterRecord;
+
+/* Batches the snapshot into large writes */
+typedef struct {
+    int sock;
+    int err;
+    size_t len;
+    uint8_t buf[HANDOFF_BUF];
+} SnapWriter;
 
 /* Get current time in milliseconds */
 static uint64_t get_time_ms(void) {
@@ -65,259 +498,2481 @@ static uint64_t get_time_ms(void) {
     return (uint64_t)tv.tv_sec * 1000 + tv.tv_usec / 1000;
 }
 
-/* Check if two sockaddr_in are equal */
-static int addr_equal(struct sockaddr_in *a, struct sockaddr_in *b) {
-    return (a->sin_addr.s_addr == b->sin_addr.s_addr &&
-            a->sin_port == b->sin_port);
+/* Monotonic clock in microseconds, for measuring tick cost */
+static uint64_t get_time_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + (uint64_t)ts.tv_nsec / 1000;
+}
+
+/* Wall clock in nanoseconds: the clock of the kernel's receive timestamps */
+static uint64_t get_realtime_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
 }
 
 /* Forward declarations */
-static void broadcast_state(int sockfd, ClientInfo clients[], GameState *game);
+static void broadcast_state(Server *srv, PoolHandle rh);
+static void send_joined(Server *srv, PoolHandle sh);
 
-/* Find client by address */
-static int find_client(ClientInfo clients[], struct sockaddr_in *addr) {
-    for (int i = 0; i < MAX_CLIENTS; i++) {
-        if (clients[i].active && addr_equal(&clients[i].addr, addr)) {
-            return i;
-        }
+/* Put one datagram on the wire: to the client, or in cluster mode to the
+   router with the client's address in front. due_us (CLOCK_MONOTONIC)
+   goes along as the departure time with --txtime, 0 = now. */
+static void udp_send(Server *srv, const struct sockaddr_in *to,
+                     const void *buf, size_t len, uint64_t due_us) {
+    if (!srv->routed && !(due_us && srv->txtime)) {
+        sendto(srv->sockfd, buf, len, 0, (const struct sockaddr *)to, sizeof(*to));
+        return;
     }
-    return -1;
+
+    RouteHeader rh;
+    memset(&rh, 0, sizeof(rh));
+    rh.ip = to->sin_addr.s_addr;
+    rh.port = to->sin_port;
+
+    union {
+        struct cmsghdr align;
+        char buf[CMSG_SPACE(sizeof(uint64_t))];
+    } ctl;
+    struct iovec iov[2] = { { &rh, sizeof(rh) }, { (void *)buf, len } };
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    if (srv->routed) {
+        msg.msg_name = &srv->router_addr;
+        msg.msg_namelen = sizeof(srv->router_addr);
+        msg.msg_iov = iov;
+        msg.msg_iovlen = 2;
+    } else {
+        msg.msg_name = (void *)to;
+        msg.msg_namelen = sizeof(*to);
+        msg.msg_iov = iov + 1;
+        msg.msg_iovlen = 1;
+    }
+
+    if (due_us && srv->txtime) {
+        uint64_t txtime_ns = due_us * 1000;
+        msg.msg_control = ctl.buf;
+        msg.msg_controllen = sizeof(ctl.buf);
+        struct cmsghdr *c = CMSG_FIRSTHDR(&msg);
+        c->cmsg_level = SOL_SOCKET;
+        c->cmsg_type = SCM_TXTIME;
+        c->cmsg_len = CMSG_LEN(sizeof(txtime_ns));
+        memcpy(CMSG_DATA(c), &txtime_ns, sizeof(txtime_ns));
+    }
+    sendmsg(srv->sockfd, &msg, 0);
 }
 
-/* Find free slot for new client */
-static int find_free_slot(ClientInfo clients[]) {
-    for (int i = 0; i < MAX_CLIENTS; i++) {
-        if (!clients[i].active) {
-            return i;
+/* Kernel receive timestamp (SO_TIMESTAMPNS) of a received message, 0 if none */
+static uint64_t rx_stamp_ns(struct msghdr *msg) {
+    for (struct cmsghdr *c = CMSG_FIRSTHDR(msg); c; c = CMSG_NXTHDR(msg, c)) {
+        if (c->cmsg_level == SOL_SOCKET && c->cmsg_type == SCM_TIMESTAMPNS) {
+            struct timespec ts;
+            memcpy(&ts, CMSG_DATA(c), sizeof(ts));
+            return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
         }
     }
-    return -1;
+    return 0;
 }
 
-/* Handle incoming messages */
-static void handle_message(int sockfd, ClientInfo clients[], 
-                          uint8_t *buffer, int recv_len,
-                          struct sockaddr_in *client_addr,
-                          int *game_started, GameState *game) {
-    uint64_t now = get_time_ms();
-    
-    if (recv_len < 1) return;
-    
-    uint8_t msg_type = buffer[0];
-    
-    switch (msg_type) {
-        case MSG_CLIENT_CONNECT: {
-            if (recv_len < sizeof(ConnectMsg)) break;
-            
-            int client_id = find_client(clients, client_addr);
-            
-            if (client_id == -1) {
-                /* New client */
-                client_id = find_free_slot(clients);
-                if (client_id == -1) {
-                    printf("Server full, rejecting connection from %s:%d\n",
-                           inet_ntoa(client_addr->sin_addr),
-                           ntohs(client_addr->sin_port));
-                    break;
-                }
-                
-                clients[client_id].addr = *client_addr;
-                clients[client_id].addr_len = sizeof(struct sockaddr_in);
-                clients[client_id].active = 1;
-                clients[client_id].last_seen_ms = now;
-                clients[client_id].current_input = INPUT_NONE;
-                
-                printf("Player %d connected: %s:%d\n",
-                       client_id,
-                       inet_ntoa(client_addr->sin_addr),
-                       ntohs(client_addr->sin_port));
-                
-                /* Check if we should start the game */
-                if (!(*game_started) && clients[0].active && clients[1].active) {
-                    *game_started = 1;
-                    printf("Both players connected! Game starting...\n");
-                }
-            } else {
-                /* Already connected, just update timestamp */
-                clients[client_id].last_seen_ms = now;
-            }
-            break;
+/* Read one datagram and its kernel receive time (*rx_ns, 0 if unknown).
+   In cluster mode only the router is heard: *from gets the client address
+   it names, or 0.0.0.0 for a cluster message.
+   Returns the length, or -1 (errno set) when nothing is waiting. */
+static int udp_recv(Server *srv, uint8_t *buf, size_t cap, struct sockaddr_in *from,
+                    uint64_t *rx_ns, int flags) {
+    while (1) {
+        RouteHeader rh;
+        union {
+            struct cmsghdr align;
+            char buf[CMSG_SPACE(sizeof(struct timespec))];
+        } ctl;
+        struct iovec iov[2] = { { &rh, sizeof(rh) }, { buf, cap } };
+        struct msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_name = from;
+        msg.msg_namelen = sizeof(*from);
+        msg.msg_iov = srv->routed ? iov : iov + 1;
+        msg.msg_iovlen = srv->routed ? 2 : 1;
+        msg.msg_control = ctl.buf;
+        msg.msg_controllen = sizeof(ctl.buf);
+
+        ssize_t n = recvmsg(srv->sockfd, &msg, flags);
+        if (n < 0) return -1;
+        *rx_ns = rx_stamp_ns(&msg);
+        if (!srv->routed) return (int)n;
+
+        if (n < (ssize_t)sizeof(rh) ||
+            from->sin_addr.s_addr != srv->router_addr.sin_addr.s_addr ||
+            from->sin_port != srv->router_addr.sin_port) {
+            continue;  /* not relayed by the router */
         }
-        
-        case MSG_CLIENT_INPUT: {
-            if (recv_len < sizeof(InputMsg)) break;
-            
-            InputMsg *msg = (InputMsg *)buffer;
-            int client_id = find_client(clients, client_addr);
-            
-            if (client_id != -1) {
-                clients[client_id].current_input = (PlayerInput)msg->input;
-                clients[client_id].last_seen_ms = now;
-            }
-            break;
+
+        memset(from, 0, sizeof(*from));
+        from->sin_family = AF_INET;
+        from->sin_addr.s_addr = rh.ip;
+        from->sin_port = rh.port;
+        return (int)(n - (ssize_t)sizeof(rh));
+    }
+}
+
+/* Send a cluster message to another node through the router. Sent from the
+   calling thread: a room snapshot does not fit an OutRecord. */
+static void cluster_send(Server *srv, uint8_t node, const void *buf, size_t len) {
+    RouteHeader rh;
+    memset(&rh, 0, sizeof(rh));
+    rh.node = node;
+
+    struct iovec iov[2] = { { &rh, sizeof(rh) }, { (void *)buf, len } };
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_name = &srv->router_addr;
+    msg.msg_namelen = sizeof(srv->router_addr);
+    msg.msg_iov = iov;
+    msg.msg_iovlen = 2;
+    sendmsg(srv->sockfd, &msg, 0);
+}
+
+/* Send one datagram: directly, or through the outbound ring in pipeline
+   mode. tick_ns != 0: a snapshot showing inputs applied by that tick, timed
+   when it reaches the socket. due_us: see udp_send(). */
+static void server_send_timed(Server *srv, const struct sockaddr_in *to,
+                              const void *buf, size_t len, uint64_t tick_ns,
+                              uint64_t due_us) {
+    if (shm_addr_client(to) >= 0) return;  /* local session: reads the shared rings */
+    if (tcp_addr_client(to) >= 0) return;  /* TCP session: its connection carries the state */
+
+    if (!srv->pipeline) {
+        udp_send(srv, to, buf, len, due_us);
+        if (tick_ns) hist_add_span_ns(&srv->lat[LAT_TICK_SEND], tick_ns, get_realtime_ns());
+        return;
+    }
+
+    OutRecord rec;
+    rec.addr = *to;
+    rec.tick_ns = tick_ns;
+    rec.due_us = due_us;
+    rec.len = (uint16_t)len;
+    memcpy(rec.data, buf, len);
+    if (spsc_push(&srv->out_ring, &rec)) srv->out_queued = 1;  /* full ring: dropped and counted */
+}
+
+/* Sim thread (pipeline mode): get the I/O thread out of poll() */
+static void wake_io(Server *srv) {
+    uint64_t one = 1;
+    if (write(srv->out_wake, &one, sizeof(one)) < 0 && errno != EAGAIN) perror("eventfd write");
+    srv->out_queued = 0;
+}
+
+static void server_send(Server *srv, const struct sockaddr_in *to,
+                        const void *buf, size_t len) {
+    server_send_timed(srv, to, buf, len, 0, 0);
+}
+
+/* Answer a join that has no valid cookie. Sent straight from the receiving
+   thread: no state is kept for the sender. */
+static void send_cookie(Server *srv, const struct sockaddr_in *to) {
+    CookieMsg msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.type = MSG_SERVER_COOKIE;
+    msg.cookie = auth_cookie(&srv->auth, to);
+    udp_send(srv, to, &msg, sizeof(msg), 0);
+}
+
+/* Turn one chunk into a record. Returns 0 for chunks the server does not
+   take (unknown types are skipped: newer clients may send more). */
+static int parse_chunk(uint8_t type, const uint8_t *data, uint8_t len, InputRecord *rec) {
+    rec->chunk = type;
+
+    switch (type) {
+        case CHUNK_INPUT:
+            if (len < 1) return 0;
+            rec->input = ((const InputChunk *)data)->input;
+            if (len >= sizeof(InputChunk)) rec->seen_tick = ((const InputChunk *)data)->seen_tick;
+            return 1;
+
+        case CHUNK_ACK:
+            if (len < sizeof(RelAck)) return 0;
+            memcpy(&rec->ack, data, sizeof(RelAck));
+            return 1;
+
+        case CHUNK_RELIABLE: {
+            if (len < REL_CHUNK_HEADER || len > sizeof(RelChunk)) return 0;
+            const RelChunk *msg = (const RelChunk *)data;
+            rec->rel_seq = ntohs(msg->seq);
+            rec->rel_kind = msg->kind;
+            rec->rel_len = (uint8_t)(len - REL_CHUNK_HEADER);
+            memcpy(rec->rel_data, msg->data, rec->rel_len);
+            return 1;
         }
-        
-        case MSG_CLIENT_DISCONNECT: {
-            int client_id = find_client(clients, client_addr);
-            if (client_id != -1) {
-                printf("Player %d disconnected\n", client_id);
-                clients[client_id].active = 0;
-                *game_started = 0;  /* Reset game when a player leaves */
-                
-                /* Immediately broadcast the new state so remaining player sees disconnection */
-                broadcast_state(sockfd, clients, game);
-            }
-            break;
+
+        case CHUNK_PING:
+            if (len < sizeof(PingChunk)) return 0;
+            rec->ping = ((const PingChunk *)data)->stamp;
+            return 1;
+
+        case CHUNK_DISCONNECT:
+        case CHUNK_RESYNC:
+            return 1;
+    }
+    return 0;
+}
+
+/* Authenticate a frame whose token checked, and refuse replays. The slot's
+   guard moves to a newer session's token once one of its frames checks; an
+   older session's token (a replay from before the slot was reused) cannot
+   take it back. */
+static int rx_guard_accept(Server *srv, PoolHandle sh, const FrameHeader *hdr,
+                           const uint8_t *buf, int len) {
+    RxGuard *g = &srv->rx_guards[pool_handle_index(sh)];
+    uint8_t fresh[FRAME_KEY_SIZE];
+    const uint8_t *key = g->key;
+
+    if (g->token != hdr->conn_id) {
+        auth_session_key(&srv->auth, hdr->conn_id, fresh);
+        key = fresh;
+    }
+    if (!frame_verify(key, buf, len)) {
+        auth_count_bad_mac(&srv->auth);
+        return 0;
+    }
+
+    if (key == fresh) {
+        PoolHandle held = (PoolHandle)(g->token >> 32);
+        if (g->token && (int16_t)(pool_handle_gen(sh) - pool_handle_gen(held)) < 0) {
+            auth_count_replay(&srv->auth);
+            return 0;
         }
+        g->token = hdr->conn_id;
+        memcpy(g->key, fresh, sizeof(g->key));
+        memset(&g->replay, 0, sizeof(g->replay));
+    }
+    if (!frame_replay_accept(&g->replay, hdr->seq)) {
+        auth_count_replay(&srv->auth);
+        return 0;
     }
+    return 1;
 }
 
-/* Broadcast game state to all active clients */
-static void broadcast_state(int sockfd, ClientInfo clients[], GameState *game) {
-    StateMsg msg;
-    msg.type = MSG_SERVER_STATE;
-    msg.ball_x = game->ball_x;
-    msg.ball_y = game->ball_y;
-    msg.paddle_left_y = game->paddle_left_y;
-    msg.paddle_right_y = game->paddle_right_y;
-    msg.score_left = game->score_left;
-    msg.score_right = game->score_right;
-    msg.tick = game->tick;
-    msg.player0_connected = clients[0].active ? 1 : 0;
-    msg.player1_connected = clients[1].active ? 1 : 0;
-    
-    for (int i = 0; i < MAX_CLIENTS; i++) {
-        if (clients[i].active) {
-            sendto(sockfd, &msg, sizeof(msg), 0,
-                   (struct sockaddr *)&clients[i].addr,
-                   clients[i].addr_len);
+/* Validate a raw datagram and turn it into fixed-size records: a join
+   (which must carry a valid cookie), or the chunks of a frame (whose
+   conn_id must be a valid session token and whose MAC must check under
+   that session's key, once for all of them; a frame seen before is
+   dropped). Returns the number of records written, at most `max`. */
+static int parse_datagram(Server *srv, const uint8_t *buffer, int recv_len,
+                          const struct sockaddr_in *client_addr,
+                          uint64_t now, uint64_t parse_ns, InputRecord *recs, int max) {
+    if (recv_len < 1) return 0;
+
+    InputRecord rec;
+    memset(&rec, 0, sizeof(rec));
+    rec.addr = *client_addr;
+    rec.recv_ms = now;
+    rec.parse_ns = parse_ns;
+    rec.type = buffer[0];
+
+    if (rec.type == MSG_CLIENT_JOIN_QUEUE) {
+        if (recv_len < (int)sizeof(JoinQueueMsg)) return 0;
+        const JoinQueueMsg *msg = (const JoinQueueMsg *)buffer;
+        if (!auth_cookie_valid(&srv->auth, client_addr, msg->cookie)) {
+            send_cookie(srv, client_addr);
+            return 0;
         }
+        rec.region = msg->region;
+        rec.rtt_bucket = msg->rtt_bucket;
+        rec.join_flags = msg->flags;
+        recs[0] = rec;
+        return 1;
+    }
+
+    FrameReader fr;
+    FrameHeader hdr;
+    if (frame_open(&fr, buffer, recv_len, MSG_FRAME, &hdr) < 0) return 0;
+    rec.session = auth_token_check(&srv->auth, hdr.conn_id, client_addr);
+    if (rec.session == POOL_INVALID_HANDLE) return 0;
+    if (!rx_guard_accept(srv, rec.session, &hdr, buffer, recv_len)) return 0;
+    rec.frame_seq = hdr.seq;
+
+    /* A malformed chunk ends the frame; the chunks before it still count */
+    int n = 0;
+    uint8_t type, len;
+    const uint8_t *data;
+    while (n < max && frame_next(&fr, &type, &data, &len) == 1) {
+        recs[n] = rec;
+        if (!parse_chunk(type, data, len, &recs[n])) continue;
+        recs[n].frame_start = (n == 0);
+        n++;
     }
+    return n;
 }
 
-/* Check for client timeouts */
-static int check_timeouts(ClientInfo clients[], int *game_started) {
-    uint64_t now = get_time_ms();
-    int timeout_occurred = 0;
-    
-    for (int i = 0; i < MAX_CLIENTS; i++) {
-        if (clients[i].active) {
-            if (now - clients[i].last_seen_ms > CLIENT_TIMEOUT_MS) {
-                printf("Player %d timed out\n", i);
-                clients[i].active = 0;
-                *game_started = 0;  /* Stop game when a player times out */
-                timeout_occurred = 1;
-            }
+/* ---------- Per-session links: reliable channel and outbound frame ---------- */
+
+static Link *session_link(Server *srv, PoolHandle sh) {
+    return &srv->links[pool_handle_index(sh)];
+}
+
+/* Put a session on the list serviced by service_reliable() */
+static void rel_mark(Server *srv, PoolHandle sh) {
+    Link *l = session_link(srv, sh);
+    if (l->rel_pos != UINT32_MAX) {
+        srv->rel_pending[l->rel_pos] = sh;  /* may replace a stale handle */
+        return;
+    }
+    l->rel_pos = srv->rel_pending_count;
+    srv->rel_pending[srv->rel_pending_count++] = sh;
+}
+
+static void rel_unmark(Server *srv, uint32_t pos) {
+    PoolHandle gone = srv->rel_pending[pos];
+    PoolHandle last = srv->rel_pending[--srv->rel_pending_count];
+
+    session_link(srv, gone)->rel_pos = UINT32_MAX;
+    if (pos < srv->rel_pending_count) {
+        srv->rel_pending[pos] = last;
+        session_link(srv, last)->rel_pos = pos;
+    }
+}
+
+/* Put a session on the list sent by flush_links() at the end of the pass */
+static void flush_mark(Server *srv, PoolHandle sh) {
+    Link *l = session_link(srv, sh);
+    if (l->flush_pos != UINT32_MAX) {
+        srv->flush_list[l->flush_pos] = sh;  /* may replace a stale handle */
+        return;
+    }
+    l->flush_pos = srv->flush_count;
+    srv->flush_list[srv->flush_count++] = sh;
+}
+
+/* Key of the session's outgoing frames, from its token */
+static void link_set_key(Server *srv, PoolHandle sh) {
+    Session *s = session_get(&srv->rooms, sh);
+    if (!s) return;
+    auth_session_key(&srv->auth, auth_token(&srv->auth, sh, &s->addr),
+                     session_link(srv, sh)->key);
+}
+
+/* Token the session's frames carry: a moved-in session keeps the old
+   node's until its client takes ours */
+static uint64_t link_token(Server *srv, PoolHandle sh, const Session *s, const Link *l) {
+    return l->moved_token ? l->moved_token : auth_token(&srv->auth, sh, &s->addr);
+}
+
+/* Fresh link for a new session (the slot may have served an older one) */
+static void link_reset(Server *srv, PoolHandle sh) {
+    Link *l = session_link(srv, sh);
+    uint32_t rel_pos = l->rel_pos;
+    uint32_t flush_pos = l->flush_pos;
+
+    memset(l, 0, sizeof(*l));
+    rel_init(&l->rel);
+    frame_writer_init(&l->out);
+    link_set_key(srv, sh);
+    l->rel_pos = rel_pos;
+    l->flush_pos = flush_pos;
+    if (rel_pos != UINT32_MAX) rel_mark(srv, sh);
+    if (flush_pos != UINT32_MAX) flush_mark(srv, sh);
+}
+
+/* Count a frame in the burst bucket of its departure (this tick's) */
+static void count_burst(Server *srv, uint64_t at_us) {
+    uint64_t b = at_us > srv->prev_tick_us ? (at_us - srv->prev_tick_us) / PACE_SLOT_US : 0;
+    srv->burst_bucket[b < BURST_BUCKETS ? b : BURST_BUCKETS - 1]++;
+}
+
+/* End of a tick's departures: fold its buckets into the window's bursts */
+static void close_bursts(Server *srv) {
+    for (uint32_t b = 0; b < BURST_BUCKETS; b++) {
+        uint32_t n = srv->burst_bucket[b];
+        if (n == 0) continue;
+        srv->bursts++;
+        srv->burst_frames += n;
+        if (n > srv->burst_max) srv->burst_max = n;
+        srv->burst_bucket[b] = 0;
+    }
+}
+
+/* Pacing: the session's frame now carries its room's traffic, which leaves
+   in the room's slot of the tick (the same every tick) */
+static void pace_link(Server *srv, const Session *s, Link *l) {
+    if (srv->pace_slots == 0 || l->due_us || !frame_pending(&l->out) ||
+        s->room == POOL_INVALID_HANDLE) {
+        return;
+    }
+    uint32_t slot = pool_handle_index(s->room) % srv->pace_slots;
+    l->due_us = srv->prev_tick_us + (uint64_t)slot * PACE_SLOT_US;
+}
+
+/* Close the session's frame and send it */
+static void link_send(Server *srv, const Session *s, Link *l) {
+    uint16_t chunks = l->out.chunks;
+    uint16_t len = frame_finish(&l->out, l->key);
+    if (len == 0) return;
+
+    /* A snapshot in the frame shows the inputs the last tick applied */
+    uint64_t tick_ns = l->state_at ? l->tick_ns : 0;
+    uint64_t due_us = srv->txtime ? l->due_us : 0;
+    server_send_timed(srv, &s->addr, l->out.buf, len, tick_ns, due_us);
+    count_burst(srv, due_us ? due_us : srv->flush_us);
+    if (s->lockstep) srv->tx_lockstep_bytes += len;
+    else srv->tx_state_bytes += len;
+    if (tick_ns) l->tick_ns = 0;
+    l->state_at = 0;
+    l->due_us = 0;
+    srv->frames_tx++;
+    srv->chunks_tx += chunks;
+}
+
+/* Append a chunk to the session's frame; a full frame goes out first */
+static int link_add(Server *srv, PoolHandle sh, const Session *s, Link *l,
+                    uint8_t type, const void *data, uint8_t len) {
+    for (int attempt = 0; attempt < 2; attempt++) {
+        uint64_t conn_id = frame_pending(&l->out) ? 0 : link_token(srv, sh, s, l);
+        if (frame_add(&l->out, MSG_FRAME, conn_id, type, data, len) == 0) return 0;
+        link_send(srv, s, l);
+    }
+    return -1;
+}
+
+/* Queue a chunk for a session; it leaves with the rest of the session's
+   traffic when the pass ends */
+static void queue_chunk(Server *srv, PoolHandle sh, uint8_t type,
+                        const void *data, uint8_t len) {
+    Session *s = session_get(&srv->rooms, sh);
+    if (!s) return;
+
+    if (link_add(srv, sh, s, session_link(srv, sh), type, data, len) == 0) {
+        flush_mark(srv, sh);
+    }
+}
+
+/* Queue a snapshot for a session. Only the latest one matters: a snapshot
+   already waiting in the frame is overwritten in place. */
+static void queue_state(Server *srv, PoolHandle sh, const StateChunk *state) {
+    Session *s = session_get(&srv->rooms, sh);
+    if (!s) return;
+    Link *l = session_link(srv, sh);
+
+    if (l->state_at && frame_pending(&l->out)) {
+        memcpy(l->out.buf + l->state_at, state, sizeof(*state));
+        srv->states_merged++;
+        return;
+    }
+    if (link_add(srv, sh, s, l, CHUNK_STATE, state, sizeof(*state)) == 0) {
+        l->state_at = (uint16_t)(l->out.len - sizeof(*state));
+        flush_mark(srv, sh);
+    }
+}
+
+/* Send a session's frame now, with what rides on any frame: the pong owed
+   and the ack block (sent alone if nothing else is going out) */
+static void flush_link(Server *srv, PoolHandle sh, const Session *s, uint64_t now) {
+    Link *l = session_link(srv, sh);
+
+    if (l->pong_owed) {
+        PongChunk pong;
+        pong.stamp = l->ping_stamp;
+        pong.hold_ms = htons((uint16_t)(now > l->ping_recv_ms ? now - l->ping_recv_ms : 0));
+        link_add(srv, sh, s, l, CHUNK_PONG, &pong, sizeof(pong));
+        l->pong_owed = 0;
+    }
+
+    if (l->rel.received_any && (frame_pending(&l->out) || l->rel.ack_pending)) {
+        RelAck ack;
+        rel_take_ack(&l->rel, &ack);
+        link_add(srv, sh, s, l, CHUNK_ACK, &ack, sizeof(ack));
+    }
+
+    link_send(srv, s, l);
+}
+
+/* One datagram per session with something pending: everything queued
+   during the pass (snapshots, events, acks, pongs) leaves together. A paced
+   frame not due yet stays listed for a later pass unless `all` (with
+   --txtime the kernel holds it instead). */
+static void flush_links(Server *srv, uint64_t now, int all) {
+    uint32_t kept = 0;
+
+    srv->flush_us = get_time_us();
+    uint64_t until_us = (all || srv->txtime) ? UINT64_MAX : srv->flush_us;
+    for (uint32_t i = 0; i < srv->flush_count; i++) {
+        PoolHandle sh = srv->flush_list[i];
+        Link *l = session_link(srv, sh);
+        Session *s = session_get(&srv->rooms, sh);
+
+        if (s && l->due_us > until_us) {
+            l->flush_pos = kept;
+            srv->flush_list[kept++] = sh;
+            continue;
         }
+        l->flush_pos = UINT32_MAX;
+        if (s) flush_link(srv, sh, s, now);  /* released: the link is reset on reuse */
     }
-    
-    return timeout_occurred;
+    srv->flush_count = kept;
 }
 
-int main(void) {
-    int sockfd;
-    struct sockaddr_in server_addr, client_addr;
-    socklen_t client_len;
-    uint8_t buffer[BUFFER_SIZE];
-    
-    GameState game;
-    ClientInfo clients[MAX_CLIENTS] = {0};
-    int game_started = 0;  /* Game only starts when both players connect */
-    
-    /* Initialize game structure */
-    game_init(&game);
-    
-    /* Create UDP socket */
-    sockfd = socket(AF_INET, SOCK_DGRAM, 0);
-    if (sockfd < 0) {
-        perror("socket creation failed");
-        exit(EXIT_FAILURE);
+/* Queue a reliable event for a session; sent by the next service pass */
+static void send_event(Server *srv, PoolHandle sh, uint8_t kind,
+                       const void *data, uint8_t len) {
+    Session *s = session_get(&srv->rooms, sh);
+    /* Local sessions see events in their slot and the room ring instead;
+       the TCP protocol has no events */
+    if (!s || shm_addr_client(&s->addr) >= 0 || tcp_addr_client(&s->addr) >= 0) return;
+    if (rel_queue(&session_link(srv, sh)->rel, kind, data, len) < 0) {
+        srv->rel_window_full++;
+        return;
     }
-    
-    /* Set socket to non-blocking mode */
-    struct timeval tv;
-    tv.tv_sec = 0;
-    tv.tv_usec = 1000; /* 1ms timeout for recvfrom */
-    setsockopt(sockfd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
-    
-    /* Configure server address */
-    memset(&server_addr, 0, sizeof(server_addr));
-    server_addr.sin_family = AF_INET;
-    server_addr.sin_addr.s_addr = INADDR_ANY;
-    server_addr.sin_port = htons(SERVER_PORT);
-    
-    /* Bind socket */
-    if (bind(sockfd, (struct sockaddr *)&server_addr, sizeof(server_addr)) < 0) {
-        perror("bind failed");
-        close(sockfd);
-        exit(EXIT_FAILURE);
+    rel_mark(srv, sh);
+}
+
+/* A room just got its two players: log it and tell both */
+static void announce_match(Server *srv, PoolHandle rh) {
+    Room *r = room_get(&srv->rooms, rh);
+    if (!r) return;
+
+    binlog(LOG_MATCH_STARTED, pool_handle_index(rh));
+
+    for (int i = 0; i < ROOM_PLAYERS; i++) {
+        MatchedEvent ev;
+        memset(&ev, 0, sizeof(ev));
+        ev.slot = (uint8_t)i;
+        ev.room_id = htonl(pool_handle_index(rh));
+
+        /* A new game: ticks seen in the previous one mean nothing here */
+        session_link(srv, r->players[i])->seen_tick = 0;
+        session_link(srv, r->players[i])->keyframe_owed = 1;  /* lockstep: starts from it */
+        send_joined(srv, r->players[i]);
+        send_event(srv, r->players[i], REL_EV_MATCHED, &ev, sizeof(ev));
     }
-    
-    printf("Pong server started on port %d\n", SERVER_PORT);
-    printf("Waiting for players...\n");
-    
-    uint64_t last_tick_ms = get_time_ms();
-    uint64_t last_waiting_broadcast_ms = get_time_ms();
-    
-    /* Main game loop */
-    while (1) {
-        uint64_t now = get_time_ms();
-        
-        /* Process incoming messages (non-blocking) */
-        while (1) {
-            client_len = sizeof(client_addr);
-            int recv_len = recvfrom(sockfd, buffer, BUFFER_SIZE, 0,
-                                   (struct sockaddr *)&client_addr, &client_len);
-            
-            if (recv_len < 0) {
-                if (errno == EAGAIN || errno == EWOULDBLOCK) {
-                    break; /* No more messages */
-                }
-                perror("recvfrom error");
+}
+
+/* Remove a session from the server. Its opponent, if any, stays seated,
+   is told reliably, and goes back to the lobby so the next waiter takes
+   the free seat. */
+static void drop_session(Server *srv, PoolHandle sh) {
+    RoomTable *t = &srv->rooms;
+    Session *s = session_get(t, sh);
+    if (!s) return;
+
+    lobby_remove(&srv->lobby, t, sh);
+    PoolHandle rh = session_leave(t, sh);
+
+    Room *r = room_get(t, rh);
+    if (r) {
+        for (int i = 0; i < ROOM_PLAYERS; i++) {
+            Session *o = session_get(t, r->players[i]);
+            if (!o) continue;
+            int conn = tcp_addr_client(&o->addr);
+            if (conn >= 0) {
+                /* A TCP client gets one HELLO per connection and cannot
+                   wait for another opponent: it goes too */
+                tcp_front_drop(&srv->tcp, (uint32_t)conn);
+                drop_session(srv, r->players[i]);  /* releases the room */
                 break;
             }
-            
-            handle_message(sockfd, clients, buffer, recv_len, &client_addr, &game_started, &game);
-        }
-        
-        /* Game tick update - only if game has started */
-        if (game_started && now - last_tick_ms >= TICK_INTERVAL_MS) {
-            last_tick_ms = now;
-            
-            /* Get inputs from both players */
-            PlayerInput left_input = INPUT_NONE;
-            PlayerInput right_input = INPUT_NONE;
-            
-            if (clients[0].active) left_input = clients[0].current_input;
-            if (clients[1].active) right_input = clients[1].current_input;
-            
-            /* Step game simulation */
-            game_step(&game, left_input, right_input);
-            
-            /* Broadcast state to clients */
-            broadcast_state(sockfd, clients, &game);
-            
-            /* Check for timeouts */
-            int timeout_occurred = check_timeouts(clients, &game_started);
-            
-            /* If timeout occurred, send immediate update */
-            if (timeout_occurred) {
-                broadcast_state(sockfd, clients, &game);
-            }
+            send_event(srv, r->players[i], REL_EV_OPPONENT_LEFT, NULL, 0);
+            lobby_enqueue(&srv->lobby, t, r->players[i], o->bucket);
         }
-        
-        /* When game is not running, broadcast at lower rate (10 Hz) so clients see disconnection */
-        if (!game_started && (clients[0].active || clients[1].active)) {
-            if (now - last_waiting_broadcast_ms >= 100) { /* 100ms = 10 Hz */
-                broadcast_state(sockfd, clients, &game);
-                last_waiting_broadcast_ms = now;
-            }
+    }
+}
+
+/* A player asked to leave (CHUNK_DISCONNECT or REL_CTL_LEAVE) */
+static void leave_session(Server *srv, PoolHandle sh) {
+    Session *s = session_get(&srv->rooms, sh);
+    if (!s) return;
+
+    PoolHandle rh = s->room;
+    if (rh != POOL_INVALID_HANDLE) {
+        binlog(LOG_PLAYER_LEFT, s->slot, pool_handle_index(rh));
+    } else {
+        binlog(LOG_QUEUED_LEFT, s->addr.sin_addr.s_addr, ntohs(s->addr.sin_port));
+    }
+
+    /* Stops the room; immediately broadcast so the remaining player sees it */
+    drop_session(srv, sh);
+    broadcast_state(srv, rh);
+}
+
+/* Deliver a session's reliable messages in order */
+static void apply_reliable(Server *srv, PoolHandle sh, const InputRecord *rec) {
+    RelChannel *c = &session_link(srv, sh)->rel;
+    RelSlot m;
+
+    rel_on_message(c, rec->rel_seq, rec->rel_kind, rec->rel_data, rec->rel_len);
+    rel_mark(srv, sh);  /* an ack is owed either way */
+
+    while (rel_deliver(c, &m)) {
+        srv->rel_delivered++;
+        if (m.kind == REL_CTL_LEAVE) {
+            /* The channel dies with the session: ack the leave right away */
+            flush_link(srv, sh, session_get(&srv->rooms, sh), rec->recv_ms);
+            leave_session(srv, sh);
+            return;
         }
-        
-        /* Small sleep to prevent CPU spinning */
-        usleep(1000); /* 1ms */
     }
-    
-    close(sockfd);
-    return 0;
-}
\ No newline at end of file
+}
+
+/* Apply one chunk of a session's frame */
+static void apply_chunk(Server *srv, PoolHandle sh, Session *s, const InputRecord *rec) {
+    RoomTable *t = &srv->rooms;
+    Link *l = session_link(srv, sh);
+    uint64_t now = rec->recv_ms;
+
+    s->last_seen_ms = now;
+    srv->chunks_rx++;
+
+    if (l->moved_token) {
+        /* Our token checked: the client has its REKEY. A frame begun under
+           the old token leaves as it is; the next ones use ours. */
+        if (frame_pending(&l->out)) link_send(srv, s, l);
+        l->moved_token = 0;
+        link_set_key(srv, sh);
+    }
+
+    if (rec->frame_start) {
+        /* Frames are numbered per direction: a jump forward means lost frames */
+        int32_t gap = (int32_t)(rec->frame_seq - l->rx_seq);
+        if (l->rx_any && gap > 1) srv->frames_lost += (uint64_t)(gap - 1);
+        if (!l->rx_any || gap > 0) l->rx_seq = rec->frame_seq;
+        l->rx_any = 1;
+        srv->frames_rx++;
+    }
+
+    Room *r = room_get(t, s->room);
+
+    switch (rec->chunk) {
+        case CHUNK_INPUT:
+            /* Anything else moves nothing; lockstep steps carry 2 bits */
+            s->input = (rec->input <= INPUT_DOWN) ? rec->input : INPUT_NONE;
+            if (!l->input_ns && r && room_playing(r)) l->input_ns = rec->parse_ns;
+            /* Frames may arrive out of order: keep the newest tick shown */
+            if ((int32_t)(rec->seen_tick - l->seen_tick) > 0) l->seen_tick = rec->seen_tick;
+
+            /* A parked room only wakes up to answer its player */
+            if (r && r->state == ROOM_WAITING) broadcast_state(srv, s->room);
+            break;
+
+        case CHUNK_ACK:
+            rel_on_ack(&l->rel, &rec->ack, now);
+            break;
+
+        case CHUNK_RELIABLE:
+            apply_reliable(srv, sh, rec);
+            break;
+
+        case CHUNK_PING:
+            l->ping_stamp = rec->ping;
+            l->ping_recv_ms = now;
+            l->pong_owed = 1;
+            /* A live room's next snapshot carries the pong; otherwise send it alone */
+            if (!(r && r->state == ROOM_LIVE)) flush_mark(srv, sh);
+            break;
+
+        case CHUNK_DISCONNECT:
+            leave_session(srv, sh);
+            break;
+
+        case CHUNK_RESYNC:
+            if (s->lockstep) {
+                l->keyframe_owed = 1;
+                srv->lockstep_resyncs++;
+            }
+            break;
+    }
+}
+
+/* Apply one parsed message to the game state */
+static void apply_record(Server *srv, const InputRecord *rec) {
+    RoomTable *t = &srv->rooms;
+    uint64_t now = rec->recv_ms;
+    /* Joins are keyed by address (they carry no token yet); frames name
+       their session directly. A stale handle yields NULL. */
+    PoolHandle sh = (rec->type == MSG_CLIENT_JOIN_QUEUE)
+                    ? session_find(t, &rec->addr) : rec->session;
+    Session *s = session_get(t, sh);
+
+    switch (rec->type) {
+        case MSG_CLIENT_JOIN_QUEUE: {
+            if (s) {
+                /* Already known: refresh and repeat our answer (it may have been lost) */
+                s->last_seen_ms = now;
+                send_joined(srv, sh);
+                break;
+            }
+
+            /* New client */
+            sh = session_create(t, &rec->addr, now);
+            if (sh == POOL_INVALID_HANDLE) {
+                binlog(LOG_SERVER_FULL, rec->addr.sin_addr.s_addr,
+                       ntohs(rec->addr.sin_port));
+                break;
+            }
+            link_reset(srv, sh);
+            session_get(t, sh)->lockstep = srv->lockstep && (rec->join_flags & JOIN_LOCKSTEP);
+
+            uint8_t bucket = lobby_bucket(rec->region, rec->rtt_bucket);
+            PoolHandle rh = POOL_INVALID_HANDLE;
+            if (overload_admit(&srv->overload)) {
+                rh = lobby_join(&srv->lobby, t, sh, bucket, now, CLIENT_TIMEOUT_MS);
+            } else {
+                /* Over budget: wait in line, matched once admission reopens */
+                lobby_enqueue(&srv->lobby, t, sh, bucket);
+                srv->overload.refused++;
+            }
+
+            if (rh == POOL_INVALID_HANDLE) {
+                binlog(LOG_PLAYER_QUEUED, bucket, rec->addr.sin_addr.s_addr,
+                       ntohs(rec->addr.sin_port));
+                send_joined(srv, sh);
+                break;
+            }
+
+            announce_match(srv, rh);
+            break;
+        }
+
+        case MSG_FRAME:
+            if (s) apply_chunk(srv, sh, s, rec);
+            break;
+    }
+}
+
+/* Handle incoming messages (single-thread mode: parse and apply at once) */
+static void handle_message(Server *srv, uint8_t *buffer, int recv_len,
+                           struct sockaddr_in *client_addr, uint64_t now, uint64_t rx_ns) {
+    InputRecord recs[RX_CHUNKS_MAX];
+    uint64_t parse_ns = get_realtime_ns();
+    hist_add_span_ns(&srv->lat[LAT_RX_PARSE], rx_ns, parse_ns);
+
+    int n = parse_datagram(srv, buffer, recv_len, client_addr, now, parse_ns,
+                           recs, RX_CHUNKS_MAX);
+    for (int i = 0; i < n; i++) {
+        apply_record(srv, &recs[i]);
+    }
+}
+
+/* Tell a session where it stands: queued, or matched with its seat */
+static void send_joined(Server *srv, PoolHandle sh) {
+    Session *s = session_get(&srv->rooms, sh);
+    if (!s) return;
+    Room *r = room_get(&srv->rooms, s->room);
+
+    int local = shm_addr_client(&s->addr);
+    if (local >= 0) {
+        shm_client_joined(&srv->shm, (uint32_t)local, r && room_playing(r), s->room, s->slot);
+        return;
+    }
+
+    /* A TCP client hears nothing until it is matched: then its HELLO */
+    int conn = tcp_addr_client(&s->addr);
+    if (conn >= 0) {
+        if (!r || !room_playing(r)) return;
+        GameRules rules;
+        game_rules_of(&r->game, &rules);
+        if (tcp_front_hello(&srv->tcp, (uint32_t)conn, s->slot, &rules) < 0) {
+            tcp_front_drop(&srv->tcp, (uint32_t)conn);  /* its session goes at the next sweep */
+        }
+        return;
+    }
+
+    JoinedMsg msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.type = MSG_SERVER_JOINED;
+    msg.status = (r && room_playing(r)) ? JOIN_MATCHED : JOIN_QUEUED;
+    msg.player_id = s->slot;
+    msg.flags = s->lockstep ? JOIN_LOCKSTEP : 0;
+    msg.room_id = htonl(r ? pool_handle_index(s->room) : 0);
+    msg.token = link_token(srv, sh, s, session_link(srv, sh));
+    memcpy(msg.key, session_link(srv, sh)->key, sizeof(msg.key));
+    GameRules rules = srv->rooms.rules;
+    if (r) game_rules_of(&r->game, &rules);
+    memcpy(&msg.rules, &rules, sizeof(rules));
+
+    server_send(srv, &s->addr, &msg, sizeof(msg));
+}
+
+/* Queue the whole game for a lockstep session */
+static void queue_keyframe(Server *srv, PoolHandle sh, const Room *r) {
+    KeyframeChunk kf;
+    memcpy(&kf.game, &r->game, sizeof(kf.game));
+    kf.player0_connected = session_get(&srv->rooms, r->players[0]) ? 1 : 0;
+    kf.player1_connected = session_get(&srv->rooms, r->players[1]) ? 1 : 0;
+    queue_chunk(srv, sh, CHUNK_KEYFRAME, &kf, sizeof(kf));
+
+    Link *l = session_link(srv, sh);
+    l->keyframe_owed = 0;
+    l->keyframe_ms = srv->last_tick_ms;
+    srv->lockstep_keyframes++;
+}
+
+/* Queue a room's game state for its players: a snapshot for those on
+   states; with `keyframe`, a keyframe for lockstep players too (their
+   regular stream is send_lockstep()'s) */
+static void send_state(Server *srv, PoolHandle rh, int keyframe) {
+    Room *r = room_get(&srv->rooms, rh);
+    if (!r) return;  /* room already released */
+    GameState *game = &r->game;
+
+    Session *players[ROOM_PLAYERS];
+    for (int i = 0; i < ROOM_PLAYERS; i++) {
+        players[i] = session_get(&srv->rooms, r->players[i]);
+    }
+
+    StateChunk msg;
+    msg.ball_x = game->ball_x;
+    msg.ball_y = game->ball_y;
+    msg.paddle_left_y = game->paddle_left_y;
+    msg.paddle_right_y = game->paddle_right_y;
+    msg.score_left = game->score_left;
+    msg.score_right = game->score_right;
+    msg.tick = game->tick;
+    msg.player0_connected = players[0] ? 1 : 0;
+    msg.player1_connected = players[1] ? 1 : 0;
+
+    for (int i = 0; i < ROOM_PLAYERS; i++) {
+        if (!players[i] || shm_addr_client(&players[i]->addr) >= 0 ||
+            tcp_addr_client(&players[i]->addr) >= 0) continue;
+        if (!players[i]->lockstep) queue_state(srv, r->players[i], &msg);
+        else if (keyframe) queue_keyframe(srv, r->players[i], r);
+        pace_link(srv, players[i], session_link(srv, r->players[i]));
+    }
+
+    /* Local players and spectators follow the room's ring */
+    if (srv->shm.hdr) {
+        RoomView v;
+        room_view_of(rh, r, &v);
+        shm_publish(&srv->shm, &v);
+    }
+}
+
+/* Broadcast a room's game state to all its players (queued in their
+   frames): for changes the inputs alone do not show */
+static void broadcast_state(Server *srv, PoolHandle rh) {
+    send_state(srv, rh, 1);
+}
+
+/* The steps up to the room's current tick that the history still has
+   (at most ROOM_REWIND_TICKS), and the checksum they must lead to */
+static void lockstep_batch(const Room *r, InputsChunk *b) {
+    uint32_t tick = r->game.tick;
+    uint8_t step, n = 0;
+
+    while (n < ROOM_REWIND_TICKS && n < tick && room_step_at(r, tick - n, &step)) n++;
+    for (uint8_t k = 0; k < n; k++) {
+        room_step_at(r, tick - n + 1 + k, &b->steps[k]);
+    }
+    b->tick = tick;
+    b->checksum = game_checksum(&r->game);
+    b->count = n;
+}
+
+/* Lockstep players' stream after a step: a keyframe when one is owed or
+   due, else every LOCKSTEP_BATCH ticks the steps that led here */
+static void send_lockstep(Server *srv, Room *r, uint32_t phase) {
+    InputsChunk batch;
+    int built = 0;
+
+    for (int i = 0; i < ROOM_PLAYERS; i++) {
+        Session *s = session_get(&srv->rooms, r->players[i]);
+        if (!s || !s->lockstep) continue;
+        Link *l = session_link(srv, r->players[i]);
+
+        if (l->keyframe_owed || srv->last_tick_ms - l->keyframe_ms >= LOCKSTEP_KEYFRAME_MS) {
+            queue_keyframe(srv, r->players[i], r);
+            pace_link(srv, s, l);
+            continue;
+        }
+        if ((r->game.tick + phase) % LOCKSTEP_BATCH != 0) continue;
+
+        if (!built) {
+            lockstep_batch(r, &batch);
+            built = 1;
+        }
+        queue_chunk(srv, r->players[i], CHUNK_INPUTS, &batch,
+                    (uint8_t)(INPUTS_CHUNK_HEADER + batch.count));
+        pace_link(srv, s, l);
+        srv->lockstep_batches++;
+    }
+}
+
+/* Check a room's players for timeouts */
+static int check_timeouts(Server *srv, PoolHandle rh, uint64_t now) {
+    Room *r = room_get(&srv->rooms, rh);
+    int timeout_occurred = 0;
+
+    for (int i = 0; i < ROOM_PLAYERS && r; i++) {
+        Session *s = session_get(&srv->rooms, r->players[i]);
+        /* last_seen may be a little newer than now (set while receiving) */
+        if (s && now > s->last_seen_ms + CLIENT_TIMEOUT_MS) {
+            binlog(LOG_PLAYER_TIMEOUT, (uint32_t)i, pool_handle_index(rh));
+            drop_session(srv, r->players[i]);  /* stops the room */
+            timeout_occurred = 1;
+            r = room_get(&srv->rooms, rh);  /* NULL once the last player left */
+        }
+    }
+
+    return timeout_occurred;
+}
+
+/* Step a room `stride` ticks' worth of game time in one game_step */
+static void step_room(Server *srv, Room *r, uint32_t stride) {
+    Session *left = session_get(&srv->rooms, r->players[0]);
+    Session *right = session_get(&srv->rooms, r->players[1]);
+    float dt = r->game.dt;
+
+    /* Inputs received since the last step take effect now */
+    for (int i = 0; i < ROOM_PLAYERS; i++) {
+        if (!session_get(&srv->rooms, r->players[i])) continue;
+        Link *l = session_link(srv, r->players[i]);
+        if (!l->input_ns) continue;
+        hist_add_span_ns(&srv->lat[LAT_PARSE_TICK], l->input_ns, srv->tick_ns);
+        l->input_ns = 0;
+        l->tick_ns = srv->tick_ns;
+    }
+
+    /* Lag compensation: each player's paddle as their client last showed
+       it, rewound at most LAGCOMP_MAX_TICKS */
+    GameRewind rw;
+    memset(&rw, 0, sizeof(rw));
+    for (int i = 0; i < ROOM_PLAYERS; i++) {
+        if (!session_get(&srv->rooms, r->players[i])) continue;
+        uint32_t seen = session_link(srv, r->players[i])->seen_tick;
+        if (seen == 0 || (int32_t)(r->game.tick - seen) < 0) continue;  /* unknown, or a future tick */
+        if (r->game.tick - seen > LAGCOMP_MAX_TICKS) {
+            seen = r->game.tick - LAGCOMP_MAX_TICKS;
+            srv->lagcomp_clamped++;
+        }
+        rw.valid[i] = (uint8_t)room_paddle_at(r, seen, i, &rw.paddle_y[i]);
+    }
+
+    PlayerInput in_left = left ? (PlayerInput)left->input : INPUT_NONE;
+    PlayerInput in_right = right ? (PlayerInput)right->input : INPUT_NONE;
+
+    r->game.dt = dt * (float)stride;
+    GameRewindResult rewind = game_step_rewind(&r->game, in_left, in_right, &rw);
+    r->game.dt = dt;
+    room_record_tick(r, ROOM_STEP(in_left, in_right, stride));
+
+    if (rewind != GAME_REWIND_NONE) srv->lagcomp_rewinds++;
+    if (rewind == GAME_REWIND_HIT) {
+        srv->lagcomp_hits++;
+        /* Lockstep players cannot replay a hit their inputs do not explain */
+        for (int i = 0; i < ROOM_PLAYERS; i++) {
+            if (session_get(&srv->rooms, r->players[i])) {
+                session_link(srv, r->players[i])->keyframe_owed = 1;
+            }
+        }
+    }
+}
+
+/* TCP players get a state after every step, as from server_tcp: their
+   client reads one per frame (the frontend conflates what it cannot take).
+   One that fails leaves, which may release the room. */
+static void send_tcp_states(Server *srv, Room *r) {
+    if (!srv->tcp.conns) return;
+
+    for (int i = 0; i < ROOM_PLAYERS; i++) {
+        PoolHandle sh = r->players[i];
+        Session *s = session_get(&srv->rooms, sh);
+        int conn = s ? tcp_addr_client(&s->addr) : -1;
+        if (conn < 0) continue;
+        if (tcp_front_state(&srv->tcp, (uint32_t)conn, &r->game) < 0) {
+            tcp_front_drop(&srv->tcp, (uint32_t)conn);
+            leave_session(srv, sh);
+            return;
+        }
+    }
+}
+
+/* Send policy after a step. Live rooms send every tick (every 2nd under
+   load); serving rooms send one keyframe when the pause starts, then only
+   when a paddle moved. Lockstep players only get the keyframes here. */
+static void send_after_step(Server *srv, PoolHandle rh, Room *r,
+                            uint8_t prev_state, uint32_t phase) {
+    const OverloadCtl *ol = &srv->overload;
+
+    if (r->state == ROOM_LIVE) {
+        uint32_t send_stride = (ol->level >= OVERLOAD_SLOW_SENDS) ? 2 : 1;
+        if ((r->game.tick + phase) % send_stride == 0) send_state(srv, rh, 0);
+        return;
+    }
+
+    if (prev_state != ROOM_SERVING) {
+        broadcast_state(srv, rh);  /* keyframe: new score, ball back at center */
+        r->dirty = 0;
+
+        if (prev_state == ROOM_LIVE) {
+            /* A point was scored: the score is an event, not just state */
+            PointEvent ev;
+            ev.score_left = htons((uint16_t)r->game.score_left);
+            ev.score_right = htons((uint16_t)r->game.score_right);
+            for (int i = 0; i < ROOM_PLAYERS; i++) {
+                send_event(srv, r->players[i], REL_EV_POINT, &ev, sizeof(ev));
+            }
+        }
+        return;
+    }
+
+    uint32_t serve_stride = (ol->level >= OVERLOAD_SLOW_SERVING) ? 4 : 1;
+    if (r->dirty && (r->game.tick + phase) % serve_stride == 0) {
+        send_state(srv, rh, 0);
+        r->dirty = 0;
+    }
+}
+
+/* One simulation pass: runs only when a tick is due, and only visits rooms
+   that are serving or live (waiting rooms are parked off the list).
+   The overload level decides how much work a tick may do. */
+static void simulate(Server *srv, uint64_t now) {
+    RoomTable *t = &srv->rooms;
+    OverloadCtl *ol = &srv->overload;
+
+    if (now - srv->last_tick_ms < srv->tick_ms) return;
+    srv->last_tick_ms = now;
+    srv->ticks++;
+    close_bursts(srv);
+    uint64_t tick_start_us = get_time_us();
+    srv->tick_ns = get_realtime_ns();
+
+    if (srv->prev_tick_us) {
+        int64_t off = (int64_t)(tick_start_us - srv->prev_tick_us) - (int64_t)srv->tick_ms * 1000;
+        hist_add(&srv->tick_jitter, (uint32_t)(off < 0 ? -off : off));
+    }
+    srv->prev_tick_us = tick_start_us;
+
+    /* Backwards: a room parked or released during the pass is swapped with the last one */
+    for (uint32_t i = t->live_count; i-- > 0; ) {
+        PoolHandle rh = t->live[i];
+        Room *r = room_get(t, rh);
+
+        /* Rooms spread their skipped ticks and sends by index */
+        uint32_t phase = pool_handle_index(rh);
+
+        /* Low priority = the newer half of the live list (established
+           matches keep full rate) */
+        uint32_t sim_stride = (ol->level >= OVERLOAD_SLOW_SIM &&
+                               i >= t->live_count / 2) ? 2 : 1;
+
+        if ((srv->ticks + phase) % sim_stride == 0) {
+            float left_y = r->game.paddle_left_y;
+            float right_y = r->game.paddle_right_y;
+            uint8_t prev_state = r->state;
+
+            step_room(srv, r, sim_stride);
+
+            r->state = (r->game.serve_wait > 0) ? ROOM_SERVING : ROOM_LIVE;
+            if (r->game.paddle_left_y != left_y || r->game.paddle_right_y != right_y)
+                r->dirty = 1;
+            room_publish(t, rh, r);
+
+            send_after_step(srv, rh, r, prev_state, phase);
+            send_lockstep(srv, r, phase);
+            send_tcp_states(srv, r);
+        }
+
+        /* Check for timeouts; if one occurred, send immediate update */
+        if (check_timeouts(srv, rh, now)) {
+            broadcast_state(srv, rh);
+        }
+    }
+
+    /* Players still queued but silent (this includes the player left alone
+       in a parked room: drop_session put them back in the lobby) */
+    lobby_expire(&srv->lobby, t, now, CLIENT_TIMEOUT_MS);
+
+    /* Pair players whose opponent left with other waiters */
+    PoolHandle rh;
+    while (overload_admit(ol) &&
+           (rh = lobby_match_next(&srv->lobby, t, now, CLIENT_TIMEOUT_MS))
+           != POOL_INVALID_HANDLE) {
+        announce_match(srv, rh);
+    }
+
+    uint64_t tick_us = get_time_us() - tick_start_us;
+    if (overload_tick(ol, (uint32_t)tick_us)) {
+        binlog(LOG_OVERLOAD, ol->level, (uint32_t)tick_us, ol->ewma_us, ol->budget_us);
+    }
+}
+
+/* Queue what the reliable channels owe: new messages, retransmissions after
+   RTO, and acks that no snapshot will carry. O(sessions listed). */
+static void service_reliable(Server *srv, uint64_t now) {
+    RoomTable *t = &srv->rooms;
+
+    /* Backwards: entries are swap-removed during the pass */
+    for (uint32_t i = srv->rel_pending_count; i-- > 0; ) {
+        PoolHandle sh = srv->rel_pending[i];
+        Session *s = session_get(t, sh);
+        if (!s) {
+            rel_unmark(srv, i);  /* session released by the lobby or a timeout */
+            continue;
+        }
+
+        RelChannel *c = &session_link(srv, sh)->rel;
+        RelSlot *due[REL_WINDOW];
+        int n = rel_poll(c, now, due, REL_WINDOW);
+        if (n < 0) {
+            binlog(LOG_PLAYER_UNREACHABLE, REL_MAX_TRIES, s->addr.sin_addr.s_addr,
+                   ntohs(s->addr.sin_port));
+            srv->rel_dead++;
+            PoolHandle rh = s->room;
+            drop_session(srv, sh);
+            broadcast_state(srv, rh);
+            continue;  /* the entry goes stale and is removed next pass */
+        }
+
+        for (int k = 0; k < n; k++) {
+            RelChunk msg;
+            msg.kind = due[k]->kind;
+            msg.seq = htons(due[k]->seq);
+            memcpy(msg.data, due[k]->data, due[k]->len);
+            queue_chunk(srv, sh, CHUNK_RELIABLE, &msg, (uint8_t)(REL_CHUNK_HEADER + due[k]->len));
+
+            srv->rel_sent++;
+            if (due[k]->tries > 1) srv->rel_retransmits++;
+        }
+
+        /* A live room's next snapshot carries the ack; otherwise it goes
+           out with this pass's frame, alone if need be */
+        Room *r = room_get(t, s->room);
+        if (c->ack_pending && !(r && r->state == ROOM_LIVE)) flush_mark(srv, sh);
+
+        if (rel_idle(c)) rel_unmark(srv, i);
+    }
+}
+
+/* Print and reset the input latency stages measured by one thread */
+static void print_latency(Hist *lat, const char *who) {
+    static const char *names[LAT_STAGES] = { "rx->parse", "parse->tick", "tick->send" };
+
+    for (int i = 0; i < LAT_STAGES; i++) {
+        const Hist *h = &lat[i];
+        if (h->count == 0) continue;
+        printf("[stats] latency %s (%s): p50=%uus p99=%uus p99.9=%uus max=%uus n=%llu\n",
+               names[i], who, hist_percentile(h, 500), hist_percentile(h, 990),
+               hist_percentile(h, 999), h->max, (unsigned long long)h->count);
+        hist_reset(&lat[i]);
+    }
+}
+
+/* Read every room through its published view, as an observer thread
+   would: no lock, and nothing the tick thread has to wait for */
+static void print_views(Server *srv, const char *who) {
+    RoomTable *t = &srv->rooms;
+    uint32_t rooms = 0, live = 0, serving = 0;
+    unsigned long long points = 0;
+    uint64_t retries = 0;
+    RoomView v;
+
+    for (uint32_t i = 0; i < t->rooms.capacity; i++) {
+        if (!room_view_at(t, i, &v, &retries)) continue;
+        rooms++;
+        live += (v.state == ROOM_LIVE);
+        serving += (v.state == ROOM_SERVING);
+        points += (unsigned long long)(v.game.score_left + v.game.score_right);
+    }
+    printf("[stats] views (%s): rooms=%u live=%u serving=%u points=%llu retries=%llu\n",
+           who, rooms, live, serving, points, (unsigned long long)retries);
+}
+
+/* Print pool occupancy, and ring counters in pipeline mode */
+static void print_stats(Server *srv) {
+    const Pool *rp = &srv->rooms.rooms;
+    const Pool *sp = &srv->rooms.sessions;
+
+    printf("[stats] rooms: %u/%u playing=%u hwm=%u exhausted=%llu | "
+           "sessions: %u/%u hwm=%u exhausted=%llu stale=%llu\n",
+           rp->in_use, rp->capacity, srv->rooms.live_count, rp->high_water,
+           (unsigned long long)rp->exhausted,
+           sp->in_use, sp->capacity, sp->high_water,
+           (unsigned long long)sp->exhausted, (unsigned long long)sp->stale);
+
+    const Lobby *l = &srv->lobby;
+    printf("[stats] lobby: waiting=%u hwm=%u joins=%llu matches=%llu expired=%llu no_room=%llu\n",
+           l->waiting, l->waiting_hwm,
+           (unsigned long long)l->joins, (unsigned long long)l->matches,
+           (unsigned long long)l->expired, (unsigned long long)l->no_room);
+
+    OverloadCtl *ol = &srv->overload;
+    printf("[stats] overload: level=%d (%s) avg=%uus max=%uus budget=%uus over=%llu "
+           "up=%llu down=%llu refused=%llu ticks@level=%llu/%llu/%llu/%llu\n",
+           ol->level, overload_level_name(ol->level), ol->ewma_us, ol->max_us, ol->budget_us,
+           (unsigned long long)ol->ticks_over_budget,
+           (unsigned long long)ol->escalations, (unsigned long long)ol->recoveries,
+           (unsigned long long)ol->refused,
+           (unsigned long long)ol->ticks_at[0], (unsigned long long)ol->ticks_at[1],
+           (unsigned long long)ol->ticks_at[2], (unsigned long long)ol->ticks_at[3]);
+    ol->max_us = 0;
+
+    /* Faults are counted for the tick thread (this one) */
+    const Hist *j = &srv->tick_jitter;
+    long faults = lowlat_thread_faults();
+    printf("[stats] tick jitter: p50=%uus p99=%uus p99.9=%uus max=%uus ticks=%llu faults=%ld\n",
+           hist_percentile(j, 500), hist_percentile(j, 990), hist_percentile(j, 999), j->max,
+           (unsigned long long)j->count, faults - srv->faults_at_stats);
+    srv->faults_at_stats = faults;
+    hist_reset(&srv->tick_jitter);
+    print_latency(srv->lat, srv->pipeline ? "sim thread" : "server");
+
+    printf("[stats] reliable: pending=%u sent=%llu retransmits=%llu delivered=%llu "
+           "window_full=%llu unreachable=%llu\n",
+           srv->rel_pending_count,
+           (unsigned long long)srv->rel_sent, (unsigned long long)srv->rel_retransmits,
+           (unsigned long long)srv->rel_delivered, (unsigned long long)srv->rel_window_full,
+           (unsigned long long)srv->rel_dead);
+
+    printf("[stats] frames: rx=%llu (%.2f chunks/frame) lost=%llu | "
+           "tx=%llu (%.2f chunks/frame) merged_states=%llu\n",
+           (unsigned long long)srv->frames_rx,
+           srv->frames_rx ? (double)srv->chunks_rx / (double)srv->frames_rx : 0.0,
+           (unsigned long long)srv->frames_lost,
+           (unsigned long long)srv->frames_tx,
+           srv->frames_tx ? (double)srv->chunks_tx / (double)srv->frames_tx : 0.0,
+           (unsigned long long)srv->states_merged);
+
+    printf("[stats] lagcomp: rewinds=%llu accepted=%llu clamped=%llu window=%d ticks\n",
+           (unsigned long long)srv->lagcomp_rewinds, (unsigned long long)srv->lagcomp_hits,
+           (unsigned long long)srv->lagcomp_clamped, LAGCOMP_MAX_TICKS);
+
+    printf("[stats] lockstep: %s batches=%llu keyframes=%llu resyncs=%llu | "
+           "tx bytes: states=%llu lockstep=%llu\n",
+           srv->lockstep ? "on" : "off",
+           (unsigned long long)srv->lockstep_batches, (unsigned long long)srv->lockstep_keyframes,
+           (unsigned long long)srv->lockstep_resyncs, (unsigned long long)srv->tx_state_bytes,
+           (unsigned long long)srv->tx_lockstep_bytes);
+
+    printf("[stats] pacing: %s slots=%u | bursts (frames per %d us of departure): "
+           "max=%u avg=%.1f\n",
+           srv->pace_slots == 0 ? "off" : srv->txtime ? "txtime" : "on", srv->pace_slots,
+           PACE_SLOT_US, srv->burst_max,
+           srv->bursts ? (double)srv->burst_frames / (double)srv->bursts : 0.0);
+    srv->burst_max = 0;
+    srv->bursts = 0;
+    srv->burst_frames = 0;
+
+    const Auth *au = &srv->auth;
+    printf("[stats] auth: challenges=%llu bad_cookies=%llu bad_tokens=%llu bad_macs=%llu "
+           "replays=%llu epoch=%u\n",
+           (unsigned long long)atomic_load_explicit(&au->challenges, memory_order_relaxed),
+           (unsigned long long)atomic_load_explicit(&au->bad_cookies, memory_order_relaxed),
+           (unsigned long long)atomic_load_explicit(&au->bad_tokens, memory_order_relaxed),
+           (unsigned long long)atomic_load_explicit(&au->bad_macs, memory_order_relaxed),
+           (unsigned long long)atomic_load_explicit(&au->replays, memory_order_relaxed),
+           atomic_load_explicit(&au->epoch, memory_order_relaxed));
+
+    const RateLimiter *rl = &srv->limiter;
+    printf("[stats] ratelimit: allowed=%llu dropped=%llu evicted=%llu\n",
+           (unsigned long long)atomic_load_explicit(&rl->allowed, memory_order_relaxed),
+           (unsigned long long)atomic_load_explicit(&rl->dropped, memory_order_relaxed),
+           (unsigned long long)atomic_load_explicit(&rl->evicted, memory_order_relaxed));
+
+    BinlogStats lg;
+    binlog_stats(&lg);
+    printf("[stats] log: records=%llu dropped=%llu threads=%u\n",
+           (unsigned long long)lg.records, (unsigned long long)lg.dropped, lg.threads);
+
+    if (srv->shm.hdr) {
+        const ShmLink *l = &srv->shm;
+        printf("[stats] shm: joins=%llu closed=%llu inputs=%llu states=%llu wakeups=%llu\n",
+               (unsigned long long)l->joins, (unsigned long long)l->closed,
+               (unsigned long long)l->inputs, (unsigned long long)l->published,
+               (unsigned long long)l->wakeups);
+    }
+
+    if (srv->tcp.conns) {
+        const TcpFront *f = &srv->tcp;
+        printf("[stats] tcp: open=%u accepted=%llu refused=%llu closed=%llu send_failed=%llu "
+               "slow_dropped=%llu\n",
+               f->open_count, (unsigned long long)f->accepted, (unsigned long long)f->refused,
+               (unsigned long long)f->closed, (unsigned long long)f->send_failed,
+               (unsigned long long)f->slow_dropped);
+        tcp_front_log_stats(&srv->tcp);
+    }
+
+    if (srv->routed) {
+        printf("[stats] cluster: node=%u rooms_moved_out=%llu rooms_moved_in=%llu\n",
+               srv->auth.node, (unsigned long long)srv->rooms_moved_out,
+               (unsigned long long)srv->rooms_moved_in);
+    }
+
+    if (!srv->pipeline) return;
+
+    SpscStats in, out;
+    spsc_stats(&srv->in_ring, &in);
+    spsc_stats(&srv->out_ring, &out);
+
+    printf("[stats] in: occ=%zu/%zu hwm=%zu pushed=%llu dropped=%llu | "
+           "out: occ=%zu/%zu hwm=%zu pushed=%llu dropped=%llu\n",
+           in.occupancy, in.capacity, in.high_water,
+           (unsigned long long)in.pushed, (unsigned long long)in.dropped,
+           out.occupancy, out.capacity, out.high_water,
+           (unsigned long long)out.pushed, (unsigned long long)out.dropped);
+}
+
+/* ---------- Cluster: moving matches between nodes ---------- */
+
+/* Snapshot a playing room to another node, then forget it here without a
+   word to the players: the other node announces itself with new tokens. */
+static void move_room_out(Server *srv, uint32_t room_id, uint8_t to_node) {
+    static RoomSnapshot snap;
+    RoomTable *t = &srv->rooms;
+    PoolHandle rh = (room_id < t->rooms.capacity) ? pool_handle_at(&t->rooms, room_id)
+                                                  : POOL_INVALID_HANDLE;
+    Room *r = room_get(t, rh);
+
+    /* Local sessions are bound to this host */
+    int local = 0;
+    for (int i = 0; r && i < ROOM_PLAYERS; i++) {
+        Session *s = session_get(t, r->players[i]);
+        local |= (s && (shm_addr_client(&s->addr) >= 0 || tcp_addr_client(&s->addr) >= 0));
+    }
+
+    if (!r || !room_playing(r) || local || to_node == srv->auth.node) {
+        binlog(LOG_CLUSTER_NOT_MOVABLE, room_id, to_node);
+        return;
+    }
+
+    memset(&snap, 0, sizeof(snap));
+    snap.hdr.op = CLUSTER_ROOM_SNAPSHOT;
+    snap.hdr.from_node = srv->auth.node;
+    snap.hdr.to_node = to_node;
+    snap.hdr.room_id = htonl(room_id);
+    snap.size = sizeof(snap);
+    snap.game = r->game;
+    snap.state = r->state;
+
+    PoolHandle players[ROOM_PLAYERS];
+    for (int i = 0; i < ROOM_PLAYERS; i++) {
+        players[i] = r->players[i];
+        Session *s = session_get(t, players[i]);
+        snap.players[i].addr = s->addr;
+        snap.players[i].input = s->input;
+        snap.players[i].bucket = s->bucket;
+        Link *l = session_link(srv, players[i]);
+        snap.players[i].rel = l->rel;
+        snap.players[i].token = link_token(srv, players[i], s, l);
+        memcpy(snap.players[i].key, l->key, sizeof(snap.players[i].key));
+        snap.players[i].out_seq = l->out.next_seq;
+    }
+    cluster_send(srv, to_node, &snap, sizeof(snap));
+
+    /* The second leave releases the room; stale list entries are skipped */
+    for (int i = 0; i < ROOM_PLAYERS; i++) {
+        lobby_remove(&srv->lobby, t, players[i]);
+        session_leave(t, players[i]);
+    }
+    srv->rooms_moved_out++;
+    binlog(LOG_CLUSTER_MOVED, room_id, to_node);
+}
+
+/* Seat a match moved from another node and hand its players their new
+   tokens. The game resumes from the snapshot. */
+static void adopt_room(Server *srv, const RoomSnapshot *snap, uint64_t now) {
+    RoomTable *t = &srv->rooms;
+    uint32_t from_room = ntohl(snap->hdr.room_id);
+
+    /* This node steps every room at its own rate: a match from a node
+       ticking at another one would change speed */
+    GameRules rules;
+    game_rules_of(&snap->game, &rules);
+    if (snap->size != sizeof(*snap) || rules.tick_hz != t->rules.tick_hz ||
+        (snap->state != ROOM_SERVING && snap->state != ROOM_LIVE)) {
+        binlog(LOG_CLUSTER_REFUSED, from_room, snap->hdr.from_node);
+        return;
+    }
+
+    PoolHandle sh[ROOM_PLAYERS];
+    for (int i = 0; i < ROOM_PLAYERS; i++) {
+        /* A session this node still has for the client is an old one */
+        PoolHandle old = session_find(t, &snap->players[i].addr);
+        if (old != POOL_INVALID_HANDLE) drop_session(srv, old);
+        sh[i] = session_create(t, &snap->players[i].addr, now);
+    }
+    PoolHandle rh = POOL_INVALID_HANDLE;
+    if (sh[0] != POOL_INVALID_HANDLE && sh[1] != POOL_INVALID_HANDLE) {
+        rh = room_create(t, now);
+    }
+
+    if (rh == POOL_INVALID_HANDLE) {
+        binlog(LOG_CLUSTER_LOST, from_room, snap->hdr.from_node);
+        for (int i = 0; i < ROOM_PLAYERS; i++) session_leave(t, sh[i]);
+        return;
+    }
+
+    for (int i = 0; i < ROOM_PLAYERS; i++) {
+        link_reset(srv, sh[i]);
+        room_seat(t, rh, sh[i]);  /* in slot order: players keep their paddle */
+
+        Session *s = session_get(t, sh[i]);
+        s->input = snap->players[i].input;
+        s->bucket = snap->players[i].bucket;
+
+        /* Framed like the old node did until the client takes the REKEY */
+        Link *l = session_link(srv, sh[i]);
+        l->rel = snap->players[i].rel;
+        l->moved_token = snap->players[i].token;
+        memcpy(l->key, snap->players[i].key, sizeof(l->key));
+        l->out.next_seq = snap->players[i].out_seq;
+        if (!rel_idle(&l->rel)) rel_mark(srv, sh[i]);
+
+        RekeyEvent ev;
+        memset(&ev, 0, sizeof(ev));
+        ev.token = auth_token(&srv->auth, sh[i], &s->addr);
+        auth_session_key(&srv->auth, ev.token, ev.key);
+        ev.room_id = htonl(pool_handle_index(rh));
+        ev.flags = s->lockstep ? JOIN_LOCKSTEP : 0;
+        send_event(srv, sh[i], REL_EV_REKEY, &ev, sizeof(ev));
+    }
+
+    Room *r = room_get(t, rh);
+    r->game = snap->game;
+    r->state = snap->state;
+    r->dirty = 1;
+
+    broadcast_state(srv, rh);
+
+    srv->rooms_moved_in++;
+    binlog(LOG_CLUSTER_ADOPTED, from_room, snap->hdr.from_node, pool_handle_index(rh));
+}
+
+/* Apply a cluster message (simulation side) */
+static void handle_cluster(Server *srv, const uint8_t *data, int len, uint64_t now) {
+    static RoomSnapshot snap;
+    ClusterHeader hdr;
+
+    if (!srv->routed || len < (int)sizeof(hdr)) return;  /* only from the router */
+    memcpy(&hdr, data, sizeof(hdr));
+
+    switch (hdr.op) {
+        case CLUSTER_MOVE_ROOM:
+            move_room_out(srv, ntohl(hdr.room_id), hdr.to_node);
+            break;
+
+        case CLUSTER_ROOM_SNAPSHOT:
+            if (len != (int)sizeof(snap)) {
+                binlog(LOG_CLUSTER_REFUSED, ntohl(hdr.room_id), hdr.from_node);
+                break;
+            }
+            memcpy(&snap, data, sizeof(snap));
+            adopt_room(srv, &snap, now);
+            break;
+    }
+}
+
+/* ---------- Hot restart ---------- */
+
+static void snap_flush(SnapWriter *w) {
+    if (!w->err && w->len && handoff_send(w->sock, w->buf, w->len, -1) < 0) w->err = 1;
+    w->len = 0;
+}
+
+static void snap_put(SnapWriter *w, const void *data, size_t len) {
+    if (w->len + len > sizeof(w->buf)) snap_flush(w);
+    if (len > sizeof(w->buf)) {
+        if (!w->err && handoff_send(w->sock, data, len, -1) < 0) w->err = 1;
+        return;
+    }
+    memcpy(w->buf + w->len, data, len);
+    w->len += len;
+}
+
+/* Pipeline mode: stop the I/O thread reading, then apply what it already
+   queued, so the snapshot covers every datagram taken off the socket */
+static void pause_rx(Server *srv, uint64_t now) {
+    atomic_store_explicit(&srv->rx_pause, 1, memory_order_release);
+    wake_io(srv);
+    while (!atomic_load_explicit(&srv->rx_paused, memory_order_acquire)) usleep(50);
+
+    static ClusterRecord crec;
+    InputRecord rec;
+    while (spsc_pop(&srv->in_ring, &rec)) {
+        apply_record(srv, &rec);
+    }
+    while (spsc_pop(&srv->cluster_ring, &crec)) {
+        handle_cluster(srv, crec.data, crec.len, now);
+    }
+    service_reliable(srv, now);
+    flush_links(srv, now, 1);
+}
+
+/* Send the UDP socket and the whole state, then wait for the new process to
+   confirm. Returns 1 once it has taken over (the caller exits), 0 to keep
+   serving. */
+/* TCP clients: the listener, then the open connections in batches, each a
+   count and the slots with their descriptors attached, then the slots'
+   state (buffers included: a stream may stop mid-message). An empty batch
+   ends the list. The old process keeps its own copies: if the handoff
+   fails it serves them on. */
+static int handoff_serve_tcp(Server *srv, int conn, SnapWriter *w) {
+    TcpFront *f = &srv->tcp;
+    uint32_t batch[1 + HANDOFF_FDS_MAX];
+    int fds[HANDOFF_FDS_MAX];
+    uint32_t c = 0;
+
+    if (handoff_send(conn, &f->port, sizeof(f->port), f->listen_fd) < 0) return 0;
+    for (;;) {
+        uint32_t n = 0;
+        for (; c < f->max_conns && n < HANDOFF_FDS_MAX; c++) {
+            if (f->conns[c].fd < 0) continue;
+            batch[1 + n] = c;
+            fds[n++] = f->conns[c].fd;
+        }
+        batch[0] = n;
+        if (handoff_send_fds(conn, batch, (1 + n) * sizeof(uint32_t), fds, (int)n) < 0) return 0;
+        if (n == 0) return 1;
+
+        for (uint32_t i = 0; i < n; i++) snap_put(w, &f->conns[batch[1 + i]], sizeof(TcpConn));
+        snap_flush(w);
+        if (w->err) return 0;
+    }
+}
+
+static int handoff_serve(Server *srv, int conn) {
+    static SnapWriter w;
+    RoomTable *t = &srv->rooms;
+
+    HandoffState hdr;
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.live_count = t->live_count;
+    hdr.ticks = srv->ticks;
+    hdr.last_tick_ms = srv->last_tick_ms;
+    memcpy(hdr.cookie_key, srv->auth.cookie_key, sizeof(hdr.cookie_key));
+    memcpy(hdr.token_key, srv->auth.token_key, sizeof(hdr.token_key));
+    memcpy(hdr.mac_key, srv->auth.mac_key, sizeof(hdr.mac_key));
+    hdr.epoch = atomic_load_explicit(&srv->auth.epoch, memory_order_relaxed);
+    hdr.rotated_ms = srv->auth.rotated_ms;
+    hdr.node = srv->auth.node;
+    if (handoff_send(conn, &hdr, sizeof(hdr), srv->sockfd) < 0) return 0;
+
+    /* Generations first: they say which slots follow, and keep every handle
+       (and so every session token) valid in the new process */
+    w.sock = conn;
+    w.err = 0;
+    w.len = 0;
+    snap_put(&w, t->rooms.generation, t->rooms.capacity * sizeof(uint16_t));
+    snap_put(&w, t->sessions.generation, t->sessions.capacity * sizeof(uint16_t));
+    snap_put(&w, t->live, t->live_count * sizeof(PoolHandle));
+    snap_put(&w, &srv->lobby, sizeof(Lobby));
+
+    for (uint32_t i = 0; i < t->rooms.capacity; i++) {
+        PoolHandle rh = pool_handle_at(&t->rooms, i);
+        if (rh != POOL_INVALID_HANDLE) snap_put(&w, room_get(t, rh), sizeof(Room));
+    }
+    for (uint32_t i = 0; i < t->sessions.capacity; i++) {
+        PoolHandle sh = pool_handle_at(&t->sessions, i);
+        if (sh == POOL_INVALID_HANDLE) continue;
+        snap_put(&w, session_get(t, sh), sizeof(Session));
+        snap_put(&w, &srv->links[i].rel, sizeof(RelChannel));
+        /* Frame seqs carry on both ways: the clients refuse old ones */
+        snap_put(&w, &srv->links[i].out.next_seq, sizeof(uint32_t));
+        snap_put(&w, &srv->links[i].moved_token, sizeof(uint64_t));
+        snap_put(&w, srv->links[i].key, FRAME_KEY_SIZE);
+        snap_put(&w, &srv->rx_guards[i], sizeof(RxGuard));
+    }
+    snap_flush(&w);
+    if (w.err) return 0;
+    if (srv->tcp.conns && !handoff_serve_tcp(srv, conn, &w)) return 0;
+
+    uint8_t reply;
+    if (handoff_recv(conn, &reply, 1, NULL) < 0 || reply != HANDOFF_TAKEN) return 0;
+    reply = HANDOFF_BYE;
+    return handoff_send(conn, &reply, 1, -1) == 0;
+}
+
+static void handoff_drop(Server *srv, const char *why) {
+    printf("Hot restart: %s, still serving\n", why);
+    close(srv->handoff_conn);
+    srv->handoff_conn = -1;
+    atomic_store_explicit(&srv->rx_pause, 0, memory_order_release);
+}
+
+/* Called after every pass: accept a replacement process, tell it what to
+   allocate, and once it is ready hand over right after the next tick so it
+   gets a whole interval to start */
+static void handoff_poll(Server *srv, uint64_t now) {
+    if (srv->handoff_listen < 0) return;
+
+    if (srv->handoff_conn < 0) {
+        srv->handoff_conn = handoff_accept(srv->handoff_listen);
+        if (srv->handoff_conn < 0) return;
+
+        HandoffLayout layout;
+        memset(&layout, 0, sizeof(layout));
+        layout.magic = HANDOFF_MAGIC;
+        layout.version = HANDOFF_VERSION;
+        layout.tick_hz = (uint16_t)srv->rooms.rules.tick_hz;
+        layout.room_size = sizeof(Room);
+        layout.session_size = sizeof(Session);
+        layout.rel_size = sizeof(RelChannel);
+        layout.lobby_size = sizeof(Lobby);
+        layout.max_rooms = srv->rooms.rooms.capacity;
+        layout.tcp_conn_size = sizeof(TcpConn);
+        layout.tcp_port = srv->tcp.conns ? srv->tcp.port : 0;
+        srv->handoff_ready = 0;
+        if (handoff_send(srv->handoff_conn, &layout, sizeof(layout), -1) < 0) {
+            handoff_drop(srv, "new process went away");
+            return;
+        }
+        printf("Hot restart: new process connected\n");
+    }
+
+    if (!srv->handoff_ready) {
+        uint8_t msg;
+        int r = handoff_try_recv(srv->handoff_conn, &msg);
+        if (r == 0) return;
+        if (r < 0 || msg != HANDOFF_READY) {
+            handoff_drop(srv, "new process refused the handoff");
+            return;
+        }
+        srv->handoff_ready = 1;
+    }
+    if (srv->last_tick_ms != now) return;  /* this pass did not tick */
+
+    uint64_t start_us = get_time_us();
+    if (srv->pipeline) pause_rx(srv, now);
+    else flush_links(srv, now, 1);  /* paced frames of the last tick */
+
+    if (!handoff_serve(srv, srv->handoff_conn)) {
+        handoff_drop(srv, "handoff failed");
+        return;
+    }
+
+    printf("Hot restart: handed over %u rooms and %u sessions in %llu us, exiting\n",
+           srv->rooms.rooms.in_use, srv->rooms.sessions.in_use,
+           (unsigned long long)(get_time_us() - start_us));
+    fflush(stdout);
+
+    /* Pipeline mode: let the I/O thread send what is already encoded */
+    for (int i = 0; i < 1000 && srv->pipeline; i++) {
+        SpscStats out;
+        spsc_stats(&srv->out_ring, &out);
+        if (out.occupancy == 0) break;
+        usleep(100);
+    }
+    binlog_stop();
+    exit(EXIT_SUCCESS);
+}
+
+/* New process: check the layout the running server announced */
+static int takeover_compatible(const HandoffLayout *layout) {
+    return layout->magic == HANDOFF_MAGIC && layout->version == HANDOFF_VERSION &&
+           layout->room_size == sizeof(Room) && layout->session_size == sizeof(Session) &&
+           layout->rel_size == sizeof(RelChannel) && layout->lobby_size == sizeof(Lobby) &&
+           layout->tcp_conn_size == sizeof(TcpConn) &&
+           layout->tick_hz >= GAME_TICK_HZ_MIN && layout->tick_hz <= GAME_TICK_HZ_MAX;
+}
+
+/* New process: take the TCP listener and connections handoff_serve_tcp()
+   sends, into the same slots (their sessions' addresses name the slots).
+   Without --tcp here they are closed, and their sessions time out. The
+   listener replaces none of ours: main opens one only on another port. */
+static int takeover_load_tcp(Server *srv, int conn) {
+    TcpFront *f = &srv->tcp;
+    static TcpConn states[HANDOFF_FDS_MAX];
+    uint32_t batch[1 + HANDOFF_FDS_MAX];
+    int fds[HANDOFF_FDS_MAX];
+    uint16_t port;
+    int nfds, ok = 1;
+
+    if (handoff_recv_fds(conn, &port, sizeof(port), fds, 1, &nfds) < 0 || nfds != 1) {
+        return -1;
+    }
+    if (!f->conns || f->listen_fd >= 0) {
+        close(fds[0]);
+    } else if (tcp_front_adopt_listener(f, fds[0]) < 0) {
+        close(fds[0]);
+        return -1;  /* main counted on it: no listener otherwise */
+    }
+
+    while (ok) {
+        if (handoff_recv_fds(conn, batch, sizeof(uint32_t), fds, HANDOFF_FDS_MAX, &nfds) < 0) {
+            return -1;
+        }
+        uint32_t n = batch[0];
+        ok = n == (uint32_t)nfds &&
+             handoff_recv(conn, batch + 1, n * sizeof(uint32_t), NULL) == 0 &&
+             handoff_recv(conn, states, n * sizeof(TcpConn), NULL) == 0;
+        for (int i = 0; i < nfds; i++) {
+            if (!ok || !f->conns || tcp_front_adopt(f, batch[1 + i], fds[i], &states[i]) < 0) {
+                close(fds[i]);
+            }
+        }
+        if (n == 0) break;
+    }
+    if (f->conns) tcp_front_adopted(f);
+    return ok ? 0 : -1;
+}
+
+/* New process, pools sized from the layout: say we are ready, receive the
+   socket and the snapshot, and confirm. Returns the inherited socket once
+   the old process has stopped, -1 if it is still serving (or gone without
+   saying so). */
+static int takeover_load(Server *srv, int conn, int tcp) {
+    RoomTable *t = &srv->rooms;
+    HandoffState hdr;
+    int fd = -1;
+
+    uint8_t msg = HANDOFF_READY;
+    if (handoff_send(conn, &msg, 1, -1) < 0) return -1;
+
+    /* The old process answers at its next tick boundary */
+    if (handoff_recv(conn, &hdr, sizeof(hdr), &fd) < 0 || fd < 0 ||
+        hdr.live_count > t->rooms.capacity) {
+        return -1;
+    }
+
+    uint16_t *gens = malloc(t->sessions.capacity * sizeof(uint16_t));
+    PoolHandle *live = malloc(t->rooms.capacity * sizeof(PoolHandle));
+    int ok = gens && live;
+
+    ok = ok && handoff_recv(conn, gens, t->rooms.capacity * sizeof(uint16_t), NULL) == 0 &&
+         pool_restore(&t->rooms, gens, t->rooms.capacity) == 0;
+    ok = ok && handoff_recv(conn, gens, t->sessions.capacity * sizeof(uint16_t), NULL) == 0 &&
+         pool_restore(&t->sessions, gens, t->sessions.capacity) == 0;
+    ok = ok && handoff_recv(conn, live, hdr.live_count * sizeof(PoolHandle), NULL) == 0;
+    ok = ok && handoff_recv(conn, &srv->lobby, sizeof(Lobby), NULL) == 0;
+
+    for (uint32_t i = 0; ok && i < t->rooms.capacity; i++) {
+        PoolHandle rh = pool_handle_at(&t->rooms, i);
+        if (rh == POOL_INVALID_HANDLE) continue;
+        ok = handoff_recv(conn, room_get(t, rh), sizeof(Room), NULL) == 0;
+    }
+    for (uint32_t i = 0; ok && i < t->sessions.capacity; i++) {
+        PoolHandle sh = pool_handle_at(&t->sessions, i);
+        if (sh == POOL_INVALID_HANDLE) continue;
+        ok = handoff_recv(conn, session_get(t, sh), sizeof(Session), NULL) == 0 &&
+             handoff_recv(conn, &srv->links[i].rel, sizeof(RelChannel), NULL) == 0 &&
+             handoff_recv(conn, &srv->links[i].out.next_seq, sizeof(uint32_t), NULL) == 0 &&
+             handoff_recv(conn, &srv->links[i].moved_token, sizeof(uint64_t), NULL) == 0 &&
+             handoff_recv(conn, srv->links[i].key, FRAME_KEY_SIZE, NULL) == 0 &&
+             handoff_recv(conn, &srv->rx_guards[i], sizeof(RxGuard), NULL) == 0;
+        if (ok && !rel_idle(&srv->links[i].rel)) rel_mark(srv, sh);
+    }
+
+    if (ok) {
+        room_table_rebuild(t, live, hdr.live_count);
+        memcpy(srv->auth.cookie_key, hdr.cookie_key, sizeof(hdr.cookie_key));
+        memcpy(srv->auth.token_key, hdr.token_key, sizeof(hdr.token_key));
+        memcpy(srv->auth.mac_key, hdr.mac_key, sizeof(hdr.mac_key));
+        atomic_store_explicit(&srv->auth.epoch, hdr.epoch, memory_order_relaxed);
+        srv->auth.rotated_ms = hdr.rotated_ms;
+        srv->auth.node = hdr.node;
+        srv->ticks = hdr.ticks;
+        srv->last_tick_ms = hdr.last_tick_ms;
+    }
+    free(gens);
+    free(live);
+    if (ok && tcp) ok = takeover_load_tcp(srv, conn) == 0;
+
+    msg = HANDOFF_TAKEN;
+    if (!ok || handoff_send(conn, &msg, 1, -1) < 0 ||
+        handoff_recv(conn, &msg, 1, NULL) < 0 || msg != HANDOFF_BYE) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+/* Apply the low-latency profile's pinning and scheduling to the calling thread */
+static void tune_thread(const char *name, int cpu, int fifo_priority) {
+    if (cpu >= 0) {
+        if (lowlat_pin_thread(cpu) < 0) perror("pin thread");
+        else printf("%s thread pinned to CPU %d\n", name, cpu);
+    }
+    if (fifo_priority > 0) {
+        if (lowlat_fifo(fifo_priority) < 0) perror("SCHED_FIFO");
+        else printf("%s thread runs SCHED_FIFO priority %d\n", name, fifo_priority);
+    }
+}
+
+/* Local clients: apply what the marked slots wrote (joins, inputs,
+   leaves), as records like those parsed from datagrams. Now and then,
+   close slots whose session the server dropped (timeout, lobby expiry). */
+static void shm_service(Server *srv, uint64_t now) {
+    ShmLink *l = &srv->shm;
+    RoomTable *t = &srv->rooms;
+    if (!l->hdr) return;
+
+    uint32_t n = shm_collect(l, srv->shm_dirty, l->hdr->max_clients);
+    uint64_t parse_ns = n ? get_realtime_ns() : 0;
+
+    for (uint32_t k = 0; k < n; k++) {
+        uint32_t c = srv->shm_dirty[k];
+        ShmClient *sc = &l->clients[c];
+
+        InputRecord rec;
+        memset(&rec, 0, sizeof(rec));
+        rec.addr = shm_client_addr(c);
+        rec.recv_ms = now;
+        rec.parse_ns = parse_ns;
+        rec.session = session_find(t, &rec.addr);
+
+        switch (atomic_load_explicit(&sc->state, memory_order_acquire)) {
+            case SHM_JOINING:
+                rec.type = MSG_CLIENT_JOIN_QUEUE;
+                rec.region = sc->region;
+                rec.rtt_bucket = sc->rtt_bucket;
+                apply_record(srv, &rec);  /* ACTIVE once answered */
+                if (session_find(t, &rec.addr) == POOL_INVALID_HANDLE) {
+                    shm_client_release(l, c);  /* server full */
+                }
+                break;
+
+            case SHM_ACTIVE:
+                if (rec.session == POOL_INVALID_HANDLE) {
+                    shm_client_release(l, c);
+                    break;
+                }
+                rec.type = MSG_FRAME;
+                rec.chunk = CHUNK_INPUT;
+                while (shm_input_pop(l, c, &rec.input)) apply_record(srv, &rec);
+                break;
+
+            case SHM_LEAVING:
+                if (rec.session != POOL_INVALID_HANDLE) {
+                    rec.type = MSG_FRAME;
+                    rec.chunk = CHUNK_DISCONNECT;
+                    apply_record(srv, &rec);
+                }
+                shm_client_release(l, c);
+                break;
+        }
+    }
+
+    if (now - srv->shm_swept_ms < CLIENT_TIMEOUT_MS) return;
+    srv->shm_swept_ms = now;
+    for (uint32_t c = 0; c < l->hdr->max_clients; c++) {
+        if (atomic_load_explicit(&l->clients[c].state, memory_order_relaxed) != SHM_ACTIVE) continue;
+        struct sockaddr_in addr = shm_client_addr(c);
+        if (session_find(t, &addr) == POOL_INVALID_HANDLE) shm_client_release(l, c);
+    }
+}
+
+/* TCP clients: connections, inputs and closes become records like those
+   parsed from datagrams. Every TCP_SWEEP_MS, open connections keep their
+   sessions alive, and a connection or a session that lost its other half
+   is ended. */
+static void tcp_service(Server *srv, uint64_t now) {
+    TcpFront *f = &srv->tcp;
+    RoomTable *t = &srv->rooms;
+    if (!f->conns) return;
+
+    TcpEvent events[TCP_EVENT_BATCH];
+    uint32_t n = tcp_front_poll(f, events, TCP_EVENT_BATCH);
+    uint64_t parse_ns = n ? get_realtime_ns() : 0;
+
+    for (uint32_t k = 0; k < n; k++) {
+        const TcpEvent *ev = &events[k];
+
+        InputRecord rec;
+        memset(&rec, 0, sizeof(rec));
+        rec.addr = tcp_client_addr(ev->conn);
+        rec.recv_ms = now;
+        rec.parse_ns = parse_ns;
+        rec.session = session_find(t, &rec.addr);
+
+        switch (ev->type) {
+            case TCP_EV_OPEN:
+                /* The slot's previous session, if no sweep ended it yet */
+                if (rec.session != POOL_INVALID_HANDLE) leave_session(srv, rec.session);
+                rec.type = MSG_CLIENT_JOIN_QUEUE;
+                apply_record(srv, &rec);  /* the HELLO goes out once matched */
+                if (session_find(t, &rec.addr) == POOL_INVALID_HANDLE) {
+                    tcp_front_drop(f, ev->conn);  /* server full */
+                }
+                break;
+
+            case TCP_EV_INPUT:
+                if (rec.session == POOL_INVALID_HANDLE) break;
+                rec.type = MSG_FRAME;
+                rec.chunk = CHUNK_INPUT;
+                rec.input = ev->input;
+                apply_record(srv, &rec);
+                break;
+
+            case TCP_EV_CLOSED:
+                if (rec.session == POOL_INVALID_HANDLE) break;
+                rec.type = MSG_FRAME;
+                rec.chunk = CHUNK_DISCONNECT;
+                apply_record(srv, &rec);
+                break;
+        }
+    }
+
+    if (now - srv->tcp_swept_ms < TCP_SWEEP_MS) return;
+    srv->tcp_swept_ms = now;
+    for (uint32_t c = 0; c < f->max_conns; c++) {
+        struct sockaddr_in addr = tcp_client_addr(c);
+        PoolHandle sh = session_find(t, &addr);
+        Session *s = session_get(t, sh);
+
+        if (!tcp_front_is_open(f, c)) {
+            if (s) leave_session(srv, sh);  /* connection dropped */
+        } else if (!s) {
+            tcp_front_drop(f, c);           /* session dropped by the server */
+        } else {
+            s->last_seen_ms = now;          /* the connection is its liveness */
+        }
+    }
+}
+
+/* Simulation thread (pipeline mode): drains inputs, ticks, queues snapshots */
+static void *sim_thread_main(void *arg) {
+    Server *srv = (Server *)arg;
+    static ClusterRecord crec;
+    InputRecord rec;
+
+    tune_thread("simulation", srv->tick_cpu, srv->fifo_priority);
+
+    while (1) {
+        uint64_t now = get_time_ms();
+
+        while (spsc_pop(&srv->in_ring, &rec)) {
+            apply_record(srv, &rec);
+        }
+        while (spsc_pop(&srv->cluster_ring, &crec)) {
+            handle_cluster(srv, crec.data, crec.len, now);
+        }
+        shm_service(srv, now);
+        tcp_service(srv, now);
+
+        simulate(srv, now);
+        service_reliable(srv, now);
+        flush_links(srv, now, 0);
+        if (srv->shm.hdr) shm_pass_done(&srv->shm);
+        handoff_poll(srv, now);
+        if (srv->out_queued) wake_io(srv);
+
+        if (now - srv->last_stats_ms >= STATS_INTERVAL_MS) {
+            print_stats(srv);
+            srv->last_stats_ms = now;
+        }
+
+        if (!srv->low_latency) usleep(1000); /* 1ms */
+    }
+    return NULL;
+}
+
+/* I/O thread: send one encoded datagram, timing snapshots (LAT_TICK_SEND) */
+static void io_send(Server *srv, const OutRecord *out) {
+    udp_send(srv, &out->addr, out->data, out->len, out->due_us);
+    if (out->tick_ns) {
+        hist_add_span_ns(&srv->io_lat[LAT_TICK_SEND], out->tick_ns, get_realtime_ns());
+    }
+}
+
+/* I/O thread (pipeline mode): socket -> in_ring, out_ring -> socket */
+static void io_loop(Server *srv) {
+    static uint8_t buffer[BUFFER_SIZE];
+    static ClusterRecord crec;
+    struct sockaddr_in client_addr;
+    InputRecord recs[RX_CHUNKS_MAX];
+    OutRecord out;
+    uint64_t rx_ns;
+    uint64_t last_stats_ms = get_time_ms();
+    struct pollfd fds[2] = { { srv->sockfd, POLLIN, 0 }, { srv->out_wake, POLLIN, 0 } };
+
+    tune_thread("I/O", srv->io_cpu, 0);
+
+    while (1) {
+        /* Sleep until a datagram arrives or the sim thread queues output;
+           the reads below never block, so queued records wait for no
+           timeout. The low-latency profile spins instead. */
+        if (!srv->low_latency && poll(fds, 2, IO_WAIT_MS) > 0 && (fds[1].revents & POLLIN)) {
+            uint64_t n;
+            if (read(srv->out_wake, &n, sizeof(n)) < 0 && errno != EAGAIN) perror("eventfd read");
+        }
+
+        /* Hot restart in progress: stop reading, keep sending */
+        if (atomic_load_explicit(&srv->rx_pause, memory_order_acquire)) {
+            atomic_store_explicit(&srv->rx_paused, 1, memory_order_release);
+            while (spsc_pop(&srv->out_ring, &out)) {
+                io_send(srv, &out);
+            }
+            usleep(100);
+            continue;
+        }
+        atomic_store_explicit(&srv->rx_paused, 0, memory_order_relaxed);
+
+        /* Bounded batch so a flood cannot starve the outbound side */
+        for (int n = 0; n < RX_BATCH &&
+                        !atomic_load_explicit(&srv->rx_pause, memory_order_relaxed); n++) {
+            int recv_len = udp_recv(srv, buffer, sizeof(buffer), &client_addr, &rx_ns,
+                                    MSG_DONTWAIT);
+
+            if (recv_len < 0) {
+                if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                    perror("recvfrom error");
+                }
+                break;
+            }
+
+            /* From another node or the router: applied by the sim thread.
+               A standalone server has no cluster: such a datagram takes
+               the normal path and is dropped as unknown. */
+            if (srv->routed && client_addr.sin_addr.s_addr == INADDR_ANY) {
+                crec.len = (uint16_t)recv_len;
+                memcpy(crec.data, buffer, (size_t)recv_len);
+                spsc_push(&srv->cluster_ring, &crec);
+                continue;
+            }
+
+            /* Over-budget sources are dropped before any parsing */
+            uint64_t now = get_time_ms();
+            if (!ratelimit_allow(&srv->limiter, &client_addr, now)) continue;
+
+            uint64_t parse_ns = get_realtime_ns();
+            hist_add_span_ns(&srv->io_lat[LAT_RX_PARSE], rx_ns, parse_ns);
+
+            int n = parse_datagram(srv, buffer, recv_len, &client_addr, now, parse_ns,
+                                   recs, RX_CHUNKS_MAX);
+            for (int i = 0; i < n; i++) {
+                spsc_push(&srv->in_ring, &recs[i]);
+            }
+        }
+
+        auth_maybe_rotate(&srv->auth, get_time_ms());
+
+        while (spsc_pop(&srv->out_ring, &out)) {
+            io_send(srv, &out);
+        }
+
+        uint64_t now = get_time_ms();
+        if (now - last_stats_ms >= STATS_INTERVAL_MS) {
+            print_latency(srv->io_lat, "I/O thread");
+            print_views(srv, "I/O thread");
+            last_stats_ms = now;
+        }
+    }
+}
+
+/* Single-thread mode: original loop */
+static void run_single_thread(Server *srv) {
+    static uint8_t buffer[BUFFER_SIZE];
+    struct sockaddr_in client_addr;
+    uint64_t rx_ns;
+
+    tune_thread("server", srv->tick_cpu, srv->fifo_priority);
+
+    /* Main game loop */
+    while (1) {
+        uint64_t now = get_time_ms();
+
+        /* Process incoming messages (non-blocking). Bounded, and cut short
+           once the tick is due, so a flood cannot delay the rooms. */
+        for (int n = 0; n < RX_BUDGET; n++) {
+            int recv_len = udp_recv(srv, buffer, sizeof(buffer), &client_addr, &rx_ns, 0);
+
+            if (recv_len < 0) {
+                if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                    break; /* No more messages */
+                }
+                perror("recvfrom error");
+                break;
+            }
+
+            uint64_t rx_ms = get_time_ms();
+            if (srv->routed && client_addr.sin_addr.s_addr == INADDR_ANY) {
+                handle_cluster(srv, buffer, recv_len, rx_ms);
+            } else if (ratelimit_allow(&srv->limiter, &client_addr, rx_ms)) {
+                handle_message(srv, buffer, recv_len, &client_addr, rx_ms, rx_ns);
+            }
+            if (rx_ms - srv->last_tick_ms >= srv->tick_ms) break;
+        }
+
+        auth_maybe_rotate(&srv->auth, now);
+        shm_service(srv, now);
+        tcp_service(srv, now);
+        simulate(srv, now);
+        service_reliable(srv, now);
+        flush_links(srv, now, 0);
+        if (srv->shm.hdr) shm_pass_done(&srv->shm);
+        handoff_poll(srv, now);
+
+        if (now - srv->last_stats_ms >= STATS_INTERVAL_MS) {
+            print_stats(srv);
+            print_views(srv, "server");
+            srv->last_stats_ms = now;
+        }
+
+        /* Small sleep to prevent CPU spinning (the low-latency profile spins) */
+        if (!srv->low_latency) usleep(1000); /* 1ms */
+    }
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr, "Usage: %s [--pipeline] [--max-rooms N] [--rate-limit PPS] "
+                    "[--tick-hz HZ] [--tick-budget-us US]\n"
+                    "       [--handoff PATH | --takeover PATH]\n"
+                    "       [--port PORT] [--node-id N --router IP:PORT]\n"
+                    "       [--low-latency] [--cpu N] [--io-cpu N] [--fifo PRIO] [--log FILE]\n"
+                    "       [--shm NAME] [--tcp PORT] [--lockstep] [--pace | --txtime]\n", prog);
+    fprintf(stderr, "  --pipeline     separate I/O and simulation threads (lock-free rings)\n");
+    fprintf(stderr, "  --max-rooms N  rooms preallocated at startup (default %d)\n",
+            DEFAULT_MAX_ROOMS);
+    fprintf(stderr, "  --rate-limit P datagrams/s allowed per source address, 0 = off (default %d)\n",
+            DEFAULT_RATE_PPS);
+    fprintf(stderr, "  --tick-hz HZ   simulation rate of the rooms, %d-%d (default %d); clients\n"
+                    "                 get it with the rest of the rules when they join\n",
+            GAME_TICK_HZ_MIN, GAME_TICK_HZ_MAX, GAME_TICK_HZ);
+    fprintf(stderr, "  --tick-budget-us US  processing time per tick before degrading\n"
+                    "                 (default: half the tick, the rest is left for I/O)\n");
+    fprintf(stderr, "  --handoff PATH hand the socket and all matches to a server started\n"
+                    "                 with --takeover PATH (hot restart)\n");
+    fprintf(stderr, "  --takeover PATH  take over from the server listening on PATH, then\n"
+                    "                 listen there for the next restart\n");
+    fprintf(stderr, "  --port PORT    UDP port (default %d)\n", SERVER_PORT);
+    fprintf(stderr, "  --node-id N    cluster node id, 0-%d (its index in router_udp's list)\n",
+            CLUSTER_MAX_NODES - 1);
+    fprintf(stderr, "  --router IP:PORT  serve clients through router_udp at this address\n");
+    fprintf(stderr, "  --low-latency  busy-poll the socket, spin instead of sleeping, lock all\n"
+                    "                 memory (one busy core per thread; compare tick jitter)\n");
+    fprintf(stderr, "  --cpu N        pin the tick thread (simulation thread in pipeline mode)\n");
+    fprintf(stderr, "  --io-cpu N     pin the I/O thread (pipeline mode)\n");
+    fprintf(stderr, "  --fifo PRIO    SCHED_FIFO for the tick thread; with --low-latency only on\n"
+                    "                 an isolated core\n");
+    fprintf(stderr, "  --log FILE     write events in binary to FILE (read it with logdump)\n"
+                    "                 instead of text on stdout\n");
+    fprintf(stderr, "  --shm NAME     also serve clients on this host through shared memory\n"
+                    "                 (POSIX name, e.g. /pong; see bot_shm)\n");
+    fprintf(stderr, "  --tcp PORT     also serve client_tcp players on this TCP port, in the\n"
+                    "                 same lobby and rooms as the UDP ones\n");
+    fprintf(stderr, "  --lockstep     send clients that support it both players' inputs, a\n"
+                    "                 checksum and periodic keyframes instead of every state\n");
+    fprintf(stderr, "  --pace         spread the rooms' sends over the tick (%d us slots, one per\n"
+                    "                 room) instead of sending them all at the tick\n", PACE_SLOT_US);
+    fprintf(stderr, "  --txtime       --pace, with the departure times handed to the kernel\n"
+                    "                 (SO_TXTIME; needs the fq qdisc on the outgoing device)\n");
+}
+
+/* Bound UDP socket for a fresh start (a hot restart inherits it instead) */
+static int create_socket(int port) {
+    struct sockaddr_in server_addr;
+
+    int sockfd = socket(AF_INET, SOCK_DGRAM, 0);
+    if (sockfd < 0) {
+        perror("socket creation failed");
+        exit(EXIT_FAILURE);
+    }
+
+    /* Set socket to non-blocking mode */
+    struct timeval tv;
+    tv.tv_sec = 0;
+    tv.tv_usec = 1000; /* 1ms timeout for recvfrom */
+    setsockopt(sockfd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+
+    /* Configure server address */
+    memset(&server_addr, 0, sizeof(server_addr));
+    server_addr.sin_family = AF_INET;
+    server_addr.sin_addr.s_addr = INADDR_ANY;
+    server_addr.sin_port = htons((uint16_t)port);
+
+    /* Bind socket */
+    if (bind(sockfd, (struct sockaddr *)&server_addr, sizeof(server_addr)) < 0) {
+        perror("bind failed");
+        close(sockfd);
+        exit(EXIT_FAILURE);
+    }
+    return sockfd;
+}
+
+int main(int argc, char *argv[]) {
+    static Server srv;
+    int max_rooms = DEFAULT_MAX_ROOMS;
+    int rate_pps = DEFAULT_RATE_PPS;
+    int tick_hz = GAME_TICK_HZ;
+    int tick_budget_us = 0;
+    const char *handoff_path = NULL;
+    int takeover = 0;
+    int port = SERVER_PORT;
+    int node_id = 0;
+    const char *router = NULL;
+    const char *log_path = NULL;
+    const char *shm_name = NULL;
+    int tcp_port = 0;
+    int pace = 0;
+
+    srv.tick_cpu = -1;
+    srv.io_cpu = -1;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--pipeline") == 0) {
+            srv.pipeline = 1;
+        } else if (strcmp(argv[i], "--max-rooms") == 0 && i + 1 < argc) {
+            max_rooms = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--rate-limit") == 0 && i + 1 < argc) {
+            rate_pps = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--tick-hz") == 0 && i + 1 < argc) {
+            tick_hz = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--tick-budget-us") == 0 && i + 1 < argc) {
+            tick_budget_us = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--handoff") == 0 && i + 1 < argc) {
+            handoff_path = argv[++i];
+        } else if (strcmp(argv[i], "--takeover") == 0 && i + 1 < argc) {
+            handoff_path = argv[++i];
+            takeover = 1;
+        } else if (strcmp(argv[i], "--port") == 0 && i + 1 < argc) {
+            port = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--node-id") == 0 && i + 1 < argc) {
+            node_id = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--router") == 0 && i + 1 < argc) {
+            router = argv[++i];
+        } else if (strcmp(argv[i], "--low-latency") == 0) {
+            srv.low_latency = 1;
+        } else if (strcmp(argv[i], "--cpu") == 0 && i + 1 < argc) {
+            srv.tick_cpu = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--io-cpu") == 0 && i + 1 < argc) {
+            srv.io_cpu = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--fifo") == 0 && i + 1 < argc) {
+            srv.fifo_priority = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--log") == 0 && i + 1 < argc) {
+            log_path = argv[++i];
+        } else if (strcmp(argv[i], "--shm") == 0 && i + 1 < argc) {
+            shm_name = argv[++i];
+        } else if (strcmp(argv[i], "--tcp") == 0 && i + 1 < argc) {
+            tcp_port = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--lockstep") == 0) {
+            srv.lockstep = 1;
+        } else if (strcmp(argv[i], "--pace") == 0) {
+            pace = 1;
+        } else if (strcmp(argv[i], "--txtime") == 0) {
+            pace = 1;
+            srv.txtime = 1;
+        } else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    if (node_id < 0 || node_id >= CLUSTER_MAX_NODES ||
+        tick_hz < GAME_TICK_HZ_MIN || tick_hz > GAME_TICK_HZ_MAX ||
+        tcp_port < 0 || tcp_port > 65535) {
+        usage(argv[0]);
+        return 1;
+    }
+    if (router) {
+        /* Cluster node: the router is the only peer */
+        char ip[INET_ADDRSTRLEN];
+        int router_port;
+        if (sscanf(router, "%15[0-9.]:%d", ip, &router_port) != 2 ||
+            inet_pton(AF_INET, ip, &srv.router_addr.sin_addr) != 1) {
+            usage(argv[0]);
+            return 1;
+        }
+        srv.router_addr.sin_family = AF_INET;
+        srv.router_addr.sin_port = htons((uint16_t)router_port);
+        srv.routed = 1;
+    }
+
+    /* Events of the packet and tick paths go through the async log */
+    if (binlog_start(log_path) < 0) {
+        perror(log_path ? log_path : "event log");
+        return 1;
+    }
+
+    /* Hot restart: the running server announces its layout; the pools
+       must match its size, and the matches it hands over go on at its
+       tick rate */
+    HandoffLayout layout;
+    int handoff_conn = -1;
+    if (takeover) {
+        handoff_conn = handoff_connect(handoff_path);
+        if (handoff_conn < 0) {
+            perror("hot restart: connect");
+            exit(EXIT_FAILURE);
+        }
+        if (handoff_recv(handoff_conn, &layout, sizeof(layout), NULL) < 0 ||
+            !takeover_compatible(&layout)) {
+            fprintf(stderr, "hot restart: incompatible server build (state layout differs); "
+                            "the running server keeps serving\n");
+            exit(EXIT_FAILURE);
+        }
+        if ((uint32_t)max_rooms != layout.max_rooms) {
+            printf("Hot restart: sizing pools for %u rooms, as the running server\n",
+                   layout.max_rooms);
+        }
+        max_rooms = (int)layout.max_rooms;
+        if ((uint32_t)tick_hz != layout.tick_hz) {
+            printf("Hot restart: ticking at %u Hz, as the running server\n", layout.tick_hz);
+        }
+        tick_hz = layout.tick_hz;
+    }
+
+    /* Preallocate every room and session: no malloc once the server runs */
+    if (max_rooms <= 0 || room_table_init(&srv.rooms, (uint32_t)max_rooms) < 0) {
+        fprintf(stderr, "cannot allocate pools for %d rooms\n", max_rooms);
+        exit(EXIT_FAILURE);
+    }
+    game_rules_default(&srv.rooms.rules, (uint32_t)tick_hz);
+    srv.tick_ms = 1000 / srv.rooms.rules.tick_hz;
+    if (pace) {
+        /* The last slot still leaves a pass before the next tick */
+        uint32_t slots = srv.tick_ms * 1000 / PACE_SLOT_US;
+        srv.pace_slots = slots > 1 ? slots - 1 : 1;
+    }
+    lobby_init(&srv.lobby);
+
+    /* One link (reliable channel + outbound frame) per session slot */
+    uint32_t max_sessions = srv.rooms.sessions.capacity;
+    srv.links = calloc(max_sessions, sizeof(Link));
+    srv.rel_pending = calloc(max_sessions, sizeof(PoolHandle));
+    srv.flush_list = calloc(max_sessions, sizeof(PoolHandle));
+    srv.rx_guards = calloc(max_sessions, sizeof(RxGuard));
+    if (!srv.links || !srv.rel_pending || !srv.flush_list || !srv.rx_guards) {
+        fprintf(stderr, "cannot allocate session links\n");
+        exit(EXIT_FAILURE);
+    }
+    for (uint32_t i = 0; i < max_sessions; i++) {
+        srv.links[i].rel_pos = UINT32_MAX;
+        srv.links[i].flush_pos = UINT32_MAX;
+    }
+    overload_init(&srv.overload, tick_budget_us > 0 ? (uint32_t)tick_budget_us
+                                                    : srv.tick_ms * 500);
+    if (rate_pps < 0 ||
+        ratelimit_init(&srv.limiter, RATE_TABLE_ENTRIES, (uint32_t)rate_pps, RATE_BURST) < 0) {
+        fprintf(stderr, "cannot allocate the rate limiter\n");
+        exit(EXIT_FAILURE);
+    }
+
+    if (auth_init(&srv.auth, get_time_ms(), (uint8_t)node_id) < 0) {
+        perror("getrandom");
+        exit(EXIT_FAILURE);
+    }
+
+    srv.last_tick_ms = get_time_ms();
+    srv.last_stats_ms = srv.last_tick_ms;
+    srv.handoff_listen = -1;
+    srv.handoff_conn = -1;
+
+    /* Everything that can still fail is set up before a takeover: once it
+       answers TAKEN the old process exits, and up to then it keeps serving
+       if this one gives up */
+    if (srv.pipeline &&
+        (spsc_init(&srv.in_ring, sizeof(InputRecord), RING_CAPACITY) < 0 ||
+         spsc_init(&srv.out_ring, sizeof(OutRecord), RING_CAPACITY) < 0 ||
+         spsc_init(&srv.cluster_ring, sizeof(ClusterRecord), CLUSTER_RING_CAPACITY) < 0)) {
+        fprintf(stderr, "ring allocation failed\n");
+        exit(EXIT_FAILURE);
+    }
+    if (srv.pipeline && (srv.out_wake = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) < 0) {
+        perror("eventfd");
+        exit(EXIT_FAILURE);
+    }
+
+    /* Local clients: one slot per session. Made for a takeover too (a new
+       region: local sessions of the old process time out), staged until
+       the old process is gone so clients keep finding its region. */
+    if (shm_name) {
+        uint32_t rooms = srv.rooms.rooms.capacity;
+        srv.shm_dirty = calloc(max_sessions, sizeof(uint32_t));
+        if (!srv.shm_dirty ||
+            (takeover ? shm_link_stage(&srv.shm, shm_name, rooms, max_sessions)
+                      : shm_link_create(&srv.shm, shm_name, rooms, max_sessions)) < 0) {
+            perror(shm_name);
+            exit(EXIT_FAILURE);
+        }
+        srv.shm_swept_ms = get_time_ms();
+        printf("Local clients: shared memory %s (%zu KB)\n", shm_name, srv.shm.size / 1024);
+    }
+
+    /* TCP clients: one connection per session, each a descriptor. A
+       takeover inherits the old process's connections, and its listener if
+       it listens on the same port: then none is opened here. */
+    if (tcp_port) {
+        int inherit = takeover && layout.tcp_port == tcp_port;
+        struct rlimit rl;
+        if (getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur < (rlim_t)max_sessions + 64) {
+            rl.rlim_cur = rl.rlim_max;
+            setrlimit(RLIMIT_NOFILE, &rl);
+        }
+        if (tcp_front_open(&srv.tcp, inherit ? 0 : (uint16_t)tcp_port, max_sessions) < 0) {
+            perror("tcp");
+            exit(EXIT_FAILURE);
+        }
+        srv.tcp_swept_ms = get_time_ms();
+        printf("TCP clients: port %d (up to %u connections)\n", tcp_port, max_sessions);
+    }
+
+    if (takeover) {
+        srv.sockfd = takeover_load(&srv, handoff_conn, layout.tcp_port != 0);
+        if (srv.sockfd < 0) {
+            shm_link_close(&srv.shm);  /* the staged region */
+            fprintf(stderr, "hot restart: handoff aborted; the running server keeps serving\n");
+            exit(EXIT_FAILURE);
+        }
+        close(handoff_conn);
+        /* Past this point nothing may end the process: the matches are ours */
+        if (shm_name && shm_link_publish(&srv.shm) < 0) {
+            perror("hot restart: publishing the shared memory (local clients cannot join)");
+        }
+        printf("Hot restart: took over %u rooms (%u playing) and %u sessions\n",
+               srv.rooms.rooms.in_use, srv.rooms.live_count, srv.rooms.sessions.in_use);
+    } else {
+        srv.sockfd = create_socket(port);
+    }
+
+    /* Kernel receive timestamps for the latency stages (set again: an
+       inherited socket may come from an older binary) */
+    int one = 1;
+    if (setsockopt(srv.sockfd, SOL_SOCKET, SO_TIMESTAMPNS, &one, sizeof(one)) < 0) {
+        perror("SO_TIMESTAMPNS");
+    }
+
+    /* Departure times on the paced frames; without it they are held here */
+    if (srv.txtime) {
+        struct sock_txtime txtime = { .clockid = CLOCK_MONOTONIC, .flags = 0 };
+        if (setsockopt(srv.sockfd, SOL_SOCKET, SO_TXTIME, &txtime, sizeof(txtime)) < 0) {
+            perror("SO_TXTIME (pacing in the server instead)");
+            srv.txtime = 0;
+        }
+    }
+
+    if (handoff_path) {
+        srv.handoff_listen = handoff_listen(handoff_path);
+        if (srv.handoff_listen < 0) perror("hot restart: listen");
+    }
+
+    if (srv.low_latency) {
+        /* The loops spin: reads must never block */
+        if (lowlat_busy_poll(srv.sockfd, LOWLAT_BUSY_POLL_US) < 0) perror("SO_BUSY_POLL");
+        fcntl(srv.sockfd, F_SETFL, fcntl(srv.sockfd, F_GETFL) | O_NONBLOCK);
+    }
+
+    printf("Pong server started on port %d at %u Hz%s\n", port, srv.rooms.rules.tick_hz,
+           srv.pipeline ? " (pipeline mode)" : "");
+    if (srv.pace_slots) {
+        printf("Pacing: rooms send in %u slots of %d us%s\n", srv.pace_slots, PACE_SLOT_US,
+               srv.txtime ? ", departure times set by the kernel (SO_TXTIME)" : "");
+    }
+    if (srv.routed) {
+        printf("Cluster node %u behind router %s\n", srv.auth.node, router);
+    }
+    printf("Waiting for players...\n");
+
+
+    /* Everything is allocated: fault it all in now rather than mid-tick */
+    if (srv.low_latency) {
+        if (lowlat_lock_memory(LOWLAT_STACK_PREFAULT) < 0) {
+            perror("mlockall (raise RLIMIT_MEMLOCK or grant CAP_IPC_LOCK)");
+        } else {
+            printf("Low-latency profile: memory locked, socket busy-polled\n");
+        }
+    }
+
+    /* No thread: the state may be a takeover's, keep serving it on one */
+    pthread_t sim;
+    if (srv.pipeline && pthread_create(&sim, NULL, sim_thread_main, &srv) != 0) {
+        perror("pthread_create (running single-threaded)");
+        srv.pipeline = 0;
+    }
+
+    if (srv.pipeline) {
+        io_loop(&srv);
+    } else {
+        run_single_thread(&srv);
+    }
+
+    close(srv.sockfd);
+    return 0;
+}
@@ -0,0 +1,376 @@
+/* shm_link.c - Shared-memory transport for clients on the server's host */
+#include "shm_link.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <linux/futex.h>
+#include <stdio.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+static size_t align_up(size_t n) {
+    return (n + POOL_CACHE_LINE - 1) & ~(size_t)(POOL_CACHE_LINE - 1);
+}
+
+/* Shared futex: the waiters are other processes */
+static long futex(atomic_uint *word, int op, unsigned val, const struct timespec *timeout) {
+    return syscall(SYS_futex, word, op, val, timeout, NULL, 0);
+}
+
+static void map_sections(ShmLink *l, uint8_t *base) {
+    l->hdr = (ShmHeader *)base;
+    l->rooms = (ShmRoomRing *)(base + l->hdr->rooms_off);
+    l->clients = (ShmClient *)(base + l->hdr->clients_off);
+    l->dirty = (_Atomic uint64_t *)(base + l->hdr->dirty_off);
+}
+
+/* Name of the shm object: the region's name, plus the suffix while staged */
+static void object_name(const ShmLink *l, char out[SHM_NAME_MAX + sizeof(SHM_STAGE_SUFFIX)]) {
+    strcpy(out, l->name);
+    if (l->staged) strcat(out, SHM_STAGE_SUFFIX);
+}
+
+static int create_region(ShmLink *l, const char *name, uint32_t max_rooms,
+                         uint32_t max_clients, int staged) {
+    char obj[SHM_NAME_MAX + sizeof(SHM_STAGE_SUFFIX)];
+
+    memset(l, 0, sizeof(*l));
+    if (strlen(name) >= sizeof(l->name)) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+
+    ShmHeader hdr;
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.magic, SHM_MAGIC, sizeof(SHM_MAGIC));
+    hdr.version = SHM_VERSION;
+    hdr.max_rooms = max_rooms;
+    hdr.max_clients = max_clients;
+    hdr.state_slots = SHM_STATE_SLOTS;
+    hdr.input_slots = SHM_INPUT_SLOTS;
+    hdr.view_size = sizeof(RoomView);
+    hdr.rooms_off = align_up(sizeof(ShmHeader));
+    hdr.clients_off = hdr.rooms_off + align_up((size_t)max_rooms * sizeof(ShmRoomRing));
+    hdr.dirty_off = hdr.clients_off + align_up((size_t)max_clients * sizeof(ShmClient));
+    hdr.size = hdr.dirty_off + align_up((max_clients + 63) / 64 * sizeof(uint64_t));
+
+    strcpy(l->name, name);
+    l->staged = staged;
+    object_name(l, obj);
+
+    /* A region left by an earlier run is replaced, not reused: clients
+       still mapping it keep the old copy and time out */
+    shm_unlink(obj);
+    int fd = shm_open(obj, O_RDWR | O_CREAT | O_EXCL, 0600);
+    if (fd < 0) return -1;
+    if (ftruncate(fd, (off_t)hdr.size) < 0) {
+        close(fd);
+        shm_unlink(obj);
+        return -1;
+    }
+
+    /* Fresh pages read as zero: every slot starts FREE, every ring empty */
+    uint8_t *base = mmap(NULL, hdr.size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED) {
+        shm_unlink(obj);
+        return -1;
+    }
+
+    memcpy(base, &hdr, sizeof(hdr));
+    map_sections(l, base);
+    l->size = hdr.size;
+    l->owner = 1;
+    return 0;
+}
+
+int shm_link_create(ShmLink *l, const char *name, uint32_t max_rooms, uint32_t max_clients) {
+    return create_region(l, name, max_rooms, max_clients, 0);
+}
+
+int shm_link_stage(ShmLink *l, const char *name, uint32_t max_rooms, uint32_t max_clients) {
+    return create_region(l, name, max_rooms, max_clients, 1);
+}
+
+int shm_link_publish(ShmLink *l) {
+    if (!l->staged) return 0;
+
+    /* shm_open() has no rename: go through the files behind the names */
+    char from[sizeof(SHM_DIR) + 1 + SHM_NAME_MAX + sizeof(SHM_STAGE_SUFFIX)];
+    char to[sizeof(SHM_DIR) + 1 + SHM_NAME_MAX];
+    char obj[SHM_NAME_MAX + sizeof(SHM_STAGE_SUFFIX)];
+    object_name(l, obj);
+    snprintf(from, sizeof(from), SHM_DIR "/%s", obj + (obj[0] == '/'));
+    snprintf(to, sizeof(to), SHM_DIR "/%s", l->name + (l->name[0] == '/'));
+    if (rename(from, to) < 0) return -1;
+    l->staged = 0;
+    return 0;
+}
+
+int shm_link_attach(ShmLink *l, const char *name) {
+    memset(l, 0, sizeof(*l));
+    if (strlen(name) >= sizeof(l->name)) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+
+    int fd = shm_open(name, O_RDWR, 0);
+    if (fd < 0) return -1;
+
+    struct stat st;
+    if (fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof(ShmHeader)) {
+        close(fd);
+        errno = EPROTO;
+        return -1;
+    }
+    uint8_t *base = mmap(NULL, (size_t)st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED) return -1;
+
+    const ShmHeader *hdr = (const ShmHeader *)base;
+    if (memcmp(hdr->magic, SHM_MAGIC, sizeof(SHM_MAGIC)) != 0 ||
+        hdr->version != SHM_VERSION || hdr->view_size != sizeof(RoomView) ||
+        hdr->state_slots != SHM_STATE_SLOTS || hdr->input_slots != SHM_INPUT_SLOTS ||
+        hdr->size > (uint64_t)st.st_size) {
+        munmap(base, (size_t)st.st_size);
+        errno = EPROTO;
+        return -1;
+    }
+
+    map_sections(l, base);
+    l->size = (size_t)st.st_size;
+    strcpy(l->name, name);
+    return 0;
+}
+
+void shm_link_close(ShmLink *l) {
+    if (!l->hdr) return;
+    munmap(l->hdr, l->size);
+    if (l->owner) {
+        char obj[SHM_NAME_MAX + sizeof(SHM_STAGE_SUFFIX)];
+        object_name(l, obj);
+        shm_unlink(obj);
+    }
+    memset(l, 0, sizeof(*l));
+}
+
+/* ---------- Server side ---------- */
+
+void shm_publish(ShmLink *l, const RoomView *v) {
+    uint32_t index = pool_handle_index(v->room);
+    if (index >= l->hdr->max_rooms) return;
+
+    /* Only this thread writes the ring: its own head needs no atomic add */
+    ShmRoomRing *ring = &l->rooms[index];
+    uint64_t n = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    room_view_publish(&ring->entries[n % SHM_STATE_SLOTS], v);
+    atomic_store_explicit(&ring->head, n + 1, memory_order_release);
+
+    l->published++;
+    l->wake_owed = 1;
+}
+
+void shm_pass_done(ShmLink *l) {
+    if (!l->wake_owed) return;
+    l->wake_owed = 0;
+
+    /* Sequentially consistent, like shm_wait(): either the sleeper sees the
+       new pass before it sleeps, or we see it counted and wake it */
+    atomic_fetch_add(&l->hdr->passes, 1);
+    if (atomic_load(&l->hdr->sleepers) > 0) {
+        futex(&l->hdr->passes, FUTEX_WAKE, INT_MAX, NULL);
+        l->wakeups++;
+    }
+}
+
+uint32_t shm_collect(ShmLink *l, uint32_t *clients, uint32_t max) {
+    uint32_t words = (l->hdr->max_clients + 63) / 64;
+    uint32_t n = 0;
+
+    for (uint32_t w = 0; w < words && n < max; w++) {
+        if (atomic_load_explicit(&l->dirty[w], memory_order_relaxed) == 0) continue;
+
+        uint64_t bits = atomic_exchange_explicit(&l->dirty[w], 0, memory_order_acquire);
+        while (bits) {
+            uint32_t bit = (uint32_t)__builtin_ctzll(bits);
+            bits &= bits - 1;
+            if (n < max) {
+                clients[n++] = w * 64 + bit;
+            } else {
+                /* No room left this pass: put the bit back for the next one */
+                atomic_fetch_or_explicit(&l->dirty[w], 1ull << bit, memory_order_relaxed);
+            }
+        }
+    }
+    return n;
+}
+
+int shm_input_pop(ShmLink *l, uint32_t client, uint8_t *input) {
+    ShmClient *c = &l->clients[client];
+    unsigned tail = atomic_load_explicit(&c->in_tail, memory_order_relaxed);
+    if (tail == atomic_load_explicit(&c->in_head, memory_order_acquire)) return 0;
+
+    *input = c->in_data[tail % SHM_INPUT_SLOTS];
+    atomic_store_explicit(&c->in_tail, tail + 1, memory_order_release);
+    l->inputs++;
+    return 1;
+}
+
+void shm_client_joined(ShmLink *l, uint32_t client, int matched,
+                       PoolHandle room, uint8_t player) {
+    ShmClient *c = &l->clients[client];
+    atomic_store_explicit(&c->room, matched ? room : POOL_INVALID_HANDLE, memory_order_relaxed);
+    atomic_store_explicit(&c->player, player, memory_order_relaxed);
+    atomic_store_explicit(&c->status, matched ? SHM_MATCHED : SHM_QUEUED, memory_order_relaxed);
+
+    /* Publishes the fields above; a client already LEAVING stays so */
+    unsigned joining = SHM_JOINING;
+    if (atomic_compare_exchange_strong_explicit(&c->state, &joining, SHM_ACTIVE,
+                                                memory_order_release, memory_order_relaxed)) {
+        l->joins++;
+    } else {
+        atomic_thread_fence(memory_order_release);
+    }
+    l->wake_owed = 1;
+}
+
+void shm_client_release(ShmLink *l, uint32_t client) {
+    ShmClient *c = &l->clients[client];
+
+    /* Inputs nobody will read: the next owner starts with an empty ring */
+    atomic_store_explicit(&c->in_tail, atomic_load_explicit(&c->in_head, memory_order_acquire),
+                          memory_order_relaxed);
+    atomic_store_explicit(&c->room, POOL_INVALID_HANDLE, memory_order_relaxed);
+
+    unsigned state = atomic_load_explicit(&c->state, memory_order_acquire);
+    if (state == SHM_LEAVING) {
+        atomic_store_explicit(&c->state, SHM_FREE, memory_order_release);
+    } else if (state == SHM_JOINING || state == SHM_ACTIVE) {
+        /* CAS: the client may be leaving at this very moment */
+        if (!atomic_compare_exchange_strong_explicit(&c->state, &state, SHM_CLOSED,
+                                                     memory_order_release,
+                                                     memory_order_relaxed) &&
+            state == SHM_LEAVING) {
+            atomic_store_explicit(&c->state, SHM_FREE, memory_order_release);
+        }
+    }
+    l->closed++;
+    l->wake_owed = 1;
+}
+
+/* ---------- Client side ---------- */
+
+static void ring_doorbell(ShmLink *l, uint32_t client) {
+    atomic_fetch_or_explicit(&l->dirty[client / 64], 1ull << (client % 64), memory_order_release);
+}
+
+int shm_client_claim(ShmLink *l, uint8_t region, uint8_t rtt_bucket) {
+    uint32_t max = l->hdr->max_clients;
+
+    for (uint32_t k = 0; k < max; k++) {
+        uint32_t i = (l->next_claim + k) % max;
+        ShmClient *c = &l->clients[i];
+        unsigned expected = SHM_FREE;
+        if (atomic_load_explicit(&c->state, memory_order_relaxed) != SHM_FREE ||
+            !atomic_compare_exchange_strong_explicit(&c->state, &expected, SHM_CLAIMED,
+                                                     memory_order_acquire,
+                                                     memory_order_relaxed)) {
+            continue;
+        }
+
+        c->region = region;
+        c->rtt_bucket = rtt_bucket;
+        atomic_store_explicit(&c->state, SHM_JOINING, memory_order_release);
+        ring_doorbell(l, i);
+        l->next_claim = i + 1;
+        return (int)i;
+    }
+    return -1;
+}
+
+int shm_client_input(ShmLink *l, uint32_t client, uint8_t input) {
+    ShmClient *c = &l->clients[client];
+    unsigned head = atomic_load_explicit(&c->in_head, memory_order_relaxed);
+    if (head - atomic_load_explicit(&c->in_tail, memory_order_acquire) >= SHM_INPUT_SLOTS) {
+        return 0;
+    }
+
+    c->in_data[head % SHM_INPUT_SLOTS] = input;
+    atomic_store_explicit(&c->in_head, head + 1, memory_order_release);
+    ring_doorbell(l, client);
+    return 1;
+}
+
+void shm_client_leave(ShmLink *l, uint32_t client) {
+    ShmClient *c = &l->clients[client];
+    unsigned state = atomic_load_explicit(&c->state, memory_order_acquire);
+
+    if (state == SHM_CLOSED) {
+        atomic_store_explicit(&c->state, SHM_FREE, memory_order_release);
+        return;
+    }
+    if ((state == SHM_JOINING || state == SHM_ACTIVE) &&
+        atomic_compare_exchange_strong_explicit(&c->state, &state, SHM_LEAVING,
+                                                memory_order_release, memory_order_relaxed)) {
+        ring_doorbell(l, client);
+    } else if (state == SHM_CLOSED) {
+        /* Closed by the server in the meantime */
+        atomic_store_explicit(&c->state, SHM_FREE, memory_order_release);
+    }
+}
+
+int shm_state_next(ShmLink *l, uint32_t room_index, uint64_t *cursor,
+                   RoomView *out, uint64_t *overruns) {
+    ShmRoomRing *ring = &l->rooms[room_index];
+
+    for (;;) {
+        uint64_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+        uint64_t n = *cursor;
+        if (n == head) return 0;
+
+        /* Fell behind: resume at the oldest entry still held */
+        if (head - n > SHM_STATE_SLOTS) {
+            uint64_t oldest = head - (SHM_STATE_SLOTS - 1);
+            if (overruns) *overruns += oldest - n;
+            n = *cursor = oldest;
+        }
+
+        /* Entry n is its slot's (n / SLOTS + 1)-th write, so its sequence
+           is twice that once written; past that, a newer entry took the
+           slot (or is being written into it) and n is lost */
+        RoomViewSlot *e = &ring->entries[n % SHM_STATE_SLOTS];
+        unsigned want = (unsigned)(2 * (n / SHM_STATE_SLOTS + 1));
+        uint32_t w[ROOM_VIEW_WORDS];
+
+        unsigned seq = atomic_load_explicit(&e->seq, memory_order_acquire);
+        if (seq == want) {
+            for (size_t i = 0; i < ROOM_VIEW_WORDS; i++) {
+                w[i] = atomic_load_explicit(&e->words[i], memory_order_relaxed);
+            }
+            atomic_thread_fence(memory_order_acquire);
+            seq = atomic_load_explicit(&e->seq, memory_order_relaxed);
+            if (seq == want) {
+                memcpy(out, w, sizeof(w));
+                *cursor = n + 1;
+                return 1;
+            }
+        }
+        if ((int)(seq - want) < 0) return 0;  /* not written yet: cannot follow head */
+
+        *cursor = n + 1;
+        if (overruns) (*overruns)++;
+    }
+}
+
+void shm_wait(ShmLink *l, unsigned seen, int timeout_ms) {
+    struct timespec ts = { timeout_ms / 1000, (long)(timeout_ms % 1000) * 1000000L };
+
+    atomic_fetch_add(&l->hdr->sleepers, 1);
+    if (atomic_load(&l->hdr->passes) == seen) {
+        futex(&l->hdr->passes, FUTEX_WAIT, seen, &ts);
+    }
+    atomic_fetch_sub(&l->hdr->sleepers, 1);
+}
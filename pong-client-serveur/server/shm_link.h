@@ -0,0 +1,218 @@
+/* shm_link.h - Shared-memory transport for clients on the server's host
+ *
+ * Bots, replay recorders and spectator relays running next to the server
+ * can skip UDP loopback. The server (--shm NAME) creates one POSIX
+ * shared-memory region, sized once at startup like its pools, which local
+ * processes map:
+ *
+ *   rooms    one broadcast ring per room slot. The server appends the room's
+ *            state whenever it would send it to the players; any number of
+ *            readers follow a ring with cursors of their own. Entries are
+ *            seqlocked (room_view.h): a slow reader is overrun and told so,
+ *            the server never waits for it.
+ *   clients  one slot per local session: its lifecycle, where the server
+ *            seated it, and an SPSC ring of inputs (client -> server).
+ *   dirty    one bit per client slot, set by the client after writing to
+ *            its slot; the server only visits the slots whose bit it takes.
+ *
+ * Neither side makes a system call per message. A reader with nothing left
+ * to read may sleep on the header's futex word; the server only calls
+ * FUTEX_WAKE, once per pass, when some reader is asleep. The server polls
+ * the client slots from its loop and never sleeps on them.
+ *
+ * A local session is an ordinary session whose address is synthetic
+ * (shm_client_addr): the lobby, rooms and timeouts treat it like any
+ * other. Datagrams addressed to it are dropped; it reads the room ring.
+ */
+#ifndef SHM_LINK_H
+#define SHM_LINK_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <netinet/in.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/socket.h>
+
+#include "room_view.h"
+
+#define SHM_MAGIC       "PONGSHM"   /* NUL included */
+#define SHM_VERSION     1
+#define SHM_STATE_SLOTS 16          /* states kept per room (~1/4 s at 60 Hz) */
+#define SHM_INPUT_SLOTS 16          /* inputs queued per client, power of two */
+#define SHM_NAME_MAX    64
+#define SHM_STAGE_SUFFIX ".new"     /* name of a staged region: see shm_link_stage() */
+#define SHM_DIR         "/dev/shm"  /* where shm_open() names live (Linux) */
+
+/* Client slot lifecycle. The client moves FREE -> CLAIMED -> JOINING and
+   ACTIVE -> LEAVING, and CLOSED -> FREE; the server moves JOINING -> ACTIVE,
+   LEAVING -> FREE, and JOINING/ACTIVE -> CLOSED when it has no session for
+   the slot (server full, timed out). */
+enum {
+    SHM_FREE    = 0,
+    SHM_CLAIMED = 1,   /* taken by a client, not announced yet */
+    SHM_JOINING = 2,   /* region / rtt_bucket written, waiting for the server */
+    SHM_ACTIVE  = 3,   /* the server has a session: status, room and player are valid */
+    SHM_LEAVING = 4,
+    SHM_CLOSED  = 5
+};
+
+/* ShmClient.status */
+enum {
+    SHM_QUEUED  = 0,
+    SHM_MATCHED = 1
+};
+
+typedef struct {
+    char     magic[8];
+    uint32_t version;
+    uint32_t max_rooms;
+    uint32_t max_clients;
+    uint32_t state_slots;
+    uint32_t input_slots;
+    uint32_t view_size;       /* sizeof(RoomView): both sides must agree */
+    uint64_t rooms_off;
+    uint64_t clients_off;
+    uint64_t dirty_off;
+    uint64_t size;
+
+    _Alignas(POOL_CACHE_LINE) atomic_uint passes;  /* server passes that wrote something; futex word */
+    atomic_uint sleepers;                          /* readers asleep on `passes` */
+} ShmHeader;
+
+typedef struct {
+    _Alignas(POOL_CACHE_LINE) _Atomic uint64_t head;  /* entries ever written */
+    RoomViewSlot entries[SHM_STATE_SLOTS];            /* entry n at n % SHM_STATE_SLOTS */
+} ShmRoomRing;
+
+typedef struct {
+    /* Written by the client */
+    _Alignas(POOL_CACHE_LINE) atomic_uint state;
+    uint8_t  region;
+    uint8_t  rtt_bucket;
+    atomic_uint in_head;
+    uint8_t  in_data[SHM_INPUT_SLOTS];   /* PlayerInput */
+
+    /* Written by the server */
+    _Alignas(POOL_CACHE_LINE) atomic_uint in_tail;
+    atomic_uint status;    /* SHM_QUEUED / SHM_MATCHED */
+    atomic_uint room;      /* room handle, 0 = none; its ring is pool_handle_index(room) */
+    atomic_uint player;    /* paddle: 0 = left, 1 = right */
+} ShmClient;
+
+/* A mapping of the region, in the server or in a client */
+typedef struct {
+    ShmHeader   *hdr;
+    ShmRoomRing *rooms;
+    ShmClient   *clients;
+    _Atomic uint64_t *dirty;
+    size_t       size;
+    char         name[SHM_NAME_MAX];
+    int          owner;         /* the server: unlinks the name on close */
+    int          staged;        /* the server: still under name SHM_STAGE_SUFFIX */
+
+    /* Server only */
+    int          wake_owed;     /* something was written this pass */
+    uint64_t     published;
+    uint64_t     inputs;
+    uint64_t     joins;
+    uint64_t     closed;
+    uint64_t     wakeups;
+
+    /* Client only */
+    uint32_t     next_claim;    /* where the next claim starts looking */
+} ShmLink;
+
+/* Synthetic address of client slot i. No datagram comes from AF_UNIX, and
+   the address index (address and port) cannot clash with a UDP peer: none
+   sends from port 0. */
+static inline struct sockaddr_in shm_client_addr(uint32_t i) {
+    struct sockaddr_in a;
+    memset(&a, 0, sizeof(a));
+    a.sin_family = AF_UNIX;
+    a.sin_addr.s_addr = htonl(i + 1);
+    return a;
+}
+
+/* Client slot of a synthetic address, or -1 for a real peer (or a TCP
+   connection's address: port 1, see tcp_front.h) */
+static inline int shm_addr_client(const struct sockaddr_in *a) {
+    if (a->sin_family != AF_UNIX || a->sin_port != 0) return -1;
+    return (int)(ntohl(a->sin_addr.s_addr) - 1);
+}
+
+/* Server: create (or recreate) the region. Returns 0, or -1 with errno set. */
+int  shm_link_create(ShmLink *l, const char *name, uint32_t max_rooms, uint32_t max_clients);
+
+/* Server taking over from a running one: create the region under a private
+   name, so clients keep finding the old process's region until
+   shm_link_publish() gives this one the real name (an atomic rename). */
+int  shm_link_stage(ShmLink *l, const char *name, uint32_t max_rooms, uint32_t max_clients);
+int  shm_link_publish(ShmLink *l);
+
+/* Client: map an existing region. Returns 0, or -1 (errno set; EPROTO if
+   the region was made by an incompatible build). */
+int  shm_link_attach(ShmLink *l, const char *name);
+
+void shm_link_close(ShmLink *l);
+
+/* ---------- Server side ---------- */
+
+/* Append a room's state to the ring of its slot */
+void shm_publish(ShmLink *l, const RoomView *v);
+
+/* End of a server pass: bump the futex word if anything was written, and
+   wake sleeping readers (the only system call, and only if one sleeps) */
+void shm_pass_done(ShmLink *l);
+
+/* Take the client slots whose dirty bit is set (at most max). */
+uint32_t shm_collect(ShmLink *l, uint32_t *clients, uint32_t max);
+
+/* Oldest queued input of a client. Returns 1, or 0 if its ring is empty. */
+int  shm_input_pop(ShmLink *l, uint32_t client, uint8_t *input);
+
+/* Tell a client where it stands; the first call makes a JOINING slot ACTIVE */
+void shm_client_joined(ShmLink *l, uint32_t client, int matched,
+                       PoolHandle room, uint8_t player);
+
+/* The server has no session for the slot: CLOSED (LEAVING: FREE) */
+void shm_client_release(ShmLink *l, uint32_t client);
+
+/* ---------- Client side ---------- */
+
+/* Claim a free slot and ask to join. Returns the slot, or -1 if none is free. */
+int  shm_client_claim(ShmLink *l, uint8_t region, uint8_t rtt_bucket);
+
+/* Queue an input. Returns 1, or 0 if the ring is full (the input is dropped). */
+int  shm_client_input(ShmLink *l, uint32_t client, uint8_t input);
+
+/* Leave; the server frees the slot */
+void shm_client_leave(ShmLink *l, uint32_t client);
+
+/* Next state of a room ring after *cursor (start from shm_room_head() to
+   see only new states). Returns 1 and advances the cursor, 0 if there is
+   nothing new. States the reader was too slow for are skipped and counted
+   in *overruns (may be NULL). */
+int  shm_state_next(ShmLink *l, uint32_t room_index, uint64_t *cursor,
+                    RoomView *out, uint64_t *overruns);
+
+static inline uint64_t shm_room_head(ShmLink *l, uint32_t room_index) {
+    return atomic_load_explicit(&l->rooms[room_index].head, memory_order_acquire);
+}
+
+/* Futex word: changes after every server pass that wrote something */
+static inline unsigned shm_passes(ShmLink *l) {
+    return atomic_load_explicit(&l->hdr->passes, memory_order_acquire);
+}
+
+/* Sleep until shm_passes() differs from `seen`, or timeout_ms. */
+void shm_wait(ShmLink *l, unsigned seen, int timeout_ms);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* SHM_LINK_H */
@@ -0,0 +1,21 @@
+/* siphash.h - SipHash-2-4 keyed hash (short-input MAC) */
+#ifndef SIPHASH_H
+#define SIPHASH_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define SIPHASH_KEY_SIZE 16
+
+/* 64-bit SipHash-2-4 of `len` bytes under a 128-bit key */
+uint64_t siphash24(const uint8_t key[SIPHASH_KEY_SIZE], const void *in, size_t len);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* SIPHASH_H */
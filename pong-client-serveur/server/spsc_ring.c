@@ -0,0 +1,103 @@
+/* spsc_ring.c - Lock-free single-producer/single-consumer ring of fixed-size records */
+#include "spsc_ring.h"
+#include <stdlib.h>
+#include <string.h>
+
+static size_t round_pow2(size_t x) {
+    size_t p = 1;
+    while (p < x) p <<= 1;
+    return p;
+}
+
+int spsc_init(SpscRing *r, size_t elem_size, size_t capacity) {
+    if (!r || elem_size == 0 || capacity == 0) return -1;
+
+    memset(r, 0, sizeof(*r));
+    r->capacity = round_pow2(capacity);
+    r->mask = r->capacity - 1;
+    r->elem_size = elem_size;
+
+    /* aligned_alloc wants a size multiple of the alignment */
+    size_t bytes = r->capacity * elem_size;
+    bytes = (bytes + SPSC_CACHE_LINE - 1) & ~(size_t)(SPSC_CACHE_LINE - 1);
+    r->slots = aligned_alloc(SPSC_CACHE_LINE, bytes);
+    if (!r->slots) return -1;
+    memset(r->slots, 0, bytes);
+
+    atomic_init(&r->head, 0);
+    atomic_init(&r->tail, 0);
+    atomic_init(&r->pushed, 0);
+    atomic_init(&r->dropped, 0);
+    atomic_init(&r->high_water, 0);
+    atomic_init(&r->push_high_water, 0);
+    return 0;
+}
+
+void spsc_destroy(SpscRing *r) {
+    if (!r) return;
+    free(r->slots);
+    r->slots = NULL;
+}
+
+int spsc_push(SpscRing *r, const void *elem) {
+    size_t head = atomic_load_explicit(&r->head, memory_order_relaxed);
+
+    if (head - r->tail_cache >= r->capacity) {
+        /* Looks full: refresh our view of the consumer. The occupancy seen
+           here is exact (capacity when the record is dropped): the mark is
+           raised with the load this path makes anyway. */
+        r->tail_cache = atomic_load_explicit(&r->tail, memory_order_acquire);
+        size_t occ = head - r->tail_cache;
+        if (occ > atomic_load_explicit(&r->push_high_water, memory_order_relaxed))
+            atomic_store_explicit(&r->push_high_water, occ, memory_order_relaxed);
+        if (occ >= r->capacity) {
+            atomic_store_explicit(&r->dropped,
+                                  atomic_load_explicit(&r->dropped, memory_order_relaxed) + 1,
+                                  memory_order_relaxed);
+            return 0;
+        }
+    }
+
+    memcpy(r->slots + (head & r->mask) * r->elem_size, elem, r->elem_size);
+    atomic_store_explicit(&r->head, head + 1, memory_order_release);
+
+    /* Only the producer writes the counters: no locked read-modify-write */
+    atomic_store_explicit(&r->pushed,
+                          atomic_load_explicit(&r->pushed, memory_order_relaxed) + 1,
+                          memory_order_relaxed);
+    return 1;
+}
+
+int spsc_pop(SpscRing *r, void *out) {
+    size_t tail = atomic_load_explicit(&r->tail, memory_order_relaxed);
+
+    if (tail == r->head_cache) {
+        /* Looks empty: refresh our view of the producer */
+        r->head_cache = atomic_load_explicit(&r->head, memory_order_acquire);
+        if (tail == r->head_cache) return 0;
+
+        /* The backlog just loaded is exact: the mark costs no extra load */
+        size_t occ = r->head_cache - tail;
+        if (occ > atomic_load_explicit(&r->high_water, memory_order_relaxed))
+            atomic_store_explicit(&r->high_water, occ, memory_order_relaxed);
+    }
+
+    memcpy(out, r->slots + (tail & r->mask) * r->elem_size, r->elem_size);
+    atomic_store_explicit(&r->tail, tail + 1, memory_order_release);
+    return 1;
+}
+
+void spsc_stats(SpscRing *r, SpscStats *out) {
+    size_t head = atomic_load_explicit(&r->head, memory_order_relaxed);
+    size_t tail = atomic_load_explicit(&r->tail, memory_order_relaxed);
+
+    /* Each side marks the occupancy it saw exactly; the peak is the larger */
+    size_t pop_hwm = atomic_load_explicit(&r->high_water, memory_order_relaxed);
+    size_t push_hwm = atomic_load_explicit(&r->push_high_water, memory_order_relaxed);
+    out->occupancy  = (head >= tail) ? head - tail : 0;
+    out->high_water = pop_hwm > push_hwm ? pop_hwm : push_hwm;
+    if (out->occupancy > out->high_water) out->high_water = out->occupancy;
+    out->capacity   = r->capacity;
+    out->pushed     = atomic_load_explicit(&r->pushed, memory_order_relaxed);
+    out->dropped    = atomic_load_explicit(&r->dropped, memory_order_relaxed);
+}
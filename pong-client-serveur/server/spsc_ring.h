@@ -0,0 +1,66 @@
+/* spsc_ring.h - Lock-free single-producer/single-consumer ring of fixed-size records */
+#ifndef SPSC_RING_H
+#define SPSC_RING_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define SPSC_CACHE_LINE 64
+
+/* One producer thread calls spsc_push(), one consumer thread calls spsc_pop().
+   Head and tail live on their own cache lines so the two sides never
+   write to the same line; each side also keeps a cached copy of the other
+   index and only reloads it when the ring looks full/empty. */
+typedef struct {
+    /* Producer side */
+    _Alignas(SPSC_CACHE_LINE) atomic_size_t head;
+    size_t tail_cache;
+    atomic_uint_fast64_t pushed;
+    atomic_uint_fast64_t dropped;    /* pushes refused because the ring was full */
+    atomic_size_t push_high_water;   /* highest occupancy the producer found when it looked full */
+
+    /* Consumer side */
+    _Alignas(SPSC_CACHE_LINE) atomic_size_t tail;
+    size_t head_cache;
+    atomic_size_t high_water;        /* highest backlog the consumer found when it looked empty */
+
+    /* Read-only after spsc_init */
+    _Alignas(SPSC_CACHE_LINE) uint8_t *slots;
+    size_t elem_size;
+    size_t capacity;                 /* power of two */
+    size_t mask;
+} SpscRing;
+
+/* Allocate storage for `capacity` records of `elem_size` bytes.
+   capacity is rounded up to a power of two. Returns 0 on success, -1 on error. */
+int spsc_init(SpscRing *r, size_t elem_size, size_t capacity);
+void spsc_destroy(SpscRing *r);
+
+/* Producer: copy one record in. Returns 1 if queued, 0 if the ring was full
+   (the record is dropped and counted). Never blocks. */
+int spsc_push(SpscRing *r, const void *elem);
+
+/* Consumer: copy the oldest record out. Returns 1 if a record was read, 0 if empty. */
+int spsc_pop(SpscRing *r, void *out);
+
+/* Snapshot of the counters (safe to call from any thread, values are approximate) */
+typedef struct {
+    size_t   occupancy;
+    size_t   high_water;   /* capacity once a push has been dropped */
+    size_t   capacity;
+    uint64_t pushed;
+    uint64_t dropped;
+} SpscStats;
+
+void spsc_stats(SpscRing *r, SpscStats *out);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* SPSC_RING_H */
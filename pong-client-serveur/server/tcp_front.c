@@ -0,0 +1,527 @@
+/* tcp_front.c - TCP transport: framed input, latest-state-wins output */
+#include "tcp_front.h"
+#include "binlog.h"
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/sockios.h>
+#include <netinet/tcp.h>
+#include <stdlib.h>
+#include <sys/epoll.h>
+#include <sys/ioctl.h>
+#include <sys/uio.h>
+#include <time.h>
+#include <unistd.h>
+
+#define EPOLL_BATCH 256   /* events taken per poll */
+#define EV_LISTEN   UINT64_MAX
+
+/* ---------- Wire protocol (as in client_tcp.c) ---------- */
+
+enum { MSG_HELLO = 1, MSG_INPUT = 2, MSG_STATE = 3 };
+
+/* Client -> Server */
+typedef struct __attribute__((packed)) {
+    uint8_t type;      // MSG_INPUT
+    uint8_t player_id; // 1 or 2 (ignored: the connection says which paddle)
+    uint8_t dir;       // 0 none, 1 up, 2 down
+    uint8_t _pad;
+} MsgInput;
+
+/* Ruleset of the match (network order, lengths and speeds * 100): the
+   client predicts and draws from it */
+typedef struct __attribute__((packed)) {
+    uint16_t tick_hz;
+    uint16_t serve_pause_ticks;
+    uint16_t field_w;
+    uint16_t field_h;
+    uint16_t paddle_h;
+    uint16_t paddle_w;
+    uint16_t paddle_margin;
+    uint16_t paddle_speed;   // units/s
+    uint16_t ball_size;
+    uint16_t ball_speed_base;
+    uint16_t ball_speed_max;
+    uint16_t ball_speed_gain;
+    uint16_t min_vy_abs;
+} NetRules;
+
+/* Server -> Client, once matched */
+typedef struct __attribute__((packed)) {
+    uint8_t type;      // MSG_HELLO
+    uint8_t player_id; // 1 or 2
+    uint16_t size;     // sizeof(NetRules) (network order)
+    NetRules rules;    // all fields network order
+} MsgHello;
+
+static uint16_t u16_net(uint16_t x) { return htons(x); }
+static uint16_t s16_net(int16_t x) { return htons((uint16_t)x); }
+
+static int16_t q100(float v) {
+    int32_t t = (int32_t)(v * 100.0f);
+    if (t < -32768) t = -32768;
+    if (t >  32767) t =  32767;
+    return (int16_t)t;
+}
+
+static uint16_t uq100(float v) {
+    int32_t t = (int32_t)(v * 100.0f);
+    if (t < 0) t = 0;
+    if (t > 65535) t = 65535;
+    return (uint16_t)t;
+}
+
+/* Rounded rather than truncated: rules such as a 1.05 gain come out exact */
+static uint16_t rq100(float v) {
+    return uq100(v + 0.005f);
+}
+
+static void fill_netstate(TcpNetState *ns, const GameState *g) {
+    ns->tick = u16_net((uint16_t)g->tick);
+
+    ns->ball_x = s16_net(q100(g->ball_x));
+    ns->ball_y = s16_net(q100(g->ball_y));
+
+    ns->paddle_left_y  = s16_net(q100(g->paddle_left_y));
+    ns->paddle_right_y = s16_net(q100(g->paddle_right_y));
+
+    ns->score_left  = u16_net((uint16_t)g->score_left);
+    ns->score_right = u16_net((uint16_t)g->score_right);
+
+    ns->field_w   = u16_net(uq100(g->field_w));
+    ns->field_h   = u16_net(uq100(g->field_h));
+    ns->paddle_h  = u16_net(uq100(g->paddle_h));
+    ns->ball_size = u16_net(uq100(g->ball_size));
+}
+
+static void fill_netrules(NetRules *nr, const GameRules *r) {
+    nr->tick_hz = u16_net((uint16_t)r->tick_hz);
+    nr->serve_pause_ticks = u16_net((uint16_t)r->serve_pause_ticks);
+
+    nr->field_w       = u16_net(rq100(r->field_w));
+    nr->field_h       = u16_net(rq100(r->field_h));
+    nr->paddle_h      = u16_net(rq100(r->paddle_h));
+    nr->paddle_w      = u16_net(rq100(r->paddle_w));
+    nr->paddle_margin = u16_net(rq100(r->paddle_margin));
+    nr->paddle_speed  = u16_net(rq100(r->paddle_speed));
+
+    nr->ball_size       = u16_net(rq100(r->ball_size));
+    nr->ball_speed_base = u16_net(rq100(r->ball_speed_base));
+    nr->ball_speed_max  = u16_net(rq100(r->ball_speed_max));
+    nr->ball_speed_gain = u16_net(rq100(r->ball_speed_gain));
+    nr->min_vy_abs      = u16_net(rq100(r->min_vy_abs));
+}
+
+static PlayerInput dir_to_input(uint8_t dir) {
+    if (dir == 1) return INPUT_UP;
+    if (dir == 2) return INPUT_DOWN;
+    return INPUT_NONE;
+}
+
+static uint64_t now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + (uint64_t)ts.tv_nsec / 1000000;
+}
+
+/* ---------- Connections ---------- */
+
+static void conn_reset(TcpConn *c) {
+    memset(c, 0, sizeof(*c));
+    c->fd = -1;
+}
+
+/* Watch the socket for input, and for room to write while it is full */
+static void conn_watch(TcpFront *f, uint32_t conn, int op) {
+    TcpConn *c = &f->conns[conn];
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN | EPOLLRDHUP | (c->want_out ? EPOLLOUT : 0);
+    ev.data.u64 = conn;
+    epoll_ctl(f->epoll_fd, op, c->fd, &ev);
+}
+
+static void conn_close(TcpFront *f, uint32_t conn) {
+    TcpConn *c = &f->conns[conn];
+    if (c->fd < 0) return;
+    close(c->fd);  /* also leaves the epoll set */
+    conn_reset(c);
+    f->free_slots[f->free_count++] = conn;
+    f->open_count--;
+}
+
+/* Unsent bytes of a connection in the server: tx, and the waiting state */
+static uint32_t conn_depth(const TcpConn *c) {
+    return c->tx_len + (c->has_state ? (uint32_t)sizeof(c->out) : 0);
+}
+
+/* Send tx and the waiting state in one call, as far as the socket takes
+   them. A state the socket took only part of moves to tx: the stream must
+   carry the rest of it before anything else. Returns 0, or -1 if the
+   connection failed. */
+static int conn_flush(TcpFront *f, uint32_t conn) {
+    TcpConn *c = &f->conns[conn];
+    int wrote = 0;
+
+    while (conn_depth(c) > 0) {
+        struct iovec iov[2];
+        int cnt = 0;
+        if (c->tx_len > 0) iov[cnt++] = (struct iovec){ c->tx, c->tx_len };
+        if (c->has_state) iov[cnt++] = (struct iovec){ &c->out, sizeof(c->out) };
+
+        /* writev() with MSG_NOSIGNAL */
+        struct msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = iov;
+        msg.msg_iovlen = (size_t)cnt;
+        ssize_t n = sendmsg(c->fd, &msg, MSG_NOSIGNAL | MSG_DONTWAIT);
+        if (n < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) break;
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        wrote = 1;
+
+        size_t from_tx = (size_t)n < c->tx_len ? (size_t)n : c->tx_len;
+        memmove(c->tx, c->tx + from_tx, c->tx_len - from_tx);
+        c->tx_len = (uint16_t)(c->tx_len - from_tx);
+        size_t from_state = (size_t)n - from_tx;
+        if (from_state > 0) {
+            memcpy(c->tx + c->tx_len, (const uint8_t *)&c->out + from_state,
+                   sizeof(c->out) - from_state);
+            c->tx_len = (uint16_t)(c->tx_len + sizeof(c->out) - from_state);
+            c->has_state = 0;
+        }
+    }
+
+    int want_out = conn_depth(c) > 0;
+    if (!want_out) c->stalled_ms = 0;
+    else if (wrote || c->stalled_ms == 0) c->stalled_ms = now_ms();
+    if (want_out != c->want_out) {
+        c->want_out = (uint8_t)want_out;
+        conn_watch(f, conn, EPOLL_CTL_MOD);
+    }
+    return 0;
+}
+
+static int send_failed(TcpFront *f, uint32_t conn) {
+    f->send_failed++;
+    binlog(LOG_TCP_SEND_FAILED, conn);
+    return -1;
+}
+
+/* Readable: drain the socket and frame every complete MsgInput. Only the
+   latest direction matters to the next tick, so however fast a client
+   sends, nothing queues up behind it; a partial message waits in rx for
+   the next event. Returns the inputs framed, or -1 if the connection is
+   gone. */
+static int conn_read(TcpFront *f, uint32_t conn, uint8_t *dir) {
+    TcpConn *c = &f->conns[conn];
+    int got = 0;
+
+    for (int reads = 0; reads < TCP_RX_READS_MAX; reads++) {
+        size_t space = sizeof(c->rx) - c->rx_len;
+        ssize_t n = recv(c->fd, c->rx + c->rx_len, space, MSG_DONTWAIT);
+        if (n == 0) return -1;
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) break;
+            return -1;
+        }
+        c->rx_len = (uint16_t)(c->rx_len + n);
+
+        size_t pos = 0;
+        for (; c->rx_len - pos >= sizeof(MsgInput); pos += sizeof(MsgInput)) {
+            MsgInput in;
+            memcpy(&in, c->rx + pos, sizeof(in));
+            if (in.type != MSG_INPUT) continue;
+            *dir = in.dir;
+            got++;
+        }
+        memmove(c->rx, c->rx + pos, c->rx_len - pos);
+        c->rx_len = (uint16_t)(c->rx_len - pos);
+
+        if ((size_t)n < space) break;  /* short read: nothing left to drain */
+    }
+
+    c->pending += (uint32_t)got;
+    c->inputs += (uint32_t)got;
+    f->inputs += (uint32_t)got;
+    return got;
+}
+
+/* Take pending connections while there is room for their events */
+static uint32_t accept_conns(TcpFront *f, TcpEvent *ev, uint32_t max) {
+    uint32_t n = 0;
+
+    while (n < max) {
+        struct sockaddr_in peer;
+        socklen_t len = sizeof(peer);
+        int fd = accept4(f->listen_fd, (struct sockaddr *)&peer, &len, SOCK_NONBLOCK);
+        if (fd < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) continue;
+            return n;  /* EAGAIN; EMFILE and the like are retried on the next poll */
+        }
+        if (f->free_count == 0) {
+            binlog(LOG_SERVER_FULL, peer.sin_addr.s_addr, ntohs(peer.sin_port));
+            f->refused++;
+            close(fd);
+            continue;
+        }
+
+        /* Each state goes out at once, and the kernel holds at most
+           TCP_NOTSENT_LOWAT unsent bytes: the rest is conflated here */
+        int yes = 1, lowat = TCP_NOTSENT_LOWAT;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &yes, sizeof(yes));
+        setsockopt(fd, IPPROTO_TCP, TCP_NOTSENT_LOWAT, &lowat, sizeof(lowat));
+
+        uint32_t conn = f->free_slots[--f->free_count];
+        conn_reset(&f->conns[conn]);
+        f->conns[conn].fd = fd;
+        conn_watch(f, conn, EPOLL_CTL_ADD);
+        f->open_count++;
+        f->accepted++;
+        binlog(LOG_TCP_CONNECTED, conn, peer.sin_addr.s_addr, ntohs(peer.sin_port));
+
+        ev[n].type = TCP_EV_OPEN;
+        ev[n].input = INPUT_NONE;
+        ev[n].conn = conn;
+        ev[n].peer = peer;
+        n++;
+    }
+    return n;
+}
+
+/* ---------- Public API ---------- */
+
+int tcp_front_open(TcpFront *f, uint16_t port, uint32_t max_conns) {
+    memset(f, 0, sizeof(*f));
+    f->listen_fd = -1;
+    f->epoll_fd = -1;
+
+    f->conns = calloc(max_conns, sizeof(TcpConn));
+    f->free_slots = calloc(max_conns, sizeof(uint32_t));
+    if (!f->conns || !f->free_slots) goto fail;
+    f->max_conns = max_conns;
+    for (uint32_t i = 0; i < max_conns; i++) {
+        conn_reset(&f->conns[i]);
+        f->free_slots[i] = max_conns - 1 - i;  /* slot 0 first */
+    }
+    f->free_count = max_conns;
+
+    f->epoll_fd = epoll_create1(0);
+    if (f->epoll_fd < 0) goto fail;
+    if (port == 0) return 0;
+
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    if (fd < 0) goto fail;
+    /* SO_REUSEPORT: a hot restart listens before the old process is gone
+       when it moves to another port */
+    int yes = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
+    setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &yes, sizeof(yes));
+
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    addr.sin_port = htons(port);
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+        listen(fd, SOMAXCONN) < 0 || tcp_front_adopt_listener(f, fd) < 0) {
+        int err = errno;
+        close(fd);
+        errno = err;
+        goto fail;
+    }
+    return 0;
+
+fail: {
+        int err = errno;
+        tcp_front_close(f);
+        errno = err;
+        return -1;
+    }
+}
+
+void tcp_front_close(TcpFront *f) {
+    for (uint32_t i = 0; f->conns && i < f->max_conns; i++) {
+        if (f->conns[i].fd >= 0) close(f->conns[i].fd);
+    }
+    if (f->epoll_fd >= 0) close(f->epoll_fd);
+    if (f->listen_fd >= 0) close(f->listen_fd);
+    free(f->conns);
+    free(f->free_slots);
+    memset(f, 0, sizeof(*f));
+    f->listen_fd = -1;
+    f->epoll_fd = -1;
+}
+
+int tcp_front_adopt_listener(TcpFront *f, int fd) {
+    struct sockaddr_in addr;
+    socklen_t len = sizeof(addr);
+    if (f->listen_fd >= 0 ||
+        getsockname(fd, (struct sockaddr *)&addr, &len) < 0 || addr.sin_family != AF_INET) {
+        errno = EINVAL;
+        return -1;
+    }
+    /* Inherited blocking or not: accept_conns() relies on EAGAIN */
+    if (fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK) < 0) return -1;
+
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN;
+    ev.data.u64 = EV_LISTEN;
+    if (epoll_ctl(f->epoll_fd, EPOLL_CTL_ADD, fd, &ev) < 0) return -1;
+    f->listen_fd = fd;
+    f->port = ntohs(addr.sin_port);
+    return 0;
+}
+
+int tcp_front_adopt(TcpFront *f, uint32_t conn, int fd, const TcpConn *state) {
+    if (conn >= f->max_conns || f->conns[conn].fd >= 0 ||
+        state->rx_len > sizeof(state->rx) || state->tx_len > sizeof(state->tx)) {
+        errno = EINVAL;
+        return -1;
+    }
+    TcpConn *c = &f->conns[conn];
+    *c = *state;
+    c->fd = fd;
+    c->conflated_at_stats = c->conflated;
+    conn_watch(f, conn, EPOLL_CTL_ADD);  /* EPOLLOUT again if it was full */
+    f->open_count++;
+    return 0;
+}
+
+void tcp_front_adopted(TcpFront *f) {
+    f->free_count = 0;
+    for (uint32_t i = f->max_conns; i-- > 0;) {
+        if (f->conns[i].fd < 0) f->free_slots[f->free_count++] = i;  /* slot 0 on top */
+    }
+}
+
+uint32_t tcp_front_poll(TcpFront *f, TcpEvent *out, uint32_t max) {
+    struct epoll_event events[EPOLL_BATCH];
+    uint32_t n = 0;
+
+    int ready = epoll_wait(f->epoll_fd, events, (int)(max < EPOLL_BATCH ? max : EPOLL_BATCH), 0);
+    for (int i = 0; i < ready && n < max; i++) {
+        if (events[i].data.u64 == EV_LISTEN) {
+            n += accept_conns(f, out + n, max - n);
+            continue;
+        }
+
+        uint32_t conn = (uint32_t)events[i].data.u64;
+        uint32_t what = events[i].events;
+        uint8_t dir = 0;
+        int got = 0;
+        if (f->conns[conn].fd < 0) continue;  /* dropped by the host meanwhile */
+
+        int gone = (what & (EPOLLERR | EPOLLHUP)) != 0;
+        if (!gone && (what & EPOLLIN)) gone = (got = conn_read(f, conn, &dir)) < 0;
+        if (!gone && (what & EPOLLOUT)) gone = conn_flush(f, conn) < 0;
+        /* Peer closed its side: whatever it sent has been read */
+        if (!gone && (what & EPOLLRDHUP) && !(what & EPOLLIN)) gone = 1;
+
+        if (gone) {
+            conn_close(f, conn);
+            f->closed++;
+            out[n].type = TCP_EV_CLOSED;
+        } else if (got > 0) {
+            out[n].type = TCP_EV_INPUT;
+            out[n].input = (uint8_t)dir_to_input(dir);
+        } else {
+            continue;
+        }
+        out[n].conn = conn;
+        n++;
+    }
+    return n;
+}
+
+int tcp_front_hello(TcpFront *f, uint32_t conn, uint8_t slot, const GameRules *rules) {
+    if (!tcp_front_is_open(f, conn)) return -1;
+    TcpConn *c = &f->conns[conn];
+    if (c->hello_sent) return 0;
+
+    MsgHello hello;
+    memset(&hello, 0, sizeof(hello));
+    hello.type = MSG_HELLO;
+    hello.player_id = (uint8_t)(slot + 1);
+    hello.size = u16_net((uint16_t)sizeof(NetRules));
+    fill_netrules(&hello.rules, rules);
+
+    if (c->tx_len + sizeof(hello) > sizeof(c->tx)) return send_failed(f, conn);
+    memcpy(c->tx + c->tx_len, &hello, sizeof(hello));
+    c->tx_len = (uint16_t)(c->tx_len + sizeof(hello));
+    c->hello_sent = 1;
+    c->pending = 0;  /* what it sent while queued steered nothing */
+    if (conn_flush(f, conn) < 0) return send_failed(f, conn);
+    return 0;
+}
+
+int tcp_front_state(TcpFront *f, uint32_t conn, const GameState *g) {
+    if (!tcp_front_is_open(f, conn)) return -1;
+    TcpConn *c = &f->conns[conn];
+    if (!c->hello_sent) return 0;  /* the client reads its HELLO first */
+
+    /* This state shows the latest input: any other since the last one was
+       coalesced away */
+    if (c->pending > f->pending_max) f->pending_max = c->pending;
+    if (c->pending > 1) {
+        c->coalesced += c->pending - 1;
+        f->coalesced += c->pending - 1;
+    }
+    c->pending = 0;
+
+    /* Latest state wins: one not taken yet is replaced. While the socket
+       is full nothing is written; the state goes out on EPOLLOUT. */
+    if (c->has_state) {
+        c->conflated++;
+        f->conflated++;
+    }
+    memset(&c->out, 0, sizeof(c->out));
+    c->out.type = MSG_STATE;
+    c->out.size = u16_net((uint16_t)sizeof(TcpNetState));
+    fill_netstate(&c->out.st, g);
+    c->has_state = 1;
+
+    if (c->want_out) {
+        uint64_t now = now_ms();
+        if (now - c->stalled_ms < TCP_SLOW_DROP_MS) return 0;
+        f->slow_dropped++;
+        binlog(LOG_TCP_SLOW_DROPPED, conn, (uint32_t)(now - c->stalled_ms), c->conflated);
+        return -1;
+    }
+    if (conn_flush(f, conn) < 0) return send_failed(f, conn);
+    return 0;
+}
+
+void tcp_front_drop(TcpFront *f, uint32_t conn) {
+    if (tcp_front_is_open(f, conn)) conn_close(f, conn);
+}
+
+void tcp_front_log_stats(TcpFront *f) {
+    uint32_t listed = 0, behind = 0;
+
+    for (uint32_t i = 0; i < f->max_conns; i++) {
+        TcpConn *c = &f->conns[i];
+        if (c->fd < 0) continue;
+        uint32_t conflated = c->conflated - c->conflated_at_stats;
+        c->conflated_at_stats = c->conflated;
+        if (conflated == 0 && conn_depth(c) == 0) continue;
+
+        behind++;
+        if (listed == TCP_STATS_CONNS) continue;
+        listed++;
+        int unsent = 0;
+        ioctl(c->fd, SIOCOUTQNSD, &unsent);
+        binlog(LOG_TCP_CONN_QUEUE, i, conn_depth(c), (uint32_t)unsent, conflated, c->conflated);
+    }
+
+    binlog(LOG_TCP_INPUTS, f->inputs, f->coalesced, f->pending_max);
+    binlog(LOG_TCP_OUT_STATS, behind, f->conflated, (uint32_t)f->slow_dropped);
+    f->inputs = 0;
+    f->coalesced = 0;
+    f->pending_max = 0;
+    f->conflated = 0;
+}
@@ -0,0 +1,183 @@
+/* tcp_front.h - TCP transport for clients behind UDP-hostile networks
+ *
+ * Speaks the fixed-size protocol of client_tcp (MsgInput in; a HELLO, then
+ * MsgState out) on nonblocking sockets under one epoll set, and leaves
+ * rooms, sessions and ticks to its host: server_tcp runs it alone,
+ * server_udp (--tcp PORT) next to its UDP and shared-memory clients, in
+ * the same rooms.
+ *
+ *   in   each readiness event drains the socket and frames every MsgInput;
+ *        the host gets one event per connection and poll with the latest
+ *        direction. Inputs no state went out in between are coalesced.
+ *   out  latest state wins: a state the socket has not taken yet is
+ *        replaced, never queued behind. The kernel holds at most
+ *        TCP_NOTSENT_LOWAT unsent bytes. A connection that stays full
+ *        without taking a byte for TCP_SLOW_DROP_MS is given up.
+ *
+ * A TCP session is an ordinary session whose address is synthetic
+ * (tcp_client_addr), like a shared-memory one: the lobby, rooms and
+ * timeouts treat it like any other. The connection is its liveness, the
+ * host refreshes its session while it is open.
+ */
+#ifndef TCP_FRONT_H
+#define TCP_FRONT_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <netinet/in.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/socket.h>
+
+#include "game.h"
+
+#define TCP_RX_BUF_SIZE    256    /* bytes framed per read (64 inputs) */
+#define TCP_RX_READS_MAX   16     /* reads per readiness event; epoll reports the rest again */
+#define TCP_OUT_BUF_SIZE   128    /* the unsent tail of a message, and a HELLO */
+#define TCP_NOTSENT_LOWAT  64     /* unsent bytes the kernel may hold (two states) */
+#define TCP_SLOW_DROP_MS   3000   /* a full connection that takes nothing for this long is dropped */
+#define TCP_STATS_CONNS    8      /* backed-up connections listed per stats call */
+#define TCP_ADDR_PORT      1      /* port of the synthetic addresses (shared memory: 0) */
+
+/* What tcp_front_poll() reports */
+typedef enum {
+    TCP_EV_OPEN   = 1,   /* new connection: `peer` is its address */
+    TCP_EV_INPUT  = 2,   /* `input` is the latest direction it sent */
+    TCP_EV_CLOSED = 3    /* gone (closed by the peer, or failed); the slot is free again */
+} TcpEventType;
+
+typedef struct {
+    uint8_t  type;       /* TcpEventType */
+    uint8_t  input;      /* PlayerInput */
+    uint32_t conn;
+    struct sockaddr_in peer;
+} TcpEvent;
+
+/* Wire state, as in client_tcp.c (network order, lengths * 100) */
+typedef struct __attribute__((packed)) {
+    uint16_t tick;          // wraps
+    int16_t ball_x;
+    int16_t ball_y;
+    int16_t paddle_left_y;
+    int16_t paddle_right_y;
+    uint16_t score_left;
+    uint16_t score_right;
+    uint16_t field_w;
+    uint16_t field_h;
+    uint16_t paddle_h;
+    uint16_t ball_size;
+} TcpNetState;
+
+typedef struct __attribute__((packed)) {
+    uint8_t type;           // MSG_STATE
+    uint8_t _pad;
+    uint16_t size;          // sizeof(TcpNetState)
+    TcpNetState st;
+} TcpMsgState;
+
+typedef struct {
+    int      fd;              /* -1 = slot free */
+    uint8_t  hello_sent;      /* the stream is in its state phase */
+    uint8_t  want_out;        /* EPOLLOUT registered: the socket is full */
+    uint8_t  has_state;       /* `out` waits behind tx */
+    uint16_t rx_len;          /* received bytes not framed yet (a partial MsgInput) */
+    uint16_t tx_len;          /* bytes that must go out in order (a started message, a HELLO) */
+    uint32_t pending;         /* inputs received since the last state went out */
+    uint32_t inputs;          /* received in all */
+    uint32_t coalesced;       /* replaced by a later one before a state showed them */
+    uint32_t conflated;       /* states replaced by a newer one before they went out */
+    uint32_t conflated_at_stats;
+    uint64_t stalled_ms;      /* last write while the socket is full (monotonic), 0 = not full */
+    TcpMsgState out;          /* latest state not sent yet: a newer one replaces it */
+    uint8_t  rx[TCP_RX_BUF_SIZE];
+    uint8_t  tx[TCP_OUT_BUF_SIZE];
+} TcpConn;
+
+typedef struct {
+    int       listen_fd;
+    uint16_t  port;           /* the listener's, 0 = none yet */
+    int       epoll_fd;       /* readable when tcp_front_poll() has work */
+    TcpConn  *conns;
+    uint32_t  max_conns;
+    uint32_t *free_slots;     /* stack of free connection slots */
+    uint32_t  free_count;
+    uint32_t  open_count;
+
+    uint64_t  accepted;
+    uint64_t  refused;        /* every slot in use */
+    uint64_t  closed;         /* by the peer, or failed */
+    uint64_t  send_failed;
+    uint64_t  slow_dropped;
+
+    /* Per stats window (tcp_front_log_stats) */
+    uint32_t  inputs;
+    uint32_t  coalesced;
+    uint32_t  pending_max;    /* most inputs from one connection between two states */
+    uint32_t  conflated;
+} TcpFront;
+
+/* Synthetic address of connection i. No datagram comes from AF_UNIX, and
+   the address index (address and port) cannot clash with a UDP peer or a
+   shared-memory client (shm_client_addr). */
+static inline struct sockaddr_in tcp_client_addr(uint32_t i) {
+    struct sockaddr_in a;
+    memset(&a, 0, sizeof(a));
+    a.sin_family = AF_UNIX;
+    a.sin_addr.s_addr = htonl(i + 1);
+    a.sin_port = htons(TCP_ADDR_PORT);
+    return a;
+}
+
+/* Connection of a synthetic address, or -1 for any other peer */
+static inline int tcp_addr_client(const struct sockaddr_in *a) {
+    if (a->sin_family != AF_UNIX || a->sin_port != htons(TCP_ADDR_PORT)) return -1;
+    return (int)(ntohl(a->sin_addr.s_addr) - 1);
+}
+
+/* Listen on port (all interfaces) for up to max_conns connections, every
+   slot allocated now. Port 0: no listener yet, a hot restart hands one over
+   (tcp_front_adopt_listener). Returns 0, or -1 with errno set. */
+int  tcp_front_open(TcpFront *f, uint16_t port, uint32_t max_conns);
+void tcp_front_close(TcpFront *f);
+
+/* Hot restart, new process: take the old process's listener (and the
+   connections queued on it), and each of its open connections into the
+   same slot with the state it had there, so the stream goes on mid-message
+   if need be. tcp_front_adopted() once they are all in. Return 0, or -1
+   (the descriptor is not taken: the caller closes it). */
+int  tcp_front_adopt_listener(TcpFront *f, int fd);
+int  tcp_front_adopt(TcpFront *f, uint32_t conn, int fd, const TcpConn *state);
+void tcp_front_adopted(TcpFront *f);
+
+/* Accept, read and flush without blocking; at most max events. Sockets
+   that still have work stay ready on epoll_fd. */
+uint32_t tcp_front_poll(TcpFront *f, TcpEvent *ev, uint32_t max);
+
+/* The connection's HELLO (player 1 or 2 for slot 0 or 1, and the rules).
+   Sent once: a connection keeps its HELLO across opponents. Returns -1 if
+   the connection failed: the host drops it. */
+int  tcp_front_hello(TcpFront *f, uint32_t conn, uint8_t slot, const GameRules *rules);
+
+/* The room's state after a step. Returns -1 if the connection failed, or
+   has been full without taking a byte for TCP_SLOW_DROP_MS: the host
+   drops it. */
+int  tcp_front_state(TcpFront *f, uint32_t conn, const GameState *g);
+
+/* Close a connection the host gave up on (no TCP_EV_CLOSED follows) */
+void tcp_front_drop(TcpFront *f, uint32_t conn);
+
+static inline int tcp_front_is_open(const TcpFront *f, uint32_t conn) {
+    return conn < f->max_conns && f->conns[conn].fd >= 0;
+}
+
+/* Log the window's inputs and sends, and the connections that fell behind
+   in it (queue depth here and in the kernel, states conflated) */
+void tcp_front_log_stats(TcpFront *f);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* TCP_FRONT_H */
@@ -0,0 +1,141 @@
+/* bench-mac.c - Receive-side cost of frame authentication
+ *
+ * Runs the server's per-frame receive checks over prebuilt client frames
+ * (an input and an ack, one frame per session, sessions interleaved):
+ *
+ *   token only   token check + chunk walk (frames without a MAC)
+ *   token + MAC  the same, then the MAC and the replay window
+ *   forged       valid token, MAC made under the wrong key
+ *
+ * and checks that every forged and every replayed frame is refused.
+ */
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <arpa/inet.h>
+#include "../server/auth.h"
+#include "../server/frame.h"
+
+#define SESSIONS 1024
+#define ROUNDS   2000   /* frames per session and pass */
+
+typedef struct {
+    uint64_t token;
+    uint8_t  key[FRAME_KEY_SIZE];
+    FrameReplay replay;
+} Guard;
+
+typedef struct {
+    struct sockaddr_in addr;
+    FrameWriter w;
+    uint8_t key[FRAME_KEY_SIZE];
+    uint8_t buf[FRAME_MAX];
+    uint16_t len;
+} Client;
+
+/* Session i: slot i, generation 1 (handle 0 is never valid) */
+#define HANDLE(i) ((PoolHandle)((1u << 16) | (uint32_t)(i)))
+
+static Auth auth;
+static Client clients[SESSIONS];
+static Guard guards[SESSIONS];
+
+static double now_s(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Next frame of a client: an input chunk and an ack block */
+static void build(Client *c, uint64_t token, const uint8_t *key) {
+    uint8_t input = 1;
+    uint8_t ack[6] = { 0 };
+    frame_add(&c->w, 10, token, 1, &input, sizeof(input));
+    frame_add(&c->w, 10, token, 2, ack, sizeof(ack));
+    c->len = frame_finish(&c->w, key);
+    memcpy(c->buf, c->w.buf, c->len);
+}
+
+/* The server's checks; returns the chunks accepted (0 = frame refused) */
+static int receive(Client *c, int check_mac) {
+    FrameReader fr;
+    FrameHeader hdr;
+    if (frame_open(&fr, c->buf, c->len, 10, &hdr) < 0) return 0;
+    PoolHandle sh = auth_token_check(&auth, hdr.conn_id, &c->addr);
+    if (sh == POOL_INVALID_HANDLE) return 0;
+
+    if (check_mac) {
+        Guard *g = &guards[pool_handle_index(sh)];
+        if (g->token != hdr.conn_id) {
+            auth_session_key(&auth, hdr.conn_id, g->key);
+            g->token = hdr.conn_id;
+            memset(&g->replay, 0, sizeof(g->replay));
+        }
+        if (!frame_verify(g->key, c->buf, c->len)) return 0;
+        if (!frame_replay_accept(&g->replay, hdr.seq)) return 0;
+    }
+
+    int n = 0;
+    uint8_t type, len;
+    const uint8_t *data;
+    while (frame_next(&fr, &type, &data, &len) == 1) n += (len > 0);
+    return n;
+}
+
+/* Build one frame per client, then time their reception; returns the rate */
+static double pass(int check_mac, int forge, int replay, unsigned long long *accepted) {
+    double total = 0;
+    for (int round = 0; round < ROUNDS; round++) {
+        for (int i = 0; i < SESSIONS; i++) {
+            uint64_t token = auth_token(&auth, HANDLE(i), &clients[i].addr);
+            uint8_t wrong[FRAME_KEY_SIZE] = { 0 };
+            if (!replay) build(&clients[i], token, forge ? wrong : clients[i].key);
+        }
+        double t0 = now_s();
+        for (int i = 0; i < SESSIONS; i++) {
+            *accepted += receive(&clients[i], check_mac) > 0;
+        }
+        total += now_s() - t0;
+    }
+    return (double)ROUNDS * SESSIONS / total;
+}
+
+int main(void) {
+    int errors = 0;
+    if (auth_init(&auth, 0, 0) < 0) {
+        fprintf(stderr, "auth_init failed\n");
+        return 1;
+    }
+    for (int i = 0; i < SESSIONS; i++) {
+        Client *c = &clients[i];
+        c->addr.sin_family = AF_INET;
+        c->addr.sin_addr.s_addr = htonl(0x0A000000u + (uint32_t)i);
+        c->addr.sin_port = htons((uint16_t)(40000 + i));
+        frame_writer_init(&c->w);
+        auth_session_key(&auth, auth_token(&auth, HANDLE(i), &c->addr), c->key);
+    }
+
+    unsigned long long ok_plain = 0, ok_mac = 0, ok_forged = 0, ok_replayed = 0;
+    double plain = pass(0, 0, 0, &ok_plain);
+    double mac = pass(1, 0, 0, &ok_mac);
+    pass(1, 0, 1, &ok_replayed);  /* the last authentic frames, again */
+    double forged = pass(1, 1, 0, &ok_forged);
+
+    unsigned long long frames = (unsigned long long)ROUNDS * SESSIONS;
+    printf("%d sessions x %d frames, %zu-byte frames\n", SESSIONS, ROUNDS,
+           (size_t)clients[0].len);
+    printf("  token only : %7.1f ns/frame (%.2f M frames/s)\n", 1e9 / plain, plain / 1e6);
+    printf("  token + MAC: %7.1f ns/frame (%.2f M frames/s)\n", 1e9 / mac, mac / 1e6);
+    printf("  forged     : %7.1f ns/frame (%.2f M frames/s)\n", 1e9 / forged, forged / 1e6);
+    printf("accepted: plain=%llu mac=%llu forged=%llu replayed=%llu (of %llu each)\n",
+           ok_plain, ok_mac, ok_forged, ok_replayed, frames);
+
+    if (ok_plain != frames || ok_mac != frames) errors++;
+    if (ok_forged != 0 || ok_replayed != 0) errors++;
+    if (errors) {
+        printf("FAILED (%d errors)\n", errors);
+        return 1;
+    }
+    printf("OK\n");
+    return 0;
+}
@@ -0,0 +1,180 @@
+/* bench-pool.c - Room/session pool and lobby churn benchmark with an allocation counter
+ *
+ * Queues enough players through the lobby to fill every room, plays a few
+ * ticks, empties the rooms again, and repeats.
+ * malloc & co are interposed so any allocation after startup is counted:
+ * the expected result is 0 bytes / 0 calls during the churn phase.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <arpa/inet.h>
+#include "../server/lobby.h"
+
+/* ================= Allocation counter ================= */
+
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t n, size_t size);
+extern void *__libc_realloc(void *p, size_t size);
+extern void *__libc_memalign(size_t align, size_t size);
+extern void  __libc_free(void *p);
+
+static unsigned long long alloc_calls;
+static unsigned long long alloc_bytes;
+
+void *malloc(size_t size) {
+    alloc_calls++;
+    alloc_bytes += size;
+    return __libc_malloc(size);
+}
+
+void *calloc(size_t n, size_t size) {
+    alloc_calls++;
+    alloc_bytes += n * size;
+    return __libc_calloc(n, size);
+}
+
+void *realloc(void *p, size_t size) {
+    alloc_calls++;
+    alloc_bytes += size;
+    return __libc_realloc(p, size);
+}
+
+void *aligned_alloc(size_t align, size_t size) {
+    alloc_calls++;
+    alloc_bytes += size;
+    return __libc_memalign(align, size);
+}
+
+void free(void *p) {
+    __libc_free(p);
+}
+
+/* ================= Helpers ================= */
+
+#define MAX_ROOMS   4096
+#define ROUNDS      50
+#define TICKS       8
+
+static double now_s(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+static struct sockaddr_in fake_addr(uint32_t n) {
+    struct sockaddr_in a;
+    memset(&a, 0, sizeof(a));
+    a.sin_family = AF_INET;
+    a.sin_addr.s_addr = htonl(0x0A000000u | (n >> 12));   /* 10.x.y.z */
+    a.sin_port = htons((uint16_t)(1024 + (n & 0xFFFu)));
+    return a;
+}
+
+/* Same steps as the server's drop_session() */
+static void leave(Lobby *l, RoomTable *t, PoolHandle sh) {
+    if (!session_get(t, sh)) return;
+
+    lobby_remove(l, t, sh);
+    PoolHandle rh = session_leave(t, sh);
+
+    Room *r = room_get(t, rh);
+    for (int i = 0; i < ROOM_PLAYERS && r; i++) {
+        Session *o = session_get(t, r->players[i]);
+        if (o) lobby_enqueue(l, t, r->players[i], o->bucket);
+    }
+}
+
+/* ================= Main ================= */
+
+int main(void) {
+    static RoomTable t;
+    static Lobby lobby;
+    static PoolHandle handles[MAX_ROOMS * ROOM_PLAYERS];
+    const uint32_t n_sessions = MAX_ROOMS * ROOM_PLAYERS;
+
+    if (room_table_init(&t, MAX_ROOMS) < 0) {
+        fprintf(stderr, "room_table_init failed\n");
+        return 1;
+    }
+    lobby_init(&lobby);
+
+    printf("Room   : %zu bytes -> stride %zu\n", sizeof(Room), t.rooms.stride);
+    printf("Session: %zu bytes -> stride %zu\n", sizeof(Session), t.sessions.stride);
+    printf("Startup: %llu allocations, %llu bytes\n", alloc_calls, alloc_bytes);
+
+    unsigned long long calls0 = alloc_calls;
+    unsigned long long bytes0 = alloc_bytes;
+    double join_s = 0.0, leave_s = 0.0, tick_s = 0.0;
+    int errors = 0;
+
+    for (int round = 0; round < ROUNDS; round++) {
+        double t0 = now_s();
+        for (uint32_t i = 0; i < n_sessions; i++) {
+            struct sockaddr_in a = fake_addr(i + (uint32_t)round * 7u);
+            handles[i] = session_create(&t, &a, 0);
+            if (handles[i] == POOL_INVALID_HANDLE) errors++;
+            lobby_join(&lobby, &t, handles[i], (uint8_t)(i % 4u), 0, 1000);
+        }
+        double t1 = now_s();
+
+        for (int k = 0; k < TICKS; k++) {
+            for (uint32_t r = 0; r < t.live_count; r++) {
+                Room *room = room_get(&t, t.live[r]);
+                game_step(&room->game, INPUT_UP, INPUT_DOWN);
+            }
+        }
+        double t2 = now_s();
+
+        /* Leave in a scrambled order so the free lists get mixed; the
+           opponent of each leaver goes back to the lobby as in the server */
+        for (uint32_t i = 0; i < n_sessions; i++) {
+            uint32_t j = (i * 2654435761u) % n_sessions;
+            leave(&lobby, &t, handles[j]);
+        }
+        /* second pass for indices the multiplicative walk did not visit */
+        for (uint32_t i = 0; i < n_sessions; i++) {
+            leave(&lobby, &t, handles[i]);
+        }
+        double t3 = now_s();
+
+        join_s  += t1 - t0;
+        tick_s  += t2 - t1;
+        leave_s += t3 - t2;
+
+        /* Every handle from this round must now be stale */
+        for (uint32_t i = 0; i < n_sessions; i++) {
+            if (session_get(&t, handles[i]) != NULL) errors++;
+        }
+        if (t.live_count != 0 || t.rooms.in_use != 0 || t.sessions.in_use != 0 ||
+            lobby.waiting != 0) errors++;
+    }
+
+    unsigned long long calls = alloc_calls - calls0;
+    unsigned long long bytes = alloc_bytes - bytes0;
+    double ops = (double)ROUNDS * n_sessions;
+
+    printf("\n%d rounds x %u sessions / %d rooms\n", ROUNDS, n_sessions, MAX_ROOMS);
+    printf("  join : %7.1f ns/op (%.0f joins/s)\n", join_s * 1e9 / ops, ops / join_s);
+    printf("  leave: %7.1f ns/op\n", leave_s * 1e9 / ops);
+    printf("  tick : %7.1f ns/room\n", tick_s * 1e9 / ((double)ROUNDS * TICKS * MAX_ROOMS));
+    printf("rooms    hwm=%u/%u exhausted=%llu\n",
+           t.rooms.high_water, t.rooms.capacity, (unsigned long long)t.rooms.exhausted);
+    printf("lobby    joins=%llu matches=%llu waiting_hwm=%u no_room=%llu\n",
+           (unsigned long long)lobby.joins, (unsigned long long)lobby.matches,
+           lobby.waiting_hwm, (unsigned long long)lobby.no_room);
+    printf("sessions hwm=%u/%u exhausted=%llu stale=%llu\n",
+           t.sessions.high_water, t.sessions.capacity,
+           (unsigned long long)t.sessions.exhausted, (unsigned long long)t.sessions.stale);
+    printf("Allocations after startup: %llu calls, %llu bytes\n", calls, bytes);
+
+    room_table_destroy(&t);
+
+    if (errors || calls != 0) {
+        printf("FAILED (%d errors)\n", errors);
+        return 1;
+    }
+    printf("OK\n");
+    return 0;
+}
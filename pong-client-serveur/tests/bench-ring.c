@@ -0,0 +1,141 @@
+/* bench-ring.c - SPSC ring: push/pop cost and high-water accounting
+ *
+ * Measures push and pop alone on one thread, a ring's worth at a time.
+ * Then a producer thread pushes numbered records as fast as it can while
+ * the consumer pops them, pausing now and then like a simulation thread
+ * busy with a tick, so the ring fills up and some pushes are dropped.
+ *
+ * The consumer must see the numbers in increasing order, every push must
+ * be either popped or counted as dropped, and whenever a push was dropped
+ * the reported high-water mark must equal the capacity.
+ */
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "../server/spsc_ring.h"
+
+#define CAPACITY      1024
+#define RECORDS       (1u << 22)
+#define PAUSE_EVERY   65536    /* pops between consumer pauses */
+#define PAUSE_NS      50000
+
+typedef struct {
+    uint64_t seq;
+    uint8_t pad[56];           /* a cache line, like the server's records */
+} Record;
+
+static SpscRing ring;
+static atomic_int done;
+
+static double now_s(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void *producer_main(void *arg) {
+    (void)arg;
+    Record rec = {0};
+    for (uint32_t i = 0; i < RECORDS; i++) {
+        rec.seq = i;
+        spsc_push(&ring, &rec);
+    }
+    atomic_store(&done, 1);
+    return NULL;
+}
+
+/* Uncontended cost: fill the ring, drain it, RECORDS records in all */
+static void measure(double *push_ns, double *pop_ns) {
+    Record rec = {0};
+    double push_s = 0, pop_s = 0;
+    for (uint32_t n = 0; n < RECORDS; n += CAPACITY) {
+        double t0 = now_s();
+        for (uint32_t i = 0; i < CAPACITY; i++) {
+            rec.seq = n + i;
+            spsc_push(&ring, &rec);
+        }
+        double t1 = now_s();
+        for (uint32_t i = 0; i < CAPACITY; i++) spsc_pop(&ring, &rec);
+        pop_s += now_s() - t1;
+        push_s += t1 - t0;
+    }
+    *push_ns = push_s * 1e9 / RECORDS;
+    *pop_ns = pop_s * 1e9 / RECORDS;
+}
+
+/* Fills the ring with no consumer: the drop must show as a full peak */
+static int check_full(void) {
+    SpscRing r;
+    SpscStats st;
+    Record rec = {0};
+    if (spsc_init(&r, sizeof(Record), 64) != 0) return 1;
+    for (int i = 0; i < 65; i++) spsc_push(&r, &rec);
+    spsc_stats(&r, &st);
+    printf("fill alone: dropped=%llu high_water=%zu/%zu\n",
+           (unsigned long long)st.dropped, st.high_water, st.capacity);
+    int bad = st.dropped != 1 || st.high_water != st.capacity;
+    spsc_destroy(&r);
+    return bad;
+}
+
+int main(void) {
+    int errors = check_full();
+    pthread_t producer;
+    double push_ns, pop_ns;
+
+    if (spsc_init(&ring, sizeof(Record), CAPACITY) != 0) {
+        fprintf(stderr, "out of memory\n");
+        return 1;
+    }
+    measure(&push_ns, &pop_ns);
+    printf("%u records of %zu bytes, capacity %d\n", RECORDS, sizeof(Record), CAPACITY);
+    printf("  push: %6.1f ns/record\n", push_ns);
+    printf("  pop : %6.1f ns/record\n", pop_ns);
+    spsc_destroy(&ring);
+
+    if (spsc_init(&ring, sizeof(Record), CAPACITY) != 0) {
+        fprintf(stderr, "out of memory\n");
+        return 1;
+    }
+    if (pthread_create(&producer, NULL, producer_main, NULL) != 0) {
+        fprintf(stderr, "pthread_create failed\n");
+        return 1;
+    }
+
+    Record rec;
+    uint64_t popped = 0, out_of_order = 0, next = 0;
+    for (;;) {
+        /* done is read before the pop, so an empty ring after it is final */
+        int last = atomic_load(&done);
+        if (!spsc_pop(&ring, &rec)) {
+            if (last) break;
+            continue;
+        }
+        out_of_order += rec.seq < next;
+        next = rec.seq + 1;
+        if (++popped % PAUSE_EVERY == 0) {
+            struct timespec ts = {0, PAUSE_NS};
+            nanosleep(&ts, NULL);
+        }
+    }
+    pthread_join(producer, NULL);
+
+    SpscStats st;
+    spsc_stats(&ring, &st);
+    printf("pausing consumer: pushed=%llu dropped=%llu popped=%llu high_water=%zu out_of_order=%llu\n",
+           (unsigned long long)st.pushed, (unsigned long long)st.dropped,
+           (unsigned long long)popped, st.high_water, (unsigned long long)out_of_order);
+
+    if (out_of_order != 0 || st.pushed != popped) errors++;
+    if (st.pushed + st.dropped != RECORDS) errors++;
+    if (st.dropped > 0 && st.high_water != st.capacity) errors++;
+    if (st.high_water > st.capacity) errors++;
+    spsc_destroy(&ring);
+    if (errors) {
+        printf("FAILED (%d errors)\n", errors);
+        return 1;
+    }
+    printf("OK\n");
+    return 0;
+}
@@ -0,0 +1,148 @@
+/* bench-view.c - Seqlock room views: torn-read stress test and writer cost
+ *
+ * One writer publishes every room again and again, as the tick thread
+ * does after each step; reader threads copy random rooms meanwhile. Each
+ * published view is filled from a single counter, so a reader can tell a
+ * consistent copy from one that mixes two writes (torn).
+ *
+ * Reports the writer's cost per room publish, alone and with the readers
+ * running; the median pass must stay under MAX_PUBLISH_NS per room, and no
+ * reader may ever see a torn view.
+ */
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "../server/room_view.h"
+
+#define ROOMS          1024
+#define PASSES         4000   /* writer passes over all rooms, per phase */
+#define READERS        3
+#define MAX_PUBLISH_NS 50.0
+
+static RoomViewSlot *views;
+static atomic_int stop;
+
+typedef struct {
+    pthread_t thread;
+    unsigned seed;
+    unsigned long long reads;
+    unsigned long long torn;
+    uint64_t retries;
+} Reader;
+
+static double now_s(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* View number n of room i: every word after the handle derives from n */
+static void fill(RoomView *v, uint32_t i, uint32_t n) {
+    uint32_t w[ROOM_VIEW_WORDS];
+    w[0] = (1u << 16) | i;
+    for (size_t k = 1; k < ROOM_VIEW_WORDS; k++) w[k] = n * 0x9E3779B1u + (uint32_t)k;
+    memcpy(v, w, sizeof(w));
+}
+
+static int consistent(const RoomView *v, uint32_t i) {
+    uint32_t w[ROOM_VIEW_WORDS];
+    memcpy(w, v, sizeof(w));
+    if (w[0] != ((1u << 16) | i)) return 0;
+    uint32_t n0 = w[1] - 1u;
+    for (size_t k = 2; k < ROOM_VIEW_WORDS; k++) {
+        if (w[k] - (uint32_t)k != n0) return 0;
+    }
+    return 1;
+}
+
+static void *reader_main(void *arg) {
+    Reader *rd = arg;
+    RoomView v;
+    while (!atomic_load_explicit(&stop, memory_order_relaxed)) {
+        uint32_t i = (uint32_t)rand_r(&rd->seed) % ROOMS;
+        room_view_read(&views[i], &v, &rd->retries);
+        rd->torn += !consistent(&v, i);
+        rd->reads++;
+    }
+    return NULL;
+}
+
+static int cmp_double(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+/* PASSES passes over every room; returns the median ns per room publish */
+static double write_phase(uint32_t *n) {
+    static double pass_ns[PASSES];
+    static RoomView src[ROOMS];
+
+    for (int p = 0; p < PASSES; p++) {
+        /* Stands in for the step: the new states exist before publishing */
+        for (uint32_t i = 0; i < ROOMS; i++) fill(&src[i], i, *n + i);
+        (*n)++;
+
+        double t0 = now_s();
+        for (uint32_t i = 0; i < ROOMS; i++) room_view_publish(&views[i], &src[i]);
+        pass_ns[p] = (now_s() - t0) * 1e9 / ROOMS;
+    }
+    qsort(pass_ns, PASSES, sizeof(double), cmp_double);
+    return pass_ns[PASSES / 2];
+}
+
+int main(void) {
+    int errors = 0;
+    uint32_t n = 0;
+    Reader readers[READERS];
+
+    views = aligned_alloc(POOL_CACHE_LINE, ROOMS * sizeof(RoomViewSlot));
+    if (!views) {
+        fprintf(stderr, "out of memory\n");
+        return 1;
+    }
+    memset(views, 0, ROOMS * sizeof(RoomViewSlot));
+    for (uint32_t i = 0; i < ROOMS; i++) {
+        RoomView v;
+        fill(&v, i, n);
+        room_view_publish(&views[i], &v);
+    }
+
+    double alone = write_phase(&n);
+
+    memset(readers, 0, sizeof(readers));
+    for (int r = 0; r < READERS; r++) {
+        readers[r].seed = 12345u + (unsigned)r;
+        if (pthread_create(&readers[r].thread, NULL, reader_main, &readers[r]) != 0) {
+            fprintf(stderr, "pthread_create failed\n");
+            return 1;
+        }
+    }
+    double contended = write_phase(&n);
+    atomic_store(&stop, 1);
+
+    unsigned long long reads = 0, torn = 0, retries = 0;
+    for (int r = 0; r < READERS; r++) {
+        pthread_join(readers[r].thread, NULL);
+        reads += readers[r].reads;
+        torn += readers[r].torn;
+        retries += readers[r].retries;
+    }
+
+    printf("%d rooms x %d passes, %zu-byte views, %d readers\n",
+           ROOMS, PASSES, sizeof(RoomView), READERS);
+    printf("  publish, no readers  : %6.1f ns/room (median pass)\n", alone);
+    printf("  publish, with readers: %6.1f ns/room (median pass)\n", contended);
+    printf("reads=%llu retries=%llu torn=%llu\n", reads, retries, torn);
+
+    if (torn != 0 || reads == 0) errors++;
+    if (alone > MAX_PUBLISH_NS || contended > MAX_PUBLISH_NS) errors++;
+    free(views);
+    if (errors) {
+        printf("FAILED (%d errors)\n", errors);
+        return 1;
+    }
+    printf("OK\n");
+    return 0;
+}